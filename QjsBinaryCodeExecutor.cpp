@@ -3,9 +3,283 @@
 
 // 包含 QuickJS 头文件（只在 .cpp 中包含，实现接口与实现的分离）
 #include <quickjs-libc.h>
+#include "qjs_bundle.h"
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <filesystem>
+#include <functional>
 #include <iostream>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define QJS_XOR_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define QJS_XOR_NEON
+#endif
+
+namespace {
+
+// 每次循环处理的字节数（4 个 SSE2/NEON 寄存器或 2 个 AVX2 寄存器）
+constexpr size_t XOR_BLOCK_SIZE = 64;
+
+// 原地 XOR 解密，与 qjsc -x 的逐字节加密结果一致（密钥从每个模块的第 0 字节重新开始）
+// 密钥先重复展开为 key_len + XOR_BLOCK_SIZE 字节，这样从任意相位都能连续取出一整块密钥，
+// 每块之后只需一次加法和比较更新相位，避免逐字节取模
+// offset 为 data 在模块内的偏移，用于分块解密
+void xorDecode(uint8_t *data, size_t len, const std::string &secret, size_t offset = 0) {
+    const size_t key_len = secret.size();
+    std::vector<uint8_t> key(key_len + XOR_BLOCK_SIZE);
+    for (size_t i = 0; i < key.size(); i++)
+        key[i] = static_cast<uint8_t>(secret[i % key_len]);
+
+    const size_t step = XOR_BLOCK_SIZE % key_len;
+    size_t phase = offset % key_len;
+    size_t i = 0;
+    for (; i + XOR_BLOCK_SIZE <= len; i += XOR_BLOCK_SIZE) {
+        uint8_t *d = data + i;
+        const uint8_t *k = key.data() + phase;
+#if defined(__AVX2__)
+        for (size_t j = 0; j < XOR_BLOCK_SIZE; j += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(d + j));
+            __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(k + j));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + j), _mm256_xor_si256(v, m));
+        }
+#elif defined(QJS_XOR_SSE2)
+        for (size_t j = 0; j < XOR_BLOCK_SIZE; j += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(d + j));
+            __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(k + j));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(d + j), _mm_xor_si128(v, m));
+        }
+#elif defined(QJS_XOR_NEON)
+        for (size_t j = 0; j < XOR_BLOCK_SIZE; j += 16)
+            vst1q_u8(d + j, veorq_u8(vld1q_u8(d + j), vld1q_u8(k + j)));
+#else
+        for (size_t j = 0; j < XOR_BLOCK_SIZE; j += 8) {
+            uint64_t v, m;
+            memcpy(&v, d + j, 8);
+            memcpy(&m, k + j, 8);
+            v ^= m;
+            memcpy(d + j, &v, 8);
+        }
+#endif
+        phase += step;
+        if (phase >= key_len)
+            phase -= key_len;
+    }
+    // 不足一块的尾部
+    for (size_t j = 0; i + j < len; j++)
+        data[i + j] ^= key[phase + j];
+}
+
+// evalModuleStream() 的读取状态
+struct StreamReader {
+    const std::function<int64_t(uint8_t *, size_t)> &reader;
+    const std::string &secret;
+    size_t offset; // 已读取的字节数
+};
+
+// JS_ReadObjectStream() 的读取回调：每读到一块就立即解密
+int64_t readStream(void *opaque, uint8_t *buf, size_t buf_size) {
+    auto *in = static_cast<StreamReader *>(opaque);
+    int64_t n = in->reader(buf, buf_size);
+    if (n > 0 && !in->secret.empty())
+        xorDecode(buf, static_cast<size_t>(n), in->secret, in->offset);
+    if (n > 0)
+        in->offset += static_cast<size_t>(n);
+    return n;
+}
+
+// 反序列化模块，压缩的模块逐块解压到 JS_ReadObjectStream() 的缓冲区，不需要完整的解压副本
+JSValue readBundleModule(JSContext *ctx, const uint8_t *data, size_t size, bool compressed,
+                         const uint8_t *dict, size_t dict_len) {
+    if (!compressed)
+        return JS_ReadObject(ctx, data, size, JS_READ_OBJ_BYTECODE);
+    QJSBundleReader reader;
+    if (qjs_bundle_reader_init(&reader, data, size, dict, dict_len) < 0)
+        return JS_ThrowSyntaxError(ctx, "truncated compressed module");
+    JSValue obj = JS_ReadObjectStream(ctx, qjs_bundle_reader_read, &reader, JS_READ_OBJ_BYTECODE);
+    qjs_bundle_reader_free(&reader);
+    return obj;
+}
+
+// 与 js_std_eval_binary_bool 相同，但支持压缩的模块
+bool evalBundleModule(JSContext *ctx, const uint8_t *data, size_t size, bool compressed,
+                      const uint8_t *dict, size_t dict_len, bool load_only) {
+    if (!compressed)
+        return js_std_eval_binary_bool(ctx, data, size, load_only);
+    QJSBundleReader reader;
+    if (qjs_bundle_reader_init(&reader, data, size, dict, dict_len) < 0) {
+        JS_ThrowSyntaxError(ctx, "truncated compressed module");
+        return false;
+    }
+    bool ok = js_std_eval_binary_stream(ctx, qjs_bundle_reader_read, &reader, load_only);
+    qjs_bundle_reader_free(&reader);
+    return ok;
+}
+
+// 读取模块共用的原子表（qjsc -b -a），必须在反序列化任何模块之前完成
+bool readBundleAtoms(JSContext *ctx, const uint8_t *data, size_t size, bool compressed, const uint8_t *dict,
+                     size_t dict_len) {
+    if (!compressed)
+        return JS_ReadAtomTable(ctx, data, size) == 0;
+    size_t len;
+    uint8_t *buf = qjs_bundle_decompress(data, size, dict, dict_len, &len);
+    if (!buf) {
+        JS_ThrowSyntaxError(ctx, "corrupted atom table");
+        return false;
+    }
+    bool ok = JS_ReadAtomTable(ctx, buf, len) == 0;
+    free(buf);
+    return ok;
+}
+
+// 原生模块由 js_module_loader 加载，与 quickjs-libc.c 中的 QJS_NATIVE_MODULE_SUFFIX 一致
+#ifdef _WIN32
+constexpr char NATIVE_MODULE_SUFFIX[] = ".dll";
+#else
+constexpr char NATIVE_MODULE_SUFFIX[] = ".so";
+#endif
+
+// 字节码缓存文件头，之后依次是源文件的绝对路径、模块名、JS_GetVersion() 和 JS_WriteObject() 的输出
+struct CodeCacheHeader {
+    char magic[4];
+    uint32_t format;
+    int64_t mtime; // 源文件修改时间（文件系统时钟的计数）
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+    uint32_t pathLen;
+    uint32_t nameLen;
+    uint32_t versionLen;
+    uint64_t dataSize;
+    uint64_t dataHash; // JS_ReadObject() 不校验字节码，损坏的缓存必须在反序列化之前发现
+};
+
+constexpr char CODE_CACHE_MAGIC[4] = {'Q', 'J', 'C', 'C'};
+constexpr uint32_t CODE_CACHE_FORMAT = 2;
+
+// 缓存键：源文件的绝对路径、模块名、修改时间、长度和内容哈希
+// 模块名是传给 JS_Eval 的文件名，可能是相对于当前目录的路径。字节码以这个名字注册模块，
+// 它导入的模块也相对于这个名字解析，所以不同工作目录下的同一个文件不能共用缓存
+struct CodeCacheKey {
+    std::string path;
+    std::string name;
+    int64_t mtime;
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+};
+
+// 64 位 FNV-1a
+uint64_t fnv1a64(const void *data, size_t len) {
+    const auto *p = static_cast<const uint8_t *>(data);
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+CodeCacheKey codeCacheKey(const std::string &filename, const std::string &source) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    CodeCacheKey key;
+    fs::path path = fs::absolute(fs::path(filename), ec);
+    key.path = ec ? filename : path.lexically_normal().string();
+    key.name = filename;
+    auto mtime = fs::last_write_time(fs::path(filename), ec);
+    key.mtime = ec ? 0 : static_cast<int64_t>(mtime.time_since_epoch().count());
+    key.sourceSize = source.size();
+    key.sourceHash = fnv1a64(source.data(), source.size());
+    return key;
+}
+
+std::string codeCacheFile(const std::string &dir, const CodeCacheKey &key) {
+    char name[32];
+    const std::string id = key.path + '\0' + key.name;
+    snprintf(name, sizeof(name), "%016llx.qjsc", static_cast<unsigned long long>(fnv1a64(id.data(), id.size())));
+    return (std::filesystem::path(dir) / name).string();
+}
+
+// 读取缓存文件中的字节码，文件不存在、格式或版本不同、缓存键不一致时返回空
+std::vector<uint8_t> readCodeCache(const std::string &file, const CodeCacheKey &key) {
+    std::vector<uint8_t> data;
+    FILE *f = fopen(file.c_str(), "rb");
+    if (!f)
+        return data;
+    const char *version = JS_GetVersion();
+    CodeCacheHeader h;
+    std::string path(key.path.size(), '\0');
+    std::string name(key.name.size(), '\0');
+    std::string ver(strlen(version), '\0');
+    if (fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, CODE_CACHE_MAGIC, sizeof(h.magic)) == 0 &&
+        h.format == CODE_CACHE_FORMAT && h.mtime == key.mtime && h.sourceSize == key.sourceSize &&
+        h.sourceHash == key.sourceHash && h.pathLen == path.size() && h.nameLen == name.size() &&
+        h.versionLen == ver.size() && h.dataSize > 0 && fread(&path[0], 1, path.size(), f) == path.size() &&
+        path == key.path && fread(&name[0], 1, name.size(), f) == name.size() && name == key.name &&
+        fread(&ver[0], 1, ver.size(), f) == ver.size() && ver == version) {
+        data.resize(h.dataSize);
+        if (fread(data.data(), 1, data.size(), f) != data.size() || fnv1a64(data.data(), data.size()) != h.dataHash)
+            data.clear();
+    }
+    fclose(f);
+    return data;
+}
+
+// 先写入同目录下的临时文件再重命名，读取方不会看到写了一半的缓存
+bool writeCodeCache(const std::string &dir, const std::string &file, const CodeCacheKey &key,
+                    const uint8_t *data, size_t size) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+
+    const char *version = JS_GetVersion();
+    CodeCacheHeader h;
+    memcpy(h.magic, CODE_CACHE_MAGIC, sizeof(h.magic));
+    h.format = CODE_CACHE_FORMAT;
+    h.mtime = key.mtime;
+    h.sourceSize = key.sourceSize;
+    h.sourceHash = key.sourceHash;
+    h.pathLen = static_cast<uint32_t>(key.path.size());
+    h.nameLen = static_cast<uint32_t>(key.name.size());
+    h.versionLen = static_cast<uint32_t>(strlen(version));
+    h.dataSize = size;
+    h.dataHash = fnv1a64(data, size);
+
+    const std::string tmp = file + "." +
+                            std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + "." +
+                            std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+              fwrite(key.path.data(), 1, key.path.size(), f) == key.path.size() &&
+              fwrite(key.name.data(), 1, key.name.size(), f) == key.name.size() &&
+              fwrite(version, 1, h.versionLen, f) == h.versionLen && fwrite(data, 1, size, f) == size;
+    ok = fclose(f) == 0 && ok;
+    if (ok)
+        std::filesystem::rename(tmp, file, ec);
+    if (!ok || ec) {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
 
 // 构造函数：初始化成员变量
 QjsBinaryCodeExecutor::QjsBinaryCodeExecutor() {
@@ -17,33 +291,140 @@ QjsBinaryCodeExecutor::~QjsBinaryCodeExecutor() {
     if (beforeReleaseCallback_) {
         beforeReleaseCallback_(runtime_, context_);
     }
+    // execute() 中创建运行时后立即调用了 js_std_init_handlers
+    if (runtime_)
+        js_std_free_handlers(runtime_);
     if (context_)
         JS_FreeContext(context_);
     if (runtime_)
         JS_FreeRuntime(runtime_);
+    unmapBundle();
+}
+
+// 将模块文件映射到内存
+// 使用私有映射：不解密时页面与页缓存共享（零拷贝），XOR 解密时只有被写的页面才会复制
+bool QjsBinaryCodeExecutor::mapBundle(const std::string &filename) {
+    unmapBundle();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER file_size;
+        if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+            if (mapping) {
+                void *view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+                CloseHandle(mapping);
+                if (view) {
+                    bundleData_ = static_cast<uint8_t *>(view);
+                    bundleSize_ = static_cast<size_t>(file_size.QuadPart);
+                    bundleMapped_ = true;
+                }
+            }
+        }
+        CloseHandle(file);
+    }
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (view != MAP_FAILED) {
+                bundleData_ = static_cast<uint8_t *>(view);
+                bundleSize_ = static_cast<size_t>(st.st_size);
+                bundleMapped_ = true;
+            }
+        }
+        close(fd);
+    }
+#endif
+
+    if (bundleMapped_) {
+        debugLog("已映射模块文件: " + std::to_string(bundleSize_) + " 字节");
+        return true;
+    }
+
+    // 无法映射（例如特殊文件系统），回退为一次性读入整个文件
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f)
+        return false;
+    fseek(f, 0, SEEK_END);
+    long file_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (file_size <= 0) {
+        fclose(f);
+        return false;
+    }
+    bundleData_ = static_cast<uint8_t *>(malloc(file_size));
+    if (!bundleData_ || fread(bundleData_, 1, file_size, f) != static_cast<size_t>(file_size)) {
+        fclose(f);
+        free(bundleData_);
+        bundleData_ = nullptr;
+        return false;
+    }
+    fclose(f);
+    bundleSize_ = static_cast<size_t>(file_size);
+    debugLog("已读取模块文件: " + std::to_string(bundleSize_) + " 字节");
+    return true;
+}
+
+// 释放模块文件映射
+void QjsBinaryCodeExecutor::unmapBundle() {
+    modules_.clear();
+    moduleIndex_.clear();
+    bundleIndexed_ = false;
+    bundleCompressed_ = false;
+    dictionary_ = Module{};
+    atomTable_ = Module{};
+    if (!bundleData_)
+        return;
+    if (bundleMapped_) {
+#ifdef _WIN32
+        UnmapViewOfFile(bundleData_);
+#else
+        munmap(bundleData_, bundleSize_);
+#endif
+    } else {
+        free(bundleData_);
+    }
+    bundleData_ = nullptr;
+    bundleSize_ = 0;
+    bundleMapped_ = false;
 }
 
 // 从文件加载模块（复刻 qjs_bc.c 的加载逻辑）
 void QjsBinaryCodeExecutor::loadModulesFromFile(const std::string &filename) {
     debugLog("正在加载模块文件: " + filename);
 
-    FILE *f = fopen(filename.c_str(), "rb");
-    if (!f) {
+    bc_version_ = 0;  // 重置版本号
+
+    if (!mapBundle(filename)) {
         reportError("无法打开文件: " + filename);
         return;
     }
 
-    modules_.clear(); // 清空已有模块
+    if (qjs_bundle_is_indexed(bundleData_, bundleSize_)) {
+        if (!loadIndexedModules()) {
+            unmapBundle();
+            reportError("模块索引损坏: " + filename);
+        }
+        return;
+    }
 
-    bc_version_ = 0;  // 重置版本号
+    const uint8_t *p = bundleData_;
+    const uint8_t *end = bundleData_ + bundleSize_;
 
     // === 读取字节码版本头（4字节）===
     uint32_t bc_version;
-    if (fread(&bc_version, sizeof(uint32_t), 1, f) != 1) {
-        fclose(f);
+    if (end - p < static_cast<ptrdiff_t>(sizeof(uint32_t))) {
+        unmapBundle();
         reportError("无法读取字节码版本头");
         return;
     }
+    memcpy(&bc_version, p, sizeof(uint32_t));
+    p += sizeof(uint32_t);
     bc_version_ = bc_version;
     debugLog("字节码版本: " + std::to_string(bc_version));
 
@@ -53,59 +434,218 @@ void QjsBinaryCodeExecutor::loadModulesFromFile(const std::string &filename) {
     }
 
     int module_index = 0;
-    while (true) {
+    while (p < end) {
         // 分别读取 load_only (1字节) 和 data_length (8字节)
-        uint8_t load_only;
+        uint8_t load_only = *p++;
         uint64_t data_length;
 
-        // 先读取 load_only 标志
-        if (fread(&load_only, 1, 1, f) != 1)
-            break; // EOF，正常结束
-
-        // 再读取数据长度
-        if (fread(&data_length, sizeof(uint64_t), 1, f) != 1) {
-            fclose(f);
+        if (end - p < static_cast<ptrdiff_t>(sizeof(uint64_t))) {
+            unmapBundle();
             std::cerr << "模块头部不完整: module #" + std::to_string(module_index) << std::endl;
             return;
         }
+        memcpy(&data_length, p, sizeof(uint64_t));
+        p += sizeof(uint64_t);
 
         debugLog("load_only=" + std::to_string(load_only) + ", size=" + std::to_string(data_length) + " 字节");
 
         // 检查数据长度是否合理（防止错误的文件格式导致分配巨大内存）
         constexpr uint64_t MAX_MODULE_SIZE = 100 * 1024 * 1024; // 100MB
         if (data_length == 0 || data_length > MAX_MODULE_SIZE) {
-            fclose(f);
+            unmapBundle();
             std::cerr << "模块大小异常: " + std::to_string(data_length) + " 字节（最大允许 " + std::to_string(MAX_MODULE_SIZE) +
                     " 字节）" << std::endl;
 
             return;
         }
 
-        // 读取模块数据
-        std::vector<uint8_t> data(data_length);
-        if (fread(data.data(), 1, data_length, f) != data_length) {
-            fclose(f);
+        if (static_cast<uint64_t>(end - p) < data_length) {
+            unmapBundle();
             std::cout << "模块数据不完整: 期望 " + std::to_string(data_length) + " 字节" << std::endl;
             return;
         }
 
-        // 如果设置了 xor_secret，对数据进行解密
-        if (!xor_secret_.empty()) {
-            size_t secret_len = xor_secret_.length();
-            for (size_t i = 0; i < data_length; i++) {
-                data[i] ^= xor_secret_[i % secret_len];
-            }
-        }
-
-        // 添加到模块列表
-        modules_.push_back({load_only != 0, std::move(data)});
+        // 添加到模块列表（只记录视图，不拷贝数据，解密推迟到第一次使用）
+        uint8_t *data = bundleData_ + (p - bundleData_);
+        modules_.push_back({std::string(), load_only != 0, data, static_cast<size_t>(data_length), xor_secret_.empty()});
+        p += data_length;
         module_index++;
     }
 
-    fclose(f);
     debugLog("加载完成: 共 " + std::to_string(module_index) + " 个模块");
 }
 
+// 解析带索引的模块文件（格式见 qjs_bundle.h）
+bool QjsBinaryCodeExecutor::loadIndexedModules() {
+    QJSBundleHeader header;
+    const uint8_t *p = qjs_bundle_read_header(bundleData_, bundleSize_, &header);
+    if (!p)
+        return false;
+    bc_version_ = header.bc_version;
+    debugLog("字节码版本: " + std::to_string(header.bc_version) + ", 模块数: " +
+             std::to_string(header.module_count));
+
+    if (header.bc_version != QJS_BUNDLE_BC_VERSION) {
+        debugLog("警告: 未知的字节码版本，可能无法正确加载");
+    }
+    bundleCompressed_ = header.version == QJS_BUNDLE_VERSION_LZ;
+
+    modules_.reserve(header.module_count);
+    for (uint32_t i = 0; i < header.module_count; i++) {
+        QJSBundleEntry entry;
+        p = qjs_bundle_read_entry(p, bundleData_, bundleSize_, &entry);
+        if (!p || entry.length == 0)
+            return false;
+
+        Module mod{std::string(entry.name, entry.name_len), (entry.flags & QJS_BUNDLE_MODULE_LOAD_ONLY) != 0,
+                   bundleData_ + entry.offset, static_cast<size_t>(entry.length), xor_secret_.empty()};
+        if (entry.flags & QJS_BUNDLE_MODULE_DICTIONARY) {
+            // 压缩字典不是模块，与模块一样在第一次使用时解密
+            debugLog("压缩字典: " + std::to_string(mod.size) + " 字节");
+            dictionary_ = std::move(mod);
+            continue;
+        }
+        if (entry.flags & QJS_BUNDLE_MODULE_ATOMS) {
+            debugLog("共享原子表: " + std::to_string(mod.size) + " 字节");
+            atomTable_ = std::move(mod);
+            continue;
+        }
+        debugLog("模块: " + mod.name + ", load_only=" + std::to_string(mod.load_only) + ", size=" +
+                 std::to_string(mod.size) + " 字节");
+        moduleIndex_.emplace(mod.name, modules_.size());
+        modules_.push_back(std::move(mod));
+    }
+
+    bundleIndexed_ = true;
+    debugLog("加载完成: 共 " + std::to_string(modules_.size()) + " 个模块（按需反序列化）");
+    return true;
+}
+
+// 第一次使用时在映射区域内原地解密（私有映射，不会写回文件）
+const uint8_t *QjsBinaryCodeExecutor::moduleData(const Module &mod) const {
+    std::lock_guard<std::mutex> lock(decodeMutex_);
+    if (!mod.decoded && !xor_secret_.empty()) {
+        xorDecode(mod.data, mod.size, xor_secret_);
+        mod.decoded = true;
+    }
+    return mod.data;
+}
+
+// 压缩字典，第一次调用时原地解密，没有字典时返回 nullptr
+const uint8_t *QjsBinaryCodeExecutor::dictionaryData() const {
+    return dictionary_.size ? moduleData(dictionary_) : nullptr;
+}
+
+// 边读取边解密、反序列化，读取与原子表、函数的反序列化交替进行
+bool QjsBinaryCodeExecutor::evalModuleStream(JSContext *ctx,
+                                             const std::function<int64_t(uint8_t *, size_t)> &reader,
+                                             bool loadOnly) const {
+    StreamReader in{reader, xor_secret_, 0};
+    bool ok = js_std_eval_binary_stream(ctx, readStream, &in, loadOnly);
+    debugLog("流式加载模块: " + std::to_string(in.offset) + " 字节" + (ok ? "" : "（失败）"));
+    return ok;
+}
+
+// 模块加载器回调：opaque 为执行器指针
+JSModuleDef *QjsBinaryCodeExecutor::bundleModuleLoader(JSContext *ctx, const char *module_name, void *opaque) {
+    auto *executor = static_cast<const QjsBinaryCodeExecutor *>(opaque);
+    return executor->loadBundleModule(ctx, module_name);
+}
+
+// 第一次 import 时才反序列化模块
+JSModuleDef *QjsBinaryCodeExecutor::loadBundleModule(JSContext *ctx, const char *module_name) const {
+    auto it = moduleIndex_.find(module_name);
+    if (it == moduleIndex_.end()) {
+        // 不在模块文件中，按普通文件加载
+        return js_module_loader(ctx, module_name, nullptr);
+    }
+
+    const Module &mod = modules_[it->second];
+    debugLog("按需加载模块: " + mod.name);
+    JSValue obj = readBundleModule(ctx, moduleData(mod), mod.size, bundleCompressed_, dictionaryData(),
+                                   dictionary_.size);
+    if (JS_IsException(obj))
+        return nullptr;
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_MODULE) {
+        JS_FreeValue(ctx, obj);
+        JS_ThrowReferenceError(ctx, "'%s' is not a module", module_name);
+        return nullptr;
+    }
+    if (js_module_set_import_meta(ctx, obj, false, false) < 0) {
+        JS_FreeValue(ctx, obj);
+        return nullptr;
+    }
+    // 模块已被上下文引用，这里释放即可
+    auto *m = static_cast<JSModuleDef *>(JS_VALUE_GET_PTR(obj));
+    JS_FreeValue(ctx, obj);
+    return m;
+}
+
+// JS 模式的模块加载器回调：opaque 为执行器指针
+JSModuleDef *QjsBinaryCodeExecutor::sourceModuleLoader(JSContext *ctx, const char *module_name, void *opaque) {
+    auto *executor = static_cast<const QjsBinaryCodeExecutor *>(opaque);
+    const size_t len = strlen(module_name);
+    const size_t suffixLen = sizeof(NATIVE_MODULE_SUFFIX) - 1;
+    if (len >= suffixLen && strcmp(module_name + len - suffixLen, NATIVE_MODULE_SUFFIX) == 0)
+        return js_module_loader(ctx, module_name, nullptr);
+    // 读取失败（以及空文件）交给默认加载器，由它抛出与原来相同的异常
+    std::string source = executor->readFileToString(module_name);
+    if (source.empty())
+        return js_module_loader(ctx, module_name, nullptr);
+    JSModuleDef *m = executor->compileSourceModule(ctx, module_name, source);
+    if (m && js_module_set_import_meta(ctx, JS_MKPTR(JS_TAG_MODULE, m), true, false) < 0)
+        return nullptr;
+    return m;
+}
+
+// 设置了缓存目录时先查缓存，未命中或缓存无效时编译源代码并写入缓存
+JSModuleDef *QjsBinaryCodeExecutor::compileSourceModule(JSContext *ctx, const std::string &filename,
+                                                        const std::string &source) const {
+    CodeCacheKey key;
+    std::string cacheFile;
+    if (!codeCacheDir_.empty()) {
+        key = codeCacheKey(filename, source);
+        cacheFile = codeCacheFile(codeCacheDir_, key);
+        std::vector<uint8_t> bytecode = readCodeCache(cacheFile, key);
+        if (!bytecode.empty()) {
+            JSValue obj = JS_ReadObject(ctx, bytecode.data(), bytecode.size(), JS_READ_OBJ_BYTECODE);
+            if (JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE) {
+                debugLog("从字节码缓存加载模块: " + filename);
+                // 模块已被上下文引用，这里释放即可
+                auto *m = static_cast<JSModuleDef *>(JS_VALUE_GET_PTR(obj));
+                JS_FreeValue(ctx, obj);
+                return m;
+            }
+            if (JS_IsException(obj))
+                JS_FreeValue(ctx, JS_GetException(ctx));
+            else
+                JS_FreeValue(ctx, obj);
+            debugLog("无法从字节码缓存恢复，重新编译: " + filename);
+        }
+    }
+
+    JSValue obj = JS_Eval(ctx, source.c_str(), source.size(), filename.c_str(),
+                          JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+    if (JS_IsException(obj))
+        return nullptr;
+    if (!cacheFile.empty()) {
+        size_t size;
+        uint8_t *buf = JS_WriteObject(ctx, &size, obj, JS_WRITE_OBJ_BYTECODE);
+        if (buf) {
+            if (writeCodeCache(codeCacheDir_, cacheFile, key, buf, size))
+                debugLog("已写入字节码缓存: " + filename + " -> " + cacheFile);
+            else
+                debugLog("写入字节码缓存失败: " + cacheFile);
+            js_free(ctx, buf);
+        } else {
+            JS_FreeValue(ctx, JS_GetException(ctx));
+        }
+    }
+    auto *m = static_cast<JSModuleDef *>(JS_VALUE_GET_PTR(obj));
+    JS_FreeValue(ctx, obj);
+    return m;
+}
+
 // 静态回调函数：QuickJS 运行时调用的入口
 // 参数：rt=JSRuntime，userdata=调用时传入的 this 指针
 JSContext *QjsBinaryCodeExecutor::workerContextCallback(JSRuntime *rt, void *userdata) {
@@ -128,66 +668,173 @@ JSContext *QjsBinaryCodeExecutor::createCustomContext(JSRuntime *rt) const {
         afterContextCreateCallback_(rt, ctx);
     }
 
-    if (executionMode_ == ExecutionMode::BINARY) {
-        // 预加载所有 load_only=1 的模块
-        for (const auto &mod: modules_) {
-            if (mod.load_only) {
-                debugLog("js_std_eval_binary_bool size: " + std::to_string(mod.data.size()));
-                js_std_eval_binary_bool(ctx, mod.data.data(), mod.data.size(), true);
-            }
-        }
+    if (executionMode_ == ExecutionMode::BINARY && atomTable_.size &&
+        !readBundleAtoms(ctx, moduleData(atomTable_), atomTable_.size, bundleCompressed_, dictionaryData(),
+                         dictionary_.size)) {
+        debugLog("加载共享原子表失败");
+        JS_FreeContext(ctx);
+        return nullptr;
+    }
+
+    if (executionMode_ == ExecutionMode::BINARY && bundleIndexed_) {
+        // 依赖模块在第一次 import 时由加载器反序列化
+        JS_SetModuleLoaderFunc(rt, nullptr, bundleModuleLoader, const_cast<QjsBinaryCodeExecutor *>(this));
+    } else if (executionMode_ == ExecutionMode::JS && !codeCacheDir_.empty()) {
+        // import 的模块同样经过字节码缓存
+        JS_SetModuleLoaderFunc(rt, nullptr, sourceModuleLoader, const_cast<QjsBinaryCodeExecutor *>(this));
+    } else if (executionMode_ == ExecutionMode::BINARY) {
+        if (!snapshotEnabled_ || !preloadFromSnapshot(ctx))
+            preloadModules(ctx);
     }
 
     return ctx;
 }
 
+// 预加载所有 load_only=1 的模块
+void QjsBinaryCodeExecutor::preloadModules(JSContext *ctx) const {
+    bool capture = false;
+    if (snapshotEnabled_) {
+        std::lock_guard<std::mutex> lock(snapshotMutex_);
+        capture = preloadSnapshot_.empty();
+    }
+
+    JSValue list = capture ? JS_NewArray(ctx) : JS_UNDEFINED;
+    uint32_t count = 0;
+    for (const auto &mod: modules_) {
+        if (!mod.load_only)
+            continue;
+        debugLog("预加载模块 size: " + std::to_string(mod.size));
+        JSValue obj = readBundleModule(ctx, moduleData(mod), mod.size, bundleCompressed_, dictionaryData(),
+                                       dictionary_.size);
+        if (JS_IsException(obj)) {
+            // 与 js_std_eval_binary_bool 一样忽略错误，但不再生成不完整的快照
+            JS_FreeValue(ctx, JS_GetException(ctx));
+            capture = false;
+            continue;
+        }
+        if (JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE) {
+            // 模块必须在设置 import.meta 之前写入，快照里不保存 import.meta
+            if (capture && JS_SetPropertyUint32(ctx, list, count++, JS_DupValue(ctx, obj)) < 0)
+                capture = false;
+            js_module_set_import_meta(ctx, obj, false, false);
+        }
+        JS_FreeValue(ctx, obj);
+    }
+
+    if (capture) {
+        size_t size;
+        uint8_t *buf = JS_WriteObject2(ctx, &size, list, JS_WRITE_OBJ_BYTECODE | JS_WRITE_OBJ_REFERENCE, nullptr);
+        if (buf) {
+            std::lock_guard<std::mutex> lock(snapshotMutex_);
+            if (preloadSnapshot_.empty())
+                preloadSnapshot_.assign(buf, buf + size);
+            js_free(ctx, buf);
+            debugLog("已生成预加载快照: " + std::to_string(count) + " 个模块, " + std::to_string(size) + " 字节");
+        } else {
+            JS_FreeValue(ctx, JS_GetException(ctx));
+        }
+    }
+    JS_FreeValue(ctx, list);
+}
+
+// 一次反序列化恢复所有预加载模块（模块按原顺序写入，依赖总是先于使用者恢复）
+bool QjsBinaryCodeExecutor::preloadFromSnapshot(JSContext *ctx) const {
+    const uint8_t *data;
+    size_t size;
+    {
+        std::lock_guard<std::mutex> lock(snapshotMutex_);
+        if (preloadSnapshot_.empty())
+            return false;
+        data = preloadSnapshot_.data();
+        size = preloadSnapshot_.size();
+    }
+
+    JSValue list = JS_ReadObject2(ctx, data, size, JS_READ_OBJ_BYTECODE | JS_READ_OBJ_REFERENCE, nullptr);
+    if (JS_IsException(list)) {
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        debugLog("预加载快照恢复失败，改为逐个加载模块");
+        return false;
+    }
+    int64_t count = 0;
+    JS_GetLength(ctx, list, &count);
+    for (int64_t i = 0; i < count; i++) {
+        JSValue obj = JS_GetPropertyUint32(ctx, list, static_cast<uint32_t>(i));
+        if (JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE)
+            js_module_set_import_meta(ctx, obj, false, false);
+        JS_FreeValue(ctx, obj);
+    }
+    JS_FreeValue(ctx, list);
+    debugLog("已从快照恢复 " + std::to_string(count) + " 个预加载模块");
+    return true;
+}
+
 
 // 获取异常堆栈信息
-void QjsBinaryCodeExecutor::getExceptionStack() const {
-    JSValue exception = JS_GetException(context_);
-    const char *err_cstr = JS_ToCString(context_, exception);
+void QjsBinaryCodeExecutor::getExceptionStack(JSRuntime *rt, JSContext *ctx) const {
+    JSValue exception = JS_GetException(ctx);
+    const char *err_cstr = JS_ToCString(ctx, exception);
     if (!err_cstr) {
-        JS_FreeValue(context_, exception);
+        JS_FreeValue(ctx, exception);
         return;
     }
 
     std::string result;
     if (JS_IsError(exception)) {
-        JSValue name_val = JS_GetPropertyStr(context_, exception, "name");
-        JSValue message_val = JS_GetPropertyStr(context_, exception, "message");
-        JSValue stack_val = JS_GetPropertyStr(context_, exception, "stack");
+        JSValue name_val = JS_GetPropertyStr(ctx, exception, "name");
+        JSValue message_val = JS_GetPropertyStr(ctx, exception, "message");
+        JSValue stack_val = JS_GetPropertyStr(ctx, exception, "stack");
 
-        const char *name_cstr = JS_ToCString(context_, name_val);
-        const char *message_cstr = JS_ToCString(context_, message_val);
-        const char *stack_cstr = JS_ToCString(context_, stack_val);
+        const char *name_cstr = JS_ToCString(ctx, name_val);
+        const char *message_cstr = JS_ToCString(ctx, message_val);
+        const char *stack_cstr = JS_ToCString(ctx, stack_val);
 
         if (jsErrorCallback_) {
-            jsErrorCallback_(runtime_, context_, name_cstr ? name_cstr : "", message_cstr ? message_cstr : "",
+            jsErrorCallback_(rt, ctx, name_cstr ? name_cstr : "", message_cstr ? message_cstr : "",
                              stack_cstr ? stack_cstr : "");
         }
 
-        JS_FreeCString(context_, name_cstr);
-        JS_FreeCString(context_, message_cstr);
-        JS_FreeCString(context_, stack_cstr);
+        JS_FreeCString(ctx, name_cstr);
+        JS_FreeCString(ctx, message_cstr);
+        JS_FreeCString(ctx, stack_cstr);
 
-        JS_FreeValue(context_, name_val);
-        JS_FreeValue(context_, message_val);
-        JS_FreeValue(context_, stack_val);
+        JS_FreeValue(ctx, name_val);
+        JS_FreeValue(ctx, message_val);
+        JS_FreeValue(ctx, stack_val);
     }
 
-    JS_FreeCString(context_, err_cstr);
-    JS_FreeValue(context_, exception);
+    JS_FreeCString(ctx, err_cstr);
+    JS_FreeValue(ctx, exception);
 }
 
 // 触发错误回调
-void QjsBinaryCodeExecutor::reportError(const std::string &msg) const {
+void QjsBinaryCodeExecutor::reportError(JSRuntime *rt, JSContext *ctx, const std::string &msg) const {
     if (errorCallback_) {
-        errorCallback_(runtime_, context_, msg);
+        errorCallback_(rt, ctx, msg);
     } else {
         fprintf(stderr, "[错误] %s\n", msg.c_str());
     }
 }
 
+// 创建运行时（主运行时和 QjsExecutorPool 的运行时）
+JSRuntime *QjsBinaryCodeExecutor::createRuntime() const {
+    JSRuntime *rt = mallocFunctions_ ? JS_NewRuntime2(mallocFunctions_, mallocOpaque_) : JS_NewRuntime();
+    if (!rt)
+        return nullptr;
+
+    if (afterRuntimeCreateCallback_) {
+        afterRuntimeCreateCallback_(rt);
+    }
+
+    // 初始化标准库处理器
+    js_std_init_handlers(rt);
+    // 从这个运行时启动的 Worker 由本执行器创建上下文，回调随运行时一起释放
+    js_std_set_worker_new_context_func2(rt, workerContextCallback, const_cast<QjsBinaryCodeExecutor *>(this));
+
+    // 设置模块加载器
+    JS_SetModuleLoaderFunc(rt, nullptr, js_module_loader, nullptr);
+    return rt;
+}
+
 // 执行主流程
 int QjsBinaryCodeExecutor::execute() {
     debugLog("开始执行...");
@@ -203,85 +850,79 @@ int QjsBinaryCodeExecutor::execute() {
     }
 
     // 1. 创建 JSRuntime
-    runtime_ = JS_NewRuntime();
+    runtime_ = createRuntime();
     if (!runtime_) {
         reportError("创建 JSRuntime 失败");
         return -1;
     }
 
-    if (afterRuntimeCreateCallback_) {
-        afterRuntimeCreateCallback_(runtime_);
-    }
-
-    // 初始化标准库处理器
-    js_std_init_handlers(runtime_);
-
-    // 2. 设置 Worker 创建回调（传递 this 指针）
-    // js_std_set_worker_new_context_func(workerContextCallback, this);
-
-    // 设置模块加载器
-    JS_SetModuleLoaderFunc(runtime_, nullptr, js_module_loader, nullptr);
-
-    // 3. 创建 JSContext
+    // 2. 创建 JSContext
     context_ = createCustomContext(runtime_);
     if (!context_) {
         reportError("创建 JSContext 失败");
         return -1;
     }
 
+    return runEntry(runtime_, context_,
+                    executionMode_ == ExecutionMode::JS ? readFileToString(entryFile_) : std::string());
+}
+
+// 执行入口模块并运行事件循环
+int QjsBinaryCodeExecutor::runEntry(JSRuntime *rt, JSContext *ctx, const std::string &jsCode) const {
     // 如果指定了入口文件，优先使用它
     debugLog("执行指定入口文件: " + entryFile_);
 
     if (executionMode_ == ExecutionMode::JS) {
         // JS 源代码模式
-        std::string jsCode = readFileToString(entryFile_);
         debugLog("JS 源代码: " + jsCode);
-        const JSValue runResult = JS_Eval(context_, jsCode.c_str(), strlen(jsCode.c_str()), entryFile_.c_str(),
-                                          JS_EVAL_TYPE_MODULE);
-        if (JS_HasException(context_)) {
+        // 与 JS_Eval(JS_EVAL_TYPE_MODULE) 相同，先编译（或从字节码缓存恢复）再执行
+        JSModuleDef *m = compileSourceModule(ctx, entryFile_, jsCode);
+        const JSValue runResult = m ? JS_EvalFunction(ctx, JS_DupValue(ctx, JS_MKPTR(JS_TAG_MODULE, m)))
+                                    : JS_EXCEPTION;
+        if (JS_HasException(ctx)) {
             debugLog("has exception!");
-            getExceptionStack();
+            getExceptionStack(rt, ctx);
         } else {
-            const JSValue pr = JS_PromiseResult(context_, runResult);
+            const JSValue pr = JS_PromiseResult(ctx, runResult);
             if (JS_IsException(pr) || JS_IsError(pr)) {
                 // 主动抛出一个 getExceptionStack() 可以捕获
-                JS_Throw(context_, pr);
-                getExceptionStack();
+                JS_Throw(ctx, pr);
+                getExceptionStack(rt, ctx);
             } else {
                 // Promise 正常 resolved，释放 如果throw了不用释放
-                JS_FreeValue(context_, pr);
+                JS_FreeValue(ctx, pr);
             }
         }
-        JS_FreeValue(context_, runResult);
+        JS_FreeValue(ctx, runResult);
     } else {
-        // 5. 执行入口模块（第一个 load_only=0 的模块）
+        // 4. 执行入口模块（第一个 load_only=0 的模块）
         bool has_entry = false;
         // 预加载所有 load_only=1 的模块（供 Worker 使用）
         for (const auto &module: modules_) {
             if (!module.load_only) {
                 // 执行main文件 通常main会在二进制文件最后 并且是唯一的load_only为false的
-                bool runSuccess = js_std_eval_binary_bool(context_, module.data.data(), module.data.size(),
-                                                          module.load_only);
+                bool runSuccess = evalBundleModule(ctx, moduleData(module), module.size, bundleCompressed_,
+                                                   dictionaryData(), dictionary_.size, module.load_only);
                 if (!runSuccess) {
-                    getExceptionStack();
+                    getExceptionStack(rt, ctx);
                 }
                 has_entry = true;
             }
         }
         if (!has_entry) {
-            reportError("未找到入口模块（load_only=0）或未指定入口文件");
+            reportError(rt, ctx, "未找到入口模块（load_only=0）或未指定入口文件");
         }
     }
 
-    // 6. 运行事件循环（处理异步操作）
+    // 5. 运行事件循环（处理异步操作）
     debugLog("进入事件循环...");
-    int ret = js_std_loop(context_);
+    int ret = js_std_loop(ctx);
 
     debugLog("执行完成，返回值: " + std::to_string(ret));
 
-    // 7. 触发 afterExecute 回调
+    // 6. 触发 afterExecute 回调
     if (afterExecuteCallback_) {
-        afterExecuteCallback_(runtime_, context_);
+        afterExecuteCallback_(rt, ctx);
     }
 
     return ret;
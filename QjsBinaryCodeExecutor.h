@@ -1,12 +1,16 @@
 #pragma once
 #include <cstdint>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <functional>
 
 // 前向声明，避免包含 quickjs 头文件，减少依赖
 struct JSRuntime;
 struct JSContext;
+struct JSModuleDef;
+struct JSMallocFunctions;
 
 /**
  * @brief 执行模式枚举
@@ -21,6 +25,11 @@ enum class ExecutionMode {
  *
  * 这个类封装了 qjs_bc.c 的核心功能，提供最简化的接口。
  * 支持加载 QuickJS 编译后的二进制字节码并执行，同时支持 Worker 线程。
+ *
+ * JS 中的 os.Worker 和 os.WorkerPool 线程都通过 workerContextCallback() 创建上下文，
+ * 与主上下文一样安装模块加载器并预加载 load_only=1 的模块。
+ * os.WorkerPool(模块, 线程数) 的线程常驻，每个线程只创建一次运行时并加载一次模块，
+ * 之后从同一个消息队列中取任务（空闲的线程先取），适合"每个任务一个 Worker"的场景。
  */
 class QjsBinaryCodeExecutor {
 public:
@@ -78,10 +87,25 @@ public:
      * @brief 从文件加载二进制模块
      * @param filename 二进制文件路径
      *
-     * 文件格式：每模块由三部分组成
-     * - 1字节：load_only 标志（0=入口模块，1=预加载模块）
-     * - 8字节：数据长度（uint64_t）
-     * - N字节：实际的字节码数据
+     * 文件格式见 qjs_bundle.h：
+     * - 带索引的格式（qjsc -b 输出）：文件头部是模块名 → (偏移, 长度, 标志) 的索引表，
+     *   依赖模块只在第一次被 import 时才反序列化（主上下文和 Worker 都一样）
+     * - 旧的扁平格式：每模块由 [load_only:1][长度:8][数据] 组成，
+     *   所有 load_only=1 的模块在创建上下文时预加载
+     *
+     * 文件通过 mmap 映射到内存（私有写时复制映射），模块只记录映射区域内的
+     * (偏移, 长度) 视图，不再逐个拷贝；无法映射时退化为一次性读入整个文件。
+     * 映射在执行器析构或再次加载时释放。
+     *
+     * 设置了 XOR 密钥时，模块在第一次被使用时才原地解密（按 SIMD 寄存器宽度分块处理），
+     * 从未被 import 的模块既不解密，对应的映射页也不会被复制。
+     *
+     * 压缩的模块文件（qjsc -b -z）中每个模块由 16 KiB 的 LZ4 块组成，并共用一个跨模块训练的字典。
+     * 反序列化时通过 JS_ReadObjectStream() 逐块解压（能放下整块时直接解压到反序列化缓冲区），
+     * 不会生成整个模块的解压副本。
+     *
+     * 共享原子表的模块文件（qjsc -b -a）在每个上下文创建时先加载一次原子表，
+     * 各模块不再重复保存、重复 intern 相同的标识符。
      */
     void loadModulesFromFile(const std::string &filename);
 
@@ -92,12 +116,28 @@ public:
      * 执行流程：
      * 1. 创建 JSRuntime 运行时环境
      * 2. 创建 JSContext 上下文
-     * 3. 预加载所有 load_only=1 的模块（供 Worker 使用）
+     * 3. 安装模块加载器（带索引的格式）或预加载所有 load_only=1 的模块（旧格式）
      * 4. 执行第一个 load_only=0 的入口模块
      * 5. 进入事件循环，等待异步操作完成
      */
     int execute();
 
+    /**
+     * @brief 边读取边反序列化并执行一个字节码模块
+     * @param ctx 目标上下文（主上下文或 Worker 上下文）
+     * @param reader 读取回调：向 buf 写入最多 size 字节，返回写入的字节数，0=数据结束，-1=出错。
+     *               可以阻塞等待数据（例如正在下载的模块），不能抛出 C++ 异常
+     * @param loadOnly true=只加载不执行（同 load_only=1 的模块）
+     * @return true=成功，false=失败（异常留在 ctx 中，可用 JS_GetException 取出）
+     *
+     * 数据为单个模块的 JS_WriteObject() 输出，即模块文件中一个模块的数据部分。
+     * 与 JS_ReadObject() 不同，不需要先读入整个模块：数据每到一块就解密（设置了 XOR
+     * 密钥时）并交给 JS_ReadObjectStream() 继续反序列化，只缓冲尚未解析的部分。
+     * 适合一边下载更新包一边开始加载，例如在 afterContextCreate 回调中调用。
+     */
+    bool evalModuleStream(JSContext *ctx, const std::function<int64_t(uint8_t *, size_t)> &reader,
+                          bool loadOnly = false) const;
+
     /**
      * @brief 设置错误回调函数
      * @param callback 接收错误信息的回调
@@ -169,6 +209,19 @@ public:
         afterRuntimeCreateCallback_ = std::move(callback);
     }
 
+    /**
+     * @brief 设置主运行时使用的内存分配函数（传给 JS_NewRuntime2）
+     * @param mf 分配函数表，为 nullptr 时使用默认分配器；需在 execute() 返回后仍然有效
+     * @param opaque 传给分配函数的用户数据
+     *
+     * 主要用于统计分配次数（见 bench.cpp）。Worker 线程的运行时不受影响，
+     * QjsExecutorPool 的运行时同样使用这组函数（多线程时需自行保证线程安全）。
+     */
+    void setMallocFunctions(const JSMallocFunctions *mf, void *opaque = nullptr) {
+        mallocFunctions_ = mf;
+        mallocOpaque_ = opaque;
+    }
+
     // 获取内部 JS 运行时和上下文（用于高级操作）
     JSRuntime *runtime() const noexcept { return runtime_; }
     JSContext *context() const noexcept { return context_; }
@@ -181,7 +234,7 @@ public:
  * @param secret 用于加密/解密字节码的密钥字符串
  *
  * 如果设置为空字符串，则不进行加解密操作。
- * 密钥会在保存和加载二进制文件时自动应用。
+ * 密钥会在保存和加载二进制文件时自动应用，每个模块只在第一次使用时解密一次。
  */
     void setXorSecret(const std::string &secret) { xor_secret_ = secret; }
 
@@ -193,6 +246,35 @@ public:
 
     uint32_t getBytecodeVersion() const { return bc_version_; }
 
+    /**
+     * @brief 设置是否使用预加载模块快照
+     * @param enabled true=启用（默认），false=每个上下文逐个反序列化模块
+     *
+     * 旧的扁平格式下，每个新上下文（包括每个 Worker）都要把所有 load_only=1 的模块
+     * 逐个 JS_ReadObject 一遍。启用快照后，第一个上下文预加载完成时把这些模块用
+     * JS_WriteObject2(JS_WRITE_OBJ_REFERENCE) 写成一个整体（共享一张原子表，
+     * 不再需要解密），之后的上下文只需一次 JS_ReadObject2 即可恢复。
+     * 内置对象（JS_AddIntrinsic*）包含 C 函数，无法序列化，仍由 JS_NewContext 创建。
+     */
+    void setSnapshotEnabled(bool enabled) { snapshotEnabled_ = enabled; }
+
+    /**
+     * @brief 设置 JS 模式的字节码缓存目录
+     * @param dir 缓存目录（不存在时自动创建），为空时（默认）不使用缓存
+     *
+     * JS 模式下入口文件和所有 import 的模块每次启动都要重新解析源代码。设置缓存目录后，
+     * 模块第一次编译时把 JS_WriteObject() 的输出写入缓存目录（每个模块一个文件，
+     * 文件名由模块的绝对路径哈希得到），之后的启动（包括 Worker 和 QjsExecutorPool）
+     * 直接反序列化字节码，不需要单独用 qjsc 编译。
+     *
+     * 缓存文件记录源文件的绝对路径、修改时间、长度、内容哈希和 QuickJS 版本，
+     * 任何一项不一致或反序列化失败（例如字节码版本不同）时回退为解析源代码并重写缓存。
+     * 缓存先写入临时文件再重命名，多个进程或线程可以共用同一个目录。
+     */
+    void setCodeCacheDir(const std::string &dir) { codeCacheDir_ = dir; }
+
+    const std::string &getCodeCacheDir() const { return codeCacheDir_; }
+
     /**
      * 主要方便安卓上打印日志
      * @param callback
@@ -202,18 +284,38 @@ public:
     }
 
 private:
-    // 模块数据结构
+    friend class QjsExecutorPool; // 复用模块文件、配置和上下文创建逻辑
+
+    // 模块数据结构（指向 bundleData_ 内部的视图）
     struct Module {
+        std::string name; // 模块名（旧格式为空）
         bool load_only; // 是否为预加载模块
-        std::vector<uint8_t> data; // 字节码数据
+        uint8_t *data; // 字节码数据
+        size_t size; // 字节码长度
+        mutable bool decoded; // 是否已解密（受 decodeMutex_ 保护）
     };
 
     uint32_t bc_version_ = 0;  // 字节码版本号
     std::string xor_secret_; // XOR 加密密钥
 
     std::vector<Module> modules_; // 存储所有加载的模块
+    uint8_t *bundleData_ = nullptr; // 模块文件内容（映射区域或堆缓冲区）
+    size_t bundleSize_ = 0; // 模块文件大小
+    bool bundleMapped_ = false; // true=bundleData_ 来自 mmap，false=来自 malloc
+    bool bundleIndexed_ = false; // true=带索引的格式，模块按需加载
+    bool bundleCompressed_ = false; // true=模块经过 LZ 压缩（qjsc -b -z）
+    Module dictionary_{}; // 压缩字典（size 为 0 表示没有字典）
+    Module atomTable_{}; // 模块共用的原子表（qjsc -b -a，size 为 0 表示没有）
+    std::unordered_map<std::string, size_t> moduleIndex_; // 模块名 → modules_ 下标
+    mutable std::mutex decodeMutex_; // 主线程与 Worker 线程可能同时第一次使用同一个模块
+    bool snapshotEnabled_ = true; // 是否使用预加载模块快照
+    mutable std::vector<uint8_t> preloadSnapshot_; // 预加载模块快照，写入一次后不再修改
+    mutable std::mutex snapshotMutex_; // 保护 preloadSnapshot_
+    std::string codeCacheDir_; // JS 模式的字节码缓存目录（空=不使用缓存）
     JSRuntime *runtime_ = nullptr; // JS 运行时实例
     JSContext *context_ = nullptr; // JS 上下文实例
+    const JSMallocFunctions *mallocFunctions_ = nullptr; // 自定义分配函数（nullptr=默认）
+    void *mallocOpaque_ = nullptr; // 传给分配函数的用户数据
     std::function<void(JSRuntime *, JSContext *, const std::string &)> errorCallback_; // 错误回调
     std::function<void(JSRuntime *, JSContext *, const std::string &, const std::string &, const std::string &)>
     jsErrorCallback_; // 错误回调
@@ -230,11 +332,25 @@ private:
     // 创建自定义上下文（供 Worker 线程调用）
     JSContext *createCustomContext(JSRuntime *rt) const;
 
+    // 创建运行时：设置分配函数、触发 afterRuntimeCreate 回调、初始化标准库处理器和模块加载器
+    JSRuntime *createRuntime() const;
+
+    // 在 ctx 中执行入口模块（JS 模式执行 jsCode）并运行事件循环，返回 js_std_loop 的结果
+    int runEntry(JSRuntime *rt, JSContext *ctx, const std::string &jsCode) const;
+
+    // 预加载所有 load_only=1 的模块，启用快照且快照为空时顺便生成快照
+    void preloadModules(JSContext *ctx) const;
+
+    // 从快照恢复预加载模块，没有快照时返回 false
+    bool preloadFromSnapshot(JSContext *ctx) const;
+
     // 获取异常堆栈信息
-    void getExceptionStack() const;
+    void getExceptionStack(JSRuntime *rt, JSContext *ctx) const;
 
     // 触发错误回调
-    void reportError(const std::string &msg) const;
+    void reportError(const std::string &msg) const { reportError(runtime_, context_, msg); }
+
+    void reportError(JSRuntime *rt, JSContext *ctx, const std::string &msg) const;
 
     // 调试输出辅助函数
     void debugLog(const std::string &msg) const;
@@ -243,4 +359,30 @@ private:
 
     // 读取文件内容到字符串
     std::string readFileToString(const std::string &filepath) const;
+
+    // 将模块文件映射到内存（失败时回退为整体读取），成功返回 true
+    bool mapBundle(const std::string &filename);
+
+    // 释放 mapBundle() 建立的映射或缓冲区
+    void unmapBundle();
+
+    // 解析带索引的模块文件，成功返回 true
+    bool loadIndexedModules();
+
+    // 模块加载器：从索引中查找并反序列化模块，找不到时回退到文件系统
+    static JSModuleDef *bundleModuleLoader(JSContext *ctx, const char *module_name, void *opaque);
+
+    JSModuleDef *loadBundleModule(JSContext *ctx, const char *module_name) const;
+
+    // 返回模块的字节码，第一次调用时原地解密
+    const uint8_t *moduleData(const Module &mod) const;
+
+    // 返回解密后的压缩字典，没有字典时返回 nullptr
+    const uint8_t *dictionaryData() const;
+
+    // JS 模式的模块加载器：编译源代码模块，设置了缓存目录时优先使用字节码缓存
+    static JSModuleDef *sourceModuleLoader(JSContext *ctx, const char *module_name, void *opaque);
+
+    // 编译（或从字节码缓存恢复）一个源代码模块，不执行；模块归上下文所有，失败时返回 nullptr
+    JSModuleDef *compileSourceModule(JSContext *ctx, const std::string &filename, const std::string &source) const;
 };
@@ -0,0 +1,138 @@
+// QjsExecutorPool.cpp
+#include "QjsExecutorPool.h"
+
+#include <quickjs-libc.h>
+
+QjsExecutorPool::QjsExecutorPool(QjsBinaryCodeExecutor &executor, size_t size) : executor_(executor) {
+    // 模块文件和源代码只加载一次，所有运行时共用
+    if (executor_.executionMode_ == ExecutionMode::BINARY) {
+        if (executor_.modules_.empty())
+            executor_.loadModulesFromFile(executor_.entryFile_);
+    } else {
+        jsCode_ = executor_.readFileToString(executor_.entryFile_);
+    }
+
+    if (size == 0)
+        size = 1;
+    slots_.reserve(size);
+    idle_.reserve(size);
+    for (size_t i = 0; i < size; i++) {
+        auto slot = std::make_unique<Slot>();
+        slot->runtime = executor_.createRuntime();
+        if (!slot->runtime) {
+            executor_.reportError(nullptr, nullptr, "创建 JSRuntime 失败");
+            continue;
+        }
+        slot->context = executor_.createCustomContext(slot->runtime);
+        if (!slot->context)
+            executor_.reportError(slot->runtime, nullptr, "创建 JSContext 失败");
+        idle_.push_back(slot.get());
+        slots_.push_back(std::move(slot));
+    }
+    executor_.debugLog("运行时池已创建: " + std::to_string(slots_.size()) + " 个运行时");
+}
+
+QjsExecutorPool::~QjsExecutorPool() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return idle_.size() == slots_.size(); });
+    for (auto &slot: slots_) {
+        JS_UpdateStackTop(slot->runtime);
+        freeContext(slot.get());
+        js_std_free_handlers(slot->runtime);
+        JS_FreeRuntime(slot->runtime);
+    }
+}
+
+QjsExecutorPool::Lease &QjsExecutorPool::Lease::operator=(Lease &&other) noexcept {
+    if (this != &other) {
+        release();
+        pool_ = other.pool_;
+        slot_ = other.slot_;
+        other.pool_ = nullptr;
+        other.slot_ = nullptr;
+    }
+    return *this;
+}
+
+JSRuntime *QjsExecutorPool::Lease::runtime() const noexcept {
+    return slot_ ? slot_->runtime : nullptr;
+}
+
+JSContext *QjsExecutorPool::Lease::context() const noexcept {
+    return slot_ ? slot_->context : nullptr;
+}
+
+int QjsExecutorPool::Lease::execute() {
+    if (!context())
+        return -1;
+    return pool_->executor_.runEntry(slot_->runtime, slot_->context, pool_->jsCode_);
+}
+
+void QjsExecutorPool::Lease::release() {
+    if (slot_)
+        pool_->release(slot_);
+    pool_ = nullptr;
+    slot_ = nullptr;
+}
+
+QjsExecutorPool::Lease QjsExecutorPool::acquire() {
+    Slot *slot;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (slots_.empty())
+            return Lease();
+        cond_.wait(lock, [this] { return !idle_.empty(); });
+        slot = idle_.back();
+        idle_.pop_back();
+    }
+    // 运行时可能在其他线程中创建或使用过，重新记录栈顶供栈溢出检查使用
+    JS_UpdateStackTop(slot->runtime);
+    if (!slot->context) {
+        slot->context = executor_.createCustomContext(slot->runtime);
+        if (!slot->context)
+            executor_.reportError(slot->runtime, nullptr, "创建 JSContext 失败");
+    }
+    return Lease(this, slot);
+}
+
+int QjsExecutorPool::execute() {
+    Lease lease = acquire();
+    if (!lease) {
+        executor_.reportError(nullptr, nullptr, "没有可用的运行时");
+        return -1;
+    }
+    return lease.execute();
+}
+
+void QjsExecutorPool::freeContext(Slot *slot) {
+    if (!slot->context)
+        return;
+    if (executor_.beforeReleaseCallback_) {
+        executor_.beforeReleaseCallback_(slot->runtime, slot->context);
+    }
+    // 残留的定时器、处理器、任务和异常引用着上下文中的对象，必须先于上下文释放
+    js_std_reset_handlers(slot->runtime);
+    JS_DiscardPendingJobs(slot->runtime);
+    JS_FreeValue(slot->context, JS_GetException(slot->context));
+    JS_FreeContext(slot->context);
+    slot->context = nullptr;
+}
+
+void QjsExecutorPool::reset(Slot *slot) {
+    JS_UpdateStackTop(slot->runtime);
+    freeContext(slot);
+    // 全局对象与模块之间的循环引用只能由 GC 回收
+    JS_RunGC(slot->runtime);
+    slot->context = executor_.createCustomContext(slot->runtime);
+    if (!slot->context)
+        executor_.debugLog("重置后创建上下文失败，下次取出时重试");
+}
+
+void QjsExecutorPool::release(Slot *slot) {
+    reset(slot);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        idle_.push_back(slot);
+    }
+    cond_.notify_one();
+}
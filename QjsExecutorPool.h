@@ -0,0 +1,144 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "QjsBinaryCodeExecutor.h"
+
+/**
+ * @brief 预热的 QuickJS 运行时池
+ *
+ * QjsBinaryCodeExecutor 每次执行都要创建运行时、上下文并反序列化模块。
+ * 池在构造时一次性创建 size 个运行时，每个运行时都预先准备好一个已安装模块加载器、
+ * 已预加载 load_only=1 模块的上下文，取出后可以直接执行入口模块。
+ *
+ * 一次执行结束、归还运行时时：
+ * 1. 释放标准库中残留的定时器、I/O 处理器和未处理的 rejection（js_std_reset_handlers）
+ * 2. 释放上下文，全局对象和模块实例随之丢弃，再运行一次 GC 回收其中的循环引用
+ * 3. 在同一个运行时中创建下一次要用的上下文
+ * 运行时本身（原子表、形状哈希表、类表、正则缓存、分配器）保留，
+ * 模块文件的映射、解密结果和预加载快照由所有运行时共用，只加载一次。
+ * 字节码对象绑定在创建它的上下文上，无法跨上下文复用，每个新上下文仍要从快照
+ * 或按需加载器恢复模块，但这一步在归还时完成，不计入下一次请求的延迟。
+ *
+ * 池是线程安全的：每个运行时同一时刻只属于一个 Lease，可以在任意线程中使用，
+ * 没有空闲运行时时 acquire() 阻塞等待。执行器的回调可能在多个线程中同时被调用。
+ *
+ * 示例：
+ * QjsBinaryCodeExecutor executor;
+ * executor.setEntryFile("main.bc");
+ * QjsExecutorPool pool(executor, 4);
+ * // 每个请求线程：
+ * int ret = pool.execute();
+ */
+class QjsExecutorPool {
+    struct Slot;
+
+public:
+    /**
+     * @brief 创建运行时池
+     * @param executor 提供模块文件和配置（执行模式、密钥、回调），必须比池活得久，
+     *                 池存在期间不能再修改它的配置
+     * @param size 运行时数量（至少为 1）
+     *
+     * 二进制模式下如果执行器还没有加载模块，池按入口文件加载一次；
+     * JS 模式下入口文件的源代码也只读取一次。
+     */
+    QjsExecutorPool(QjsBinaryCodeExecutor &executor, size_t size);
+
+    /**
+     * @brief 等待所有 Lease 归还后释放全部运行时
+     *
+     * 每个上下文释放前触发执行器的 beforeRelease 回调。
+     */
+    ~QjsExecutorPool();
+
+    QjsExecutorPool(const QjsExecutorPool &) = delete;
+
+    QjsExecutorPool &operator=(const QjsExecutorPool &) = delete;
+
+    /**
+     * @brief 独占一个预热的运行时，析构时归还并重置
+     */
+    class Lease {
+    public:
+        Lease() = default;
+
+        ~Lease() { release(); }
+
+        Lease(Lease &&other) noexcept : pool_(other.pool_), slot_(other.slot_) {
+            other.pool_ = nullptr;
+            other.slot_ = nullptr;
+        }
+
+        Lease &operator=(Lease &&other) noexcept;
+
+        Lease(const Lease &) = delete;
+
+        Lease &operator=(const Lease &) = delete;
+
+        // 上下文创建失败时为 false
+        explicit operator bool() const noexcept { return context() != nullptr; }
+
+        JSRuntime *runtime() const noexcept;
+
+        JSContext *context() const noexcept;
+
+        /**
+         * @brief 在上下文中执行入口模块并运行事件循环
+         * @return 与 QjsBinaryCodeExecutor::execute() 相同，0=成功，其他=失败
+         *
+         * 上下文的状态在归还前不会被清除，同一个 Lease 多次执行时共用同一个全局对象。
+         */
+        int execute();
+
+        // 提前归还运行时
+        void release();
+
+    private:
+        friend class QjsExecutorPool;
+
+        Lease(QjsExecutorPool *pool, Slot *slot) : pool_(pool), slot_(slot) {}
+
+        QjsExecutorPool *pool_ = nullptr;
+        Slot *slot_ = nullptr;
+    };
+
+    /**
+     * @brief 取出一个空闲的运行时，没有空闲运行时时阻塞等待
+     */
+    Lease acquire();
+
+    /**
+     * @brief 取出运行时、执行入口模块并归还
+     * @return 与 QjsBinaryCodeExecutor::execute() 相同，没有可用的上下文时返回 -1
+     */
+    int execute();
+
+    size_t size() const { return slots_.size(); }
+
+private:
+    // 一个常驻运行时及其下一次要用的上下文
+    struct Slot {
+        JSRuntime *runtime = nullptr;
+        JSContext *context = nullptr; // 创建失败时为 nullptr，下次取出时重试
+    };
+
+    QjsBinaryCodeExecutor &executor_;
+    std::string jsCode_; // JS 模式下入口文件的源代码
+    std::vector<std::unique_ptr<Slot>> slots_;
+    std::vector<Slot *> idle_; // 空闲的运行时（后进先出，最近用过的缓存更热）
+    std::mutex mutex_; // 保护 idle_
+    std::condition_variable cond_;
+
+    // 丢弃上一次执行的上下文，在同一个运行时中创建新的上下文
+    void reset(Slot *slot);
+
+    // 释放上下文（不创建新的）
+    void freeContext(Slot *slot);
+
+    void release(Slot *slot);
+};
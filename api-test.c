@@ -5,7 +5,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include "quickjs.h"
+#include "quickjs-libc.h"
 #include "cutils.h"
+#if !defined(_WIN32) && !defined(__wasi__) && !defined(__EMSCRIPTEN__)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 
 static JSValue eval(JSContext *ctx, const char *code)
 {
@@ -228,6 +235,76 @@ static void async_call(void)
     JS_FreeRuntime(rt);
 }
 
+// job whose first argument is its sequence number and the last one its
+// argument count
+static JSValue ordered_job(JSContext *ctx, int argc, JSValueConst *argv)
+{
+    int *next = (int *)JS_GetContextOpaque(ctx);
+    int32_t seq, n;
+    assert(!JS_ToInt32(ctx, &seq, argv[0]));
+    assert(!JS_ToInt32(ctx, &n, argv[argc - 1]));
+    assert(seq == *next);
+    assert(n == argc);
+    ++*next;
+    if (seq == 7)
+        return JS_ThrowTypeError(ctx, "job 7");
+    return JS_UNDEFINED;
+}
+
+static void enqueue_ordered_job(JSContext *ctx, int seq)
+{
+    JSValue argv[8];
+    int argc = 2 + seq % 7, i;
+    argv[0] = JS_NewInt32(ctx, seq);
+    for (i = 1; i < argc - 1; i++)
+        argv[i] = JS_NewString(ctx, "arg");
+    argv[argc - 1] = JS_NewInt32(ctx, argc);
+    assert(!JS_EnqueueJob(ctx, ordered_job, argc, argv));
+    for (i = 0; i < argc; i++)
+        JS_FreeValue(ctx, argv[i]);
+}
+
+static void execute_pending_jobs(void)
+{
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    JSContext *ctx1;
+    int next = 0, seq = 0, i;
+    JS_SetContextOpaque(ctx, &next);
+    for (i = 0; i < 20; i++)
+        enqueue_ordered_job(ctx, seq++);
+    assert(JS_ExecutePendingJobs(rt, 5, &ctx1) == 5);
+    assert(ctx1 == ctx);
+    assert(next == 5);
+    // job 7 throws
+    assert(JS_ExecutePendingJobs(rt, -1, &ctx1) == -1);
+    assert(ctx1 == ctx);
+    assert(next == 8);
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    // the queue wraps around, then grows
+    for (i = 0; i < 40; i++)
+        enqueue_ordered_job(ctx, seq++);
+    assert(JS_ExecutePendingJob(rt, &ctx1) == 1);
+    assert(JS_ExecutePendingJobs(rt, -1, &ctx1) == seq - 9);
+    assert(next == seq);
+    assert(!JS_IsJobPending(rt));
+    assert(JS_ExecutePendingJobs(rt, -1, &ctx1) == 0);
+    assert(ctx1 == NULL);
+    // the queue grown by a burst of jobs is freed once drained
+    JSMemoryUsage before, after;
+    JS_ComputeMemoryUsage(rt, &before);
+    for (i = 0; i < 10000; i++)
+        enqueue_ordered_job(ctx, seq++);
+    assert(JS_ExecutePendingJobs(rt, -1, &ctx1) == 10000);
+    JS_ComputeMemoryUsage(rt, &after);
+    assert(after.malloc_size <= before.malloc_size);
+    // pending jobs are freed with the runtime
+    for (i = 0; i < 30; i++)
+        enqueue_ordered_job(ctx, seq++);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
 static JSValue save_value(JSContext *ctx, JSValueConst this_val,
                           int argc, JSValueConst *argv)
 {
@@ -795,11 +872,909 @@ static void slice_string_tocstring(void)
     JS_FreeRuntime(rt);
 }
 
+static void utf8_long_string(void)
+{
+    static const char *const pieces[] = { "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80" };
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    char buf[4096];
+    size_t len, buf_len;
+    int32_t n;
+    // long ASCII runs around 8-bit, 16-bit and non-BMP code points
+    for (int kind = 0; kind < 3; kind++) {
+        buf_len = 0;
+        for (int i = 0; i < 10; i++) {
+            memset(buf + buf_len, 'a' + i, 37 * i + 1);
+            buf_len += 37 * i + 1;
+            for (int k = 0; k <= kind && k < i; k++) {
+                strcpy(buf + buf_len, pieces[k]);
+                buf_len += strlen(pieces[k]);
+            }
+        }
+        JSValue str = JS_NewStringLen(ctx, buf, buf_len);
+        assert(JS_IsString(str));
+        JSValue v = JS_GetPropertyStr(ctx, str, "length");
+        assert(!JS_ToInt32(ctx, &n, v));
+        assert(n == 1675 + 9 + 8 * (kind >= 1) + 2 * 7 * (kind >= 2));
+        const char *s = JS_ToCStringLen(ctx, &len, str);
+        assert(s);
+        assert(len == buf_len);
+        assert(!memcmp(s, buf, len));
+        JS_FreeCString(ctx, s);
+        JS_FreeValue(ctx, str);
+    }
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void gc_step(void)
+{
+    static const char init_code[] =
+"globalThis.live = []; \
+function garbage(n) { \
+    for (let i = 0; i < n; i++) { \
+        const a = {}, b = {a}; \
+        a.b = b; \
+        a.f = function() { return b; }; \
+    } \
+} \
+function mutate(i) { \
+    const o = {i}; \
+    o.self = o; \
+    if (i & 1) \
+        live.push(o); \
+    garbage(10); \
+}";
+    JSMemoryUsage usage1, usage2;
+    char buf[64];
+    int i;
+
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    JSValue ret = eval(ctx, init_code);
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    // no automatic collection to finish the cycles behind our back
+    JS_SetGCThreshold(rt, -1);
+
+    // the snapshot goes stale while the script runs between the steps
+    ret = eval(ctx, "garbage(1000)");
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    for (i = 0; !JS_RunGCStep(rt, 100); i++) {
+        snprintf(buf, sizeof(buf), "mutate(%d)", i);
+        ret = eval(ctx, buf);
+        assert(!JS_IsException(ret));
+        JS_FreeValue(ctx, ret);
+    }
+    assert(i > 0);
+
+    // a cycle without mutation finds everything JS_RunGC() would
+    while (!JS_RunGCStep(rt, 100))
+        continue;
+    JS_ComputeMemoryUsage(rt, &usage1);
+    JS_RunGC(rt);
+    JS_ComputeMemoryUsage(rt, &usage2);
+    assert(usage1.obj_count == usage2.obj_count);
+    assert(usage1.memory_used_size == usage2.memory_used_size);
+
+    ret = eval(ctx, "live.length > 0 && "
+                    "live.every(o => o.self === o && (o.i & 1))");
+    assert(JS_IsBool(ret) && JS_ToBool(ctx, ret));
+    JS_FreeValue(ctx, ret);
+
+    // a full collection in the middle of a cycle
+    ret = eval(ctx, "garbage(100)");
+    JS_FreeValue(ctx, ret);
+    assert(!JS_RunGCStep(rt, 10));
+    JS_RunGC(rt);
+    assert(JS_RunGCStep(rt, 0));
+
+    // the count only changes when GC objects are created
+    JSValue global = JS_GetGlobalObject(ctx);
+    JSValue func = JS_GetPropertyStr(ctx, global, "garbage");
+    uint64_t count = JS_GetGCAllocCount(rt);
+    JSValue arg = JS_NewInt32(ctx, 0);
+    ret = JS_Call(ctx, func, global, 1, &arg);
+    assert(!JS_IsException(ret));
+    assert(JS_GetGCAllocCount(rt) == count);
+    arg = JS_NewInt32(ctx, 1);
+    ret = JS_Call(ctx, func, global, 1, &arg);
+    assert(!JS_IsException(ret));
+    assert(JS_GetGCAllocCount(rt) >= count + 3);
+    JS_FreeValue(ctx, func);
+    JS_FreeValue(ctx, global);
+
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static int gc_trigger_count;
+
+static JSGCTriggerAction gc_trigger(JSRuntime *rt, JSGCTriggerInfo *info,
+                                    void *opaque)
+{
+    gc_trigger_count++;
+    assert(info->next_threshold > info->malloc_size);
+    assert(info->step_budget == 1000);
+    if (gc_trigger_count == 1) {
+        info->next_threshold = info->malloc_size + 1024 * 1024;
+        return JS_GC_TRIGGER_DEFER;
+    }
+    return JS_GC_TRIGGER_RUN;
+}
+
+static void gc_policy(void)
+{
+    JSMemoryUsage usage;
+    JSGCPolicy policy;
+
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    JS_GetGCPolicy(rt, &policy);
+    assert(policy.min_threshold == 256 * 1024);
+    policy.min_threshold = 1024 * 1024;
+    policy.max_growth = 2;
+    policy.target_gc_ratio = 0.05;
+    policy.step_budget = 1000;
+    JS_SetGCPolicy(rt, &policy);
+    assert(JS_GetGCThreshold(rt) == 1024 * 1024);
+    JS_SetGCTriggerFunc(rt, gc_trigger, NULL);
+
+    JSValue ret = eval(ctx, "for (let i = 0; i < 200000; i++) { "
+                            "    const a = {}, b = {a}; a.b = b; "
+                            "}");
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    assert(gc_trigger_count > 2);
+    // the cycles were collected along the way
+    JS_ComputeMemoryUsage(rt, &usage);
+    assert(usage.malloc_size < 16 * 1024 * 1024);
+
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static int slab_mf_count;
+
+static void *slab_mf_calloc(void *opaque, size_t count, size_t size)
+{
+    slab_mf_count++;
+    return calloc(count, size);
+}
+
+static void *slab_mf_malloc(void *opaque, size_t size)
+{
+    slab_mf_count++;
+    return malloc(size);
+}
+
+static void slab_mf_free(void *opaque, void *ptr)
+{
+    if (ptr)
+        slab_mf_count--;
+    free(ptr);
+}
+
+static void *slab_mf_realloc(void *opaque, void *ptr, size_t size)
+{
+    if (!ptr)
+        slab_mf_count++;
+    return realloc(ptr, size);
+}
+
+static void slab_alloc(void)
+{
+    static const JSMallocFunctions mf = {
+        slab_mf_calloc, slab_mf_malloc, slab_mf_free, slab_mf_realloc, NULL,
+    };
+    JSMemoryUsage usage;
+    int64_t count;
+
+    JSRuntime *rt = JS_NewRuntime3(&mf, NULL, JS_RUNTIME_SLAB_ALLOC);
+    JSContext *ctx = JS_NewContext(rt);
+    JS_ComputeMemoryUsage(rt, &usage);
+    count = usage.malloc_count;
+    // most of the engine allocations do not go through 'mf'
+    assert(slab_mf_count < count / 4);
+    JSValue ret = eval(ctx, "const a = [];"
+                            "for (let i = 0; i < 20000; i++) {"
+                            "    a.push({ i, s: 'x' + i, b: [i] });"
+                            "    if (i % 3 == 0) a[i >> 1] = null;"
+                            "}"
+                            "a.length = 0;"
+                            "JSON.stringify({ x: 'y'.repeat(1000) }).length");
+    assert(!JS_IsException(ret));
+    assert(JS_VALUE_GET_INT(ret) == 1008);
+    JS_FreeValue(ctx, ret);
+    JS_RunGC(rt);
+    JS_ComputeMemoryUsage(rt, &usage);
+    assert(usage.malloc_count < count + 100);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+    assert(slab_mf_count == 0);
+}
+
+// superinstructions are not serialized, the output must be stable
+static void superinstruction_serde(void)
+{
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    static const char code[] = "let s = 0;"
+                               "for (let i = 0; i < 10; i++)"
+                               "    for (var j = 10; j > 0; j--)"
+                               "        if (j <= i) s += j;"
+                               "for (var k = 2147483645; k < 2147483650; k++)"
+                               "    if (k >= 2147483648) s++;"
+                               "s";
+    JSValue obj = JS_Eval(ctx, code, strlen(code), "<input>",
+                          JS_EVAL_TYPE_GLOBAL|JS_EVAL_FLAG_COMPILE_ONLY);
+    assert(!JS_IsException(obj));
+    size_t len1 = 0, len2 = 0;
+    uint8_t *buf1 = JS_WriteObject(ctx, &len1, obj, JS_WRITE_OBJ_BYTECODE);
+    assert(buf1);
+    JS_FreeValue(ctx, obj);
+    obj = JS_ReadObject(ctx, buf1, len1, JS_READ_OBJ_BYTECODE);
+    assert(!JS_IsException(obj));
+    uint8_t *buf2 = JS_WriteObject(ctx, &len2, obj, JS_WRITE_OBJ_BYTECODE);
+    assert(buf2);
+    assert(len1 == len2);
+    assert(!memcmp(buf1, buf2, len1));
+    js_free(ctx, buf1);
+    js_free(ctx, buf2);
+    JSValue ret = JS_EvalFunction(ctx, obj);
+    assert(!JS_IsException(ret));
+    assert(JS_VALUE_GET_INT(ret) == 167);
+    JS_FreeValue(ctx, ret);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+typedef struct {
+    const uint8_t *buf;
+    size_t len, pos;
+    int calls;
+    bool fail;
+} stream_input;
+
+// returns between 1 and 7 bytes at a time
+static int64_t stream_read(void *opaque, uint8_t *buf, size_t buf_size)
+{
+    stream_input *in = opaque;
+    size_t n = 1 + in->calls++ % 7;
+    if (in->fail && in->pos >= in->len / 2)
+        return -1;
+    if (n > buf_size)
+        n = buf_size;
+    if (n > in->len - in->pos)
+        n = in->len - in->pos;
+    memcpy(buf, in->buf + in->pos, n);
+    in->pos += n;
+    return n;
+}
+
+static void read_object_stream(void)
+{
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    static const char code[] = "var big = 'x'.repeat(100000);"
+                               "var ab = new Uint8Array(40000).fill(7).buffer;"
+                               "function f(a) { return a.length + '\u1234'.length; }"
+                               "[f(big), new Uint8Array(ab)[39999], 'é€']";
+    JSValue obj = JS_Eval(ctx, code, strlen(code), "<input>",
+                          JS_EVAL_TYPE_GLOBAL|JS_EVAL_FLAG_COMPILE_ONLY);
+    assert(!JS_IsException(obj));
+    size_t len1 = 0, len2 = 0;
+    uint8_t *buf1 = JS_WriteObject(ctx, &len1, obj, JS_WRITE_OBJ_BYTECODE);
+    assert(buf1);
+    JS_FreeValue(ctx, obj);
+    stream_input in = { buf1, len1, 0, 0, false };
+    obj = JS_ReadObjectStream(ctx, stream_read, &in, JS_READ_OBJ_BYTECODE);
+    assert(!JS_IsException(obj));
+    assert(in.pos == len1);
+    uint8_t *buf2 = JS_WriteObject(ctx, &len2, obj, JS_WRITE_OBJ_BYTECODE);
+    assert(buf2);
+    assert(len1 == len2);
+    assert(!memcmp(buf1, buf2, len1));
+    js_free(ctx, buf2);
+    JSValue ret = JS_EvalFunction(ctx, obj);
+    assert(!JS_IsException(ret));
+    JSValue json = JS_JSONStringify(ctx, ret, JS_UNDEFINED, JS_UNDEFINED);
+    const char *str = JS_ToCString(ctx, json);
+    assert(str);
+    assert(!strcmp(str, "[100001,7,\"é€\"]"));
+    JS_FreeCString(ctx, str);
+    JS_FreeValue(ctx, json);
+    JS_FreeValue(ctx, ret);
+    // truncated input
+    in = (stream_input){ buf1, len1 - 1, 0, 0, false };
+    obj = JS_ReadObjectStream(ctx, stream_read, &in, JS_READ_OBJ_BYTECODE);
+    assert(JS_IsException(obj));
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    // read error
+    in = (stream_input){ buf1, len1, 0, 0, true };
+    obj = JS_ReadObjectStream(ctx, stream_read, &in, JS_READ_OBJ_BYTECODE);
+    assert(JS_IsException(obj));
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    js_free(ctx, buf1);
+    // the lengths read from the input are not allocated before the data
+    static const char *const forged[][2] = {
+        // a string of 2^29 characters
+        { "''", "\x80\x80\x80\x80\x04" "abc" },
+        // an ArrayBuffer of 2 GB
+        { "new ArrayBuffer(0)", "\xff\xff\xff\xff\x07\xff\xff\xff\xff\x0f" "abc" },
+    };
+    JS_SetMemoryLimit(rt, 16 * 1024 * 1024);
+    for (size_t i = 0; i < countof(forged); i++) {
+        uint8_t input[32];
+        size_t len = strlen(forged[i][1]);
+        ret = eval(ctx, forged[i][0]);
+        buf1 = JS_WriteObject(ctx, &len1, ret, 0);
+        assert(buf1 && len1 > 3);
+        JS_FreeValue(ctx, ret);
+        // keep the version, the atom count and the tag
+        memcpy(input, buf1, 3);
+        memcpy(input + 3, forged[i][1], len);
+        js_free(ctx, buf1);
+        for (int stream = 0; stream < 2; stream++) {
+            in = (stream_input){ input, 3 + len, 0, 0, false };
+            if (stream)
+                obj = JS_ReadObjectStream(ctx, stream_read, &in, 0);
+            else
+                obj = JS_ReadObject(ctx, input, 3 + len, 0);
+            assert(JS_IsException(obj));
+            JSValue exc = JS_GetException(ctx);
+            str = JS_ToCString(ctx, exc);
+            assert(str && strstr(str, "read after the end of the buffer"));
+            JS_FreeCString(ctx, str);
+            JS_FreeValue(ctx, exc);
+        }
+    }
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void shared_atoms(void)
+{
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    static const char code1[] = "var sharedName = { sharedKey: 1 }; sharedName.sharedKey";
+    static const char code2[] = "var otherName = { sharedKey: 2 }; otherName.sharedKey + 40";
+    JSValue obj1 = JS_Eval(ctx, code1, strlen(code1), "<input1>",
+                           JS_EVAL_TYPE_GLOBAL|JS_EVAL_FLAG_COMPILE_ONLY);
+    JSValue obj2 = JS_Eval(ctx, code2, strlen(code2), "<input2>",
+                           JS_EVAL_TYPE_GLOBAL|JS_EVAL_FLAG_COMPILE_ONLY);
+    assert(!JS_IsException(obj1));
+    assert(!JS_IsException(obj2));
+    int flags = JS_WRITE_OBJ_BYTECODE|JS_WRITE_OBJ_SHARED_ATOMS;
+    size_t len1, len2, len, atoms_len;
+    uint8_t *buf1 = JS_WriteObject(ctx, &len1, obj1, flags);
+    uint8_t *buf2 = JS_WriteObject(ctx, &len2, obj2, flags);
+    uint8_t *buf = JS_WriteObject(ctx, &len, obj2, JS_WRITE_OBJ_BYTECODE);
+    uint8_t *atoms = JS_WriteAtomTable(ctx, &atoms_len);
+    assert(buf1 && buf2 && buf && atoms);
+    assert(len2 < len); // "sharedKey" is only in the atom table
+    JS_FreeValue(ctx, obj1);
+    JS_FreeValue(ctx, obj2);
+    JS_FreeContext(ctx);
+    ctx = JS_NewContext(rt);
+    // the atom table must be loaded first
+    obj1 = JS_ReadObject(ctx, buf1, len1, JS_READ_OBJ_BYTECODE);
+    assert(JS_IsException(obj1));
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    assert(JS_ReadAtomTable(ctx, buf1, len1) == -1);
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    assert(JS_ReadAtomTable(ctx, atoms, atoms_len) == 0);
+    obj1 = JS_ReadObject(ctx, buf1, len1, JS_READ_OBJ_BYTECODE);
+    obj2 = JS_ReadObject(ctx, buf2, len2, JS_READ_OBJ_BYTECODE);
+    assert(!JS_IsException(obj1));
+    assert(!JS_IsException(obj2));
+    JSValue ret = JS_EvalFunction(ctx, obj1);
+    assert(JS_VALUE_GET_TAG(ret) == JS_TAG_INT && JS_VALUE_GET_INT(ret) == 1);
+    ret = JS_EvalFunction(ctx, obj2);
+    assert(JS_VALUE_GET_TAG(ret) == JS_TAG_INT && JS_VALUE_GET_INT(ret) == 42);
+    js_free(ctx, buf1);
+    js_free(ctx, buf2);
+    js_free(ctx, buf);
+    js_free(ctx, atoms);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void profiler(void)
+{
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    // only sampled on request
+    assert(JS_StartProfiling(rt, 0) == 0);
+    assert(JS_StartProfiling(rt, 0) == -1);
+    JS_RequestProfileSample(rt);
+    JSValue ret = eval(ctx, "function hot() {"
+                            "    let s = 0;"
+                            "    for (let i = 0; i < 100000; i++) s += i;"
+                            "    return s;"
+                            "}"
+                            "hot()");
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    JSValue profile = JS_StopProfiling(ctx);
+    assert(JS_IsString(profile));
+    const char *json = JS_ToCString(ctx, profile);
+    assert(json);
+    JSValue obj = JS_ParseJSON(ctx, json, strlen(json), "<profile>");
+    assert(!JS_IsException(obj));
+    JS_FreeCString(ctx, json);
+    JS_FreeValue(ctx, profile);
+    assert(JS_IsUndefined(JS_StopProfiling(ctx)));
+    JSValue global = JS_GetGlobalObject(ctx);
+    JS_SetPropertyStr(ctx, global, "profile", obj);
+    JS_FreeValue(ctx, global);
+    ret = eval(ctx, "profile.samples.length === 1 &&"
+                    "profile.timeDeltas.length === 1 &&"
+                    "profile.nodes[0].callFrame.functionName === '(root)' &&"
+                    "profile.nodes.find(n => n.id === profile.samples[0])"
+                    "    .callFrame.functionName === 'hot'");
+    assert(JS_IsBool(ret));
+    assert(JS_VALUE_GET_BOOL(ret));
+    // the profiler is freed with the runtime
+    assert(JS_StartProfiling(rt, 1) == 0);
+    ret = eval(ctx, "hot()");
+    JS_FreeValue(ctx, ret);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void heap_sampling(void)
+{
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    assert(JS_StartHeapSampling(rt, 0) == -1);
+    // every allocation is sampled
+    assert(JS_StartHeapSampling(rt, 1) == 0);
+    assert(JS_StartHeapSampling(rt, 1) == -1);
+    JSValue ret = eval(ctx, "function alloc() {"
+                            "    let a = [];"
+                            "    for (let i = 0; i < 100; i++) a.push({ i });"
+                            "    return a;"
+                            "}"
+                            "alloc().length");
+    assert(!JS_IsException(ret));
+    JSValue profile = JS_StopHeapSampling(ctx);
+    assert(JS_IsString(profile));
+    assert(JS_IsUndefined(JS_StopHeapSampling(ctx)));
+    const char *json = JS_ToCString(ctx, profile);
+    assert(json);
+    JSValue obj = JS_ParseJSON(ctx, json, strlen(json), "<profile>");
+    assert(!JS_IsException(obj));
+    JS_FreeCString(ctx, json);
+    JS_FreeValue(ctx, profile);
+    JSValue global = JS_GetGlobalObject(ctx);
+    JS_SetPropertyStr(ctx, global, "profile", obj);
+    JS_FreeValue(ctx, global);
+    ret = eval(ctx, "function find(n, name) {"
+                    "    if (n.callFrame.functionName === name) return n;"
+                    "    for (let c of n.children) {"
+                    "        let r = find(c, name);"
+                    "        if (r) return r;"
+                    "    }"
+                    "}"
+                    "profile.head.callFrame.functionName === '(root)' &&"
+                    "profile.samples.length > 100 &&"
+                    "find(profile.head, 'alloc').selfSize > 0");
+    assert(JS_IsBool(ret));
+    assert(JS_VALUE_GET_BOOL(ret));
+    // the profiler is freed with the runtime
+    assert(JS_StartHeapSampling(rt, 10) == 0);
+    ret = eval(ctx, "alloc()");
+    JS_FreeValue(ctx, ret);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void heap_snapshot(void)
+{
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    JSValue ret = eval(ctx, "class Foo { constructor() { this.bar = 'hello' } }"
+                            "var foo = new Foo();"
+                            "var counter = (() => { let count = 0; return () => count++ })()");
+    assert(!JS_IsException(ret));
+    JSValue snapshot = JS_TakeHeapSnapshot(ctx);
+    assert(JS_IsString(snapshot));
+    const char *json = JS_ToCString(ctx, snapshot);
+    assert(json);
+    JSValue obj = JS_ParseJSON(ctx, json, strlen(json), "<snapshot>");
+    assert(!JS_IsException(obj));
+    JS_FreeCString(ctx, json);
+    JS_FreeValue(ctx, snapshot);
+    JSValue global = JS_GetGlobalObject(ctx);
+    JS_SetPropertyStr(ctx, global, "snapshot", obj);
+    JS_FreeValue(ctx, global);
+    ret = eval(ctx, "var { nodes, edges, strings, snapshot: { meta } } = snapshot;"
+                    "var nf = meta.node_fields.length, ef = meta.edge_fields.length;"
+                    "var types = meta.node_types[0], etypes = meta.edge_types[0];"
+                    "function edgesOf(i) {"
+                    "    let first = 0, r = [];"
+                    "    for (let j = 0; j < i; j++) first += nodes[j * nf + 4];"
+                    "    for (let j = 0; j < nodes[i * nf + 4]; j++) {"
+                    "        let e = (first + j) * ef;"
+                    "        r.push({ type: etypes[edges[e]], name: edges[e + 1],"
+                    "                 to: edges[e + 2] / nf });"
+                    "    }"
+                    "    return r;"
+                    "}"
+                    "function name(i) { return strings[nodes[i * nf + 1]] }"
+                    "var count = nodes.length / nf;"
+                    "var ids = new Set();"
+                    "for (let i = 0; i < count; i++) ids.add(nodes[i * nf + 2]);"
+                    "var foo = [...Array(count).keys()].find(i =>"
+                    "    types[nodes[i * nf]] === 'object' && name(i) === 'Foo');"
+                    "var bar = edgesOf(foo).find(e =>"
+                    "    e.type === 'property' && strings[e.name] === 'bar');"
+                    "var fn = [...Array(count).keys()].find(i =>"
+                    "    types[nodes[i * nf]] === 'closure' &&"
+                    "    edgesOf(i).some(e => e.type === 'context' &&"
+                    "                         strings[e.name] === 'count'));"
+                    "ids.size === count &&"
+                    "meta.node_fields.join() === 'type,name,id,self_size,edge_count,trace_node_id' &&"
+                    "snapshot.snapshot.node_count === count &&"
+                    "name(0) === '(GC roots)' && edgesOf(0).length > 0 &&"
+                    "foo !== undefined && bar !== undefined &&"
+                    "types[nodes[bar.to * nf]] === 'string' && name(bar.to) === 'hello' &&"
+                    "fn !== undefined");
+    assert(JS_IsBool(ret));
+    assert(JS_VALUE_GET_BOOL(ret));
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void regexp_cache(void)
+{
+    JSMemoryUsage m;
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    JS_ComputeMemoryUsage(rt, &m);
+    assert(m.regexp_cache_count == 0);
+    // the literal and the constructor share the same compiled bytecode
+    JSValue ret = eval(ctx, "/a+b/g.test('xaab') &&"
+                            "new RegExp('a+b', 'g').test('xaab') &&"
+                            "!new RegExp('a+b', 'gi').test('xcd')");
+    assert(JS_IsBool(ret));
+    assert(JS_VALUE_GET_BOOL(ret));
+    JS_ComputeMemoryUsage(rt, &m);
+    assert(m.regexp_cache_count == 2);
+    assert(m.regexp_cache_hits == 1);
+    assert(m.regexp_cache_misses == 2);
+    // syntax errors are not cached
+    ret = eval(ctx, "try { new RegExp('(') } catch (e) {}"
+                    "try { new RegExp('(') } catch (e) {}");
+    JS_FreeValue(ctx, ret);
+    JS_ComputeMemoryUsage(rt, &m);
+    assert(m.regexp_cache_count == 2);
+    assert(m.regexp_cache_misses == 4);
+    // the cache is bounded
+    ret = eval(ctx, "for (let i = 0; i < 1000; i++) new RegExp('x' + i)");
+    JS_FreeValue(ctx, ret);
+    JS_ComputeMemoryUsage(rt, &m);
+    assert(m.regexp_cache_count > 0 && m.regexp_cache_count < 1000);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void json_stringify_utf8(void)
+{
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    char small[8], large[64], *out;
+    size_t len;
+    JSValue obj = eval(ctx, "({a: [1, 2.5], s: '\\u00e9\\u20ac\\ud83d\\ude00'})");
+    assert(!JS_IsException(obj));
+    const char expected[] = "{\"a\":[1,2.5],\"s\":\"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\"}";
+    // fits in the caller buffer
+    out = JS_JSONStringifyUTF8(ctx, obj, JS_UNDEFINED, JS_UNDEFINED,
+                               large, sizeof(large), &len);
+    assert(out == large);
+    assert(len == strlen(expected));
+    assert(!strcmp(out, expected));
+    // allocated if too small
+    out = JS_JSONStringifyUTF8(ctx, obj, JS_UNDEFINED, JS_UNDEFINED,
+                               small, sizeof(small), &len);
+    assert(out && out != small);
+    assert(len == strlen(expected));
+    assert(!strcmp(out, expected));
+    js_free(ctx, out);
+    out = JS_JSONStringifyUTF8(ctx, obj, JS_UNDEFINED, JS_UNDEFINED,
+                               NULL, 0, &len);
+    assert(out && !strcmp(out, expected));
+    js_free(ctx, out);
+    JS_FreeValue(ctx, obj);
+    // undefined result
+    out = JS_JSONStringifyUTF8(ctx, JS_UNDEFINED, JS_UNDEFINED, JS_UNDEFINED,
+                               large, sizeof(large), &len);
+    assert(!out && len == 0 && !JS_HasException(ctx));
+    // exception
+    obj = eval(ctx, "({a: 1n})");
+    out = JS_JSONStringifyUTF8(ctx, obj, JS_UNDEFINED, JS_UNDEFINED,
+                               large, sizeof(large), &len);
+    assert(!out && JS_HasException(ctx));
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    JS_FreeValue(ctx, obj);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static JSValue answer(JSContext *ctx, JSValueConst this_val,
+                      int argc, JSValueConst *argv)
+{
+    return JS_NewInt32(ctx, 42);
+}
+
+static const JSCFunctionListEntry answer_funcs[] = {
+    JS_CFUNC_DEF("answer", 0, answer),
+    JS_PROP_INT32_DEF("version", 3, 0),
+    JS_ALIAS_DEF("reply", "answer"),
+};
+
+static void function_list_shapes(void)
+{
+    static const char code[] =
+        "[Object, Array.prototype, String.prototype, Math, Map.prototype,"
+        " Symbol, globalThis].map(o => Reflect.ownKeys(o).map(k => {"
+        "  const d = Object.getOwnPropertyDescriptor(o, k);"
+        "  return [String(k), typeof d.value, typeof d.get, d.writable,"
+        "          d.enumerable, d.configurable].join();"
+        "}).join()).join(';') + (String.prototype.trimLeft === String.prototype.trimStart) +"
+        "new Map([[1, 2]]).size + Math.max(1, 2) + [3, 1, 2].sort()";
+    JSRuntime *rt = JS_NewRuntime();
+    const char *first = NULL;
+    for (int i = 0; i < 3; i++) {
+        // the second and third contexts reuse the shapes of the first one
+        JSContext *ctx = JS_NewContext(rt);
+        JSValue ret = eval(ctx, code);
+        assert(JS_IsString(ret));
+        const char *str = JS_ToCString(ctx, ret);
+        if (first)
+            assert(!strcmp(str, first));
+        else
+            first = strdup(str);
+        JS_FreeCString(ctx, str);
+        JS_FreeValue(ctx, ret);
+        JSValue obj = JS_NewObject(ctx);
+        JS_SetPropertyFunctionList(ctx, obj, answer_funcs,
+                                   sizeof(answer_funcs) / sizeof(answer_funcs[0]));
+        JSValue global = JS_GetGlobalObject(ctx);
+        JS_SetPropertyStr(ctx, global, "o", obj);
+        JS_FreeValue(ctx, global);
+        ret = eval(ctx, "o.answer() + o.reply() + o.version +"
+                        "Object.keys(o).length");
+        assert(JS_IsNumber(ret));
+        int32_t n;
+        JS_ToInt32(ctx, &n, ret);
+        assert(n == 42 + 42 + 3 + 0);
+        JS_FreeContext(ctx);
+    }
+    free((void *)first);
+    JS_FreeRuntime(rt);
+}
+
+#if JS_HAVE_THREADS && !defined(_WIN32) && !defined(__wasi__) && !defined(__EMSCRIPTEN__)
+// a scripted HTTP server for the built-in client of std.urlGet(): the
+// request path selects the response
+static struct {
+    int listen_fd;
+    int conns; // accepted connections
+    char request_line[256];
+} http_srv;
+
+static const struct {
+    const char *path;
+    const char *response; // NULL: never answer
+    bool close; // close the connection after the response
+} http_responses[] = {
+    { "/length", "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello", false },
+    { "/chunked", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                  "5;name=value\r\nhello\r\n6\r\n world\r\n0\r\n"
+                  "X-Trailer: 1\r\n\r\n", false },
+    { "/eof", "HTTP/1.0 200 OK\r\n\r\nuntil close", true },
+    { "/interim", "HTTP/1.1 100 Continue\r\n\r\n"
+                  "HTTP/1.1 103 Early Hints\r\nLink: </style.css>\r\n\r\n"
+                  "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok", false },
+    // a keep-alive response on a connection closed by the server
+    { "/stale", "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nstale", true },
+    { "/huge-chunk", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                     "ffffffffffffffff\r\nab", true },
+    { "/stall", NULL, false },
+    { "/quit", "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n", true },
+};
+
+static void http_server(void *arg)
+{
+    char req[1024], path[256];
+    int fd, i;
+    size_t len;
+    bool quit = false;
+
+    while (!quit) {
+        fd = accept(http_srv.listen_fd, NULL, NULL);
+        assert(fd >= 0);
+        http_srv.conns++;
+        for (;;) {
+            // read the request until the empty line
+            len = 0;
+            while (len < 4 || memcmp(req + len - 4, "\r\n\r\n", 4)) {
+                assert(len < sizeof(req) - 1);
+                if (recv(fd, req + len, 1, 0) != 1)
+                    goto done;
+                len++;
+            }
+            req[len] = '\0';
+            len = strcspn(req, "\r");
+            assert(len < sizeof(http_srv.request_line));
+            memcpy(http_srv.request_line, req, len);
+            http_srv.request_line[len] = '\0';
+            assert(sscanf(req, "GET %255s ", path) == 1);
+            for (i = 0; i < countof(http_responses); i++) {
+                if (!strcmp(path, http_responses[i].path))
+                    break;
+            }
+            if (i == countof(http_responses)) {
+                static const char not_found[] = "HTTP/1.1 404 Not Found\r\n"
+                                                "Content-Length: 0\r\n\r\n";
+                send(fd, not_found, strlen(not_found), 0);
+                continue;
+            }
+            if (!http_responses[i].response) {
+                // wait until the client gives up
+                while (recv(fd, req, sizeof(req), 0) > 0)
+                    continue;
+                break;
+            }
+            send(fd, http_responses[i].response,
+                 strlen(http_responses[i].response), 0);
+            quit = !strcmp(path, "/quit");
+            if (http_responses[i].close)
+                break;
+        }
+    done:
+        close(fd);
+    }
+}
+
+static char *http_eval(JSContext *ctx, const char *code)
+{
+    JSValue ret = eval(ctx, code);
+    assert(!JS_IsException(ret));
+    const char *str = JS_ToCString(ctx, ret);
+    assert(str);
+    char *s = strdup(str);
+    JS_FreeCString(ctx, str);
+    JS_FreeValue(ctx, ret);
+    return s;
+}
+
+#define HTTP_CHECK(code, expected) do {             \
+        char *s = http_eval(ctx, code);             \
+        assert(!strcmp(s, expected));               \
+        free(s);                                    \
+    } while (0)
+
+static void http_client(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    js_thread_t thread;
+    char code[128];
+
+    http_srv.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(http_srv.listen_fd >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(!bind(http_srv.listen_fd, (struct sockaddr *)&addr, sizeof(addr)));
+    assert(!listen(http_srv.listen_fd, 4));
+    assert(!getsockname(http_srv.listen_fd, (struct sockaddr *)&addr, &addr_len));
+    assert(!js_thread_create(&thread, http_server, NULL, 0));
+
+    JSRuntime *rt = JS_NewRuntime();
+    js_std_init_handlers(rt);
+    JSContext *ctx = JS_NewContext(rt);
+    js_init_module_std(ctx, "qjs:std");
+    static const char init[] = "import * as std from 'qjs:std';"
+                               "globalThis.std = std;"
+                               "globalThis.get = (path, opts) => {"
+                               "    const r = std.urlGet(U + path, { full: true, ...opts });"
+                               "    return r.response === null ? 'error' :"
+                               "           r.status + ' ' + r.response;"
+                               "};";
+    snprintf(code, sizeof(code), "globalThis.U = 'http://127.0.0.1:%d'",
+             ntohs(addr.sin_port));
+    JS_FreeValue(ctx, eval(ctx, code));
+    JSValue ret = JS_Eval(ctx, init, strlen(init), "<init>", JS_EVAL_TYPE_MODULE);
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+
+    HTTP_CHECK("get('/length')", "200 hello");
+    // the connection is kept alive
+    HTTP_CHECK("get('/chunked')", "200 hello world");
+    HTTP_CHECK("get('/length')", "200 hello");
+    assert(http_srv.conns == 1);
+    // the interim responses and their headers are skipped
+    HTTP_CHECK("get('/interim')", "200 ok");
+    HTTP_CHECK("std.urlGet(U + '/interim', { full: true }).responseHeaders",
+               "Content-Length: 2\r\n");
+    // the next request fails on the closed connection and is retried
+    HTTP_CHECK("get('/stale')", "200 stale");
+    HTTP_CHECK("get('/length')", "200 hello");
+    assert(http_srv.conns == 2);
+    HTTP_CHECK("get('/eof')", "200 until close");
+    HTTP_CHECK("get('/length')", "200 hello");
+    assert(http_srv.conns == 3);
+    HTTP_CHECK("get('/huge-chunk')", "error");
+    // the request target cannot add headers
+    HTTP_CHECK("get('/a b\\r\\nX-Injected: 1?q=\\x7f#frag')", "404 ");
+    assert(!strcmp(http_srv.request_line,
+                   "GET /a%20b%0D%0AX-Injected:%201?q=%7F HTTP/1.1"));
+    // a stalled server does not hang the caller
+    uint64_t start = js__hrtime_ns();
+    HTTP_CHECK("get('/stall', { timeout: 100 })", "error");
+    assert(js__hrtime_ns() - start < 5000 * 1000000ULL);
+    HTTP_CHECK("get('/quit')", "200 ");
+
+    js_thread_join(thread);
+    close(http_srv.listen_fd);
+    js_std_free_handlers(rt);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+// freeing a runtime does not wait for its blocked I/O requests
+static void async_io_teardown(void)
+{
+    static const char code[] =
+        "import * as os from 'qjs:os';"
+        "const [r, w] = os.pipe();"
+        "globalThis.fds = [r, w];"
+        "const n = 1 << 24;"
+        "os.writeAsync(w, new ArrayBuffer(n), 0, n);"
+        "os.setTimeout(() => { throw new Error('stop'); }, 100);";
+    JSRuntime *rt = JS_NewRuntime();
+    js_std_init_handlers(rt);
+    JSContext *ctx = JS_NewContext(rt);
+    js_init_module_os(ctx, "qjs:os");
+    JSValue ret = JS_Eval(ctx, code, strlen(code), "<input>", JS_EVAL_TYPE_MODULE);
+    assert(!JS_IsException(ret));
+    JS_FreeValue(ctx, ret);
+    // the write blocks in an I/O thread since nothing reads the pipe
+    assert(js_std_loop(ctx));
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    int32_t fds[2];
+    for (int i = 0; i < 2; i++) {
+        char expr[16];
+        snprintf(expr, sizeof(expr), "fds[%d]", i);
+        ret = eval(ctx, expr);
+        assert(!JS_ToInt32(ctx, &fds[i], ret));
+    }
+    js_std_free_handlers(rt);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+    // unblock the detached write
+    char buf[65536];
+    size_t total = 0;
+    ssize_t len;
+    while (total < 1 << 24 && (len = read(fds[0], buf, sizeof(buf))) > 0)
+        total += len;
+    assert(total == 1 << 24);
+    close(fds[0]);
+    close(fds[1]);
+}
+#endif
+
 int main(void)
 {
     cfunctions();
     sync_call();
     async_call();
+    execute_pending_jobs();
     async_call_stack_overflow();
     raw_context_global_var();
     is_array();
@@ -811,5 +1786,22 @@ int main(void)
     new_errors();
     global_object_prototype();
     slice_string_tocstring();
+    utf8_long_string();
+    gc_step();
+    gc_policy();
+    slab_alloc();
+    superinstruction_serde();
+    read_object_stream();
+    shared_atoms();
+    profiler();
+    heap_sampling();
+    heap_snapshot();
+    regexp_cache();
+    json_stringify_utf8();
+    function_list_shapes();
+#if JS_HAVE_THREADS && !defined(_WIN32) && !defined(__wasi__) && !defined(__EMSCRIPTEN__)
+    http_client();
+    async_io_teardown();
+#endif
     return 0;
 }
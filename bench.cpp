@@ -0,0 +1,791 @@
+//
+// 引擎级基准测试
+//
+// 用法: bench [-r 次数] [-w 次数] [-o 结果.json] [-b 基线.json] [-t 百分比] [-m microbench.js] [场景...]
+//
+// 每个场景重复执行若干次，输出中位数、p99 等统计值以及每次的平均分配次数（通过计数的
+// JSMallocFunctions 统计，只统计主运行时）。-b 与之前保存的结果比较，中位数或分配次数
+// 增加超过阈值时返回 1。-m 在同一进程中运行 tests/microbench.js，结果以 microbench. 为前缀。
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "QjsBinaryCodeExecutor.h"
+#include "QjsExecutorPool.h"
+#include "cutils.h"
+#include "qjs_bundle.h"
+#include <quickjs-libc.h>
+
+namespace {
+
+// 分配计数，作为 JSMallocFunctions 的 opaque 使用
+struct AllocStats {
+    uint64_t allocs = 0; // malloc/calloc 以及 realloc(nullptr, ...) 次数
+    uint64_t reallocs = 0; // 其余 realloc 次数
+    uint64_t frees = 0;
+    uint64_t bytes = 0; // 申请的总字节数
+
+    AllocStats operator-(const AllocStats &o) const {
+        return {allocs - o.allocs, reallocs - o.reallocs, frees - o.frees, bytes - o.bytes};
+    }
+
+    AllocStats &operator+=(const AllocStats &o) {
+        allocs += o.allocs;
+        reallocs += o.reallocs;
+        frees += o.frees;
+        bytes += o.bytes;
+        return *this;
+    }
+};
+
+void *countCalloc(void *opaque, size_t count, size_t size) {
+    auto *s = static_cast<AllocStats *>(opaque);
+    s->allocs++;
+    s->bytes += count * size;
+    return calloc(count, size);
+}
+
+void *countMalloc(void *opaque, size_t size) {
+    auto *s = static_cast<AllocStats *>(opaque);
+    s->allocs++;
+    s->bytes += size;
+    return malloc(size);
+}
+
+void countFree(void *opaque, void *ptr) {
+    if (!ptr)
+        return;
+    static_cast<AllocStats *>(opaque)->frees++;
+    free(ptr);
+}
+
+void *countRealloc(void *opaque, void *ptr, size_t size) {
+    auto *s = static_cast<AllocStats *>(opaque);
+    if (!ptr) {
+        s->allocs++;
+    } else if (size == 0) {
+        s->frees++;
+    } else {
+        s->reallocs++;
+    }
+    s->bytes += size;
+    return realloc(ptr, size);
+}
+
+const JSMallocFunctions countingMallocFunctions = {
+    countCalloc,
+    countMalloc,
+    countFree,
+    countRealloc,
+    js__malloc_usable_size
+};
+
+struct Options {
+    int reps = 0; // 0=使用场景的默认次数
+    int warmup = 3;
+    std::string output;
+    std::string baseline;
+    double threshold = 10; // 百分比
+    std::string microbench;
+    std::vector<std::string> filters;
+};
+
+// 一个场景（或一个 microbench 测试）的结果
+struct Result {
+    std::string name;
+    std::string unit = "us";
+    std::vector<double> samples;
+    AllocStats alloc; // 所有计时轮次的合计
+    bool counted = false; // alloc 是否有效
+    std::map<std::string, double> extra; // 场景相关的附加数据（大小、对象数等）
+};
+
+struct Summary {
+    double median, p99, min, max, mean;
+};
+
+// 最近秩法，保证结果是实际出现过的样本
+double percentile(const std::vector<double> &sorted, double p) {
+    size_t rank = static_cast<size_t>(p / 100 * static_cast<double>(sorted.size()) + 0.999999);
+    rank = std::clamp<size_t>(rank, 1, sorted.size());
+    return sorted[rank - 1];
+}
+
+Summary summarize(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    double sum = 0;
+    for (double x: v)
+        sum += x;
+    return {percentile(v, 50), percentile(v, 99), v.front(), v.back(), sum / static_cast<double>(v.size())};
+}
+
+class Stopwatch {
+public:
+    double elapsedUs() const {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+};
+
+[[noreturn]] void fail(const std::string &msg) {
+    fprintf(stderr, "bench: %s\n", msg.c_str());
+    exit(2);
+}
+
+void checkException(JSContext *ctx, JSValue val, const char *what) {
+    if (JS_IsException(val)) {
+        js_std_dump_error(ctx);
+        fail(std::string(what) + " failed");
+    }
+}
+
+// 预热 opt.warmup 次后计时 reps 次，body 返回本轮计时部分的耗时（微秒）。
+// 分配次数取 stats 在计时轮次中的增量，只想统计计时部分的场景自己累加到 stats
+template<class F>
+void repeat(Result &res, const Options &opt, int defaultReps, const AllocStats *stats, F &&body) {
+    const int reps = opt.reps > 0 ? opt.reps : defaultReps;
+    for (int i = 0; i < opt.warmup; i++)
+        body();
+    const AllocStats before = stats ? *stats : AllocStats{};
+    for (int i = 0; i < reps; i++)
+        res.samples.push_back(body());
+    if (stats) {
+        res.alloc = *stats - before;
+        res.counted = true;
+    }
+}
+
+std::string tempPath(const std::string &name) {
+    std::error_code ec;
+    std::filesystem::path dir = std::filesystem::temp_directory_path(ec);
+    if (ec)
+        dir = ".";
+    return (dir / ("qjs-bench-" + std::to_string(js__hrtime_ns() % 1000000007) + "-" + name)).string();
+}
+
+void writeFile(const std::string &path, const std::string &data) {
+    std::ofstream out(path, std::ios::binary);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    if (!out)
+        fail("cannot write " + path);
+}
+
+std::string jsonString(const std::string &s) {
+    std::string out = "\"";
+    for (unsigned char c: s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    return out + "\"";
+}
+
+std::string jsonNumber(double v) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3f", v);
+    return buf;
+}
+
+JSContext *newStdContext(JSRuntime *rt) {
+    JSContext *ctx = JS_NewContext(rt);
+    if (!ctx)
+        return nullptr;
+    js_init_module_std(ctx, "qjs:std");
+    js_init_module_os(ctx, "qjs:os");
+    return ctx;
+}
+
+// 生成一个较大的模块：函数、对象字面量、字符串常量和闭包，内容固定以保证可重复
+std::string makeModuleSource(int functions) {
+    std::ostringstream s;
+    for (int i = 0; i < functions; i++) {
+        s << "export function f" << i << "(a, b) {\n"
+          << "    const o = { id: " << i << ", name: \"item" << i << "\", values: [a, b, " << i << "] };\n"
+          << "    return o.values.map((v) => v * " << (i % 7 + 1) << ").join(\",\") + o.name;\n"
+          << "}\n";
+    }
+    s << "export const total = " << functions << ";\n";
+    return s.str();
+}
+
+std::vector<uint8_t> compileModule(JSContext *ctx, const std::string &source, const char *filename) {
+    JSValue obj = JS_Eval(ctx, source.c_str(), source.size(), filename,
+                          JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+    checkException(ctx, obj, "compile");
+    size_t size;
+    uint8_t *buf = JS_WriteObject(ctx, &size, obj, JS_WRITE_OBJ_BYTECODE);
+    // 未执行的模块归上下文所有，不能 JS_FreeValue
+    if (!buf)
+        fail("JS_WriteObject failed");
+    std::vector<uint8_t> out(buf, buf + size);
+    js_free(ctx, buf);
+    return out;
+}
+
+const std::vector<uint8_t> &bundleBytecode() {
+    static std::vector<uint8_t> bytecode;
+    if (bytecode.empty()) {
+        JSRuntime *rt = JS_NewRuntime();
+        JSContext *ctx = JS_NewContext(rt);
+        bytecode = compileModule(ctx, makeModuleSource(2000), "bench_bundle.js");
+        JS_FreeContext(ctx);
+        JS_FreeRuntime(rt);
+    }
+    return bytecode;
+}
+
+void benchRuntimeNew(const Options &opt, Result &res) {
+    AllocStats stats;
+    repeat(res, opt, 200, &stats, [&] {
+        Stopwatch sw;
+        JSRuntime *rt = JS_NewRuntime2(&countingMallocFunctions, &stats);
+        JS_FreeRuntime(rt);
+        return sw.elapsedUs();
+    });
+}
+
+void benchContextNew(const Options &opt, Result &res) {
+    AllocStats stats;
+    JSRuntime *rt = JS_NewRuntime2(&countingMallocFunctions, &stats);
+    repeat(res, opt, 200, &stats, [&] {
+        Stopwatch sw;
+        JSContext *ctx = JS_NewContext(rt);
+        JS_FreeContext(ctx);
+        return sw.elapsedUs();
+    });
+    JS_FreeRuntime(rt);
+}
+
+void benchBundleRead(const Options &opt, Result &res) {
+    const std::vector<uint8_t> &bytecode = bundleBytecode();
+    AllocStats stats, timed; // 上下文的创建和释放不计入 timed
+    JSRuntime *rt = JS_NewRuntime2(&countingMallocFunctions, &stats);
+    repeat(res, opt, 50, &timed, [&] {
+        JSContext *ctx = JS_NewContext(rt);
+        const AllocStats before = stats;
+        Stopwatch sw;
+        JSValue obj = JS_ReadObject(ctx, bytecode.data(), bytecode.size(), JS_READ_OBJ_BYTECODE);
+        const double us = sw.elapsedUs();
+        timed += stats - before;
+        checkException(ctx, obj, "JS_ReadObject");
+        JS_FreeContext(ctx);
+        return us;
+    });
+    JS_FreeRuntime(rt);
+    res.extra["bytes"] = static_cast<double>(bytecode.size());
+}
+
+// 旧的扁平格式：字节码版本 + [load_only][length][data]
+std::string legacyBundle() {
+    const std::vector<uint8_t> &bytecode = bundleBytecode();
+    std::string bundle;
+    uint32_t bcVersion = QJS_BUNDLE_BC_VERSION;
+    uint8_t loadOnly = 0;
+    uint64_t length = bytecode.size();
+    bundle.append(reinterpret_cast<const char *>(&bcVersion), sizeof(bcVersion));
+    bundle.append(reinterpret_cast<const char *>(&loadOnly), sizeof(loadOnly));
+    bundle.append(reinterpret_cast<const char *>(&length), sizeof(length));
+    bundle.append(bytecode.begin(), bytecode.end());
+    return bundle;
+}
+
+void benchExecutorColdStart(const Options &opt, Result &res) {
+    const std::string bundle = legacyBundle();
+    const std::string path = tempPath("bundle.bin");
+    writeFile(path, bundle);
+
+    AllocStats stats;
+    // 计时包括构造、加载、执行和析构
+    repeat(res, opt, 30, &stats, [&] {
+        Stopwatch sw;
+        {
+            QjsBinaryCodeExecutor executor;
+            executor.setEntryFile(path);
+            executor.setMallocFunctions(&countingMallocFunctions, &stats);
+            executor.onError([](JSRuntime *, JSContext *, const std::string &err) { fail(err); });
+            executor.onJsError([](JSRuntime *, JSContext *, const std::string &name, const std::string &msg,
+                                  const std::string &) { fail(name + ": " + msg); });
+            if (executor.execute() != 0)
+                fail("executor returned an error");
+        }
+        return sw.elapsedUs();
+    });
+    std::filesystem::remove(path);
+    res.extra["bytes"] = static_cast<double>(bundle.size());
+}
+
+// JS 模式启动：入口文件 import 与 bundle_read 相同的模块源代码，cached=true 时使用字节码缓存
+void runJsStart(const Options &opt, Result &res, bool cached) {
+    namespace fs = std::filesystem;
+    const fs::path dir = tempPath(cached ? "js-cached" : "js-source");
+    fs::create_directories(dir);
+    writeFile((dir / "lib.js").string(), makeModuleSource(2000));
+    writeFile((dir / "main.js").string(), "import { total, f0 } from \"./lib.js\";\n"
+                                          "if (total !== 2000 || f0(1, 2) !== \"1,2,0item0\") throw new Error(\"bad\");\n");
+    const std::string cacheDir = (dir / "cache").string();
+
+    AllocStats stats;
+    // 计时包括构造、编译（或读取缓存）、执行和析构；预热的第一次执行写入缓存
+    repeat(res, opt, 30, &stats, [&] {
+        Stopwatch sw;
+        {
+            QjsBinaryCodeExecutor executor;
+            executor.setExecutionMode(ExecutionMode::JS);
+            executor.setEntryFile((dir / "main.js").string());
+            if (cached)
+                executor.setCodeCacheDir(cacheDir);
+            executor.setMallocFunctions(&countingMallocFunctions, &stats);
+            executor.onError([](JSRuntime *, JSContext *, const std::string &err) { fail(err); });
+            executor.onJsError([](JSRuntime *, JSContext *, const std::string &name, const std::string &msg,
+                                  const std::string &) { fail(name + ": " + msg); });
+            if (executor.execute() != 0)
+                fail("executor returned an error");
+        }
+        return sw.elapsedUs();
+    });
+    if (cached) {
+        size_t entries = 0;
+        for (const auto &e: fs::directory_iterator(cacheDir))
+            entries += e.path().extension() == ".qjsc";
+        if (entries != 2)
+            fail("expected 2 code cache entries, got " + std::to_string(entries));
+    }
+    fs::remove_all(dir);
+}
+
+void benchJsSourceStart(const Options &opt, Result &res) {
+    runJsStart(opt, res, false);
+}
+
+void benchJsCachedStart(const Options &opt, Result &res) {
+    runJsStart(opt, res, true);
+}
+
+void benchPoolWarmRun(const Options &opt, Result &res) {
+    const std::string bundle = legacyBundle();
+    const std::string path = tempPath("bundle.bin");
+    writeFile(path, bundle);
+
+    AllocStats stats;
+    QjsBinaryCodeExecutor executor;
+    executor.setEntryFile(path);
+    executor.setMallocFunctions(&countingMallocFunctions, &stats);
+    executor.onError([](JSRuntime *, JSContext *, const std::string &err) { fail(err); });
+    executor.onJsError([](JSRuntime *, JSContext *, const std::string &name, const std::string &msg,
+                          const std::string &) { fail(name + ": " + msg); });
+    QjsExecutorPool pool(executor, 1);
+    // 与 executor_cold_start 相同的模块，只计时执行，归还时的重置不计时（分配次数包括重置）
+    repeat(res, opt, 30, &stats, [&] {
+        QjsExecutorPool::Lease lease = pool.acquire();
+        Stopwatch sw;
+        if (!lease || lease.execute() != 0)
+            fail("pool returned an error");
+        return sw.elapsedUs();
+    });
+    std::filesystem::remove(path);
+}
+
+void benchGcPause(const Options &opt, Result &res) {
+    AllocStats stats, timed;
+    JSRuntime *rt = JS_NewRuntime2(&countingMallocFunctions, &stats);
+    JSContext *ctx = JS_NewContext(rt);
+    // 只测量 JS_RunGC，避免分配过程中自动触发
+    JS_SetGCThreshold(rt, static_cast<size_t>(-1));
+    static const char live[] =
+        "globalThis.live = [];\n"
+        "for (let i = 0; i < 100000; i++) {\n"
+        "    const o = { id: i, name: 'o' + i, next: null };\n"
+        "    o.self = o;\n"
+        "    if (i > 0) live[i - 1].next = o;\n"
+        "    live.push(o);\n"
+        "}\n";
+    static const char garbage[] =
+        "for (let i = 0; i < 20000; i++) {\n"
+        "    const a = { i }, b = { a };\n"
+        "    a.b = b;\n"
+        "}\n";
+    checkException(ctx, JS_Eval(ctx, live, sizeof(live) - 1, "<live>", JS_EVAL_TYPE_GLOBAL), "eval");
+    JS_RunGC(rt);
+    repeat(res, opt, 50, &timed, [&] {
+        JSValue val = JS_Eval(ctx, garbage, sizeof(garbage) - 1, "<garbage>", JS_EVAL_TYPE_GLOBAL);
+        checkException(ctx, val, "eval");
+        JS_FreeValue(ctx, val);
+        const AllocStats before = stats;
+        Stopwatch sw;
+        JS_RunGC(rt);
+        const double us = sw.elapsedUs();
+        timed += stats - before;
+        return us;
+    });
+    JSMemoryUsage mu;
+    JS_ComputeMemoryUsage(rt, &mu);
+    res.extra["live_objects"] = static_cast<double>(mu.obj_count);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+double toNumber(JSContext *ctx, JSValueConst val) {
+    double d = 0;
+    JS_ToFloat64(ctx, &d, val);
+    return d;
+}
+
+void benchWorkerRoundTrip(const Options &opt, Result &res) {
+    const std::string workerPath = tempPath("worker.mjs");
+    writeFile(workerPath,
+              "import * as os from 'qjs:os';\n"
+              "const parent = os.Worker.parent;\n"
+              "parent.onmessage = (e) => {\n"
+              "    if (e.data === null)\n"
+              "        parent.onmessage = null;\n"
+              "    else\n"
+              "        parent.postMessage(e.data);\n"
+              "};\n");
+    const int reps = opt.reps > 0 ? opt.reps : 1000;
+    // os.now() 的单位是微秒；每次往返一条消息，前 warmup 次不计
+    std::string source =
+        "import * as os from 'qjs:os';\n"
+        "const worker = new os.Worker(" + jsonString(workerPath) + ");\n"
+        "const warmup = " + std::to_string(opt.warmup) + ", reps = " + std::to_string(reps) + ";\n"
+        "const samples = [];\n"
+        "let n = 0, t0;\n"
+        "function send() {\n"
+        "    t0 = os.now();\n"
+        "    worker.postMessage({ seq: n, payload: 'ping' });\n"
+        "}\n"
+        "worker.onmessage = () => {\n"
+        "    const t = os.now() - t0;\n"
+        "    if (n++ >= warmup)\n"
+        "        samples.push(t);\n"
+        "    if (samples.length < reps) {\n"
+        "        send();\n"
+        "    } else {\n"
+        "        worker.postMessage(null);\n"
+        "        worker.onmessage = null;\n"
+        "        globalThis.benchSamples = samples;\n"
+        "    }\n"
+        "};\n"
+        "send();\n";
+
+    AllocStats stats;
+    JSRuntime *rt = JS_NewRuntime2(&countingMallocFunctions, &stats);
+    js_std_init_handlers(rt);
+    JS_SetModuleLoaderFunc(rt, nullptr, js_module_loader, nullptr);
+    // QjsBinaryCodeExecutor 会把 Worker 回调设成它自己，这里换回来
+    js_std_set_worker_new_context_func(newStdContext);
+    JSContext *ctx = newStdContext(rt);
+    JSValue val = JS_Eval(ctx, source.c_str(), source.size(), "<worker_roundtrip>", JS_EVAL_TYPE_MODULE);
+    checkException(ctx, val, "eval");
+    val = js_std_await(ctx, val);
+    checkException(ctx, val, "eval");
+    JS_FreeValue(ctx, val);
+    if (js_std_loop(ctx) != 0)
+        fail("worker_roundtrip failed");
+
+    JSValue global = JS_GetGlobalObject(ctx);
+    JSValue samples = JS_GetPropertyStr(ctx, global, "benchSamples");
+    int64_t len = 0;
+    JS_GetLength(ctx, samples, &len);
+    for (int64_t i = 0; i < len; i++) {
+        JSValue v = JS_GetPropertyInt64(ctx, samples, i);
+        res.samples.push_back(toNumber(ctx, v));
+        JS_FreeValue(ctx, v);
+    }
+    JS_FreeValue(ctx, samples);
+    JS_FreeValue(ctx, global);
+    // 一次运行中的所有消息，近似为每次往返的分配
+    res.alloc = stats;
+    res.counted = true;
+    js_std_free_handlers(rt);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+    std::filesystem::remove(workerPath);
+    if (res.samples.empty())
+        fail("worker_roundtrip produced no samples");
+}
+
+JSValue jsLogToStderr(JSContext *ctx, JSValueConst, int argc, JSValueConst *argv) {
+    for (int i = 0; i < argc; i++) {
+        const char *str = JS_ToCString(ctx, argv[i]);
+        if (!str)
+            return JS_EXCEPTION;
+        fprintf(stderr, i ? " %s" : "%s", str);
+        JS_FreeCString(ctx, str);
+    }
+    fputc('\n', stderr);
+    return JS_UNDEFINED;
+}
+
+// 在进程内运行 tests/microbench.js，表格输出到 stderr，结果通过 -o 写入的 JSON 文件读回
+void runMicrobench(const Options &opt, std::vector<Result> &results) {
+    const std::string outPath = tempPath("microbench.json");
+    std::vector<std::string> args = {opt.microbench, "-o", outPath};
+    std::vector<char *> argv;
+    for (auto &a: args)
+        argv.push_back(a.data());
+
+    AllocStats stats;
+    JSRuntime *rt = JS_NewRuntime2(&countingMallocFunctions, &stats);
+    js_std_init_handlers(rt);
+    JS_SetModuleLoaderFunc(rt, nullptr, js_module_loader, nullptr);
+    JSContext *ctx = newStdContext(rt);
+    js_std_add_helpers(ctx, static_cast<int>(argv.size()), argv.data());
+    JSValue global = JS_GetGlobalObject(ctx);
+    JSValue console = JS_GetPropertyStr(ctx, global, "console");
+    JS_SetPropertyStr(ctx, console, "log", JS_NewCFunction(ctx, jsLogToStderr, "log", 1));
+    JS_FreeValue(ctx, console);
+    JS_FreeValue(ctx, global);
+
+    size_t len;
+    uint8_t *buf = js_load_file(ctx, &len, opt.microbench.c_str());
+    if (!buf)
+        fail("cannot read " + opt.microbench);
+    JSValue val = JS_Eval(ctx, reinterpret_cast<const char *>(buf), len, opt.microbench.c_str(),
+                          JS_EVAL_TYPE_MODULE);
+    js_free(ctx, buf);
+    checkException(ctx, val, "microbench");
+    val = js_std_await(ctx, val);
+    checkException(ctx, val, "microbench");
+    JS_FreeValue(ctx, val);
+    js_std_loop(ctx);
+
+    buf = js_load_file(ctx, &len, outPath.c_str());
+    if (!buf)
+        fail("microbench did not write its results");
+    JSValue obj = JS_ParseJSON(ctx, reinterpret_cast<const char *>(buf), len, outPath.c_str());
+    js_free(ctx, buf);
+    checkException(ctx, obj, "JSON.parse");
+    JSPropertyEnum *props;
+    uint32_t count;
+    if (JS_GetOwnPropertyNames(ctx, &props, &count, obj, JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY) == 0) {
+        for (uint32_t i = 0; i < count; i++) {
+            const char *name = JS_AtomToCString(ctx, props[i].atom);
+            JSValue v = JS_GetProperty(ctx, obj, props[i].atom);
+            Result res;
+            res.name = std::string("microbench.") + name;
+            res.unit = "ns";
+            res.samples.push_back(toNumber(ctx, v));
+            results.push_back(std::move(res));
+            JS_FreeValue(ctx, v);
+            JS_FreeCString(ctx, name);
+        }
+        JS_FreePropertyEnum(ctx, props, count);
+    }
+    JS_FreeValue(ctx, obj);
+    js_std_free_handlers(rt);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+    std::filesystem::remove(outPath);
+}
+
+struct Scenario {
+    const char *name;
+    void (*run)(const Options &, Result &);
+};
+
+const Scenario scenarios[] = {
+    {"runtime_new", benchRuntimeNew},
+    {"context_new", benchContextNew},
+    {"bundle_read", benchBundleRead},
+    {"executor_cold_start", benchExecutorColdStart},
+    {"js_source_start", benchJsSourceStart},
+    {"js_cached_start", benchJsCachedStart},
+    {"pool_warm_run", benchPoolWarmRun},
+    {"gc_pause", benchGcPause},
+    {"worker_roundtrip", benchWorkerRoundTrip},
+};
+
+bool selected(const Options &opt, const std::string &name) {
+    if (opt.filters.empty())
+        return true;
+    return std::any_of(opt.filters.begin(), opt.filters.end(),
+                       [&](const std::string &f) { return name.rfind(f, 0) == 0; });
+}
+
+std::string toJson(const Options &opt, const std::vector<Result> &results) {
+    std::ostringstream s;
+    s << "{\n  \"version\": 1,\n  \"warmup\": " << opt.warmup << ",\n  \"results\": {";
+    const char *sep = "\n";
+    for (const Result &res: results) {
+        Summary sum = summarize(res.samples);
+        const double reps = static_cast<double>(res.samples.size());
+        s << sep << "    " << jsonString(res.name) << ": {\"unit\": " << jsonString(res.unit)
+          << ", \"reps\": " << res.samples.size()
+          << ", \"median\": " << jsonNumber(sum.median) << ", \"p99\": " << jsonNumber(sum.p99)
+          << ", \"min\": " << jsonNumber(sum.min) << ", \"max\": " << jsonNumber(sum.max)
+          << ", \"mean\": " << jsonNumber(sum.mean);
+        if (res.counted) {
+            s << ", \"allocs\": " << jsonNumber(static_cast<double>(res.alloc.allocs) / reps)
+              << ", \"reallocs\": " << jsonNumber(static_cast<double>(res.alloc.reallocs) / reps)
+              << ", \"frees\": " << jsonNumber(static_cast<double>(res.alloc.frees) / reps)
+              << ", \"alloc_bytes\": " << jsonNumber(static_cast<double>(res.alloc.bytes) / reps);
+        }
+        for (const auto &[key, value]: res.extra)
+            s << ", " << jsonString(key) << ": " << jsonNumber(value);
+        s << "}";
+        sep = ",\n";
+    }
+    s << "\n  }\n}\n";
+    return s.str();
+}
+
+struct BaselineEntry {
+    double median = 0;
+    double allocs = -1; // -1=没有分配统计
+};
+
+std::map<std::string, BaselineEntry> loadBaseline(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        fail("cannot read " + path);
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::map<std::string, BaselineEntry> out;
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    JSValue obj = JS_ParseJSON(ctx, text.c_str(), text.size(), path.c_str());
+    checkException(ctx, obj, "JSON.parse");
+    JSValue results = JS_GetPropertyStr(ctx, obj, "results");
+    JSPropertyEnum *props;
+    uint32_t count;
+    if (JS_IsObject(results) &&
+        JS_GetOwnPropertyNames(ctx, &props, &count, results, JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY) == 0) {
+        for (uint32_t i = 0; i < count; i++) {
+            const char *name = JS_AtomToCString(ctx, props[i].atom);
+            JSValue entry = JS_GetProperty(ctx, results, props[i].atom);
+            JSValue median = JS_GetPropertyStr(ctx, entry, "median");
+            JSValue allocs = JS_GetPropertyStr(ctx, entry, "allocs");
+            BaselineEntry e;
+            e.median = toNumber(ctx, median);
+            if (JS_IsNumber(allocs))
+                e.allocs = toNumber(ctx, allocs);
+            out[name] = e;
+            JS_FreeValue(ctx, allocs);
+            JS_FreeValue(ctx, median);
+            JS_FreeValue(ctx, entry);
+            JS_FreeCString(ctx, name);
+        }
+        JS_FreePropertyEnum(ctx, props, count);
+    }
+    JS_FreeValue(ctx, results);
+    JS_FreeValue(ctx, obj);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+    return out;
+}
+
+// 打印对比表，返回回归的数量
+int compareBaseline(const Options &opt, const std::vector<Result> &results) {
+    const std::map<std::string, BaselineEntry> baseline = loadBaseline(opt.baseline);
+    int regressions = 0;
+    fprintf(stderr, "%-32s %12s %12s %8s %10s\n", "TEST", "BASE", "NEW", "TIME", "ALLOCS");
+    for (const Result &res: results) {
+        auto it = baseline.find(res.name);
+        if (it == baseline.end())
+            continue;
+        const double median = summarize(res.samples).median;
+        const double timeDelta = it->second.median > 0 ? (median / it->second.median - 1) * 100 : 0;
+        bool regressed = timeDelta > opt.threshold;
+        char allocText[16] = "-";
+        if (res.counted && it->second.allocs >= 0) {
+            const double allocs = static_cast<double>(res.alloc.allocs) / static_cast<double>(res.samples.size());
+            const double allocDelta = it->second.allocs > 0 ? (allocs / it->second.allocs - 1) * 100 : 0;
+            snprintf(allocText, sizeof(allocText), "%+.1f%%", allocDelta);
+            regressed |= allocDelta > opt.threshold;
+        }
+        fprintf(stderr, "%-32s %12.3f %12.3f %+7.1f%% %10s%s\n", res.name.c_str(), it->second.median, median,
+                timeDelta, allocText, regressed ? "  REGRESSION" : "");
+        regressions += regressed;
+    }
+    return regressions;
+}
+
+void usage() {
+    fprintf(stderr,
+            "usage: bench [options] [scenario...]\n"
+            "  -r n       repetitions per scenario (default: per scenario)\n"
+            "  -w n       warmup iterations (default: 3)\n"
+            "  -o file    write the JSON results to file instead of stdout\n"
+            "  -b file    compare against a baseline JSON file, exit with 1 on regression\n"
+            "  -t pct     regression threshold in percent (default: 10)\n"
+            "  -m file    also run tests/microbench.js\n"
+            "scenarios:");
+    for (const Scenario &sc: scenarios)
+        fprintf(stderr, " %s", sc.name);
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        auto value = [&]() -> const char * {
+            if (++i >= argc)
+                usage();
+            return argv[i];
+        };
+        if (arg == "-r") {
+            opt.reps = atoi(value());
+        } else if (arg == "-w") {
+            opt.warmup = atoi(value());
+        } else if (arg == "-o") {
+            opt.output = value();
+        } else if (arg == "-b") {
+            opt.baseline = value();
+        } else if (arg == "-t") {
+            opt.threshold = atof(value());
+        } else if (arg == "-m") {
+            opt.microbench = value();
+        } else if (arg.empty() || arg[0] == '-') {
+            usage();
+        } else {
+            opt.filters.push_back(arg);
+        }
+    }
+
+    std::vector<Result> results;
+    for (const Scenario &sc: scenarios) {
+        if (!selected(opt, sc.name))
+            continue;
+        fprintf(stderr, "running %s\n", sc.name);
+        Result res;
+        res.name = sc.name;
+        sc.run(opt, res);
+        results.push_back(std::move(res));
+    }
+    if (!opt.microbench.empty())
+        runMicrobench(opt, results);
+
+    const std::string json = toJson(opt, results);
+    if (opt.output.empty())
+        fputs(json.c_str(), stdout);
+    else
+        writeFile(opt.output, json);
+
+    if (!opt.baseline.empty() && compareBaseline(opt, results) > 0)
+        return 1;
+    return 0;
+}
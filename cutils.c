@@ -41,6 +41,14 @@
 
 #include "cutils.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UTF8_USE_SSE2
+#elif (defined(__aarch64__) && defined(__ARM_NEON)) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define UTF8_USE_NEON
+#endif
+
 #undef NANOSEC
 #define NANOSEC ((uint64_t) 1e9)
 
@@ -393,6 +401,166 @@ uint32_t utf8_decode_len(const uint8_t *p, size_t max_len, const uint8_t **pp) {
     return 0xFFFD;
 }
 
+/*---- ASCII runs ----*/
+
+/* The UTF-8 routines below spend most of their time on runs of 7-bit
+   ASCII characters. These helpers process such runs in blocks of 16 to
+   64 bytes with the SIMD instructions that are always available on the
+   target (SSE2 on x86-64, NEON on AArch64) and 8 bytes at a time elsewhere.
+   Each returns the length of the ASCII prefix of `src[0..len)` and
+   copies it to `dest` (which can be null for the scan-only variant).
+   Bytes past the prefix are never stored.
+ */
+#define ASCII_MASK64    UINT64_C(0x8080808080808080)
+#define ASCII_MASK64_16 UINT64_C(0xFF80FF80FF80FF80)
+
+static size_t ascii_run8(uint8_t *dest, const uint8_t *src, size_t len)
+{
+    size_t i = 0;
+#if defined(UTF8_USE_SSE2)
+    for (; i + 64 <= len; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(src + i + 48));
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))))
+            break;
+        if (dest) {
+            _mm_storeu_si128((__m128i *)(dest + i), a);
+            _mm_storeu_si128((__m128i *)(dest + i + 16), b);
+            _mm_storeu_si128((__m128i *)(dest + i + 32), c);
+            _mm_storeu_si128((__m128i *)(dest + i + 48), d);
+        }
+    }
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        int mask = _mm_movemask_epi8(a);
+        if (mask) {
+            len = i + ctz32(mask);
+            break;
+        }
+        if (dest)
+            _mm_storeu_si128((__m128i *)(dest + i), a);
+    }
+#elif defined(UTF8_USE_NEON)
+    for (; i + 64 <= len; i += 64) {
+        uint8x16_t a = vld1q_u8(src + i);
+        uint8x16_t b = vld1q_u8(src + i + 16);
+        uint8x16_t c = vld1q_u8(src + i + 32);
+        uint8x16_t d = vld1q_u8(src + i + 48);
+        if (vmaxvq_u8(vorrq_u8(vorrq_u8(a, b), vorrq_u8(c, d))) >= 0x80)
+            break;
+        if (dest) {
+            vst1q_u8(dest + i, a);
+            vst1q_u8(dest + i + 16, b);
+            vst1q_u8(dest + i + 32, c);
+            vst1q_u8(dest + i + 48, d);
+        }
+    }
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t a = vld1q_u8(src + i);
+        if (vmaxvq_u8(a) >= 0x80)
+            break;
+        if (dest)
+            vst1q_u8(dest + i, a);
+    }
+#endif
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v = get_u64(src + i);
+        if (v & ASCII_MASK64)
+            break;
+        if (dest)
+            put_u64(dest + i, v);
+    }
+    for (; i < len && src[i] < 0x80; i++) {
+        if (dest)
+            dest[i] = src[i];
+    }
+    return i;
+}
+
+/* widen an ASCII run to 16-bit code units */
+static size_t ascii_run_widen(uint16_t *dest, const uint8_t *src, size_t len)
+{
+    size_t i = 0, n;
+#if defined(UTF8_USE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        if (_mm_movemask_epi8(a))
+            break;
+        _mm_storeu_si128((__m128i *)(dest + i), _mm_unpacklo_epi8(a, zero));
+        _mm_storeu_si128((__m128i *)(dest + i + 8), _mm_unpackhi_epi8(a, zero));
+    }
+#elif defined(UTF8_USE_NEON)
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t a = vld1q_u8(src + i);
+        if (vmaxvq_u8(a) >= 0x80)
+            break;
+        vst1q_u16(dest + i, vmovl_u8(vget_low_u8(a)));
+        vst1q_u16(dest + i + 8, vmovl_high_u8(a));
+    }
+#endif
+    for (; i + 8 <= len; i += 8) {
+        if (get_u64(src + i) & ASCII_MASK64)
+            break;
+        for (n = 0; n < 8; n++)
+            dest[i + n] = src[i + n];
+    }
+    for (; i < len && src[i] < 0x80; i++)
+        dest[i] = src[i];
+    return i;
+}
+
+/* narrow a run of 16-bit code units below 0x80 to bytes */
+static size_t ascii_run_narrow(uint8_t *dest, const uint16_t *src, size_t len)
+{
+    size_t i = 0, n;
+#if defined(UTF8_USE_SSE2)
+    const __m128i mask = _mm_set1_epi16((short)0xFF80);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 8));
+        __m128i hi = _mm_and_si128(_mm_or_si128(a, b), mask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(hi, zero)) != 0xFFFF)
+            break;
+        _mm_storeu_si128((__m128i *)(dest + i), _mm_packus_epi16(a, b));
+    }
+#elif defined(UTF8_USE_NEON)
+    for (; i + 16 <= len; i += 16) {
+        uint16x8_t a = vld1q_u16(src + i);
+        uint16x8_t b = vld1q_u16(src + i + 8);
+        if (vmaxvq_u16(vorrq_u16(a, b)) >= 0x80)
+            break;
+        vst1q_u8(dest + i, vcombine_u8(vmovn_u16(a), vmovn_u16(b)));
+    }
+#endif
+    for (; i + 4 <= len; i += 4) {
+        if (get_u64((const uint8_t *)(src + i)) & ASCII_MASK64_16)
+            break;
+        for (n = 0; n < 4; n++)
+            dest[i + n] = src[i + n];
+    }
+    for (; i < len && src[i] < 0x80; i++)
+        dest[i] = src[i];
+    return i;
+}
+
+/* The run of ASCII characters at `p` is long enough to be worth
+   calling the block routines above. Shorter runs are handled by the per
+   code point loops: a failed check means the run ends within 8 units.
+ */
+static inline bool ascii_block8(const uint8_t *p, const uint8_t *p_end)
+{
+    return p_end - p >= 8 && !(get_u64(p) & ASCII_MASK64);
+}
+
+static inline bool ascii_block16(const uint16_t *p, const uint16_t *p_end)
+{
+    return p_end - p >= 4 && !(get_u64((const uint8_t *)p) & ASCII_MASK64_16);
+}
+
 /* Scan a UTF-8 encoded buffer for content type
    `buf` is a valid pointer to a UTF-8 encoded string
    `len` is the number of bytes to scan
@@ -407,35 +575,39 @@ uint32_t utf8_decode_len(const uint8_t *p, size_t max_len, const uint8_t **pp) {
 int utf8_scan(const char *buf, size_t buf_len, size_t *plen)
 {
     const uint8_t *p, *p_end, *p_next;
-    size_t i, len;
+    size_t len, n;
     int kind;
-    uint8_t cbits;
 
     kind = UTF8_PLAIN_ASCII;
-    cbits = 0;
-    len = buf_len;
-    // TODO: handle more than 1 byte at a time
-    for (i = 0; i < buf_len; i++)
-        cbits |= buf[i];
-    if (cbits >= 0x80) {
-        p = (const uint8_t *)buf;
-        p_end = p + buf_len;
+    len = ascii_run8(NULL, (const uint8_t *)buf, buf_len);
+    if (len < buf_len) {
+        p = (const uint8_t *)buf + len;
+        p_end = (const uint8_t *)buf + buf_len;
         kind = UTF8_NON_ASCII;
-        len = 0;
         while (p < p_end) {
+            if (*p < 0x80) {
+                /* skip a run of ASCII bytes */
+                if (ascii_block8(p, p_end)) {
+                    n = ascii_run8(NULL, p, p_end - p);
+                } else {
+                    for (n = 1; p + n < p_end && p[n] < 0x80; n++)
+                        continue;
+                }
+                p += n;
+                len += n;
+                continue;
+            }
+            /* parse UTF-8 sequence, check for encoding error */
+            uint32_t c = utf8_decode_len(p, p_end - p, &p_next);
+            if (p_next == p + 1)
+                kind |= UTF8_HAS_ERRORS;
+            p = p_next;
             len++;
-            if (*p++ >= 0x80) {
-                /* parse UTF-8 sequence, check for encoding error */
-                uint32_t c = utf8_decode_len(p - 1, p_end - (p - 1), &p_next);
-                if (p_next == p)
-                    kind |= UTF8_HAS_ERRORS;
-                p = p_next;
-                if (c > 0xFF) {
-                    kind |= UTF8_HAS_16BIT;
-                    if (c > 0xFFFF) {
-                        len++;
-                        kind |= UTF8_HAS_NON_BMP1;
-                    }
+            if (c > 0xFF) {
+                kind |= UTF8_HAS_16BIT;
+                if (c > 0xFFFF) {
+                    len++;
+                    kind |= UTF8_HAS_NON_BMP1;
                 }
             }
         }
@@ -455,14 +627,25 @@ int utf8_scan(const char *buf, size_t buf_len, size_t *plen)
 size_t utf8_decode_buf8(uint8_t *dest, size_t dest_len, const char *src, size_t src_len)
 {
     const uint8_t *p, *p_end;
-    size_t i;
+    size_t i, n;
 
     p = (const uint8_t *)src;
     p_end = p + src_len;
     for (i = 0; p < p_end; i++) {
         uint32_t c = *p++;
-        if (c >= 0xC0)
+        if (c >= 0xC0) {
             c = (c << 6) + *p++ - ((0xC0 << 6) + 0x80);
+        } else if (ascii_block8(p - 1, p_end)) {
+            /* copy a run of ASCII bytes */
+            p--;
+            if (i < dest_len)
+                n = ascii_run8(dest + i, p, min_size_t(p_end - p, dest_len - i));
+            else
+                n = ascii_run8(NULL, p, p_end - p);
+            p += n;
+            i += n - 1;
+            continue;
+        }
         if (i < dest_len)
             dest[i] = c;
     }
@@ -482,8 +665,8 @@ size_t utf8_decode_buf8(uint8_t *dest, size_t dest_len, const char *src, size_t
  */
 size_t utf8_decode_buf16(uint16_t *dest, size_t dest_len, const char *src, size_t src_len)
 {
-    const uint8_t *p, *p_end;
-    size_t i;
+    const uint8_t *p, *p_end, *p_next;
+    size_t i, n;
 
     p = (const uint8_t *)src;
     p_end = p + src_len;
@@ -491,7 +674,8 @@ size_t utf8_decode_buf16(uint16_t *dest, size_t dest_len, const char *src, size_
         uint32_t c = *p++;
         if (c >= 0x80) {
             /* parse utf-8 sequence */
-            c = utf8_decode_len(p - 1, p_end - (p - 1), &p);
+            c = utf8_decode_len(p - 1, p_end - (p - 1), &p_next);
+            p = p_next;
             /* encoding errors are converted as 0xFFFD and use a single byte */
             if (c > 0xFFFF) {
                 if (i < dest_len)
@@ -499,6 +683,24 @@ size_t utf8_decode_buf16(uint16_t *dest, size_t dest_len, const char *src, size_
                 i++;
                 c = get_lo_surrogate(c);
             }
+        } else if (ascii_block8(p - 1, p_end)) {
+            /* copy a run of ASCII bytes */
+            p--;
+            if (i < dest_len)
+                n = ascii_run_widen(dest + i, p, min_size_t(p_end - p, dest_len - i));
+            else
+                n = ascii_run8(NULL, p, p_end - p);
+            p += n;
+            i += n - 1;
+            continue;
+        } else {
+            /* short run of ASCII bytes */
+            while (p < p_end && *p < 0x80) {
+                if (i < dest_len)
+                    dest[i] = c;
+                i++;
+                c = *p++;
+            }
         }
         if (i < dest_len)
             dest[i] = c;
@@ -515,7 +717,7 @@ size_t utf8_decode_buf16(uint16_t *dest, size_t dest_len, const char *src, size_
  */
 size_t utf8_encode_buf8(char *dest, size_t dest_len, const uint8_t *src, size_t src_len)
 {
-    size_t i, j;
+    size_t i, j, n;
     uint32_t c;
 
     for (i = j = 0; i < src_len; i++) {
@@ -523,7 +725,14 @@ size_t utf8_encode_buf8(char *dest, size_t dest_len, const uint8_t *src, size_t
         if (c < 0x80) {
             if (j + 1 >= dest_len)
                 goto overflow;
-            dest[j++] = c;
+            if (!ascii_block8(src + i, src + src_len)) {
+                dest[j++] = c;
+                continue;
+            }
+            n = ascii_run8((uint8_t *)dest + j, src + i,
+                           min_size_t(src_len - i, dest_len - 1 - j));
+            i += n - 1;
+            j += n;
         } else {
             if (j + 2 >= dest_len)
                 goto overflow;
@@ -552,7 +761,7 @@ overflow:
  */
 size_t utf8_encode_buf16(char *dest, size_t dest_len, const uint16_t *src, size_t src_len)
 {
-    size_t i, j;
+    size_t i, j, n;
     uint32_t c;
 
     for (i = j = 0; i < src_len;) {
@@ -560,7 +769,15 @@ size_t utf8_encode_buf16(char *dest, size_t dest_len, const uint16_t *src, size_
         if (c < 0x80) {
             if (j + 1 >= dest_len)
                 goto overflow;
-            dest[j++] = c;
+            if (!ascii_block16(src + i - 1, src + src_len)) {
+                dest[j++] = c;
+                continue;
+            }
+            i--;
+            n = ascii_run_narrow((uint8_t *)dest + j, src + i,
+                                 min_size_t(src_len - i, dest_len - 1 - j));
+            i += n;
+            j += n;
         } else {
             if (is_hi_surrogate(c) && i < src_len && is_lo_surrogate(src[i]))
                 c = from_surrogate(c, src[i++]);
@@ -191,6 +191,14 @@ static inline int64_t min_int64(int64_t a, int64_t b)
         return b;
 }
 
+static inline size_t min_size_t(size_t a, size_t b)
+{
+    if (a < b)
+        return a;
+    else
+        return b;
+}
+
 /* WARNING: undefined if a = 0 */
 static inline int clz32(unsigned int a)
 {
@@ -109,6 +109,20 @@ static const REOpCode reopcode_info[REOP_COUNT] = {
 
 #define RE_HEADER_LEN 8
 
+/* With LRE_FLAG_SCAN, the bytecode is followed by:
+     uint8_t bitmap[32];     characters < 256 which can start a match
+     uint8_t flags;          RE_SCAN_xxx
+     uint8_t prefix_len;
+     uint16_t prefix[prefix_len];  required literal prefix of a match
+   It is only generated for non sticky regexps. */
+#define RE_SCAN_HIGH       (1 << 0) /* a character >= 256 can start a match */
+#define RE_SCAN_LEN        34
+#define RE_SCAN_PREFIX_MAX 16
+/* length of the split_goto_first/any/goto loop trying every position */
+#define RE_SCAN_LOOP_LEN   11
+/* maximum number of opcodes examined to find the first characters */
+#define RE_SCAN_BUDGET     256
+
 static inline int lre_is_digit(int c) {
     return c >= '0' && c <= '9';
 }
@@ -237,7 +251,7 @@ static __maybe_unused void lre_dump_bytecode(const uint8_t *buf,
            re_flags, buf[RE_HEADER_CAPTURE_COUNT], buf[RE_HEADER_STACK_SIZE]);
     if (re_flags & LRE_FLAG_NAMED_GROUPS) {
         const char *p;
-        p = (char *)buf + RE_HEADER_LEN + bc_len;
+        p = lre_get_groupnames(buf);
         printf("named groups: ");
         for(i = 1; i < buf[RE_HEADER_CAPTURE_COUNT]; i++) {
             if (i != 1)
@@ -1786,6 +1800,163 @@ static int lre_compute_stack_size(const uint8_t *bc_buf, int bc_buf_len)
     return stack_size_max;
 }
 
+typedef struct {
+    uint8_t bitmap[32];
+    bool high; /* any character >= 256 */
+} REFirstChars;
+
+static void re_first_chars_add(REFirstChars *fc, uint32_t c1, uint32_t c2)
+{
+    uint32_t c;
+
+    if (c2 >= 256)
+        fc->high = true;
+    for(c = c1; c <= c2 && c < 256; c++)
+        fc->bitmap[c >> 3] |= 1 << (c & 7);
+}
+
+static bool re_first_chars_has(const REFirstChars *fc, uint32_t c)
+{
+    if (c >= 256)
+        return fc->high;
+    return (fc->bitmap[c >> 3] >> (c & 7)) & 1;
+}
+
+/* add to 'fc' the characters which can be matched first when executing
+   the bytecode from 'pos'. Return -1 if a match can start with an
+   empty string or an assertion, or if the analysis is too long. */
+static int re_get_first_chars(REFirstChars *fc, const uint8_t *bc_buf,
+                              int bc_buf_len, int pos, int *pbudget)
+{
+    int opcode, n, i;
+
+    for(;;) {
+        if (pos < 0 || pos >= bc_buf_len || --(*pbudget) < 0)
+            return -1;
+        opcode = bc_buf[pos];
+        switch(opcode) {
+        case REOP_char8:
+            re_first_chars_add(fc, bc_buf[pos + 1], bc_buf[pos + 1]);
+            return 0;
+        case REOP_char16:
+            re_first_chars_add(fc, get_u16(bc_buf + pos + 1),
+                               get_u16(bc_buf + pos + 1));
+            return 0;
+        case REOP_char32:
+            re_first_chars_add(fc, get_u32(bc_buf + pos + 1),
+                               get_u32(bc_buf + pos + 1));
+            return 0;
+        case REOP_dot:
+            re_first_chars_add(fc, 0, '\n' - 1);
+            re_first_chars_add(fc, '\n' + 1, '\r' - 1);
+            re_first_chars_add(fc, '\r' + 1, 0x10ffff);
+            return 0;
+        case REOP_range:
+            n = get_u16(bc_buf + pos + 1);
+            for(i = 0; i < n; i++) {
+                re_first_chars_add(fc, get_u16(bc_buf + pos + 3 + i * 4),
+                                   get_u16(bc_buf + pos + 3 + i * 4 + 2));
+            }
+            return 0;
+        case REOP_range32:
+            n = get_u16(bc_buf + pos + 1);
+            for(i = 0; i < n; i++) {
+                re_first_chars_add(fc, get_u32(bc_buf + pos + 3 + i * 8),
+                                   get_u32(bc_buf + pos + 3 + i * 8 + 4));
+            }
+            return 0;
+        case REOP_save_start:
+        case REOP_save_end:
+        case REOP_save_reset:
+        case REOP_push_i32:
+        case REOP_drop:
+        case REOP_push_char_pos:
+        case REOP_check_advance:
+            pos += reopcode_info[opcode].size;
+            break;
+        case REOP_goto:
+            pos += 5 + (int)get_u32(bc_buf + pos + 1);
+            break;
+        case REOP_split_goto_first:
+        case REOP_split_next_first:
+        case REOP_loop:
+            if (re_get_first_chars(fc, bc_buf, bc_buf_len, pos + 5, pbudget))
+                return -1;
+            pos += 5 + (int)get_u32(bc_buf + pos + 1);
+            break;
+        case REOP_simple_greedy_quant:
+            if (re_get_first_chars(fc, bc_buf, bc_buf_len, pos + 17, pbudget))
+                return -1;
+            if (get_u32(bc_buf + pos + 5) != 0)
+                return 0;
+            pos += 17 + (int)get_u32(bc_buf + pos + 1);
+            break;
+        default:
+            return -1;
+        }
+    }
+}
+
+/* append the first character information of the regexp */
+static void re_emit_scan_info(REParseState *s)
+{
+    REFirstChars fc, fc1;
+    const uint8_t *bc_buf;
+    int bc_buf_len, pos, budget, prefix_len, c;
+    uint8_t prefix[2 * RE_SCAN_PREFIX_MAX];
+
+    bc_buf = s->byte_code.buf + RE_HEADER_LEN;
+    bc_buf_len = s->byte_code.size - RE_HEADER_LEN;
+    pos = RE_SCAN_LOOP_LEN;
+    memset(&fc, 0, sizeof(fc));
+    budget = RE_SCAN_BUDGET;
+    if (re_get_first_chars(&fc, bc_buf, bc_buf_len, pos, &budget))
+        return;
+    /* the input characters are canonicalized before the comparison */
+    memset(&fc1, 0, sizeof(fc1));
+    fc1.high = fc.high || s->ignore_case;
+    for(c = 0; c < 256; c++) {
+        if (re_first_chars_has(&fc, s->ignore_case ?
+                               lre_canonicalize(c, s->is_unicode) : c))
+            fc1.bitmap[c >> 3] |= 1 << (c & 7);
+    }
+    if (fc1.high) {
+        for(c = 0; c < 32 && fc1.bitmap[c] == 0xff; c++)
+            continue;
+        if (c == 32)
+            return; /* no possible acceleration */
+    }
+
+    prefix_len = 0;
+    if (!s->ignore_case) {
+        pos += reopcode_info[REOP_save_start].size;
+        while (prefix_len < RE_SCAN_PREFIX_MAX && pos < bc_buf_len) {
+            if (bc_buf[pos] == REOP_char8) {
+                c = bc_buf[pos + 1];
+            } else if (bc_buf[pos] == REOP_char16) {
+                c = get_u16(bc_buf + pos + 1);
+                /* may be combined with another surrogate */
+                if (s->is_unicode && c >= 0xd800 && c <= 0xdfff)
+                    break;
+            } else {
+                break;
+            }
+            put_u16(prefix + 2 * prefix_len, c);
+            prefix_len++;
+            pos += reopcode_info[bc_buf[pos]].size;
+        }
+    }
+
+    dbuf_put(&s->byte_code, fc1.bitmap, sizeof(fc1.bitmap));
+    dbuf_putc(&s->byte_code, fc1.high ? RE_SCAN_HIGH : 0);
+    dbuf_putc(&s->byte_code, prefix_len);
+    dbuf_put(&s->byte_code, prefix, 2 * prefix_len);
+    if (!dbuf_error(&s->byte_code)) {
+        put_u16(s->byte_code.buf + RE_HEADER_FLAGS,
+                LRE_FLAG_SCAN | lre_get_flags(s->byte_code.buf));
+    }
+}
+
 /* 'buf' must be a zero terminated UTF-8 string of length buf_len.
    Return NULL if error and allocate an error message in *perror_msg,
    otherwise the compiled bytecode and its length in plen.
@@ -1866,12 +2037,19 @@ uint8_t *lre_compile(int *plen, char *error_msg, int error_msg_size,
     put_u32(s->byte_code.buf + RE_HEADER_BYTECODE_LEN,
             s->byte_code.size - RE_HEADER_LEN);
 
+    if (!is_sticky)
+        re_emit_scan_info(s);
+
     /* add the named groups if needed */
     if (s->group_names.size > (s->capture_count - 1)) {
         dbuf_put(&s->byte_code, s->group_names.buf, s->group_names.size);
         put_u16(s->byte_code.buf + RE_HEADER_FLAGS,
                 LRE_FLAG_NAMED_GROUPS | lre_get_flags(s->byte_code.buf));
     }
+    if (dbuf_error(&s->byte_code)) {
+        re_parse_out_of_memory(s);
+        goto error;
+    }
     dbuf_free(&s->group_names);
 
 #ifdef DUMP_REOP
@@ -2483,6 +2661,82 @@ static intptr_t lre_exec_backtrack(REExecContext *s, uint8_t **capture,
     }
 }
 
+/* return the first position from 'cptr' where a match can start according
+   to the first character information 'scan' or NULL if there is none.
+   'cptr_start' is the start position of the search. */
+static const uint8_t *lre_scan(REExecContext *s, const uint8_t *scan,
+                               const uint8_t *cptr, const uint8_t *cptr_start)
+{
+    const uint8_t *bitmap, *prefix;
+    int prefix_len, i;
+    uint32_t c;
+    bool high;
+
+    bitmap = scan;
+    high = (scan[32] & RE_SCAN_HIGH) != 0;
+    prefix_len = scan[33];
+    prefix = scan + RE_SCAN_LEN;
+    if (s->cbuf_type == 0) {
+        const uint8_t *p, *end;
+
+        p = cptr;
+        end = s->cbuf_end;
+        for(;;) {
+            if (prefix_len > 0) {
+                c = get_u16(prefix);
+                if (c >= 256 || p >= end)
+                    return NULL;
+                p = memchr(p, c, end - p);
+                if (!p)
+                    return NULL;
+                if (end - p < prefix_len)
+                    return NULL;
+                for(i = 1; i < prefix_len; i++) {
+                    if (p[i] != get_u16(prefix + 2 * i))
+                        break;
+                }
+                if (i == prefix_len)
+                    return p;
+            } else {
+                while (p < end && !((bitmap[*p >> 3] >> (*p & 7)) & 1))
+                    p++;
+                if (p >= end)
+                    return NULL;
+                return p;
+            }
+            p++;
+        }
+    } else {
+        const uint16_t *p, *end, *start;
+
+        p = (const uint16_t *)cptr;
+        end = (const uint16_t *)s->cbuf_end;
+        start = (const uint16_t *)cptr_start;
+        for(;;) {
+            for(; p < end; p++) {
+                c = *p;
+                if (c < 256 ? (bitmap[c >> 3] >> (c & 7)) & 1 : high)
+                    break;
+            }
+            if (p >= end)
+                return NULL;
+            /* the second half of a surrogate pair is not a position */
+            if (!(s->cbuf_type == 2 && p > start && is_lo_surrogate(*p) &&
+                  is_hi_surrogate(p[-1]))) {
+                if (end - p < prefix_len)
+                    return NULL;
+                for(i = 0; i < prefix_len; i++) {
+                    if (p[i] != get_u16(prefix + 2 * i))
+                        break;
+                }
+                if (i == prefix_len)
+                    return (const uint8_t *)p;
+            }
+            p++;
+        }
+    }
+}
+
 /* Return 1 if match, 0 if not match or < 0 if error (see LRE_RET_x). cindex is the
    starting position of the match and must be such as 0 <= cindex <=
    clen. */
@@ -2519,8 +2773,38 @@ int lre_exec(uint8_t **capture,
         capture[i] = NULL;
     alloca_size = s->stack_size_max * sizeof(stack_buf[0]);
     stack_buf = alloca(alloca_size);
-    ret = lre_exec_backtrack(s, capture, stack_buf, 0, bc_buf + RE_HEADER_LEN,
-                             cbuf + (cindex << cbuf_type), false);
+    if (re_flags & LRE_FLAG_SCAN) {
+        const uint8_t *scan, *cptr, *cptr_start;
+
+        /* instead of the bytecode loop, try only the positions where a
+           match can start */
+        scan = bc_buf + RE_HEADER_LEN +
+            get_u32(bc_buf + RE_HEADER_BYTECODE_LEN);
+        cptr_start = cbuf + (cindex << cbuf_type);
+        cptr = cptr_start;
+        for(;;) {
+            cptr = lre_scan(s, scan, cptr, cptr_start);
+            if (!cptr) {
+                ret = 0;
+                break;
+            }
+            ret = lre_exec_backtrack(s, capture, stack_buf, 0,
+                                     bc_buf + RE_HEADER_LEN + RE_SCAN_LOOP_LEN,
+                                     cptr, false);
+            if (ret != 0)
+                break;
+            ret = lre_poll_timeout(s);
+            if (ret < 0)
+                break;
+            for(i = 0; i < s->capture_count * 2; i++)
+                capture[i] = NULL;
+            cptr += 1 << cbuf_type;
+        }
+    } else {
+        ret = lre_exec_backtrack(s, capture, stack_buf, 0,
+                                 bc_buf + RE_HEADER_LEN,
+                                 cbuf + (cindex << cbuf_type), false);
+    }
     lre_realloc(s->opaque, s->state_stack, 0);
     return ret;
 }
@@ -2539,17 +2823,22 @@ int lre_get_flags(const uint8_t *bc_buf)
    'capture_count - 1' zero terminated UTF-8 strings. */
 const char *lre_get_groupnames(const uint8_t *bc_buf)
 {
-    uint32_t re_bytecode_len;
-    if ((lre_get_flags(bc_buf) & LRE_FLAG_NAMED_GROUPS) == 0)
+    const uint8_t *p;
+    int re_flags;
+
+    re_flags = lre_get_flags(bc_buf);
+    if ((re_flags & LRE_FLAG_NAMED_GROUPS) == 0)
         return NULL;
-    re_bytecode_len = get_u32(bc_buf + RE_HEADER_BYTECODE_LEN);
-    return (const char *)(bc_buf + RE_HEADER_LEN + re_bytecode_len);
+    p = bc_buf + RE_HEADER_LEN + get_u32(bc_buf + RE_HEADER_BYTECODE_LEN);
+    if (re_flags & LRE_FLAG_SCAN)
+        p += RE_SCAN_LEN + 2 * p[33];
+    return (const char *)p;
 }
 
 void lre_byte_swap(uint8_t *buf, size_t len, bool is_byte_swapped)
 {
     uint8_t *p, *pe;
-    uint32_t n, r, nw;
+    uint32_t n, r, nw, re_flags;
 
     p = buf;
     if (len < RE_HEADER_LEN)
@@ -2558,9 +2847,13 @@ void lre_byte_swap(uint8_t *buf, size_t len, bool is_byte_swapped)
     // format is:
     //  <header>
     //  <bytecode>
+    //  <first character information> (if LRE_FLAG_SCAN)
     //  <capture group name 1>
     //  <capture group name 2>
     //  etc.
+    re_flags = get_u16(&p[RE_HEADER_FLAGS]);
+    if (is_byte_swapped)
+        re_flags = bswap16(re_flags);
     inplace_bswap16(&p[RE_HEADER_FLAGS]);
 
     n = get_u32(&p[RE_HEADER_BYTECODE_LEN]);
@@ -2618,6 +2911,14 @@ void lre_byte_swap(uint8_t *buf, size_t len, bool is_byte_swapped)
         }
         p = &p[n];
     }
+
+    if (re_flags & LRE_FLAG_SCAN) {
+        if (len - (pe - buf) < RE_SCAN_LEN ||
+            len - (pe - buf) - RE_SCAN_LEN < 2 * pe[33])
+            abort();
+        for(r = 0; r < pe[33]; r++)
+            inplace_bswap16(&pe[RE_SCAN_LEN + 2 * r]);
+    }
 }
 
 #ifdef TEST
@@ -10,49 +10,180 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include "quickjs-libc.h"
+#include "qjs_bundle.h"
 
 // 全局存储所有模块，供JS_NewCustomContext访问
 typedef struct {
     bool load_only;
     uint64_t size;
-    uint8_t *data;
+    const uint8_t *data; // 指向 g_bundle 内部
 } ModuleInfo;
 
 static ModuleInfo *g_modules = NULL;
 static int g_module_count = 0;
 
+// 整个二进制文件（mmap 映射或 malloc 缓冲区）
+static uint8_t *g_bundle = NULL;
+static size_t g_bundle_size = 0;
+static bool g_bundle_mapped = false;
+
+// 压缩格式（qjsc -b -z）的共享字典
+static bool g_bundle_compressed = false;
+static const uint8_t *g_dict = NULL;
+static size_t g_dict_size = 0;
+// 模块共用的原子表（qjsc -b -a）
+static const uint8_t *g_atoms = NULL;
+static size_t g_atoms_size = 0;
+
 /**
- * @brief 从二进制文件加载所有模块到全局数组
+ * @brief 映射二进制文件到内存，无法映射时整体读入
  */
-static int load_all_modules(const char *filename) {
+static int map_bundle(const char *filename) {
+#ifndef _WIN32
+    int fd = open(filename, O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *view = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view != MAP_FAILED) {
+                g_bundle = view;
+                g_bundle_size = st.st_size;
+                g_bundle_mapped = true;
+            }
+        }
+        close(fd);
+        if (g_bundle_mapped)
+            return 0;
+    }
+#endif
     FILE *f = fopen(filename, "rb");
     if (!f) {
         perror("Failed to open binary file");
         return -1;
     }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len <= 0 || !(g_bundle = malloc(len)) ||
+        fread(g_bundle, 1, len, f) != (size_t)len) {
+        fprintf(stderr, "Error: Failed to read '%s'\n", filename);
+        fclose(f);
+        free(g_bundle);
+        g_bundle = NULL;
+        return -1;
+    }
+    fclose(f);
+    g_bundle_size = len;
+    return 0;
+}
+
+static void unmap_bundle(void) {
+    if (!g_bundle) return;
+#ifndef _WIN32
+    if (g_bundle_mapped)
+        munmap(g_bundle, g_bundle_size);
+    else
+#endif
+        free(g_bundle);
+    g_bundle = NULL;
+    g_bundle_size = 0;
+    g_bundle_mapped = false;
+    g_bundle_compressed = false;
+    g_dict = NULL;
+    g_dict_size = 0;
+    g_atoms = NULL;
+    g_atoms_size = 0;
+}
+
+/**
+ * @brief 从二进制文件加载所有模块到全局数组
+ *
+ * 模块数据不再逐个拷贝，只记录在映射区域内的位置
+ */
+static int load_all_modules(const char *filename) {
+    if (map_bundle(filename) < 0)
+        return -1;
 
     int capacity = 16;
     g_modules = malloc(sizeof(ModuleInfo) * capacity);
     if (!g_modules) {
-        fclose(f);
+        unmap_bundle();
         return -1;
     }
 
+    const uint8_t *p = g_bundle;
+    const uint8_t *end = g_bundle + g_bundle_size;
     g_module_count = 0;
-    while (1) {
+
+    // 带索引的格式（见 qjs_bundle.h）
+    if (qjs_bundle_is_indexed(g_bundle, g_bundle_size)) {
+        QJSBundleHeader header;
+        QJSBundleEntry entry;
+        p = qjs_bundle_read_header(g_bundle, g_bundle_size, &header);
+        if (!p) {
+            fprintf(stderr, "Error: Unsupported bundle header\n");
+            goto error;
+        }
+        if (header.module_count > (uint32_t)capacity) {
+            ModuleInfo *new_modules = realloc(g_modules, sizeof(ModuleInfo) * header.module_count);
+            if (!new_modules) goto error;
+            g_modules = new_modules;
+        }
+        g_bundle_compressed = header.version == QJS_BUNDLE_VERSION_LZ;
+        for (uint32_t i = 0; i < header.module_count; i++) {
+            p = qjs_bundle_read_entry(p, g_bundle, g_bundle_size, &entry);
+            if (!p) {
+                fprintf(stderr, "Error: Invalid index entry #%u\n", i);
+                goto error;
+            }
+            if (entry.flags & QJS_BUNDLE_MODULE_DICTIONARY) {
+                g_dict = g_bundle + entry.offset;
+                g_dict_size = entry.length;
+                continue;
+            }
+            if (entry.flags & QJS_BUNDLE_MODULE_ATOMS) {
+                g_atoms = g_bundle + entry.offset;
+                g_atoms_size = entry.length;
+                continue;
+            }
+            g_modules[g_module_count].data = g_bundle + entry.offset;
+            g_modules[g_module_count].size = entry.length;
+            g_modules[g_module_count].load_only = (entry.flags & QJS_BUNDLE_MODULE_LOAD_ONLY) != 0;
+            g_module_count++;
+        }
+        printf("Loaded %d modules from '%s'\n", g_module_count, filename);
+        return 0;
+    }
+
+    // 跳过字节码版本头（4字节，见 qjsc -b）
+    if (end - p < (ptrdiff_t)sizeof(uint32_t)) {
+        fprintf(stderr, "Error: Missing bytecode version header\n");
+        goto error;
+    }
+    p += sizeof(uint32_t);
+    while (p < end) {
         uint8_t load_only;
         uint64_t data_length;
 
-        if (fread(&load_only, 1, 1, f) != 1) break; // EOF
+        load_only = *p++;
 
-        if (fread(&data_length, sizeof(uint64_t), 1, f) != 1) {
+        if (end - p < (ptrdiff_t)sizeof(uint64_t)) {
             fprintf(stderr, "Error: Incomplete module header at #%d\n", g_module_count);
             goto error;
         }
+        memcpy(&data_length, p, sizeof(uint64_t));
+        p += sizeof(uint64_t);
 
         // 动态扩容
         if (g_module_count >= capacity) {
@@ -62,33 +193,27 @@ static int load_all_modules(const char *filename) {
             g_modules = new_modules;
         }
 
-        // 读取数据
-        g_modules[g_module_count].data = malloc(data_length);
-        if (!g_modules[g_module_count].data) goto error;
-
-        if (fread(g_modules[g_module_count].data, 1, data_length, f) != data_length) {
+        if ((uint64_t)(end - p) < data_length) {
             fprintf(stderr, "Error: Failed to read %llu bytes for module #%d\n",
                     (unsigned long long) data_length, g_module_count);
             goto error;
         }
 
+        g_modules[g_module_count].data = p;
         g_modules[g_module_count].size = data_length;
         g_modules[g_module_count].load_only = load_only;
         g_module_count++;
+        p += data_length;
     }
 
     printf("Loaded %d modules from '%s'\n", g_module_count, filename);
-    fclose(f);
     return 0;
 
 error:
-    fclose(f);
-    for (int i = 0; i < g_module_count; i++) {
-        free(g_modules[i].data);
-    }
     free(g_modules);
     g_modules = NULL;
     g_module_count = 0;
+    unmap_bundle();
     return -1;
 }
 
@@ -97,12 +222,45 @@ error:
  */
 static void free_all_modules(void) {
     if (!g_modules) return;
-    for (int i = 0; i < g_module_count; i++) {
-        free(g_modules[i].data);
-    }
     free(g_modules);
     g_modules = NULL;
     g_module_count = 0;
+    unmap_bundle();
+}
+
+/**
+ * @brief 执行一个模块，压缩的模块边解压边反序列化
+ */
+static bool eval_module(JSContext *ctx, const ModuleInfo *mod, bool load_only) {
+    if (!g_bundle_compressed)
+        return js_std_eval_binary_bool(ctx, mod->data, mod->size, load_only);
+
+    QJSBundleReader reader;
+    if (qjs_bundle_reader_init(&reader, mod->data, mod->size, g_dict, g_dict_size) < 0) {
+        JS_ThrowSyntaxError(ctx, "truncated compressed module");
+        return false;
+    }
+    bool ret = js_std_eval_binary_stream(ctx, qjs_bundle_reader_read, &reader, load_only);
+    qjs_bundle_reader_free(&reader);
+    return ret;
+}
+
+/**
+ * @brief 加载模块共用的原子表，必须在反序列化任何模块之前调用
+ */
+static bool load_atoms(JSContext *ctx) {
+    if (!g_bundle_compressed)
+        return JS_ReadAtomTable(ctx, g_atoms, g_atoms_size) == 0;
+
+    size_t len;
+    uint8_t *buf = qjs_bundle_decompress(g_atoms, g_atoms_size, g_dict, g_dict_size, &len);
+    if (!buf) {
+        JS_ThrowSyntaxError(ctx, "corrupted atom table");
+        return false;
+    }
+    bool ret = JS_ReadAtomTable(ctx, buf, len) == 0;
+    free(buf);
+    return ret;
 }
 
 /**
@@ -117,10 +275,16 @@ static JSContext *JS_NewCustomContext(JSRuntime *rt) {
         return NULL;
     }
 
+    if (g_atoms && !load_atoms(ctx)) {
+        fprintf(stderr, "Error: Failed to load the shared atom table\n");
+        JS_FreeContext(ctx);
+        return NULL;
+    }
+
     // 为Worker预加载所有依赖模块
     for (int i = 0; i < g_module_count; i++) {
         if (g_modules[i].load_only) {
-            js_std_eval_binary_bool(ctx, g_modules[i].data, g_modules[i].size, true);
+            eval_module(ctx, &g_modules[i], true);
         }
     }
 
@@ -222,7 +386,7 @@ int main(int argc, char **argv) {
         if (!g_modules[i].load_only) {
             has_entry = true;
             printf("----------- [ main.js ] -----------\n");
-            bool state = js_std_eval_binary_bool(ctx, g_modules[i].data, g_modules[i].size, 0);
+            bool state = eval_module(ctx, &g_modules[i], false);
             if (!state) {
                 printf("----------- [ !state ] -----------\n");
                 char* error_info = getExceptionStack(ctx);
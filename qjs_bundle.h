@@ -0,0 +1,374 @@
+/*
+ * QuickJS bytecode bundle format
+ *
+ * Written by "qjsc -b", read by QjsBinaryCodeExecutor and qjs_bc.c.
+ * All integers are stored in host byte order.
+ *
+ * Indexed bundle:
+ *
+ *   uint32_t magic;           QJS_BUNDLE_MAGIC
+ *   uint16_t version;         QJS_BUNDLE_VERSION or QJS_BUNDLE_VERSION_LZ
+ *   uint16_t flags;           reserved, 0
+ *   uint32_t bc_version;      QJS_BUNDLE_BC_VERSION
+ *   uint32_t module_count;
+ *   module_count times:
+ *     uint8_t  flags;         QJS_BUNDLE_MODULE_xxx
+ *     uint16_t name_len;
+ *     char     name[name_len]; module name as passed to the module loader
+ *     uint64_t offset;        from the start of the file
+ *     uint64_t length;
+ *   module data (JS_WriteObject() output, optionally XOR encoded)
+ *
+ * In QJS_BUNDLE_VERSION_LZ bundles ("qjsc -b -z") the module data is
+ * compressed, then optionally XOR encoded:
+ *
+ *   uint32_t raw_length;      length of the JS_WriteObject() output
+ *   blocks until the end of the module data:
+ *     uint32_t block_len;     QJS_BUNDLE_BLOCK_STORED set if not compressed
+ *     uint8_t  data[block_len & ~QJS_BUNDLE_BLOCK_STORED];
+ *
+ * Each block decodes to QJS_BUNDLE_BLOCK_SIZE bytes, except the last
+ * one. The blocks use the LZ4 block format and their matches can only
+ * reference the block itself and the dictionary, so that they can be
+ * decoded one at a time directly into the destination buffer. The
+ * dictionary is the data of the entry with the QJS_BUNDLE_MODULE_DICTIONARY
+ * flag, if any. It is built by qjsc from the substrings that are common
+ * to several modules (atoms, constant pools...) and is at most
+ * QJS_BUNDLE_DICT_MAX_SIZE bytes.
+ *
+ * With "qjsc -b -a" the modules are written with JS_WRITE_OBJ_SHARED_ATOMS
+ * and do not embed an atom table: the entry with the
+ * QJS_BUNDLE_MODULE_ATOMS flag holds the atoms of all of them
+ * (JS_WriteAtomTable() output, compressed like a module) and must be
+ * loaded with JS_ReadAtomTable() in every context before the modules.
+ *
+ * Legacy bundles have no index: the uint32_t bytecode version is directly
+ * followed by [load_only:1][length:8][data] records until the end of file.
+ */
+#ifndef QJS_BUNDLE_H
+#define QJS_BUNDLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QJS_BUNDLE_MAGIC       0x42534a51 /* "QJSB" */
+#define QJS_BUNDLE_VERSION     1
+#define QJS_BUNDLE_VERSION_LZ  2 /* compressed modules */
+#define QJS_BUNDLE_BC_VERSION  2072
+
+/* the module is a dependency, not an entry point */
+#define QJS_BUNDLE_MODULE_LOAD_ONLY  (1 << 0)
+/* the compression dictionary, not a module */
+#define QJS_BUNDLE_MODULE_DICTIONARY (1 << 1)
+/* the atom table shared by the modules, not a module */
+#define QJS_BUNDLE_MODULE_ATOMS      (1 << 2)
+
+#define QJS_BUNDLE_BLOCK_SIZE    16384
+#define QJS_BUNDLE_BLOCK_STORED  0x80000000u
+/* the whole dictionary is in the 64 KiB match window of every block */
+#define QJS_BUNDLE_DICT_MAX_SIZE (65535 - QJS_BUNDLE_BLOCK_SIZE)
+
+#define QJS_BUNDLE_HEADER_SIZE  16
+
+typedef struct QJSBundleHeader {
+    uint16_t version;
+    uint16_t flags;
+    uint32_t bc_version;
+    uint32_t module_count;
+} QJSBundleHeader;
+
+typedef struct QJSBundleEntry {
+    const char *name; /* not zero terminated */
+    size_t name_len;
+    uint8_t flags;
+    uint64_t offset;
+    uint64_t length;
+} QJSBundleEntry;
+
+static inline bool qjs_bundle_is_indexed(const uint8_t *buf, size_t len)
+{
+    uint32_t magic;
+
+    if (len < sizeof(magic))
+        return false;
+    memcpy(&magic, buf, sizeof(magic));
+    return magic == QJS_BUNDLE_MAGIC;
+}
+
+/* return the position of the first index entry or NULL if the header is
+   invalid or of an unsupported version */
+static inline const uint8_t *qjs_bundle_read_header(const uint8_t *buf,
+                                                    size_t len,
+                                                    QJSBundleHeader *h)
+{
+    if (len < QJS_BUNDLE_HEADER_SIZE || !qjs_bundle_is_indexed(buf, len))
+        return NULL;
+    memcpy(&h->version, buf + 4, 2);
+    memcpy(&h->flags, buf + 6, 2);
+    memcpy(&h->bc_version, buf + 8, 4);
+    memcpy(&h->module_count, buf + 12, 4);
+    if (h->version != QJS_BUNDLE_VERSION && h->version != QJS_BUNDLE_VERSION_LZ)
+        return NULL;
+    return buf + QJS_BUNDLE_HEADER_SIZE;
+}
+
+/* read the index entry at 'p'. 'buf' and 'len' describe the whole
+   bundle. Return the position of the next entry or NULL if the entry is
+   truncated or points outside of the bundle. */
+static inline const uint8_t *qjs_bundle_read_entry(const uint8_t *p,
+                                                   const uint8_t *buf,
+                                                   size_t len,
+                                                   QJSBundleEntry *e)
+{
+    const uint8_t *end = buf + len;
+    uint16_t name_len;
+
+    if (end - p < 3)
+        return NULL;
+    e->flags = p[0];
+    memcpy(&name_len, p + 1, 2);
+    p += 3;
+    if ((size_t)(end - p) < (size_t)name_len + 16)
+        return NULL;
+    e->name = (const char *)p;
+    e->name_len = name_len;
+    p += name_len;
+    memcpy(&e->offset, p, 8);
+    memcpy(&e->length, p + 8, 8);
+    p += 16;
+    if (e->offset > len || e->length > len - e->offset)
+        return NULL;
+    return p;
+}
+
+/* decode the LZ4 block 'src' to 'dst'. The matches before 'dst' are
+   read from the end of 'dict'. Return the decoded length or -1 if the
+   block is invalid or does not fit in 'dst_len' bytes. */
+static inline int64_t qjs_bundle_lz_decode(uint8_t *dst, size_t dst_len,
+                                           const uint8_t *src, size_t src_len,
+                                           const uint8_t *dict, size_t dict_len)
+{
+    const uint8_t *ip = src, *ip_end = src + src_len;
+    uint8_t *op = dst, *op_end = dst + dst_len;
+    size_t lit_len, match_len, offset, n;
+    const uint8_t *match;
+    unsigned int token, c;
+
+    while (ip < ip_end) {
+        token = *ip++;
+        lit_len = token >> 4;
+        if (lit_len == 15) {
+            do {
+                if (ip >= ip_end)
+                    return -1;
+                c = *ip++;
+                lit_len += c;
+            } while (c == 255);
+        }
+        if (lit_len > (size_t)(ip_end - ip) || lit_len > (size_t)(op_end - op))
+            return -1;
+        memcpy(op, ip, lit_len);
+        op += lit_len;
+        ip += lit_len;
+        if (ip == ip_end)
+            break; /* the last sequence has no match */
+        if (ip_end - ip < 2)
+            return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        match_len = (token & 15) + 4;
+        if ((token & 15) == 15) {
+            do {
+                if (ip >= ip_end)
+                    return -1;
+                c = *ip++;
+                match_len += c;
+            } while (c == 255);
+        }
+        if (offset == 0 || match_len > (size_t)(op_end - op))
+            return -1;
+        if (offset > (size_t)(op - dst)) {
+            /* starts in the dictionary */
+            n = offset - (op - dst);
+            if (n > dict_len)
+                return -1;
+            match = dict + dict_len - n;
+            if (n > match_len)
+                n = match_len;
+            memcpy(op, match, n);
+            op += n;
+            match_len -= n;
+            match = dst;
+        } else {
+            match = op - offset;
+        }
+        if (match_len <= (size_t)(op - match)) {
+            memcpy(op, match, match_len);
+            op += match_len;
+        } else {
+            /* overlapping copy */
+            while (match_len--)
+                *op++ = *match++;
+        }
+    }
+    return op - dst;
+}
+
+/* streaming decoder of a compressed module, 'read' has the
+   JSReadObjectFunc signature */
+typedef struct QJSBundleReader {
+    const uint8_t *ptr, *end; /* next block */
+    const uint8_t *dict;
+    size_t dict_len;
+    uint64_t raw_left; /* bytes not decoded yet */
+    const uint8_t *win; /* decoded data not returned yet */
+    size_t win_len;
+    uint8_t *block; /* QJS_BUNDLE_BLOCK_SIZE bytes, allocated on demand */
+} QJSBundleReader;
+
+/* return -1 if the module header is truncated */
+static inline int qjs_bundle_reader_init(QJSBundleReader *r,
+                                         const uint8_t *data, size_t len,
+                                         const uint8_t *dict, size_t dict_len)
+{
+    uint32_t raw_length;
+
+    memset(r, 0, sizeof(*r));
+    if (len < 4)
+        return -1;
+    memcpy(&raw_length, data, 4);
+    r->ptr = data + 4;
+    r->end = data + len;
+    r->dict = dict;
+    r->dict_len = dict_len;
+    r->raw_left = raw_length;
+    return 0;
+}
+
+static inline void qjs_bundle_reader_free(QJSBundleReader *r)
+{
+    free(r->block);
+    r->block = NULL;
+}
+
+/* Return the number of bytes stored in 'buf', 0 at the end of the
+   module or -1 if it is corrupted. A whole block is decoded directly to
+   'buf' when it fits. */
+static inline int64_t qjs_bundle_reader_read(void *opaque, uint8_t *buf,
+                                             size_t buf_size)
+{
+    QJSBundleReader *r = (QJSBundleReader *)opaque;
+    uint32_t block_len;
+    size_t raw_len, n;
+    uint8_t *dst;
+    int64_t ret;
+
+    if (r->win_len == 0) {
+        if (r->raw_left == 0)
+            return 0;
+        if (r->end - r->ptr < 4)
+            return -1;
+        memcpy(&block_len, r->ptr, 4);
+        r->ptr += 4;
+        raw_len = r->raw_left < QJS_BUNDLE_BLOCK_SIZE ?
+            (size_t)r->raw_left : QJS_BUNDLE_BLOCK_SIZE;
+        n = block_len & ~QJS_BUNDLE_BLOCK_STORED;
+        if (n > (size_t)(r->end - r->ptr))
+            return -1;
+        if (block_len & QJS_BUNDLE_BLOCK_STORED) {
+            if (n != raw_len)
+                return -1;
+            r->win = r->ptr;
+        } else {
+            if (buf_size >= raw_len) {
+                dst = buf;
+            } else {
+                if (!r->block) {
+                    r->block = (uint8_t *)malloc(QJS_BUNDLE_BLOCK_SIZE);
+                    if (!r->block)
+                        return -1;
+                }
+                dst = r->block;
+            }
+            ret = qjs_bundle_lz_decode(dst, raw_len, r->ptr, n,
+                                       r->dict, r->dict_len);
+            if (ret != (int64_t)raw_len)
+                return -1;
+            r->win = dst;
+        }
+        r->ptr += n;
+        r->raw_left -= raw_len;
+        r->win_len = raw_len;
+        if (r->win == buf) {
+            r->win_len = 0;
+            return raw_len;
+        }
+    }
+    n = r->win_len < buf_size ? r->win_len : buf_size;
+    memcpy(buf, r->win, n);
+    r->win += n;
+    r->win_len -= n;
+    return n;
+}
+
+/* return an upper bound of the length the blocks of 'r' decode to, so
+   that a corrupted raw_length cannot make the caller allocate more: a
+   stored block holds its data and each byte of a compressed block
+   decodes to at most 255 bytes (a match length extension byte) */
+static inline uint64_t qjs_bundle_reader_max_length(const QJSBundleReader *r)
+{
+    const uint8_t *p = r->ptr;
+    uint64_t max_len = 0;
+    uint32_t block_len;
+    size_t n;
+
+    while (r->end - p >= 4) {
+        memcpy(&block_len, p, 4);
+        p += 4;
+        n = block_len & ~QJS_BUNDLE_BLOCK_STORED;
+        if (n > (size_t)(r->end - p))
+            break;
+        p += n;
+        if (!(block_len & QJS_BUNDLE_BLOCK_STORED))
+            n = n > QJS_BUNDLE_BLOCK_SIZE / 255 ? QJS_BUNDLE_BLOCK_SIZE : n * 255;
+        max_len += n < QJS_BUNDLE_BLOCK_SIZE ? n : QJS_BUNDLE_BLOCK_SIZE;
+    }
+    return max_len;
+}
+
+/* decode a whole compressed module to a malloc() buffer. Return NULL if
+   it is corrupted. */
+static inline uint8_t *qjs_bundle_decompress(const uint8_t *data, size_t len,
+                                             const uint8_t *dict,
+                                             size_t dict_len, size_t *plen)
+{
+    QJSBundleReader r;
+    uint8_t *buf;
+    size_t pos;
+    int64_t ret;
+
+    if (qjs_bundle_reader_init(&r, data, len, dict, dict_len) < 0 ||
+        r.raw_left > qjs_bundle_reader_max_length(&r) ||
+        r.raw_left > SIZE_MAX - 1)
+        return NULL;
+    /* never empty, so that NULL is only returned on error */
+    buf = (uint8_t *)malloc((size_t)r.raw_left + 1);
+    if (!buf)
+        return NULL;
+    pos = 0;
+    while ((ret = qjs_bundle_reader_read(&r, buf + pos,
+                                         (size_t)r.raw_left + r.win_len)) > 0)
+        pos += ret;
+    qjs_bundle_reader_free(&r);
+    if (ret < 0) {
+        free(buf);
+        return NULL;
+    }
+    *plen = pos;
+    return buf;
+}
+
+#endif /* QJS_BUNDLE_H */
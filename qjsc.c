@@ -33,6 +33,7 @@
 
 #include "cutils.h"
 #include "quickjs-libc.h"
+#include "qjs_bundle.h"
 
 typedef enum {
     OUTPUT_C,
@@ -61,7 +62,20 @@ static const char *c_ident_prefix = "qjsc_";
 static int strip;
 
 const char *xor_secret;
-bool is_out_bc_head = false;
+static bool compress_bundle;
+static bool share_atoms;
+
+/* modules of the raw bundle, written by output_bundle() */
+typedef struct {
+    char *name;
+    uint8_t flags;
+    uint8_t *data;
+    size_t len;
+} bundle_module_t;
+
+static bundle_module_t *bundle_modules;
+static int bundle_module_count;
+static int bundle_module_size;
 
 void namelist_add(namelist_t *lp, const char *name, const char *short_name,
                   int flags)
@@ -167,6 +181,8 @@ static void output_object_code(JSContext *ctx,
         if (strip > 1)
             flags |= JS_WRITE_OBJ_STRIP_DEBUG;
     }
+    if (share_atoms)
+        flags |= JS_WRITE_OBJ_SHARED_ATOMS;
 
     out_buf = JS_WriteObject(ctx, &out_buf_len, obj, flags);
     if (!out_buf) {
@@ -177,33 +193,46 @@ static void output_object_code(JSContext *ctx,
     namelist_add(&cname_list, c_name, NULL, load_only);
 
     if (output_type == OUTPUT_RAW) {
-
-        if (!is_out_bc_head) {
-            // 输出二进制代码的文件头
-            uint32_t bc_version = 2072;
-            fwrite(&bc_version, sizeof(uint32_t), 1, fo);
-            printf("bc_head version: %d\n", bc_version);
-            is_out_bc_head = true;
+        bundle_module_t *bm;
+        const char *name;
+        JSAtom atom;
+
+        /* the index is keyed by the name seen by the module loader */
+        name = NULL;
+        if (JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE) {
+            atom = JS_GetModuleName(ctx, JS_VALUE_GET_PTR(obj));
+            name = JS_AtomToCString(ctx, atom);
+            JS_FreeAtom(ctx, atom);
         }
 
-        printf("name: %s len=%zu load_only=%d\n", c_name, out_buf_len, load_only);
+        printf("name: %s len=%zu load_only=%d\n", name ? name : c_name,
+               out_buf_len, load_only);
         printf("xor_secret: %s\n", xor_secret);
 
-        if (xor_secret) {
-            // 如果设置了 xor_secret（字符串） 对out_buf进行一轮xor加密
-            size_t secret_len = strlen(xor_secret);
-            // 使用密钥循环应用XOR加密
-            for (size_t i = 0; i < out_buf_len; i++) {
-                out_buf[i] ^= xor_secret[i % secret_len];
+        if (bundle_module_count == bundle_module_size) {
+            bundle_module_size = bundle_module_size * 2 + 8;
+            bundle_modules = realloc(bundle_modules, sizeof(bundle_modules[0]) *
+                                     bundle_module_size);
+            if (!bundle_modules) {
+                fprintf(stderr, "qjsc: out of memory\n");
+                exit(1);
             }
         }
-
-        // uint16_t name_len = (uint16_t) strlen(c_name);
-        // fwrite(&name_len, sizeof(uint16_t), 1, fo);
-        // fwrite(c_name, 1, name_len, fo);
-        fwrite(&load_only, sizeof(uint8_t), 1, fo);
-        fwrite(&out_buf_len, sizeof(uint64_t), 1, fo);
-        fwrite(out_buf, 1, out_buf_len, fo);
+        if (strlen(name ? name : c_name) > UINT16_MAX) {
+            fprintf(stderr, "qjsc: module name too long\n");
+            exit(1);
+        }
+        bm = &bundle_modules[bundle_module_count++];
+        bm->name = strdup(name ? name : c_name);
+        bm->flags = load_only ? QJS_BUNDLE_MODULE_LOAD_ONLY : 0;
+        bm->data = malloc(out_buf_len);
+        bm->len = out_buf_len;
+        if (!bm->name || !bm->data) {
+            fprintf(stderr, "qjsc: out of memory\n");
+            exit(1);
+        }
+        memcpy(bm->data, out_buf, out_buf_len);
+        JS_FreeCString(ctx, name);
     } else {
         fprintf(fo, "const uint32_t %s_size = %u;\n\n",
                 c_name, (unsigned int)out_buf_len);
@@ -216,6 +245,381 @@ static void output_object_code(JSContext *ctx,
     js_free(ctx, out_buf);
 }
 
+static void *xmalloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (!ptr) {
+        fprintf(stderr, "qjsc: out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void xor_encode(uint8_t *buf, size_t len)
+{
+    // 如果设置了 xor_secret（字符串） 对模块数据进行一轮xor加密
+    size_t secret_len = strlen(xor_secret);
+    // 使用密钥循环应用XOR加密
+    for (size_t i = 0; i < len; i++) {
+        buf[i] ^= xor_secret[i % secret_len];
+    }
+}
+
+/* LZ4 block compression of the bundle modules (see qjs_bundle.h) */
+
+#define LZ_HASH_BITS      16
+#define LZ_MIN_MATCH      4
+#define LZ_LAST_LITERALS  5  /* the last bytes are always literals */
+#define LZ_MF_LIMIT       12 /* no match starts in the last bytes */
+#define LZ_MAX_OFFSET     65535
+
+static uint32_t lz_hash(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *lz_put_len(uint8_t *op, size_t n)
+{
+    while (n >= 255) {
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = n;
+    return op;
+}
+
+static uint8_t *lz_put_sequence(uint8_t *op, const uint8_t *lit, size_t lit_len,
+                                size_t offset, size_t match_len)
+{
+    uint8_t *token = op++;
+
+    *token = (lit_len >= 15 ? 15 : lit_len) << 4;
+    if (lit_len >= 15)
+        op = lz_put_len(op, lit_len - 15);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (match_len == 0)
+        return op; /* last sequence */
+    *op++ = offset;
+    *op++ = offset >> 8;
+    match_len -= LZ_MIN_MATCH;
+    *token |= match_len >= 15 ? 15 : match_len;
+    if (match_len >= 15)
+        op = lz_put_len(op, match_len - 15);
+    return op;
+}
+
+/* compress the 'len' bytes at 'base + dict_len', the first 'dict_len'
+   bytes of 'base' being the dictionary. 'dst' must have room for
+   len + len / 255 + 16 bytes. Return the compressed length. */
+static size_t lz_compress(uint8_t *dst, const uint8_t *base, size_t dict_len,
+                          size_t len, uint32_t *htab)
+{
+    const uint8_t *ip, *anchor, *end, *ref;
+    uint8_t *op;
+    size_t match_len;
+    uint32_t h, cand;
+
+    memset(htab, 0, sizeof(htab[0]) << LZ_HASH_BITS);
+    for(ip = base; ip + LZ_MIN_MATCH <= base + dict_len; ip++)
+        htab[lz_hash(ip)] = ip - base + 1;
+    ip = anchor = base + dict_len;
+    end = ip + len;
+    op = dst;
+    while (len > LZ_MF_LIMIT && ip < end - LZ_MF_LIMIT) {
+        h = lz_hash(ip);
+        cand = htab[h];
+        htab[h] = ip - base + 1;
+        ref = base + cand - 1;
+        if (cand == 0 || ip - ref > LZ_MAX_OFFSET ||
+            memcmp(ref, ip, LZ_MIN_MATCH)) {
+            ip++;
+            continue;
+        }
+        match_len = LZ_MIN_MATCH;
+        while (ip + match_len < end - LZ_LAST_LITERALS &&
+               ref[match_len] == ip[match_len])
+            match_len++;
+        while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+            ip--;
+            ref--;
+            match_len++;
+        }
+        op = lz_put_sequence(op, anchor, ip - anchor, ip - ref, match_len);
+        ip += match_len;
+        anchor = ip;
+        htab[lz_hash(ip - 2)] = ip - 2 - base + 1;
+    }
+    return lz_put_sequence(op, anchor, end - anchor, 0, 0) - dst;
+}
+
+/* compress 'bm' in place with the dictionary 'dict' */
+static void lz_compress_module(bundle_module_t *bm, const uint8_t *dict,
+                               size_t dict_len)
+{
+    uint8_t *out, *base;
+    uint32_t *htab, u32;
+    size_t pos, n, out_len, block_len;
+
+    out = xmalloc(4 + bm->len + bm->len / 255 +
+                  (bm->len / QJS_BUNDLE_BLOCK_SIZE + 1) * 20);
+    base = xmalloc(dict_len + QJS_BUNDLE_BLOCK_SIZE);
+    htab = xmalloc(sizeof(htab[0]) << LZ_HASH_BITS);
+    memcpy(base, dict, dict_len);
+    u32 = bm->len;
+    memcpy(out, &u32, 4);
+    out_len = 4;
+    for(pos = 0; pos < bm->len; pos += n) {
+        n = bm->len - pos;
+        if (n > QJS_BUNDLE_BLOCK_SIZE)
+            n = QJS_BUNDLE_BLOCK_SIZE;
+        memcpy(base + dict_len, bm->data + pos, n);
+        block_len = lz_compress(out + out_len + 4, base, dict_len, n, htab);
+        if (block_len >= n) {
+            memcpy(out + out_len + 4, bm->data + pos, n);
+            block_len = n;
+            u32 = n | QJS_BUNDLE_BLOCK_STORED;
+        } else {
+            u32 = block_len;
+        }
+        memcpy(out + out_len, &u32, 4);
+        out_len += 4 + block_len;
+    }
+    printf("compressed: %s %zu -> %zu\n", bm->name, bm->len, out_len);
+    free(htab);
+    free(base);
+    free(bm->data);
+    bm->data = out;
+    bm->len = out_len;
+}
+
+/* Build the dictionary from the substrings found in several modules.
+   The modules are cut in segments which are scored by the number of
+   other modules containing their k-mers. The best segments are kept,
+   the k-mers of a kept segment no longer count so that the dictionary
+   has few duplicates. The best segment is last because it has the
+   shortest offsets. Return the dictionary length. */
+
+#define DICT_KMER         8
+#define DICT_SEGMENT      64
+#define DICT_HASH_BITS    20
+
+typedef struct {
+    int module;
+    size_t pos;
+    uint32_t score;
+} dict_segment_t;
+
+static uint32_t dict_kmer_hash(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return (v * UINT64_C(0x9e3779b97f4a7c15)) >> (64 - DICT_HASH_BITS);
+}
+
+static uint32_t dict_segment_score(const dict_segment_t *seg,
+                                   const uint16_t *counts)
+{
+    const uint8_t *p = bundle_modules[seg->module].data + seg->pos;
+    uint32_t score = 0;
+    int i;
+
+    for(i = 0; i + DICT_KMER <= DICT_SEGMENT; i++) {
+        if (counts[dict_kmer_hash(p + i)] > 1)
+            score += counts[dict_kmer_hash(p + i)] - 1;
+    }
+    return score;
+}
+
+static int dict_segment_cmp(const void *a, const void *b)
+{
+    const dict_segment_t *s1 = a, *s2 = b;
+    if (s1->score != s2->score)
+        return s1->score < s2->score ? 1 : -1;
+    if (s1->module != s2->module)
+        return s1->module - s2->module;
+    return s1->pos < s2->pos ? -1 : s1->pos > s2->pos;
+}
+
+static size_t build_dictionary(uint8_t *dict, size_t dict_size)
+{
+    uint16_t *counts;
+    int32_t *last_module;
+    dict_segment_t *segs;
+    size_t seg_count, seg_size, pos, dict_len;
+    uint32_t h, score;
+    bundle_module_t *bm;
+    int i, j;
+
+    counts = xmalloc(sizeof(counts[0]) << DICT_HASH_BITS);
+    last_module = xmalloc(sizeof(last_module[0]) << DICT_HASH_BITS);
+    memset(counts, 0, sizeof(counts[0]) << DICT_HASH_BITS);
+    memset(last_module, 0xff, sizeof(last_module[0]) << DICT_HASH_BITS);
+    seg_count = seg_size = 0;
+    segs = NULL;
+    for(i = 0; i < bundle_module_count; i++) {
+        bm = &bundle_modules[i];
+        for(pos = 0; pos + DICT_KMER <= bm->len; pos++) {
+            h = dict_kmer_hash(bm->data + pos);
+            if (last_module[h] != i && counts[h] < UINT16_MAX) {
+                last_module[h] = i;
+                counts[h]++;
+            }
+        }
+        for(pos = 0; pos + DICT_SEGMENT <= bm->len; pos += DICT_SEGMENT) {
+            if (seg_count == seg_size) {
+                seg_size = seg_size * 2 + 256;
+                segs = realloc(segs, seg_size * sizeof(segs[0]));
+                if (!segs) {
+                    fprintf(stderr, "qjsc: out of memory\n");
+                    exit(1);
+                }
+            }
+            segs[seg_count].module = i;
+            segs[seg_count].pos = pos;
+            seg_count++;
+        }
+    }
+    for(pos = 0; pos < seg_count; pos++)
+        segs[pos].score = dict_segment_score(&segs[pos], counts);
+    qsort(segs, seg_count, sizeof(segs[0]), dict_segment_cmp);
+
+    /* filled from the end */
+    dict_len = 0;
+    for(pos = 0; pos < seg_count && segs[pos].score > 0; pos++) {
+        if (dict_len + DICT_SEGMENT > dict_size)
+            break;
+        /* the score decreases when the k-mers are already in the dictionary */
+        score = dict_segment_score(&segs[pos], counts);
+        if (score < segs[pos].score / 2)
+            continue;
+        bm = &bundle_modules[segs[pos].module];
+        dict_len += DICT_SEGMENT;
+        memcpy(dict + dict_size - dict_len, bm->data + segs[pos].pos,
+               DICT_SEGMENT);
+        for(j = 0; j + DICT_KMER <= DICT_SEGMENT; j++)
+            counts[dict_kmer_hash(bm->data + segs[pos].pos + j)] = 0;
+    }
+    memmove(dict, dict + dict_size - dict_len, dict_len);
+    free(segs);
+    free(last_module);
+    free(counts);
+    return dict_len;
+}
+
+/* insert an entry which is not a module before the modules */
+static void bundle_insert_first(const char *name, uint8_t flags,
+                                uint8_t *data, size_t len)
+{
+    bundle_module_t *bm;
+
+    bundle_modules = realloc(bundle_modules, sizeof(bundle_modules[0]) *
+                             (bundle_module_count + 1));
+    if (!bundle_modules) {
+        fprintf(stderr, "qjsc: out of memory\n");
+        exit(1);
+    }
+    memmove(bundle_modules + 1, bundle_modules,
+            sizeof(bundle_modules[0]) * bundle_module_count);
+    bundle_module_count++;
+    bundle_module_size = bundle_module_count;
+    bm = &bundle_modules[0];
+    bm->name = strdup(name);
+    bm->flags = flags;
+    bm->data = data;
+    bm->len = len;
+}
+
+/* write the indexed bundle (see qjs_bundle.h) */
+static void output_bundle(JSContext *ctx, FILE *fo)
+{
+    uint32_t u32;
+    uint16_t u16;
+    uint64_t offset, len;
+    bundle_module_t *bm;
+    uint8_t *dict;
+    size_t dict_len;
+    int i;
+
+    if (share_atoms) {
+        uint8_t *atoms;
+        size_t atoms_len;
+
+        atoms = JS_WriteAtomTable(ctx, &atoms_len);
+        if (!atoms) {
+            js_std_dump_error(ctx);
+            exit(1);
+        }
+        printf("atom table: %zu bytes\n", atoms_len);
+        /* compressed with the modules */
+        bundle_insert_first("", QJS_BUNDLE_MODULE_ATOMS,
+                            xmalloc(atoms_len), atoms_len);
+        memcpy(bundle_modules[0].data, atoms, atoms_len);
+        js_free(ctx, atoms);
+    }
+
+    dict = NULL;
+    dict_len = 0;
+    if (compress_bundle) {
+        if (bundle_module_count > 1) {
+            dict = xmalloc(QJS_BUNDLE_DICT_MAX_SIZE);
+            dict_len = build_dictionary(dict, QJS_BUNDLE_DICT_MAX_SIZE);
+            printf("dictionary: %zu bytes\n", dict_len);
+        }
+        for(i = 0; i < bundle_module_count; i++)
+            lz_compress_module(&bundle_modules[i], dict, dict_len);
+        if (dict_len > 0) {
+            /* the dictionary is stored as the first entry */
+            bundle_insert_first("", QJS_BUNDLE_MODULE_DICTIONARY, dict,
+                                dict_len);
+        } else {
+            free(dict);
+        }
+    }
+    if (xor_secret) {
+        for(i = 0; i < bundle_module_count; i++)
+            xor_encode(bundle_modules[i].data, bundle_modules[i].len);
+    }
+
+    u32 = QJS_BUNDLE_MAGIC;
+    fwrite(&u32, sizeof(u32), 1, fo);
+    u16 = compress_bundle ? QJS_BUNDLE_VERSION_LZ : QJS_BUNDLE_VERSION;
+    fwrite(&u16, sizeof(u16), 1, fo);
+    u16 = 0;
+    fwrite(&u16, sizeof(u16), 1, fo);
+    u32 = QJS_BUNDLE_BC_VERSION;
+    fwrite(&u32, sizeof(u32), 1, fo);
+    u32 = bundle_module_count;
+    fwrite(&u32, sizeof(u32), 1, fo);
+    printf("bc_head version: %d\n", QJS_BUNDLE_BC_VERSION);
+
+    offset = QJS_BUNDLE_HEADER_SIZE;
+    for(i = 0; i < bundle_module_count; i++)
+        offset += 3 + strlen(bundle_modules[i].name) + 16;
+    for(i = 0; i < bundle_module_count; i++) {
+        bm = &bundle_modules[i];
+        fwrite(&bm->flags, sizeof(bm->flags), 1, fo);
+        u16 = strlen(bm->name);
+        fwrite(&u16, sizeof(u16), 1, fo);
+        fwrite(bm->name, 1, u16, fo);
+        fwrite(&offset, sizeof(offset), 1, fo);
+        len = bm->len;
+        fwrite(&len, sizeof(len), 1, fo);
+        offset += len;
+    }
+    for(i = 0; i < bundle_module_count; i++) {
+        bm = &bundle_modules[i];
+        fwrite(bm->data, 1, bm->len, fo);
+        free(bm->data);
+        free(bm->name);
+    }
+    free(bundle_modules);
+    bundle_modules = NULL;
+    bundle_module_count = bundle_module_size = 0;
+}
+
 static int js_module_dummy_init(JSContext *ctx, JSModuleDef *m)
 {
     /* should never be called when compiling JS code */
@@ -335,6 +739,299 @@ static void compile_file(JSContext *ctx, FILE *fo,
     JS_FreeValue(ctx, obj);
 }
 
+#if JS_HAVE_THREADS
+
+/* parallel compilation of the bundle ("-j n"): each thread compiles
+   modules in its own runtime. The imports are only resolved to
+   placeholders and queued, then the main thread reads the compiled
+   modules back and outputs them in the order of a sequential
+   compilation, which also lets them share its atom table. */
+typedef struct compile_job_t {
+    char *filename;
+    const char *script_name;
+    char c_name[1024]; /* entries only */
+    int module; /* -1 = autodetect */
+    bool load_only; /* imported module */
+    uint8_t *data; /* JS_WriteObject() output, malloc() buffer */
+    size_t len;
+} compile_job_t;
+
+static struct {
+    js_mutex_t mutex;
+    js_cond_t cond;
+    compile_job_t **jobs;
+    int count;
+    int size;
+    int next; /* first job not started */
+    int busy; /* jobs being compiled */
+} job_queue;
+
+/* must be called with job_queue.mutex held after the threads are started */
+static compile_job_t *add_job(const char *filename, bool load_only)
+{
+    compile_job_t *job;
+
+    if (job_queue.count == job_queue.size) {
+        job_queue.size = job_queue.size * 2 + 16;
+        job_queue.jobs = realloc(job_queue.jobs, sizeof(job_queue.jobs[0]) *
+                                 job_queue.size);
+        if (!job_queue.jobs) {
+            fprintf(stderr, "qjsc: out of memory\n");
+            exit(1);
+        }
+    }
+    job = xmalloc(sizeof(*job));
+    memset(job, 0, sizeof(*job));
+    job->filename = strdup(filename);
+    job->module = load_only ? 1 : -1;
+    job->load_only = load_only;
+    job_queue.jobs[job_queue.count++] = job;
+    return job;
+}
+
+/* the imported modules are compiled once, the entries always are */
+static compile_job_t *find_module_job(const char *filename)
+{
+    int i;
+
+    for(i = 0; i < job_queue.count; i++) {
+        compile_job_t *job = job_queue.jobs[i];
+        if (job->load_only && !strcmp(job->filename, filename))
+            return job;
+    }
+    return NULL;
+}
+
+static JSModuleDef *jsc_parallel_module_loader(JSContext *ctx,
+                                               const char *module_name,
+                                               void *opaque)
+{
+    if (!namelist_find(&cmodule_list, module_name)) {
+        if (js__has_suffix(module_name, ".so")) {
+            JS_ThrowReferenceError(ctx, "%s: dynamically linking to shared libraries not supported",
+                                   module_name);
+            return NULL;
+        }
+        js_mutex_lock(&job_queue.mutex);
+        if (!find_module_job(module_name)) {
+            add_job(module_name, true);
+            js_cond_signal(&job_queue.cond);
+        }
+        js_mutex_unlock(&job_queue.mutex);
+    }
+    /* enough to resolve the import, the module is not evaluated */
+    return JS_NewCModule(ctx, module_name, js_module_dummy_init);
+}
+
+static void compile_job(JSContext *ctx, compile_job_t *job)
+{
+    uint8_t *buf, *out_buf;
+    size_t buf_len, out_buf_len;
+    int eval_flags, module;
+    JSValue obj;
+
+    buf = js_load_file(ctx, &buf_len, job->filename);
+    if (!buf) {
+        if (job->load_only)
+            fprintf(stderr, "qjsc: could not load module filename '%s'\n", job->filename);
+        else
+            fprintf(stderr, "Could not load '%s'\n", job->filename);
+        exit(1);
+    }
+    module = job->module;
+    if (module < 0) {
+        module = (js__has_suffix(job->filename, ".mjs") ||
+                  JS_DetectModule((const char *)buf, buf_len));
+    }
+    eval_flags = JS_EVAL_FLAG_COMPILE_ONLY;
+    if (module)
+        eval_flags |= JS_EVAL_TYPE_MODULE;
+    else
+        eval_flags |= JS_EVAL_TYPE_GLOBAL;
+    obj = JS_Eval(ctx, (const char *)buf, buf_len,
+                  job->script_name ? job->script_name : job->filename,
+                  eval_flags);
+    js_free(ctx, buf);
+    if (JS_IsException(obj)) {
+        js_mutex_lock(&job_queue.mutex);
+        js_std_dump_error(ctx);
+        exit(1);
+    }
+    /* stripped when it is written again by the main thread */
+    out_buf = JS_WriteObject(ctx, &out_buf_len, obj, JS_WRITE_OBJ_BYTECODE);
+    JS_FreeValue(ctx, obj);
+    if (!out_buf) {
+        js_mutex_lock(&job_queue.mutex);
+        js_std_dump_error(ctx);
+        exit(1);
+    }
+    job->data = xmalloc(out_buf_len);
+    memcpy(job->data, out_buf, out_buf_len);
+    job->len = out_buf_len;
+    js_free(ctx, out_buf);
+}
+
+static void compile_thread(void *arg)
+{
+    compile_job_t *job;
+    JSRuntime *rt;
+    JSContext *ctx;
+
+    rt = JS_NewRuntime();
+    if (!rt) {
+        fprintf(stderr, "qjsc: out of memory\n");
+        exit(1);
+    }
+    JS_SetModuleLoaderFunc(rt, NULL, jsc_parallel_module_loader, NULL);
+
+    js_mutex_lock(&job_queue.mutex);
+    for(;;) {
+        while (job_queue.next == job_queue.count && job_queue.busy > 0)
+            js_cond_wait(&job_queue.cond, &job_queue.mutex);
+        if (job_queue.next == job_queue.count)
+            break; /* no job left and none can be added */
+        job = job_queue.jobs[job_queue.next++];
+        job_queue.busy++;
+        js_mutex_unlock(&job_queue.mutex);
+
+        /* a new context for each job, so that the loader sees all the
+           imports instead of the modules compiled before */
+        ctx = JS_NewContextRaw(rt);
+        if (!ctx) {
+            fprintf(stderr, "qjsc: out of memory\n");
+            exit(1);
+        }
+        /* enough to compile */
+        JS_AddIntrinsicBaseObjects(ctx);
+        JS_AddIntrinsicEval(ctx);
+        JS_AddIntrinsicRegExpCompiler(ctx);
+        compile_job(ctx, job);
+        JS_FreeContext(ctx);
+
+        js_mutex_lock(&job_queue.mutex);
+        job_queue.busy--;
+        js_cond_broadcast(&job_queue.cond);
+    }
+    js_cond_broadcast(&job_queue.cond);
+    js_mutex_unlock(&job_queue.mutex);
+
+    JS_FreeRuntime(rt);
+}
+
+/* read a compiled module back in the main context, which resolves its
+   imports like the compilation of a sequential build: the modules not
+   loaded yet, including the ones of an import cycle, are output by
+   jsc_emit_module_loader() before it */
+static JSValue read_job(JSContext *ctx, compile_job_t *job)
+{
+    JSValue obj;
+
+    obj = JS_ReadObject(ctx, job->data, job->len, JS_READ_OBJ_BYTECODE);
+    if (JS_IsException(obj)) {
+        js_std_dump_error(ctx);
+        exit(1);
+    }
+    return obj;
+}
+
+/* same as jsc_module_loader() with the module compiled by a thread */
+static JSModuleDef *jsc_emit_module_loader(JSContext *ctx,
+                                           const char *module_name,
+                                           void *opaque)
+{
+    compile_job_t *job;
+    JSModuleDef *m;
+    JSValue obj;
+    char cname[1024];
+
+    job = find_module_job(module_name);
+    if (!job)
+        return jsc_module_loader(ctx, module_name, opaque);
+
+    obj = read_job(ctx, job);
+    get_c_name(cname, sizeof(cname), module_name);
+    if (namelist_find(&cname_list, cname))
+        find_unique_cname(cname, sizeof(cname));
+    output_object_code(ctx, outfile, obj, cname, true);
+
+    /* the module is already referenced, so we must free it */
+    m = JS_VALUE_GET_PTR(obj);
+    JS_FreeValue(ctx, obj);
+    return m;
+}
+
+static void compile_files_parallel(JSContext *ctx, FILE *fo, int nb_threads,
+                                   char **files, int nb_files,
+                                   const char *script_name,
+                                   const char *c_name1, int module,
+                                   namelist_t *dynamic_module_list)
+{
+    js_thread_t *threads;
+    compile_job_t *job;
+    JSValue obj;
+    int i;
+
+    js_mutex_init(&job_queue.mutex);
+    js_cond_init(&job_queue.cond);
+    for(i = 0; i < nb_files; i++) {
+        job = add_job(files[i], false);
+        job->script_name = script_name;
+        job->module = module;
+        if (i == 0 && c_name1)
+            js__pstrcpy(job->c_name, sizeof(job->c_name), c_name1);
+        else
+            get_c_name(job->c_name, sizeof(job->c_name), files[i]);
+    }
+    for(i = 0; i < dynamic_module_list->count; i++) {
+        if (!find_module_job(dynamic_module_list->array[i].name))
+            add_job(dynamic_module_list->array[i].name, true);
+    }
+
+    threads = xmalloc(sizeof(threads[0]) * nb_threads);
+    for(i = 0; i < nb_threads; i++) {
+        if (js_thread_create(&threads[i], compile_thread, NULL, 0)) {
+            fprintf(stderr, "qjsc: could not create thread\n");
+            exit(1);
+        }
+    }
+    for(i = 0; i < nb_threads; i++)
+        js_thread_join(threads[i]);
+    free(threads);
+
+    /* the entries then the -D modules, the imports are output when
+       they are first resolved */
+    JS_SetModuleLoaderFunc(JS_GetRuntime(ctx), NULL,
+                           jsc_emit_module_loader, NULL);
+    for(i = 0; i < nb_files; i++) {
+        job = job_queue.jobs[i];
+        obj = read_job(ctx, job);
+        output_object_code(ctx, fo, obj, job->c_name, false);
+        JS_FreeValue(ctx, obj);
+    }
+    for(i = 0; i < dynamic_module_list->count; i++) {
+        if (!jsc_emit_module_loader(ctx, dynamic_module_list->array[i].name,
+                                    NULL)) {
+            fprintf(stderr, "Could not load dynamic module '%s'\n",
+                    dynamic_module_list->array[i].name);
+            exit(1);
+        }
+    }
+    JS_SetModuleLoaderFunc(JS_GetRuntime(ctx), NULL, jsc_module_loader, NULL);
+
+    for(i = 0; i < job_queue.count; i++) {
+        job = job_queue.jobs[i];
+        free(job->filename);
+        free(job->data);
+        free(job);
+    }
+    free(job_queue.jobs);
+    js_cond_destroy(&job_queue.cond);
+    js_mutex_destroy(&job_queue.mutex);
+    memset(&job_queue, 0, sizeof(job_queue));
+}
+
+#endif /* JS_HAVE_THREADS */
+
 static const char main_c_template1[] =
     "int main(int argc, char **argv)\n"
     "{\n"
@@ -366,7 +1063,10 @@ void help(void)
            "usage: " PROG_NAME " [options] [files]\n"
            "\n"
            "options are:\n"
-           "-b          output raw bytecode instead of C code\n"
+           "-b          output a raw bytecode bundle (see qjs_bundle.h) instead of C code\n"
+           "-z          compress the modules of the bundle\n"
+           "-a          store one atom table shared by the modules of the bundle\n"
+           "-j n        compile the modules of the bundle with 'n' threads\n"
            "-e          output main() and bytecode in a C file\n"
            "-o output   set the output filename\n"
            "-n script_name    set the script name (as used in stack traces)\n"
@@ -435,6 +1135,7 @@ int main(int argc, char **argv)
     size_t stack_size;
     namelist_t dynamic_module_list;
     bool load_system_modules = true;
+    int nb_threads = 1;
 
     out_filename = NULL;
     script_name = NULL;
@@ -479,6 +1180,26 @@ int main(int argc, char **argv)
                 output_type = OUTPUT_RAW;
                 continue;
             }
+            if (opt == 'z') {
+                compress_bundle = true;
+                continue;
+            }
+            if (opt == 'a') {
+                share_atoms = true;
+                continue;
+            }
+            if (opt == 'j') {
+                if (!optarg) {
+                    check_hasarg(optind, argc, opt);
+                    optarg = argv[optind++];
+                }
+                nb_threads = atoi(optarg);
+                if (nb_threads < 1) {
+                    fprintf(stderr, "qjsc: invalid thread count: %s\n", optarg);
+                    exit(1);
+                }
+                continue;
+            }
             if (opt == 'x') {
                 if (!optarg) {
                     check_hasarg(optind, argc, opt);
@@ -594,6 +1315,11 @@ int main(int argc, char **argv)
     if (optind >= argc)
         help();
 
+    if ((share_atoms || nb_threads > 1) && output_type != OUTPUT_RAW) {
+        fprintf(stderr, "qjsc: -a and -j require -b\n");
+        exit(1);
+    }
+
     if (!out_filename)
         out_filename = "out.c";
 
@@ -632,17 +1358,26 @@ int main(int argc, char **argv)
                 );
     }
 
-    for(i = optind; i < argc; i++) {
-        const char *filename = argv[i];
-        compile_file(ctx, fo, filename, script_name, cname, module);
-        cname = NULL;
-    }
+#if JS_HAVE_THREADS
+    if (nb_threads > 1) {
+        compile_files_parallel(ctx, fo, nb_threads, argv + optind,
+                               argc - optind, script_name, cname, module,
+                               &dynamic_module_list);
+    } else
+#endif
+    {
+        for(i = optind; i < argc; i++) {
+            const char *filename = argv[i];
+            compile_file(ctx, fo, filename, script_name, cname, module);
+            cname = NULL;
+        }
 
-    for(i = 0; i < dynamic_module_list.count; i++) {
-        if (!jsc_module_loader(ctx, dynamic_module_list.array[i].name, NULL)) {
-            fprintf(stderr, "Could not load dynamic module '%s'\n",
-                    dynamic_module_list.array[i].name);
-            exit(1);
+        for(i = 0; i < dynamic_module_list.count; i++) {
+            if (!jsc_module_loader(ctx, dynamic_module_list.array[i].name, NULL)) {
+                fprintf(stderr, "Could not load dynamic module '%s'\n",
+                        dynamic_module_list.array[i].name);
+                exit(1);
+            }
         }
     }
 
@@ -699,6 +1434,8 @@ int main(int argc, char **argv)
             }
         }
         fputs(main_c_template2, fo);
+    } else if (output_type == OUTPUT_RAW) {
+        output_bundle(ctx, fo);
     }
 
     JS_FreeContext(ctx);
@@ -78,6 +78,27 @@ typedef sig_t sighandler_t;
 extern char **environ;
 #endif
 
+/* persistent readiness backend for the read/write handlers, poll() is
+   used when it is not available */
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#include <sys/epoll.h>
+#define USE_EPOLL
+#elif defined(__APPLE__) || defined(__OpenBSD__) || defined(__FreeBSD__) || \
+      defined(__NetBSD__) || defined(__DragonFly__)
+#include <sys/event.h>
+#define USE_KQUEUE
+#endif
+
+/* native HTTP client for std.urlGet(), curl is used otherwise */
+#if !defined(__wasi__) && !defined(__EMSCRIPTEN__)
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#define USE_HTTP_CLIENT
+#endif
+
 #endif /* _WIN32 */
 
 #include "cutils.h"
@@ -113,10 +134,15 @@ extern char **environ;
    - add socket calls
 */
 
-typedef struct {
+typedef struct JSOSRWHandler {
     struct list_head link;
+    struct JSOSRWHandler *hash_next; /* in JSThreadState.rw_hash */
     int fd;
     JSValue rw_func[2];
+    /* true if the fd is watched by poll() instead of the event backend */
+    bool polled;
+    int events; /* POLLIN | POLLOUT registered with the event backend */
+    uint64_t id; /* reported by the event backend instead of a pointer */
 } JSOSRWHandler;
 
 typedef struct {
@@ -125,15 +151,25 @@ typedef struct {
     JSValue func;
 } JSOSSignalHandler;
 
-typedef struct {
-    struct list_head link;
+typedef struct JSOSTimer {
+    struct JSOSTimer *hash_next; /* in JSThreadState.timer_hash */
+    int heap_index; /* position in its JSOSTimerHeap */
     int64_t timer_id;
     uint8_t repeats:1;
+    uint8_t expired:1; /* in os_expired_timers instead of os_timers */
+    uint64_t seq; /* creation order */
     int64_t timeout;
     int64_t delay;
     JSValue func;
 } JSOSTimer;
 
+/* binary min-heap of timers */
+typedef struct {
+    JSOSTimer **tab;
+    int count;
+    int size;
+} JSOSTimerHeap;
+
 typedef struct {
     struct list_head link;
     JSValue promise;
@@ -142,13 +178,18 @@ typedef struct {
 
 #ifdef USE_WORKER
 
-typedef struct {
-    struct list_head link;
+typedef struct JSWorkerMessage {
+    struct list_head link; /* in JSWorkerMessagePipe.msg_queue */
+    struct JSWorkerMessage *next; /* in JSWorkerMessagePipe.incoming */
     uint8_t *data;
     size_t data_len;
     /* list of SharedArrayBuffers, necessary to free the message */
     uint8_t **sab_tab;
     size_t sab_tab_len;
+    /* contents of the transferred ArrayBuffers, NULL once adopted by
+       the receiver */
+    uint8_t **transfer_tab;
+    size_t transfer_tab_len;
 } JSWorkerMessage;
 
 typedef struct JSWaker {
@@ -160,9 +201,16 @@ typedef struct JSWaker {
 #endif
 } JSWaker;
 
+/* The senders push the messages to the 'incoming' lock-free stack. The
+   receiver moves them in order to 'msg_queue' a batch at a time. The
+   waker is signaled when a message is pushed to an empty stack and is
+   cleared when 'msg_queue' becomes empty, so there is at most one
+   wakeup per batch. */
 typedef struct {
     int ref_count;
-    js_mutex_t mutex;
+    JSWorkerMessage *_Atomic incoming; /* last sent message first */
+    js_mutex_t mutex; /* protects msg_queue, several threads of a
+                         WorkerPool can receive from the same pipe */
     struct list_head msg_queue; /* list of JSWorkerMessage.link */
     JSWaker waker;
 } JSWorkerMessagePipe;
@@ -177,23 +225,64 @@ typedef struct {
 
 typedef struct JSThreadState {
     struct list_head os_rw_handlers; /* list of JSOSRWHandler.link */
+    int event_fd; /* epoll or kqueue descriptor, -1 if not available */
+    int polled_rw_count; /* number of os_rw_handlers with 'polled' set */
+    uint64_t next_rw_id; /* id of the next JSOSRWHandler */
+    JSOSRWHandler **rw_hash; /* os_rw_handlers by id */
+    int rw_hash_size; /* power of two */
+    int rw_hash_count;
     struct list_head os_signal_handlers; /* list JSOSSignalHandler.link */
-    struct list_head os_timers; /* list of JSOSTimer.link */
+    JSOSTimerHeap os_timers; /* pending timers, ordered by timeout */
+    JSOSTimerHeap os_expired_timers; /* expired timers, in creation order */
+    JSOSTimer **timer_hash; /* setTimeout / setInterval timers by id */
+    int timer_hash_size; /* power of two */
+    int timer_hash_count;
+    uint64_t next_timer_seq;
     struct list_head port_list; /* list of JSWorkerMessageHandler.link */
     struct list_head rejected_promise_list; /* list of JSRejectedPromiseEntry.link */
     int eval_script_recurse; /* only used in the main thread */
     int64_t next_timer_id; /* for setTimeout / setInterval */
     bool can_js_os_poll;
+    size_t idle_gc_budget; /* JS_RunGCStep() budget when idle, 0 = none */
+    bool idle_gc_running; /* a GC cycle was started by js_os_idle_gc() */
+    uint64_t idle_gc_time; /* end of the last idle GC cycle */
+    uint64_t idle_gc_alloc_count; /* JS_GetGCAllocCount() at its start */
     /* not used in the main thread */
 #ifdef USE_WORKER
     JSWorkerMessagePipe *recv_pipe, *send_pipe;
 #else
     void *recv_pipe;
+#endif // USE_WORKER
+    /* context constructor of the workers started from this runtime */
+    JSContext *(*worker_new_context_func)(JSRuntime *rt, void *opaque);
+    void *worker_new_context_opaque;
+    /* asynchronous I/O requests, initialized on first use */
+    int io_pending; /* submitted and not yet handled */
+#ifdef USE_WORKER
+    bool io_ready;
+    js_mutex_t io_mutex;
+    struct list_head io_done; /* list of JSIORequest.link */
+    JSWaker io_waker; /* signaled when io_done is not empty */
+    struct list_head io_fd_requests; /* list of JSIORequest.fd_link */
+    struct list_head io_requests; /* list of JSIORequest.ts_link */
+#endif // USE_WORKER
+    /* idle keep-alive connections of std.urlGet() */
+    struct list_head http_conns; /* list of JSHTTPConn.link */
+    int http_conn_count;
+#ifdef USE_WORKER
+    js_mutex_t http_mutex; /* also used by the I/O threads */
 #endif // USE_WORKER
     JSClassID std_file_class_id;
     JSClassID worker_class_id;
 } JSThreadState;
 
+/* number of GC objects visited per idle GC step */
+#define JS_STD_IDLE_GC_BUDGET 4096
+/* minimum delay in ms between the idle GC cycles */
+#define JS_STD_IDLE_GC_INTERVAL 1000
+/* maximum number of threads of a WorkerPool */
+#define JS_WORKER_POOL_MAX_THREADS 256
+
 static uint64_t os_pending_signals;
 
 static void *js_std_dbuf_realloc(void *opaque, void *ptr, size_t size)
@@ -1554,6 +1643,37 @@ static JSValue js_std_file_putByte(JSContext *ctx, JSValueConst this_val,
 
 #define URL_GET_PROGRAM "curl -s -i --"
 #define URL_GET_BUF_SIZE 4096
+#define URL_GET_TIMEOUT  30000 /* default timeout in ms */
+
+struct JSUrlGetResponse {
+    int status; /* 0 if network or protocol error */
+    DynBuf headers; /* CRLF terminated lines, without the status line */
+    DynBuf data;
+    int timeout; /* in ms, for the built-in HTTP client */
+};
+
+static JSUrlGetFunc *js_url_get_func;
+static void *js_url_get_opaque;
+
+static void js_url_response_init(JSUrlGetResponse *resp)
+{
+    resp->status = 0;
+    dbuf_init(&resp->headers);
+    dbuf_init(&resp->data);
+    resp->timeout = URL_GET_TIMEOUT;
+}
+
+static void js_url_response_free(JSUrlGetResponse *resp)
+{
+    dbuf_free(&resp->headers);
+    dbuf_free(&resp->data);
+}
+
+int js_std_url_response_write(JSUrlGetResponse *resp, bool is_header,
+                              const void *buf, size_t len)
+{
+    return dbuf_put(is_header ? &resp->headers : &resp->data, buf, len);
+}
 
 static int http_get_header_line(FILE *f, char *buf, size_t buf_size,
                                 DynBuf *dbuf)
@@ -1589,42 +1709,17 @@ static int http_get_status(const char *buf)
     return atoi(p);
 }
 
-static JSValue js_std_urlGet(JSContext *ctx, JSValueConst this_val,
-                             int argc, JSValueConst *argv)
+/* download 'url' with the curl command line utility. Return -1 if curl
+   could not be started. */
+static int js_curl_get(const char *url, JSUrlGetResponse *resp)
 {
-    const char *url;
     DynBuf cmd_buf;
-    DynBuf data_buf_s, *data_buf = &data_buf_s;
-    DynBuf header_buf_s, *header_buf = &header_buf_s;
     char *buf;
     size_t i, len;
     int status;
-    JSValue response = JS_UNDEFINED, ret_obj;
-    JSValueConst options_obj;
     FILE *f;
-    bool binary_flag, full_flag;
-
-    url = JS_ToCString(ctx, argv[0]);
-    if (!url)
-        return JS_EXCEPTION;
-
-    binary_flag = false;
-    full_flag = false;
-
-    if (argc >= 2) {
-        options_obj = argv[1];
-
-        if (get_bool_option(ctx, &binary_flag, options_obj, "binary"))
-            goto fail_obj;
-
-        if (get_bool_option(ctx, &full_flag, options_obj, "full")) {
-        fail_obj:
-            JS_FreeCString(ctx, url);
-            return JS_EXCEPTION;
-        }
-    }
 
-    js_std_dbuf_init(ctx, &cmd_buf);
+    dbuf_init(&cmd_buf);
     dbuf_printf(&cmd_buf, "%s '", URL_GET_PROGRAM);
     for(i = 0; url[i] != '\0'; i++) {
         unsigned char c = url[i];
@@ -1642,258 +1737,885 @@ static JSValue js_std_urlGet(JSContext *ctx, JSValueConst this_val,
             break;
         }
     }
-    JS_FreeCString(ctx, url);
     dbuf_putstr(&cmd_buf, "'");
     dbuf_putc(&cmd_buf, '\0');
     if (dbuf_error(&cmd_buf)) {
         dbuf_free(&cmd_buf);
-        return JS_EXCEPTION;
+        return 0;
     }
     //    printf("%s\n", (char *)cmd_buf.buf);
     f = popen((char *)cmd_buf.buf, "r");
     dbuf_free(&cmd_buf);
-    if (!f) {
-        return JS_ThrowTypeError(ctx, "could not start curl");
-    }
-
-    js_std_dbuf_init(ctx, data_buf);
-    js_std_dbuf_init(ctx, header_buf);
+    if (!f)
+        return -1;
 
-    buf = js_malloc(ctx, URL_GET_BUF_SIZE);
+    buf = malloc(URL_GET_BUF_SIZE);
     if (!buf)
-        goto fail;
+        goto done;
 
     /* get the HTTP status */
-    if (http_get_header_line(f, buf, URL_GET_BUF_SIZE, NULL) < 0) {
-        status = 0;
-        goto bad_header;
-    }
+    if (http_get_header_line(f, buf, URL_GET_BUF_SIZE, NULL) < 0)
+        goto done;
     status = http_get_status(buf);
-    if (!full_flag && !(status >= 200 && status <= 299)) {
-        goto bad_header;
-    }
 
     /* wait until there is an empty line */
     for(;;) {
-        if (http_get_header_line(f, buf, URL_GET_BUF_SIZE, header_buf) < 0) {
-        bad_header:
-            response = JS_NULL;
+        if (http_get_header_line(f, buf, URL_GET_BUF_SIZE, &resp->headers) < 0)
             goto done;
-        }
         if (!strcmp(buf, "\r\n"))
             break;
     }
-    if (dbuf_error(header_buf))
-        goto fail;
-    header_buf->size -= 2; /* remove the trailing CRLF */
 
     /* download the data */
     for(;;) {
         len = fread(buf, 1, URL_GET_BUF_SIZE, f);
         if (len == 0)
             break;
-        dbuf_put(data_buf, (uint8_t *)buf, len);
-    }
-    if (dbuf_error(data_buf))
-        goto fail;
-    if (binary_flag) {
-        response = JS_NewArrayBufferCopy(ctx,
-                                         data_buf->buf, data_buf->size);
-    } else {
-        response = JS_NewStringLen(ctx, (char *)data_buf->buf, data_buf->size);
+        dbuf_put(&resp->data, (uint8_t *)buf, len);
     }
-    if (JS_IsException(response))
-        goto fail;
+    resp->status = status;
  done:
-    js_free(ctx, buf);
-    buf = NULL;
+    free(buf);
     pclose(f);
-    f = NULL;
-    dbuf_free(data_buf);
-    data_buf = NULL;
-
-    if (full_flag) {
-        ret_obj = JS_NewObject(ctx);
-        if (JS_IsException(ret_obj))
-            goto fail;
-        JS_DefinePropertyValueStr(ctx, ret_obj, "response",
-                                  response,
-                                  JS_PROP_C_W_E);
-        if (!JS_IsNull(response)) {
-            JS_DefinePropertyValueStr(ctx, ret_obj, "responseHeaders",
-                                      JS_NewStringLen(ctx, (char *)header_buf->buf,
-                                                      header_buf->size),
-                                      JS_PROP_C_W_E);
-            JS_DefinePropertyValueStr(ctx, ret_obj, "status",
-                                      JS_NewInt32(ctx, status),
-                                      JS_PROP_C_W_E);
-        }
-    } else {
-        ret_obj = response;
-    }
-    dbuf_free(header_buf);
-    return ret_obj;
- fail:
-    if (f)
-        pclose(f);
-    js_free(ctx, buf);
-    if (data_buf)
-        dbuf_free(data_buf);
-    if (header_buf)
-        dbuf_free(header_buf);
-    JS_FreeValue(ctx, response);
-    return JS_EXCEPTION;
+    return 0;
 }
-#endif // !defined(__wasi__)
 
-static JSClassDef js_std_file_class = {
-    "FILE",
-    .finalizer = js_std_file_finalizer,
-};
+#ifdef USE_HTTP_CLIENT
 
-static const JSCFunctionListEntry js_std_error_props[] = {
-    /* various errno values */
-#define DEF(x) JS_PROP_INT32_DEF(#x, x, JS_PROP_CONFIGURABLE )
-    DEF(EINVAL),
-    DEF(EIO),
-    DEF(EACCES),
-    DEF(EEXIST),
-    DEF(ENOSPC),
-    DEF(ENOSYS),
-    DEF(EBUSY),
-    DEF(ENOENT),
-    DEF(EPERM),
-    DEF(EPIPE),
-    DEF(EBADF),
-#undef DEF
-};
+/* Native HTTP/1.1 client for the "http:" URLs. The connections are kept
+   alive in a per runtime pool and reused by the next requests to the
+   same host and port. */
 
-static const JSCFunctionListEntry js_std_funcs[] = {
-    JS_CFUNC_DEF("exit", 1, js_std_exit ),
-    JS_CFUNC_DEF("gc", 0, js_std_gc ),
-    JS_CFUNC_DEF("evalScript", 1, js_evalScript ),
-    JS_CFUNC_DEF("loadScript", 1, js_loadScript ),
-    JS_CFUNC_DEF("getenv", 1, js_std_getenv ),
-    JS_CFUNC_DEF("setenv", 1, js_std_setenv ),
-    JS_CFUNC_DEF("unsetenv", 1, js_std_unsetenv ),
-    JS_CFUNC_DEF("getenviron", 1, js_std_getenviron ),
-#if !defined(__wasi__)
-    JS_CFUNC_DEF("urlGet", 1, js_std_urlGet ),
+#define HTTP_MAX_IDLE_CONNS 8
+#define HTTP_MAX_HOST_LEN   255
+#define HTTP_MAX_DATA_SIZE  INT32_MAX /* limit of the response body */
+
+#ifdef MSG_NOSIGNAL
+#define HTTP_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define HTTP_SEND_FLAGS 0
 #endif
-    JS_CFUNC_DEF("loadFile", 1, js_std_loadFile ),
-    JS_CFUNC_DEF("writeFile", 2, js_std_writeFile ),
-    JS_CFUNC_DEF("strerror", 1, js_std_strerror ),
 
-    /* FILE I/O */
-    JS_CFUNC_DEF("open", 2, js_std_open ),
-#if !defined(__wasi__)
-    JS_CFUNC_DEF("popen", 2, js_std_popen ),
-    JS_CFUNC_DEF("tmpfile", 0, js_std_tmpfile ),
+typedef struct JSHTTPConn {
+    struct list_head link; /* in JSThreadState.http_conns */
+    int fd;
+    int port;
+    char host[HTTP_MAX_HOST_LEN + 1];
+} JSHTTPConn;
+
+/* buffered reader of a connection */
+typedef struct {
+    int fd;
+    size_t pos;
+    size_t len;
+    uint8_t buf[URL_GET_BUF_SIZE];
+} JSHTTPReader;
+
+static void http_lock(JSThreadState *ts)
+{
+#ifdef USE_WORKER
+    js_mutex_lock(&ts->http_mutex);
 #endif
-    JS_CFUNC_DEF("fdopen", 2, js_std_fdopen ),
-    JS_CFUNC_MAGIC_DEF("puts", 1, js_std_file_puts, 0 ),
-    JS_CFUNC_DEF("printf", 1, js_std_printf ),
-    JS_CFUNC_DEF("sprintf", 1, js_std_sprintf ),
-    JS_PROP_INT32_DEF("SEEK_SET", SEEK_SET, JS_PROP_CONFIGURABLE ),
-    JS_PROP_INT32_DEF("SEEK_CUR", SEEK_CUR, JS_PROP_CONFIGURABLE ),
-    JS_PROP_INT32_DEF("SEEK_END", SEEK_END, JS_PROP_CONFIGURABLE ),
-    JS_OBJECT_DEF("Error", js_std_error_props, countof(js_std_error_props), JS_PROP_CONFIGURABLE),
-};
+}
 
-static const JSCFunctionListEntry js_std_file_proto_funcs[] = {
-    JS_CFUNC_DEF("close", 0, js_std_file_close ),
-    JS_CFUNC_MAGIC_DEF("puts", 1, js_std_file_puts, 1 ),
-    JS_CFUNC_DEF("printf", 1, js_std_file_printf ),
-    JS_CFUNC_DEF("flush", 0, js_std_file_flush ),
-    JS_CFUNC_MAGIC_DEF("tell", 0, js_std_file_tell, 0 ),
-    JS_CFUNC_MAGIC_DEF("tello", 0, js_std_file_tell, 1 ),
-    JS_CFUNC_DEF("seek", 2, js_std_file_seek ),
-    JS_CFUNC_DEF("eof", 0, js_std_file_eof ),
-    JS_CFUNC_DEF("fileno", 0, js_std_file_fileno ),
-    JS_CFUNC_DEF("error", 0, js_std_file_error ),
-    JS_CFUNC_DEF("clearerr", 0, js_std_file_clearerr ),
-    JS_CFUNC_MAGIC_DEF("read", 3, js_std_file_read_write, 0 ),
-    JS_CFUNC_MAGIC_DEF("write", 3, js_std_file_read_write, 1 ),
-    JS_CFUNC_DEF("getline", 0, js_std_file_getline ),
-    JS_CFUNC_MAGIC_DEF("readAsArrayBuffer", 0, js_std_file_readAs, 0 ),
-    JS_CFUNC_MAGIC_DEF("readAsString", 0, js_std_file_readAs, 1 ),
-    JS_CFUNC_DEF("getByte", 0, js_std_file_getByte ),
-    JS_CFUNC_DEF("putByte", 1, js_std_file_putByte ),
-    /* setvbuf, ...  */
-};
+static void http_unlock(JSThreadState *ts)
+{
+#ifdef USE_WORKER
+    js_mutex_unlock(&ts->http_mutex);
+#endif
+}
 
-static int js_std_init(JSContext *ctx, JSModuleDef *m)
+/* parse "http://host[:port][/path]". Return false if the URL must be
+   handled by curl. */
+static bool http_parse_url(const char *url, char *host, int *pport,
+                           const char **ppath)
 {
-    JSValue proto;
-    JSRuntime *rt = JS_GetRuntime(ctx);
-    JSThreadState *ts = js_get_thread_state(rt);
+    const char *p, *q, *end;
+    size_t len, i;
+    long port;
 
-    /* FILE class */
-    /* the class ID is created once */
-    JS_NewClassID(rt, &ts->std_file_class_id);
-    /* the class is created once per runtime */
-    JS_NewClass(rt, ts->std_file_class_id, &js_std_file_class);
-    proto = JS_NewObject(ctx);
-    JS_SetPropertyFunctionList(ctx, proto, js_std_file_proto_funcs,
-                               countof(js_std_file_proto_funcs));
-    JS_SetClassProto(ctx, ts->std_file_class_id, proto);
+    if (strncmp(url, "http://", 7))
+        return false;
+    p = url + 7;
+    end = p + strcspn(p, "/?#");
+    if (memchr(p, '@', end - p))
+        return false; /* user name and password */
+    if (*p == '[') {
+        /* IPv6 address */
+        p++;
+        q = memchr(p, ']', end - p);
+        if (!q)
+            return false;
+        len = q - p;
+        q++;
+    } else {
+        q = p;
+        while (q < end && *q != ':')
+            q++;
+        len = q - p;
+    }
+    if (len == 0 || len > HTTP_MAX_HOST_LEN)
+        return false;
+    for(i = 0; i < len; i++) {
+        /* the host is copied to the request */
+        if ((uint8_t)p[i] <= ' ' || (uint8_t)p[i] >= 0x7f)
+            return false;
+    }
+    memcpy(host, p, len);
+    host[len] = '\0';
+    port = 80;
+    if (q < end) {
+        if (*q != ':' || q + 1 == end)
+            return false;
+        port = 0;
+        for(q++; q < end; q++) {
+            if (!my_isdigit(*q))
+                return false;
+            port = port * 10 + (*q - '0');
+            if (port > 65535)
+                return false;
+        }
+    }
+    *pport = port;
+    *ppath = end;
+    return true;
+}
 
-    JS_SetModuleExportList(ctx, m, js_std_funcs,
-                           countof(js_std_funcs));
-    JS_SetModuleExport(ctx, m, "in", js_new_std_file(ctx, stdin, false));
-    JS_SetModuleExport(ctx, m, "out", js_new_std_file(ctx, stdout, false));
-    JS_SetModuleExport(ctx, m, "err", js_new_std_file(ctx, stderr, false));
+/* connect 'fd' to 'ai' in less than 'timeout' ms */
+static int http_connect_timeout(int fd, struct addrinfo *ai, int timeout)
+{
+    struct pollfd pfd;
+    socklen_t len;
+    int flags, ret, err;
+
+    flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+    ret = connect(fd, ai->ai_addr, ai->ai_addrlen);
+    if (ret < 0 && errno == EINPROGRESS) {
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        do {
+            ret = poll(&pfd, 1, timeout);
+        } while (ret < 0 && errno == EINTR);
+        if (ret <= 0)
+            return -1;
+        len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err)
+            return -1;
+        ret = 0;
+    }
+    if (ret < 0 || fcntl(fd, F_SETFL, flags) < 0)
+        return -1;
     return 0;
 }
 
-JSModuleDef *js_init_module_std(JSContext *ctx, const char *module_name)
+/* the send() and recv() calls fail after 'timeout' ms without progress */
+static void http_set_timeout(int fd, int timeout)
 {
-    JSModuleDef *m;
-    m = JS_NewCModule(ctx, module_name, js_std_init);
-    if (!m)
-        return NULL;
-    JS_AddModuleExportList(ctx, m, js_std_funcs, countof(js_std_funcs));
-    JS_AddModuleExport(ctx, m, "in");
-    JS_AddModuleExport(ctx, m, "out");
-    JS_AddModuleExport(ctx, m, "err");
-    return m;
+    struct timeval tv;
+
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
 }
 
-/**********************************************************/
-/* 'os' object */
+static int http_connect(const char *host, int port, int timeout)
+{
+    struct addrinfo hints, *res, *ai;
+    char port_str[16];
+    int fd, one;
 
-static JSValue js_os_open(JSContext *ctx, JSValueConst this_val,
-                          int argc, JSValueConst *argv)
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    if (getaddrinfo(host, port_str, &hints, &res))
+        return -1;
+    fd = -1;
+    for(ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (http_connect_timeout(fd, ai, timeout) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0)
+        return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    return fd;
+}
+
+/* return an idle connection to host:port or -1 */
+static int http_conn_get(JSThreadState *ts, const char *host, int port)
 {
-    const char *filename;
-    int flags, mode, ret;
+    struct list_head *el;
+    JSHTTPConn *c;
+    int fd;
 
-    filename = JS_ToCString(ctx, argv[0]);
-    if (!filename)
-        return JS_EXCEPTION;
-    if (JS_ToInt32(ctx, &flags, argv[1]))
-        goto fail;
-    if (argc >= 3 && !JS_IsUndefined(argv[2])) {
-        if (JS_ToInt32(ctx, &mode, argv[2])) {
-        fail:
-            JS_FreeCString(ctx, filename);
-            return JS_EXCEPTION;
+    fd = -1;
+    http_lock(ts);
+    list_for_each(el, &ts->http_conns) {
+        c = list_entry(el, JSHTTPConn, link);
+        if (c->port == port && !strcmp(c->host, host)) {
+            list_del(&c->link);
+            ts->http_conn_count--;
+            fd = c->fd;
+            free(c);
+            break;
         }
-    } else {
-        mode = 0666;
     }
-#if defined(_WIN32)
-    /* force binary mode by default */
-    if (!(flags & O_TEXT))
-        flags |= O_BINARY;
-#endif
-    ret = js_get_errno(open(filename, flags, mode));
-    JS_FreeCString(ctx, filename);
-    return JS_NewInt32(ctx, ret);
+    http_unlock(ts);
+    return fd;
 }
 
-static JSValue js_os_close(JSContext *ctx, JSValueConst this_val,
-                           int argc, JSValueConst *argv)
+static void http_conn_put(JSThreadState *ts, const char *host, int port,
+                          int fd)
+{
+    JSHTTPConn *c;
+
+    c = NULL;
+    http_lock(ts);
+    if (ts->http_conn_count < HTTP_MAX_IDLE_CONNS)
+        c = malloc(sizeof(*c));
+    if (c) {
+        c->fd = fd;
+        c->port = port;
+        strcpy(c->host, host);
+        list_add(&c->link, &ts->http_conns);
+        ts->http_conn_count++;
+    }
+    http_unlock(ts);
+    if (!c)
+        close(fd);
+}
+
+static void http_free_conns(JSThreadState *ts)
+{
+    struct list_head *el, *el1;
+    JSHTTPConn *c;
+
+    list_for_each_safe(el, el1, &ts->http_conns) {
+        c = list_entry(el, JSHTTPConn, link);
+        list_del(&c->link);
+        close(c->fd);
+        free(c);
+    }
+    ts->http_conn_count = 0;
+}
+
+static int http_send(int fd, const uint8_t *buf, size_t len)
+{
+    ssize_t ret;
+
+    while (len > 0) {
+        ret = send(fd, buf, len, HTTP_SEND_FLAGS);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/* read at most 'len' bytes, from the buffer first. Return 0 at the end
+   of the stream or < 0 if error. */
+static ssize_t http_read(JSHTTPReader *r, uint8_t *buf, size_t len)
+{
+    ssize_t ret;
+
+    if (r->pos < r->len) {
+        if (len > r->len - r->pos)
+            len = r->len - r->pos;
+        memcpy(buf, r->buf + r->pos, len);
+        r->pos += len;
+        return len;
+    }
+    for(;;) {
+        ret = recv(r->fd, buf, len, 0);
+        if (ret >= 0 || errno != EINTR)
+            return ret;
+    }
+}
+
+static int http_getc(JSHTTPReader *r)
+{
+    ssize_t ret;
+
+    if (r->pos == r->len) {
+        ret = http_read(r, r->buf, sizeof(r->buf));
+        if (ret <= 0)
+            return -1;
+        r->pos = 0;
+        r->len = ret;
+    }
+    return r->buf[r->pos++];
+}
+
+/* same as http_get_header_line() */
+static int http_read_line(JSHTTPReader *r, char *buf, size_t buf_size,
+                          DynBuf *dbuf)
+{
+    int c;
+    char *p;
+
+    p = buf;
+    for(;;) {
+        c = http_getc(r);
+        if (c < 0)
+            return -1;
+        if ((p - buf) < buf_size - 1)
+            *p++ = c;
+        if (dbuf)
+            dbuf_putc(dbuf, c);
+        if (c == '\n')
+            break;
+    }
+    *p = '\0';
+    return 0;
+}
+
+/* append exactly 'len' bytes to 'data' */
+static int http_read_data(JSHTTPReader *r, DynBuf *data, size_t len)
+{
+    ssize_t ret;
+
+    /* the length comes from the server: it must not wrap around */
+    if (len > HTTP_MAX_DATA_SIZE - data->size)
+        return -1;
+    if (dbuf_realloc(data, data->size + len))
+        return -1;
+    while (len > 0) {
+        ret = http_read(r, data->buf + data->size, len);
+        if (ret <= 0)
+            return -1;
+        data->size += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/* return the value of the header 'name' in 'line' or NULL */
+static const char *http_header_value(const char *line, const char *name)
+{
+    size_t len = strlen(name);
+
+    if (strncasecmp(line, name, len) || line[len] != ':')
+        return NULL;
+    line += len + 1;
+    while (*line == ' ' || *line == '\t')
+        line++;
+    return line;
+}
+
+static bool http_has_token(const char *value, const char *token)
+{
+    size_t len = strlen(token);
+
+    for(;;) {
+        while (*value == ' ' || *value == '\t' || *value == ',')
+            value++;
+        if (*value == '\0' || *value == '\r' || *value == '\n')
+            return false;
+        if (!strncasecmp(value, token, len) &&
+            strchr(" \t,\r\n", value[len]))
+            return true;
+        value += strcspn(value, ",");
+    }
+}
+
+/* read the response of a GET request. Return -1 if error and set
+   '*pkeep_alive' if the connection can be reused. */
+static int http_read_response(JSHTTPReader *r, JSUrlGetResponse *resp,
+                              bool *pkeep_alive)
+{
+    char line[URL_GET_BUF_SIZE];
+    const char *v;
+    int64_t content_length;
+    bool chunked, keep_alive, has_body;
+    size_t chunk_len;
+    char *p;
+    uint8_t *buf;
+    ssize_t ret;
+
+    *pkeep_alive = false;
+    /* the interim 1xx responses are followed by the final one */
+    do {
+        if (http_read_line(r, line, sizeof(line), NULL) < 0)
+            return -1;
+        if (strncmp(line, "HTTP/1.", 7))
+            return -1;
+        keep_alive = (line[7] != '0');
+        resp->status = http_get_status(line);
+        resp->headers.size = 0;
+        content_length = -1;
+        chunked = false;
+        for(;;) {
+            if (http_read_line(r, line, sizeof(line), &resp->headers) < 0)
+                return -1;
+            if (!strcmp(line, "\r\n"))
+                break;
+            if ((v = http_header_value(line, "content-length")))
+                content_length = strtoll(v, NULL, 10);
+            else if ((v = http_header_value(line, "transfer-encoding")))
+                chunked = http_has_token(v, "chunked");
+            else if ((v = http_header_value(line, "connection")))
+                keep_alive = !http_has_token(v, "close") &&
+                    (keep_alive || http_has_token(v, "keep-alive"));
+        }
+    } while (resp->status >= 100 && resp->status <= 199);
+
+    has_body = !(resp->status == 204 || resp->status == 304);
+    if (!has_body) {
+    } else if (chunked) {
+        for(;;) {
+            if (http_read_line(r, line, sizeof(line), NULL) < 0)
+                return -1;
+            chunk_len = strtoul(line, &p, 16);
+            if (p == line)
+                return -1;
+            if (chunk_len == 0)
+                break;
+            if (http_read_data(r, &resp->data, chunk_len) ||
+                http_read_line(r, line, sizeof(line), NULL) < 0)
+                return -1;
+        }
+        /* trailer */
+        do {
+            if (http_read_line(r, line, sizeof(line), NULL) < 0)
+                return -1;
+        } while (strcmp(line, "\r\n"));
+    } else if (content_length >= 0) {
+        if (content_length > HTTP_MAX_DATA_SIZE ||
+            http_read_data(r, &resp->data, content_length))
+            return -1;
+    } else {
+        /* the end of the body is the end of the connection */
+        keep_alive = false;
+        buf = NULL;
+        for(;;) {
+            if (resp->data.size > HTTP_MAX_DATA_SIZE - URL_GET_BUF_SIZE ||
+                dbuf_realloc(&resp->data, resp->data.size + URL_GET_BUF_SIZE))
+                return -1;
+            buf = resp->data.buf + resp->data.size;
+            ret = http_read(r, buf, URL_GET_BUF_SIZE);
+            if (ret < 0)
+                return -1;
+            if (ret == 0)
+                break;
+            resp->data.size += ret;
+        }
+    }
+    /* the pending data would be parsed as the next response */
+    *pkeep_alive = keep_alive && r->pos == r->len;
+    return 0;
+}
+
+/* append the request target. The bytes which cannot appear in it are
+   percent-encoded so that the URL cannot add headers or requests. */
+static void http_put_path(DynBuf *req, const char *path)
+{
+    const uint8_t *p;
+
+    if (*path != '/')
+        dbuf_putc(req, '/');
+    for(p = (const uint8_t *)path; *p != '\0' && *p != '#'; p++) {
+        if (*p <= ' ' || *p >= 0x7f)
+            dbuf_printf(req, "%%%02X", *p);
+        else
+            dbuf_putc(req, *p);
+    }
+}
+
+/* Return false if the URL is not handled */
+static bool js_http_get(JSThreadState *ts, const char *url,
+                        JSUrlGetResponse *resp)
+{
+    char host[HTTP_MAX_HOST_LEN + 1];
+    const char *path;
+    DynBuf req;
+    JSHTTPReader *r;
+    int port, fd, attempt;
+    bool reused, keep_alive;
+
+    if (!http_parse_url(url, host, &port, &path))
+        return false;
+
+    dbuf_init(&req);
+    dbuf_putstr(&req, "GET ");
+    http_put_path(&req, path);
+    dbuf_putstr(&req, " HTTP/1.1\r\n");
+    if (strchr(host, ':'))
+        dbuf_printf(&req, "Host: [%s]", host);
+    else
+        dbuf_printf(&req, "Host: %s", host);
+    if (port != 80)
+        dbuf_printf(&req, ":%d", port);
+    dbuf_putstr(&req, "\r\nUser-Agent: quickjs\r\nAccept: */*\r\n\r\n");
+    r = malloc(sizeof(*r));
+    if (dbuf_error(&req) || !r)
+        goto done;
+
+    for(attempt = 0; attempt < 2; attempt++) {
+        fd = http_conn_get(ts, host, port);
+        reused = (fd >= 0);
+        if (!reused)
+            fd = http_connect(host, port, resp->timeout);
+        if (fd < 0)
+            break;
+        http_set_timeout(fd, resp->timeout);
+        r->fd = fd;
+        r->pos = r->len = 0;
+        if (http_send(fd, req.buf, req.size) == 0 &&
+            http_read_response(r, resp, &keep_alive) == 0) {
+            if (keep_alive)
+                http_conn_put(ts, host, port, fd);
+            else
+                close(fd);
+            goto done;
+        }
+        close(fd);
+        /* the server may have closed an idle connection: retry once
+           with a new one */
+        resp->status = 0;
+        resp->headers.size = 0;
+        resp->data.size = 0;
+        if (!reused)
+            break;
+    }
+ done:
+    free(r);
+    dbuf_free(&req);
+    return true;
+}
+
+#endif // USE_HTTP_CLIENT
+
+/* download 'url'. Return -1 if curl could not be started. Can be called
+   from the I/O threads. */
+static int js_url_get(JSThreadState *ts, const char *url,
+                      JSUrlGetResponse *resp)
+{
+    if (js_url_get_func) {
+        resp->status = max_int(js_url_get_func(js_url_get_opaque, url, resp), 0);
+        return 0;
+    }
+#ifdef USE_HTTP_CLIENT
+    if (js_http_get(ts, url, resp))
+        return 0;
+#endif
+    return js_curl_get(url, resp);
+}
+
+static void js_url_free_data(JSRuntime *rt, void *opaque, void *ptr)
+{
+    free(ptr);
+}
+
+/* build the result of urlGet() from the response */
+static JSValue js_url_get_result(JSContext *ctx, JSUrlGetResponse *resp,
+                                 bool binary_flag, bool full_flag)
+{
+    JSValue response, ret_obj;
+    int status;
+
+    status = resp->status;
+    if (status == 0 || (!full_flag && !(status >= 200 && status <= 299))) {
+        response = JS_NULL;
+    } else if (binary_flag) {
+        /* the ArrayBuffer takes ownership of the downloaded data */
+        if (resp->data.buf) {
+            response = JS_NewArrayBuffer(ctx, resp->data.buf, resp->data.size,
+                                         js_url_free_data, NULL, false);
+            if (!JS_IsException(response))
+                dbuf_init(&resp->data);
+        } else {
+            response = JS_NewArrayBufferCopy(ctx, NULL, 0);
+        }
+    } else {
+        response = JS_NewStringLen(ctx, (char *)resp->data.buf, resp->data.size);
+    }
+    if (JS_IsException(response))
+        return JS_EXCEPTION;
+
+    if (!full_flag)
+        return response;
+    ret_obj = JS_NewObject(ctx);
+    if (JS_IsException(ret_obj)) {
+        JS_FreeValue(ctx, response);
+        return JS_EXCEPTION;
+    }
+    JS_DefinePropertyValueStr(ctx, ret_obj, "response",
+                              response,
+                              JS_PROP_C_W_E);
+    if (!JS_IsNull(response)) {
+        /* remove the trailing CRLF */
+        JS_DefinePropertyValueStr(ctx, ret_obj, "responseHeaders",
+                                  JS_NewStringLen(ctx, (char *)resp->headers.buf,
+                                                  max_int(resp->headers.size, 2) - 2),
+                                  JS_PROP_C_W_E);
+        JS_DefinePropertyValueStr(ctx, ret_obj, "status",
+                                  JS_NewInt32(ctx, status),
+                                  JS_PROP_C_W_E);
+    }
+    return ret_obj;
+}
+
+static int js_url_get_options(JSContext *ctx, int argc, JSValueConst *argv,
+                              bool *pbinary_flag, bool *pfull_flag,
+                              int *ptimeout)
+{
+    JSValue val;
+    int64_t timeout;
+    int ret;
+
+    *pbinary_flag = false;
+    *pfull_flag = false;
+    *ptimeout = URL_GET_TIMEOUT;
+    if (argc >= 2) {
+        if (get_bool_option(ctx, pbinary_flag, argv[1], "binary") ||
+            get_bool_option(ctx, pfull_flag, argv[1], "full"))
+            return -1;
+        val = JS_GetPropertyStr(ctx, argv[1], "timeout");
+        if (JS_IsException(val))
+            return -1;
+        ret = 0;
+        if (!JS_IsUndefined(val)) {
+            ret = JS_ToInt64(ctx, &timeout, val);
+            *ptimeout = min_int64(max_int64(timeout, 1), INT32_MAX);
+        }
+        JS_FreeValue(ctx, val);
+        if (ret)
+            return -1;
+    }
+    return 0;
+}
+
+static JSValue js_std_urlGet(JSContext *ctx, JSValueConst this_val,
+                             int argc, JSValueConst *argv)
+{
+    JSThreadState *ts = js_get_thread_state(JS_GetRuntime(ctx));
+    JSUrlGetResponse resp;
+    const char *url;
+    bool binary_flag, full_flag;
+    JSValue ret;
+    int err, timeout;
+
+    url = JS_ToCString(ctx, argv[0]);
+    if (!url)
+        return JS_EXCEPTION;
+    if (js_url_get_options(ctx, argc, argv, &binary_flag, &full_flag,
+                           &timeout)) {
+        JS_FreeCString(ctx, url);
+        return JS_EXCEPTION;
+    }
+    js_url_response_init(&resp);
+    resp.timeout = timeout;
+    err = js_url_get(ts, url, &resp);
+    JS_FreeCString(ctx, url);
+    if (err < 0)
+        return JS_ThrowTypeError(ctx, "could not start curl");
+    if (dbuf_error(&resp.headers) || dbuf_error(&resp.data)) {
+        js_url_response_free(&resp);
+        return JS_ThrowOutOfMemory(ctx);
+    }
+    ret = js_url_get_result(ctx, &resp, binary_flag, full_flag);
+    js_url_response_free(&resp);
+    return ret;
+}
+
+void js_std_set_url_get_func(JSUrlGetFunc *func, void *opaque)
+{
+    js_url_get_func = func;
+    js_url_get_opaque = opaque;
+}
+#else
+void js_std_set_url_get_func(JSUrlGetFunc *func, void *opaque)
+{
+}
+
+int js_std_url_response_write(JSUrlGetResponse *resp, bool is_header,
+                              const void *buf, size_t len)
+{
+    return -1;
+}
+#endif // !defined(__wasi__)
+
+static JSClassDef js_std_file_class = {
+    "FILE",
+    .finalizer = js_std_file_finalizer,
+};
+
+static const JSCFunctionListEntry js_std_error_props[] = {
+    /* various errno values */
+#define DEF(x) JS_PROP_INT32_DEF(#x, x, JS_PROP_CONFIGURABLE )
+    DEF(EINVAL),
+    DEF(EIO),
+    DEF(EACCES),
+    DEF(EEXIST),
+    DEF(ENOSPC),
+    DEF(ENOSYS),
+    DEF(EBUSY),
+    DEF(ENOENT),
+    DEF(EPERM),
+    DEF(EPIPE),
+    DEF(EBADF),
+#undef DEF
+};
+
+#ifdef USE_WORKER
+static JSValue js_std_loadFileAsync(JSContext *ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv);
+#if !defined(__wasi__)
+static JSValue js_std_urlGetAsync(JSContext *ctx, JSValueConst this_val,
+                                  int argc, JSValueConst *argv);
+#endif
+#endif
+
+static const JSCFunctionListEntry js_std_funcs[] = {
+    JS_CFUNC_DEF("exit", 1, js_std_exit ),
+    JS_CFUNC_DEF("gc", 0, js_std_gc ),
+    JS_CFUNC_DEF("evalScript", 1, js_evalScript ),
+    JS_CFUNC_DEF("loadScript", 1, js_loadScript ),
+    JS_CFUNC_DEF("getenv", 1, js_std_getenv ),
+    JS_CFUNC_DEF("setenv", 1, js_std_setenv ),
+    JS_CFUNC_DEF("unsetenv", 1, js_std_unsetenv ),
+    JS_CFUNC_DEF("getenviron", 1, js_std_getenviron ),
+#if !defined(__wasi__)
+    JS_CFUNC_DEF("urlGet", 1, js_std_urlGet ),
+#ifdef USE_WORKER
+    JS_CFUNC_DEF("urlGetAsync", 1, js_std_urlGetAsync ),
+#endif
+#endif
+    JS_CFUNC_DEF("loadFile", 1, js_std_loadFile ),
+#ifdef USE_WORKER
+    JS_CFUNC_DEF("loadFileAsync", 1, js_std_loadFileAsync ),
+#endif
+    JS_CFUNC_DEF("writeFile", 2, js_std_writeFile ),
+    JS_CFUNC_DEF("strerror", 1, js_std_strerror ),
+
+    /* FILE I/O */
+    JS_CFUNC_DEF("open", 2, js_std_open ),
+#if !defined(__wasi__)
+    JS_CFUNC_DEF("popen", 2, js_std_popen ),
+    JS_CFUNC_DEF("tmpfile", 0, js_std_tmpfile ),
+#endif
+    JS_CFUNC_DEF("fdopen", 2, js_std_fdopen ),
+    JS_CFUNC_MAGIC_DEF("puts", 1, js_std_file_puts, 0 ),
+    JS_CFUNC_DEF("printf", 1, js_std_printf ),
+    JS_CFUNC_DEF("sprintf", 1, js_std_sprintf ),
+    JS_PROP_INT32_DEF("SEEK_SET", SEEK_SET, JS_PROP_CONFIGURABLE ),
+    JS_PROP_INT32_DEF("SEEK_CUR", SEEK_CUR, JS_PROP_CONFIGURABLE ),
+    JS_PROP_INT32_DEF("SEEK_END", SEEK_END, JS_PROP_CONFIGURABLE ),
+    JS_OBJECT_DEF("Error", js_std_error_props, countof(js_std_error_props), JS_PROP_CONFIGURABLE),
+};
+
+static const JSCFunctionListEntry js_std_file_proto_funcs[] = {
+    JS_CFUNC_DEF("close", 0, js_std_file_close ),
+    JS_CFUNC_MAGIC_DEF("puts", 1, js_std_file_puts, 1 ),
+    JS_CFUNC_DEF("printf", 1, js_std_file_printf ),
+    JS_CFUNC_DEF("flush", 0, js_std_file_flush ),
+    JS_CFUNC_MAGIC_DEF("tell", 0, js_std_file_tell, 0 ),
+    JS_CFUNC_MAGIC_DEF("tello", 0, js_std_file_tell, 1 ),
+    JS_CFUNC_DEF("seek", 2, js_std_file_seek ),
+    JS_CFUNC_DEF("eof", 0, js_std_file_eof ),
+    JS_CFUNC_DEF("fileno", 0, js_std_file_fileno ),
+    JS_CFUNC_DEF("error", 0, js_std_file_error ),
+    JS_CFUNC_DEF("clearerr", 0, js_std_file_clearerr ),
+    JS_CFUNC_MAGIC_DEF("read", 3, js_std_file_read_write, 0 ),
+    JS_CFUNC_MAGIC_DEF("write", 3, js_std_file_read_write, 1 ),
+    JS_CFUNC_DEF("getline", 0, js_std_file_getline ),
+    JS_CFUNC_MAGIC_DEF("readAsArrayBuffer", 0, js_std_file_readAs, 0 ),
+    JS_CFUNC_MAGIC_DEF("readAsString", 0, js_std_file_readAs, 1 ),
+    JS_CFUNC_DEF("getByte", 0, js_std_file_getByte ),
+    JS_CFUNC_DEF("putByte", 1, js_std_file_putByte ),
+    /* setvbuf, ...  */
+};
+
+static int js_std_init(JSContext *ctx, JSModuleDef *m)
+{
+    JSValue proto;
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = js_get_thread_state(rt);
+
+    /* FILE class */
+    /* the class ID is created once */
+    JS_NewClassID(rt, &ts->std_file_class_id);
+    /* the class is created once per runtime */
+    JS_NewClass(rt, ts->std_file_class_id, &js_std_file_class);
+    proto = JS_NewObject(ctx);
+    JS_SetPropertyFunctionList(ctx, proto, js_std_file_proto_funcs,
+                               countof(js_std_file_proto_funcs));
+    JS_SetClassProto(ctx, ts->std_file_class_id, proto);
+
+    JS_SetModuleExportList(ctx, m, js_std_funcs,
+                           countof(js_std_funcs));
+    JS_SetModuleExport(ctx, m, "in", js_new_std_file(ctx, stdin, false));
+    JS_SetModuleExport(ctx, m, "out", js_new_std_file(ctx, stdout, false));
+    JS_SetModuleExport(ctx, m, "err", js_new_std_file(ctx, stderr, false));
+    return 0;
+}
+
+JSModuleDef *js_init_module_std(JSContext *ctx, const char *module_name)
+{
+    JSModuleDef *m;
+    m = JS_NewCModule(ctx, module_name, js_std_init);
+    if (!m)
+        return NULL;
+    JS_AddModuleExportList(ctx, m, js_std_funcs, countof(js_std_funcs));
+    JS_AddModuleExport(ctx, m, "in");
+    JS_AddModuleExport(ctx, m, "out");
+    JS_AddModuleExport(ctx, m, "err");
+    return m;
+}
+
+/**********************************************************/
+/* 'os' object */
+
+static JSValue js_os_open(JSContext *ctx, JSValueConst this_val,
+                          int argc, JSValueConst *argv)
+{
+    const char *filename;
+    int flags, mode, ret;
+
+    filename = JS_ToCString(ctx, argv[0]);
+    if (!filename)
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &flags, argv[1]))
+        goto fail;
+    if (argc >= 3 && !JS_IsUndefined(argv[2])) {
+        if (JS_ToInt32(ctx, &mode, argv[2])) {
+        fail:
+            JS_FreeCString(ctx, filename);
+            return JS_EXCEPTION;
+        }
+    } else {
+        mode = 0666;
+    }
+#if defined(_WIN32)
+    /* force binary mode by default */
+    if (!(flags & O_TEXT))
+        flags |= O_BINARY;
+#endif
+    ret = js_get_errno(open(filename, flags, mode));
+    JS_FreeCString(ctx, filename);
+    return JS_NewInt32(ctx, ret);
+}
+
+static JSValue js_os_close(JSContext *ctx, JSValueConst this_val,
+                           int argc, JSValueConst *argv)
 {
     int fd, ret;
     if (JS_ToInt32(ctx, &fd, argv[0]))
@@ -2131,13 +2853,206 @@ static JSOSRWHandler *find_rh(JSThreadState *ts, int fd)
     return NULL;
 }
 
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+static JSOSRWHandler *find_rh_by_id(JSThreadState *ts, uint64_t id)
+{
+    JSOSRWHandler *rh;
+
+    if (ts->rw_hash_size == 0)
+        return NULL;
+    rh = ts->rw_hash[id & (ts->rw_hash_size - 1)];
+    for(; rh != NULL; rh = rh->hash_next) {
+        if (rh->id == id)
+            return rh;
+    }
+    return NULL;
+}
+
+static int js_os_event_open(void)
+{
+#if defined(USE_EPOLL)
+    return epoll_create1(EPOLL_CLOEXEC);
+#else
+    int fd = kqueue();
+    if (fd >= 0)
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+#endif
+}
+
+/* only the pipes and the sockets are registered: the other kinds of
+   files are either refused by epoll or reported differently than by
+   poll() at end of file */
+static bool js_os_event_supported(int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) < 0)
+        return false;
+    return S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode);
+}
+
+/* change the events of 'rh' from 'old_events' to 'new_events' */
+static int js_os_event_ctl(int event_fd, JSOSRWHandler *rh,
+                           int old_events, int new_events)
+{
+    int ret;
+#if defined(USE_EPOLL)
+    struct epoll_event ev;
+    int op;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (new_events & POLLIN ? EPOLLIN : 0) |
+        (new_events & POLLOUT ? EPOLLOUT : 0);
+    ev.data.u64 = rh->id;
+    if (!new_events)
+        op = EPOLL_CTL_DEL;
+    else if (!old_events)
+        op = EPOLL_CTL_ADD;
+    else
+        op = EPOLL_CTL_MOD;
+    ret = epoll_ctl(event_fd, op, rh->fd, &ev);
+    /* the fd was closed and reused while the handler was set */
+    if (ret < 0 && op == EPOLL_CTL_MOD && errno == ENOENT)
+        ret = epoll_ctl(event_fd, EPOLL_CTL_ADD, rh->fd, &ev);
+#else
+    struct kevent kev[2];
+    int n = 0;
+
+    if ((old_events ^ new_events) & POLLIN) {
+        EV_SET(&kev[n++], rh->fd, EVFILT_READ,
+               new_events & POLLIN ? EV_ADD : EV_DELETE, 0, 0,
+               (void *)(uintptr_t)rh->id);
+    }
+    if ((old_events ^ new_events) & POLLOUT) {
+        EV_SET(&kev[n++], rh->fd, EVFILT_WRITE,
+               new_events & POLLOUT ? EV_ADD : EV_DELETE, 0, 0,
+               (void *)(uintptr_t)rh->id);
+    }
+    ret = kevent(event_fd, kev, n, NULL, 0, NULL);
+#endif
+    return ret;
+}
+
+/* Recreate the event backend with the handlers which are still
+   registered. Used when a fd could not be removed: after close(fd),
+   epoll keeps reporting the file while a dup of the fd is open. */
+static void js_os_event_rebuild(JSThreadState *ts)
+{
+    JSOSRWHandler *rh;
+    struct list_head *el;
+
+    close(ts->event_fd);
+    ts->event_fd = js_os_event_open();
+    list_for_each(el, &ts->os_rw_handlers) {
+        rh = list_entry(el, JSOSRWHandler, link);
+        if (rh->polled || !rh->events)
+            continue;
+        if (ts->event_fd < 0 ||
+            js_os_event_ctl(ts->event_fd, rh, 0, rh->events) < 0) {
+            rh->polled = true;
+            ts->polled_rw_count++;
+            rh->events = 0;
+        }
+    }
+}
+
+#endif // USE_EPOLL || USE_KQUEUE
+
+/* make sure that one more handler can be added to rw_hash */
+static int js_os_rw_reserve(JSRuntime *rt, JSThreadState *ts)
+{
+    JSOSRWHandler **hash, *rh, *rh_next;
+    int i, new_size;
+
+    if (ts->rw_hash_count + 1 > ts->rw_hash_size) {
+        new_size = max_int(16, ts->rw_hash_size * 2);
+        hash = js_mallocz_rt(rt, sizeof(hash[0]) * new_size);
+        if (!hash)
+            return -1;
+        for(i = 0; i < ts->rw_hash_size; i++) {
+            for(rh = ts->rw_hash[i]; rh != NULL; rh = rh_next) {
+                rh_next = rh->hash_next;
+                rh->hash_next = hash[rh->id & (new_size - 1)];
+                hash[rh->id & (new_size - 1)] = rh;
+            }
+        }
+        js_free_rt(rt, ts->rw_hash);
+        ts->rw_hash = hash;
+        ts->rw_hash_size = new_size;
+    }
+    return 0;
+}
+
+/* register the fd of a new handler with the event backend if possible.
+   js_os_rw_reserve() must have been called. */
+static void init_rw_handler(JSThreadState *ts, JSOSRWHandler *rh)
+{
+    JSOSRWHandler **prh;
+
+    rh->polled = true;
+    rh->events = 0;
+    rh->id = ts->next_rw_id++;
+    prh = &ts->rw_hash[rh->id & (ts->rw_hash_size - 1)];
+    rh->hash_next = *prh;
+    *prh = rh;
+    ts->rw_hash_count++;
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    if (ts->event_fd >= 0 && js_os_event_supported(rh->fd))
+        rh->polled = false;
+#endif
+    ts->polled_rw_count += rh->polled;
+}
+
+/* update the registered events after a change of the handlers */
+static void update_rw_handler(JSThreadState *ts, JSOSRWHandler *rh)
+{
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    int events;
+    bool stale;
+
+    if (rh->polled)
+        return;
+    events = (POLLIN * !JS_IsNull(rh->rw_func[0])) |
+        (POLLOUT * !JS_IsNull(rh->rw_func[1]));
+    if (events == rh->events)
+        return;
+    if (js_os_event_ctl(ts->event_fd, rh, rh->events, events) < 0) {
+        /* 'rh' may still be registered if it could not be removed */
+        stale = rh->events &&
+            (!events || js_os_event_ctl(ts->event_fd, rh, rh->events, 0) < 0);
+        if (events) {
+            /* fall back to poll() */
+            rh->polled = true;
+            ts->polled_rw_count++;
+        }
+        rh->events = 0;
+        if (stale)
+            js_os_event_rebuild(ts);
+        return;
+    }
+    rh->events = events;
+#endif
+}
+
 static void free_rw_handler(JSRuntime *rt, JSOSRWHandler *rh)
 {
+    JSThreadState *ts = js_get_thread_state(rt);
+    JSOSRWHandler **prh;
     int i;
+
     list_del(&rh->link);
+    prh = &ts->rw_hash[rh->id & (ts->rw_hash_size - 1)];
+    while (*prh != rh)
+        prh = &(*prh)->hash_next;
+    *prh = rh->hash_next;
+    ts->rw_hash_count--;
     for(i = 0; i < 2; i++) {
         JS_FreeValueRT(rt, rh->rw_func[i]);
+        rh->rw_func[i] = JS_NULL;
     }
+    update_rw_handler(ts, rh);
+    ts->polled_rw_count -= rh->polled;
     js_free_rt(rt, rh);
 }
 
@@ -2162,6 +3077,8 @@ static JSValue js_os_setReadHandler(JSContext *ctx, JSValueConst this_val,
                 JS_IsNull(rh->rw_func[1])) {
                 /* remove the entry */
                 free_rw_handler(JS_GetRuntime(ctx), rh);
+            } else {
+                update_rw_handler(ts, rh);
             }
         }
     } else {
@@ -2169,16 +3086,20 @@ static JSValue js_os_setReadHandler(JSContext *ctx, JSValueConst this_val,
             return JS_ThrowTypeError(ctx, "not a function");
         rh = find_rh(ts, fd);
         if (!rh) {
+            if (js_os_rw_reserve(JS_GetRuntime(ctx), ts))
+                return JS_ThrowOutOfMemory(ctx);
             rh = js_mallocz(ctx, sizeof(*rh));
             if (!rh)
                 return JS_EXCEPTION;
             rh->fd = fd;
             rh->rw_func[0] = JS_NULL;
             rh->rw_func[1] = JS_NULL;
+            init_rw_handler(ts, rh);
             list_add_tail(&rh->link, &ts->os_rw_handlers);
         }
         JS_FreeValue(ctx, rh->rw_func[magic]);
         rh->rw_func[magic] = JS_DupValue(ctx, func);
+        update_rw_handler(ts, rh);
     }
     return JS_UNDEFINED;
 }
@@ -2294,9 +3215,154 @@ static uint64_t js__hrtime_ms(void)
     return js__hrtime_ns() / (1000 * 1000);
 }
 
+/* Pending timers are kept in a heap ordered by timeout. When they
+   expire, they are moved to a second heap ordered by creation, so that
+   the expired timers fire in the order in which they were created. */
+static bool timer_lt(const JSOSTimer *a, const JSOSTimer *b)
+{
+    if (!a->expired && a->timeout != b->timeout)
+        return a->timeout < b->timeout;
+    return a->seq < b->seq;
+}
+
+static void timer_heap_set(JSOSTimerHeap *h, int i, JSOSTimer *th)
+{
+    h->tab[i] = th;
+    th->heap_index = i;
+}
+
+static void timer_heap_sift_up(JSOSTimerHeap *h, int i)
+{
+    JSOSTimer *th = h->tab[i];
+    int parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!timer_lt(th, h->tab[parent]))
+            break;
+        timer_heap_set(h, i, h->tab[parent]);
+        i = parent;
+    }
+    timer_heap_set(h, i, th);
+}
+
+static void timer_heap_sift_down(JSOSTimerHeap *h, int i)
+{
+    JSOSTimer *th = h->tab[i];
+    int child;
+
+    for(;;) {
+        child = 2 * i + 1;
+        if (child >= h->count)
+            break;
+        if (child + 1 < h->count && timer_lt(h->tab[child + 1], h->tab[child]))
+            child++;
+        if (!timer_lt(h->tab[child], th))
+            break;
+        timer_heap_set(h, i, h->tab[child]);
+        i = child;
+    }
+    timer_heap_set(h, i, th);
+}
+
+/* the room must have been reserved with js_os_timer_reserve() */
+static void timer_heap_push(JSOSTimerHeap *h, JSOSTimer *th)
+{
+    assert(h->count < h->size);
+    timer_heap_set(h, h->count++, th);
+    timer_heap_sift_up(h, th->heap_index);
+}
+
+static void timer_heap_remove(JSOSTimerHeap *h, JSOSTimer *th)
+{
+    JSOSTimer *last;
+    int i;
+
+    i = th->heap_index;
+    last = h->tab[--h->count];
+    if (i < h->count) {
+        timer_heap_set(h, i, last);
+        timer_heap_sift_up(h, i);
+        timer_heap_sift_down(h, last->heap_index);
+    }
+}
+
+static int timer_heap_resize(JSRuntime *rt, JSOSTimerHeap *h, int size)
+{
+    JSOSTimer **tab;
+    int new_size;
+
+    if (size <= h->size)
+        return 0;
+    new_size = max_int(size, h->size * 3 / 2);
+    tab = js_realloc_rt(rt, h->tab, sizeof(h->tab[0]) * new_size);
+    if (!tab)
+        return -1;
+    h->tab = tab;
+    h->size = new_size;
+    return 0;
+}
+
+/* make sure that one more timer can be added without failing, including
+   when it moves between the two heaps */
+static int js_os_timer_reserve(JSRuntime *rt, JSThreadState *ts)
+{
+    JSOSTimer **hash, *th, *th_next;
+    int count, i, new_size;
+
+    count = ts->os_timers.count + ts->os_expired_timers.count + 1;
+    if (timer_heap_resize(rt, &ts->os_timers, count) ||
+        timer_heap_resize(rt, &ts->os_expired_timers, count))
+        return -1;
+    if (ts->timer_hash_count + 1 > ts->timer_hash_size) {
+        new_size = max_int(16, ts->timer_hash_size * 2);
+        hash = js_mallocz_rt(rt, sizeof(hash[0]) * new_size);
+        if (!hash)
+            return -1;
+        for(i = 0; i < ts->timer_hash_size; i++) {
+            for(th = ts->timer_hash[i]; th != NULL; th = th_next) {
+                th_next = th->hash_next;
+                th->hash_next = hash[th->timer_id & (new_size - 1)];
+                hash[th->timer_id & (new_size - 1)] = th;
+            }
+        }
+        js_free_rt(rt, ts->timer_hash);
+        ts->timer_hash = hash;
+        ts->timer_hash_size = new_size;
+    }
+    return 0;
+}
+
+static void add_timer(JSThreadState *ts, JSOSTimer *th)
+{
+    JSOSTimer **pth;
+
+    th->seq = ts->next_timer_seq++;
+    timer_heap_push(&ts->os_timers, th);
+    if (th->timer_id > 0) {
+        pth = &ts->timer_hash[th->timer_id & (ts->timer_hash_size - 1)];
+        th->hash_next = *pth;
+        *pth = th;
+        ts->timer_hash_count++;
+    }
+}
+
 static void free_timer(JSRuntime *rt, JSOSTimer *th)
 {
-    list_del(&th->link);
+    JSThreadState *ts = js_get_thread_state(rt);
+    JSOSTimer **pth;
+
+    if (th->expired)
+        timer_heap_remove(&ts->os_expired_timers, th);
+    else
+        timer_heap_remove(&ts->os_timers, th);
+    if (th->timer_id > 0) {
+        pth = &ts->timer_hash[th->timer_id & (ts->timer_hash_size - 1)];
+        while (*pth != th)
+            pth = &(*pth)->hash_next;
+        *pth = th->hash_next;
+        ts->timer_hash_count--;
+    }
     JS_FreeValueRT(rt, th->func);
     js_free_rt(rt, th);
 }
@@ -2319,6 +3385,8 @@ static JSValue js_os_setTimeout(JSContext *ctx, JSValueConst this_val,
         return JS_EXCEPTION;
     if (delay < 1)
         delay = 1;
+    if (js_os_timer_reserve(rt, ts))
+        return JS_ThrowOutOfMemory(ctx);
     th = js_mallocz(ctx, sizeof(*th));
     if (!th)
         return JS_EXCEPTION;
@@ -2329,17 +3397,18 @@ static JSValue js_os_setTimeout(JSContext *ctx, JSValueConst this_val,
     th->timeout = js__hrtime_ms() + delay;
     th->delay = delay;
     th->func = JS_DupValue(ctx, func);
-    list_add_tail(&th->link, &ts->os_timers);
+    add_timer(ts, th);
     return JS_NewInt64(ctx, th->timer_id);
 }
 
-static JSOSTimer *find_timer_by_id(JSThreadState *ts, int timer_id)
+static JSOSTimer *find_timer_by_id(JSThreadState *ts, int64_t timer_id)
 {
-    struct list_head *el;
-    if (timer_id <= 0)
+    JSOSTimer *th;
+
+    if (timer_id <= 0 || ts->timer_hash_size == 0)
         return NULL;
-    list_for_each(el, &ts->os_timers) {
-        JSOSTimer *th = list_entry(el, JSOSTimer, link);
+    th = ts->timer_hash[timer_id & (ts->timer_hash_size - 1)];
+    for(; th != NULL; th = th->hash_next) {
         if (th->timer_id == timer_id)
             return th;
     }
@@ -2379,7 +3448,10 @@ static JSValue js_os_sleepAsync(JSContext *ctx, JSValueConst this_val,
     if (JS_IsException(promise))
         return JS_EXCEPTION;
 
-    th = js_mallocz(ctx, sizeof(*th));
+    if (js_os_timer_reserve(rt, ts))
+        th = NULL;
+    else
+        th = js_mallocz(ctx, sizeof(*th));
     if (!th) {
         JS_FreeValue(ctx, promise);
         JS_FreeValue(ctx, resolving_funcs[0]);
@@ -2389,7 +3461,7 @@ static JSValue js_os_sleepAsync(JSContext *ctx, JSValueConst this_val,
     th->timer_id = -1;
     th->timeout = js__hrtime_ms() + delay;
     th->func = JS_DupValue(ctx, resolving_funcs[0]);
-    list_add_tail(&th->link, &ts->os_timers);
+    add_timer(ts, th);
     JS_FreeValue(ctx, resolving_funcs[0]);
     JS_FreeValue(ctx, resolving_funcs[1]);
     return promise;
@@ -2416,36 +3488,43 @@ static int js_os_run_timers(JSRuntime *rt, JSContext *ctx, JSThreadState *ts, in
     JSValue func;
     JSOSTimer *th;
     int64_t cur_time, delay;
-    struct list_head *el;
     int r;
 
-    if (list_empty(&ts->os_timers)) {
+    if (ts->os_timers.count == 0 && ts->os_expired_timers.count == 0) {
         *min_delay = -1;
         return 0;
     }
 
     cur_time = js__hrtime_ms();
-    *min_delay = INT32_MAX;
+    while (ts->os_timers.count > 0 &&
+           ts->os_timers.tab[0]->timeout <= cur_time) {
+        th = ts->os_timers.tab[0];
+        timer_heap_remove(&ts->os_timers, th);
+        th->expired = true;
+        timer_heap_push(&ts->os_expired_timers, th);
+    }
 
-    list_for_each(el, &ts->os_timers) {
-        th = list_entry(el, JSOSTimer, link);
-        delay = th->timeout - cur_time;
-        if (delay > 0) {
-            *min_delay = min_int(*min_delay, delay);
-        } else {
-            *min_delay = 0;
-            func = JS_DupValueRT(rt, th->func);
-            if (th->repeats)
-                th->timeout = cur_time + th->delay;
-            else
-                free_timer(rt, th);
-            r = call_handler(ctx, func);
-            JS_FreeValueRT(rt, func);
-            return r;
-        }
+    if (ts->os_expired_timers.count == 0) {
+        delay = ts->os_timers.tab[0]->timeout - cur_time;
+        *min_delay = min_int64(delay, INT32_MAX);
+        return 0;
     }
 
-    return 0;
+    /* fire one timer: the oldest expired one */
+    *min_delay = 0;
+    th = ts->os_expired_timers.tab[0];
+    func = JS_DupValueRT(rt, th->func);
+    if (th->repeats) {
+        timer_heap_remove(&ts->os_expired_timers, th);
+        th->expired = false;
+        th->timeout = cur_time + th->delay;
+        timer_heap_push(&ts->os_timers, th);
+    } else {
+        free_timer(rt, th);
+    }
+    r = call_handler(ctx, func);
+    JS_FreeValueRT(rt, func);
+    return r;
 }
 
 #ifdef USE_WORKER
@@ -2468,6 +3547,11 @@ static void js_waker_clear(JSWaker *w)
     ResetEvent(w->handle);
 }
 
+static void js_waker_wait(JSWaker *w)
+{
+    WaitForSingleObject(w->handle, INFINITE);
+}
+
 static void js_waker_close(JSWaker *w)
 {
     CloseHandle(w->handle);
@@ -2482,6 +3566,9 @@ static int js_waker_init(JSWaker *w)
 
     if (pipe(fds) < 0)
         return -1;
+    /* a full pipe is signaled, an empty one is cleared */
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
     w->read_fd = fds[0];
     w->write_fd = fds[1];
     return 0;
@@ -2495,7 +3582,7 @@ static void js_waker_signal(JSWaker *w)
         ret = write(w->write_fd, "", 1);
         if (ret == 1)
             break;
-        if (ret < 0 && (errno != EAGAIN || errno != EINTR))
+        if (ret < 0 && errno != EINTR)
             break;
     }
 }
@@ -2507,13 +3594,23 @@ static void js_waker_clear(JSWaker *w)
 
     for(;;) {
         ret = read(w->read_fd, buf, sizeof(buf));
+        if (ret == sizeof(buf))
+            continue;
         if (ret >= 0)
             break;
-        if (errno != EAGAIN && errno != EINTR)
+        if (errno != EINTR)
             break;
     }
 }
 
+static void js_waker_wait(JSWaker *w)
+{
+    struct pollfd pfd = { w->read_fd, POLLIN, 0 };
+
+    while (poll(&pfd, 1, -1) < 0 && errno == EINTR)
+        continue;
+}
+
 static void js_waker_close(JSWaker *w)
 {
     close(w->read_fd);
@@ -2524,35 +3621,634 @@ static void js_waker_close(JSWaker *w)
 
 #endif // _WIN32
 
+/* Asynchronous I/O
+
+   The requests are run by a small pool of threads shared by all the
+   runtimes. The completed requests are queued in the JSThreadState of
+   the submitting runtime and their promise is settled from
+   js_os_poll(). The reads and writes of the pipes, sockets and
+   terminals are only given to the pool once js_os_poll() reports that
+   the fd is ready, so that they don't hold a thread while idle.
+
+   The requests only reference memory allocated with malloc() while
+   they run, so that a runtime can be freed without waiting for them:
+   they are detached and freed by their thread. */
+
+#define JS_IO_MAX_THREADS 4
+
+typedef enum {
+    JS_IO_READ,
+    JS_IO_WRITE,
+    JS_IO_LOAD_FILE,
+    JS_IO_URL_GET,
+} JSIOOp;
+
+typedef struct JSIORequest {
+    struct list_head link; /* in js_io_queue, then in JSThreadState.io_done */
+    struct list_head ts_link; /* in JSThreadState.io_requests */
+    JSThreadState *ts; /* NULL if detached, protected by js_io_mutex */
+    JSIOOp op;
+    /* JS_IO_READ, JS_IO_WRITE: the data is in 'data'. It is copied from
+       or to 'buffer' at 'pos' by the runtime thread, hence the
+       ArrayBuffer can be detached or resized in the meantime and a
+       running request does not reference it. */
+    int fd;
+    size_t pos;
+    size_t len;
+    struct list_head fd_link; /* in JSThreadState.io_fd_requests if
+                                 'fd' must be ready */
+    bool fd_wait;
+    bool queued; /* given to the I/O threads */
+    bool running; /* run by an I/O thread, protected by js_io_mutex */
+    /* JS_IO_LOAD_FILE, JS_IO_URL_GET: 'filename' is the URL */
+    char *filename; /* allocated with malloc() */
+    bool binary;
+    bool full;
+    uint8_t *data; /* allocated with malloc() */
+    size_t data_len;
+#if !defined(__wasi__)
+    JSUrlGetResponse *resp; /* allocated with malloc() */
+#endif
+    ssize_t ret;
+    JSValue buffer; /* JS_IO_READ: the destination ArrayBuffer */
+    JSValue resolving_funcs[2];
+} JSIORequest;
+
+static js_once_t js_io_once = JS_ONCE_INIT;
+static js_mutex_t js_io_mutex;
+static js_cond_t js_io_cond;
+static struct list_head js_io_queue; /* list of JSIORequest.link */
+static int js_io_thread_count, js_io_idle_count;
+
+static void js_io_init(void)
+{
+    js_mutex_init(&js_io_mutex);
+    js_cond_init(&js_io_cond);
+    init_list_head(&js_io_queue);
+}
+
+static JSIORequest *js_io_new_request(JSContext *ctx, JSIOOp op)
+{
+    JSIORequest *req;
+
+    req = calloc(1, sizeof(*req));
+    if (!req) {
+        JS_ThrowOutOfMemory(ctx);
+        return NULL;
+    }
+    req->op = op;
+    req->buffer = JS_UNDEFINED;
+    req->resolving_funcs[0] = JS_UNDEFINED;
+    req->resolving_funcs[1] = JS_UNDEFINED;
+    return req;
+}
+
+/* free the part of 'req' owned by its runtime */
+static void js_io_free_values(JSRuntime *rt, JSIORequest *req)
+{
+    JS_FreeValueRT(rt, req->buffer);
+    JS_FreeValueRT(rt, req->resolving_funcs[0]);
+    JS_FreeValueRT(rt, req->resolving_funcs[1]);
+    req->buffer = JS_UNDEFINED;
+    req->resolving_funcs[0] = JS_UNDEFINED;
+    req->resolving_funcs[1] = JS_UNDEFINED;
+}
+
+static void js_io_free_data(JSIORequest *req)
+{
+    free(req->filename);
+    free(req->data);
+#if !defined(__wasi__)
+    if (req->resp) {
+        js_url_response_free(req->resp);
+        free(req->resp);
+    }
+#endif
+    free(req);
+}
+
+static void js_io_free_request(JSRuntime *rt, JSIORequest *req)
+{
+    js_io_free_values(rt, req);
+    js_io_free_data(req);
+}
+
+/* queue a completed request in its runtime, or free it if it was
+   detached */
+static void js_io_complete(JSIORequest *req)
+{
+    JSThreadState *ts;
+
+    js_mutex_lock(&js_io_mutex);
+    req->running = false;
+    ts = req->ts;
+    if (ts) {
+        js_mutex_lock(&ts->io_mutex);
+        if (list_empty(&ts->io_done))
+            js_waker_signal(&ts->io_waker);
+        list_add_tail(&req->link, &ts->io_done);
+        js_mutex_unlock(&ts->io_mutex);
+    }
+    js_mutex_unlock(&js_io_mutex);
+    if (!ts)
+        js_io_free_data(req);
+}
+
+static void js_io_thread_func(void *opaque)
+{
+    JSIORequest *req;
+
+    js_mutex_lock(&js_io_mutex);
+    for(;;) {
+        while (list_empty(&js_io_queue)) {
+            js_io_idle_count++;
+            js_cond_wait(&js_io_cond, &js_io_mutex);
+            js_io_idle_count--;
+        }
+        req = list_entry(js_io_queue.next, JSIORequest, link);
+        list_del(&req->link);
+        req->running = true;
+        js_mutex_unlock(&js_io_mutex);
+
+        switch(req->op) {
+        case JS_IO_READ:
+            req->ret = js_get_errno(read(req->fd, req->data, req->len));
+            break;
+        case JS_IO_WRITE:
+            req->ret = js_get_errno(write(req->fd, req->data, req->len));
+            break;
+        case JS_IO_LOAD_FILE:
+            req->data = js_load_file(NULL, &req->data_len, req->filename);
+            break;
+        case JS_IO_URL_GET:
+#if !defined(__wasi__)
+            req->ret = js_url_get(req->ts, req->filename, req->resp);
+#endif
+            break;
+        }
+
+        js_io_complete(req);
+        js_mutex_lock(&js_io_mutex);
+    }
+}
+
+/* give 'req' to the I/O threads. Return -1 if no thread could be
+   created. */
+static int js_io_queue_request(JSIORequest *req)
+{
+    js_thread_t thr;
+
+    js_once(&js_io_once, js_io_init);
+    js_mutex_lock(&js_io_mutex);
+    if (js_io_idle_count == 0 && js_io_thread_count < JS_IO_MAX_THREADS) {
+        if (js_thread_create(&thr, js_io_thread_func, NULL,
+                             JS_THREAD_CREATE_DETACHED) == 0) {
+            js_io_thread_count++;
+        } else if (js_io_thread_count == 0) {
+            js_mutex_unlock(&js_io_mutex);
+            return -1;
+        }
+    }
+    list_add_tail(&req->link, &js_io_queue);
+    req->queued = true;
+    js_cond_signal(&js_io_cond);
+    js_mutex_unlock(&js_io_mutex);
+    return 0;
+}
+
+/* create the promise of 'req' and queue it. 'req' is freed in case of
+   error. */
+static JSValue js_io_submit(JSContext *ctx, JSIORequest *req)
+{
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = js_get_thread_state(rt);
+    JSValue promise;
+
+    if (!ts->io_ready) {
+        if (js_waker_init(&ts->io_waker)) {
+            js_io_free_request(rt, req);
+            return JS_ThrowInternalError(ctx, "could not create the I/O waker");
+        }
+        js_mutex_init(&ts->io_mutex);
+        init_list_head(&ts->io_done);
+        init_list_head(&ts->io_fd_requests);
+        init_list_head(&ts->io_requests);
+        ts->io_ready = true;
+    }
+    promise = JS_NewPromiseCapability(ctx, req->resolving_funcs);
+    if (JS_IsException(promise)) {
+        js_io_free_request(rt, req);
+        return JS_EXCEPTION;
+    }
+    req->ts = ts;
+    /* the completions are handled by js_os_poll() even if the os module
+       is not imported */
+    ts->can_js_os_poll = true;
+
+    if (req->fd_wait) {
+        /* queued by js_os_poll() when the fd is ready */
+        list_add_tail(&req->fd_link, &ts->io_fd_requests);
+    } else if (js_io_queue_request(req)) {
+        js_io_free_request(rt, req);
+        JS_FreeValue(ctx, promise);
+        return JS_ThrowInternalError(ctx, "could not create the I/O thread");
+    }
+    list_add_tail(&req->ts_link, &ts->io_requests);
+    ts->io_pending++;
+    return promise;
+}
+
+#if !defined(_WIN32)
+/* return true if 'req' must wait for the fd to be ready: the requests
+   of the same fd and direction are run one at a time so that a ready
+   fd does not start several blocking reads */
+static bool js_io_fd_polled(JSThreadState *ts, JSIORequest *req)
+{
+    struct list_head *el;
+    JSIORequest *req1;
+
+    if (req->queued)
+        return false;
+    list_for_each(el, &ts->io_fd_requests) {
+        req1 = list_entry(el, JSIORequest, fd_link);
+        if (req1 == req)
+            return true;
+        if (req1->fd == req->fd && req1->op == req->op)
+            return false;
+    }
+    return false;
+}
+
+/* queue the request of a ready fd */
+static void js_io_fd_ready(JSThreadState *ts, int fd, int revents)
+{
+    struct list_head *el;
+    JSIORequest *req;
+    int events;
+
+    list_for_each(el, &ts->io_fd_requests) {
+        req = list_entry(el, JSIORequest, fd_link);
+        events = req->op == JS_IO_READ ? POLLIN : POLLOUT;
+        if (req->fd == fd && (revents & (events|POLLERR|POLLHUP|POLLNVAL)) &&
+            js_io_fd_polled(ts, req)) {
+            if (js_io_queue_request(req)) {
+                req->queued = true;
+                req->ret = -EAGAIN;
+                js_io_complete(req);
+            }
+            return;
+        }
+    }
+}
+#endif // !defined(_WIN32)
+
+/* return the next completed request or NULL */
+static JSIORequest *js_io_take_completed(JSThreadState *ts)
+{
+    JSIORequest *req;
+
+    req = NULL;
+    js_mutex_lock(&ts->io_mutex);
+    if (!list_empty(&ts->io_done)) {
+        req = list_entry(ts->io_done.next, JSIORequest, link);
+        list_del(&req->link);
+        if (list_empty(&ts->io_done))
+            js_waker_clear(&ts->io_waker);
+    }
+    js_mutex_unlock(&ts->io_mutex);
+    return req;
+}
+
+static void js_io_free_buffer(JSRuntime *rt, void *opaque, void *ptr)
+{
+    free(ptr);
+}
+
+/* copy the data of a completed read to the ArrayBuffer */
+static JSValue js_io_read_result(JSContext *ctx, JSIORequest *req)
+{
+    uint8_t *buf;
+    size_t size;
+
+    if (req->ret <= 0)
+        return JS_NewInt64(ctx, req->ret);
+    buf = JS_GetArrayBuffer(ctx, &size, req->buffer);
+    if (!buf && JS_HasException(ctx))
+        return JS_EXCEPTION; /* detached */
+    if (req->pos + req->ret > size)
+        return JS_ThrowRangeError(ctx, "read/write array buffer overflow");
+    memcpy(buf + req->pos, req->data, req->ret);
+    return JS_NewInt64(ctx, req->ret);
+}
+
+/* settle the promise of a completed request. Return -1 if exception, 0
+   if no request was completed, 1 otherwise. */
+static int handle_io_completion(JSContext *ctx, JSThreadState *ts)
+{
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSIORequest *req;
+    JSValue val, ret;
+
+    req = js_io_take_completed(ts);
+    if (!req)
+        return 0;
+    ts->io_pending--;
+    list_del(&req->ts_link);
+    if (req->fd_wait)
+        list_del(&req->fd_link);
+    switch(req->op) {
+    case JS_IO_READ:
+        val = js_io_read_result(ctx, req);
+        break;
+    case JS_IO_LOAD_FILE:
+        if (!req->data) {
+            val = JS_NULL;
+        } else if (req->binary) {
+            val = JS_NewUint8Array(ctx, req->data, req->data_len,
+                                   js_io_free_buffer, NULL, false);
+            if (!JS_IsException(val))
+                req->data = NULL;
+        } else {
+            val = JS_NewStringLen(ctx, (char *)req->data, req->data_len);
+        }
+        break;
+#if !defined(__wasi__)
+    case JS_IO_URL_GET:
+        if (req->ret < 0) {
+            val = JS_ThrowTypeError(ctx, "could not start curl");
+        } else if (dbuf_error(&req->resp->headers) ||
+                   dbuf_error(&req->resp->data)) {
+            val = JS_ThrowOutOfMemory(ctx);
+        } else {
+            val = js_url_get_result(ctx, req->resp, req->binary, req->full);
+        }
+        break;
+#endif
+    default:
+        val = JS_NewInt64(ctx, req->ret);
+        break;
+    }
+    if (JS_IsException(val)) {
+        val = JS_GetException(ctx);
+        ret = JS_Call(ctx, req->resolving_funcs[1], JS_UNDEFINED, 1, (JSValueConst *)&val);
+    } else {
+        ret = JS_Call(ctx, req->resolving_funcs[0], JS_UNDEFINED, 1, (JSValueConst *)&val);
+    }
+    JS_FreeValue(ctx, val);
+    js_io_free_request(rt, req);
+    if (JS_IsException(ret))
+        return -1;
+    JS_FreeValue(ctx, ret);
+    return 1;
+}
+
+/* drop the pending requests without settling their promises. The
+   requests run by an I/O thread are detached, except the URL requests
+   which use the connections of 'ts': they are waited for, their
+   duration being bounded by their timeout. */
+static void js_io_free_handlers(JSRuntime *rt, JSThreadState *ts)
+{
+    JSIORequest *req;
+    struct list_head *el, *el1;
+
+    if (!ts->io_ready)
+        return;
+    js_once(&js_io_once, js_io_init);
+    js_mutex_lock(&js_io_mutex);
+    list_for_each_safe(el, el1, &ts->io_requests) {
+        req = list_entry(el, JSIORequest, ts_link);
+        if (req->running && req->op == JS_IO_URL_GET)
+            continue;
+        list_del(&req->ts_link);
+        ts->io_pending--;
+        if (req->running) {
+            js_io_free_values(rt, req);
+            req->ts = NULL;
+        } else {
+            if (req->queued)
+                list_del(&req->link); /* in js_io_queue or io_done */
+            js_io_free_request(rt, req);
+        }
+    }
+    js_mutex_unlock(&js_io_mutex);
+    while (ts->io_pending > 0) {
+        req = js_io_take_completed(ts);
+        if (req) {
+            list_del(&req->ts_link);
+            js_io_free_request(rt, req);
+            ts->io_pending--;
+        } else {
+            js_waker_wait(&ts->io_waker);
+        }
+    }
+    js_mutex_destroy(&ts->io_mutex);
+    js_waker_close(&ts->io_waker);
+    ts->io_ready = false;
+}
+
+/* loadFileAsync(filename, [options]) */
+static JSValue js_std_loadFileAsync(JSContext *ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv)
+{
+    JSIORequest *req;
+    const char *filename;
+    bool binary = false;
+
+    if (argc >= 2) {
+        if (get_bool_option(ctx, &binary, argv[1], "binary"))
+            return JS_EXCEPTION;
+    }
+    filename = JS_ToCString(ctx, argv[0]);
+    if (!filename)
+        return JS_EXCEPTION;
+    req = js_io_new_request(ctx, JS_IO_LOAD_FILE);
+    if (!req) {
+        JS_FreeCString(ctx, filename);
+        return JS_EXCEPTION;
+    }
+    req->binary = binary;
+    req->filename = strdup(filename);
+    JS_FreeCString(ctx, filename);
+    if (!req->filename) {
+        js_io_free_data(req);
+        return JS_ThrowOutOfMemory(ctx);
+    }
+    return js_io_submit(ctx, req);
+}
+
+#if !defined(__wasi__)
+/* urlGetAsync(url, [options]) */
+static JSValue js_std_urlGetAsync(JSContext *ctx, JSValueConst this_val,
+                                  int argc, JSValueConst *argv)
+{
+    JSIORequest *req;
+    const char *url;
+    bool binary_flag, full_flag;
+    int timeout;
+
+    if (js_url_get_options(ctx, argc, argv, &binary_flag, &full_flag,
+                           &timeout))
+        return JS_EXCEPTION;
+    url = JS_ToCString(ctx, argv[0]);
+    if (!url)
+        return JS_EXCEPTION;
+    req = js_io_new_request(ctx, JS_IO_URL_GET);
+    if (!req) {
+        JS_FreeCString(ctx, url);
+        return JS_EXCEPTION;
+    }
+    req->binary = binary_flag;
+    req->full = full_flag;
+    req->filename = strdup(url);
+    JS_FreeCString(ctx, url);
+    req->resp = malloc(sizeof(*req->resp));
+    if (!req->filename || !req->resp) {
+        js_io_free_data(req);
+        return JS_ThrowOutOfMemory(ctx);
+    }
+    js_url_response_init(req->resp);
+    req->resp->timeout = timeout;
+    return js_io_submit(ctx, req);
+}
+#endif // !defined(__wasi__)
+
+/* readAsync(fd, buffer, offset, length), writeAsync(fd, buffer, offset,
+   length) */
+static JSValue js_os_read_write_async(JSContext *ctx, JSValueConst this_val,
+                                      int argc, JSValueConst *argv, int magic)
+{
+    JSIORequest *req;
+    int fd;
+    uint64_t pos, len;
+    size_t size;
+    uint8_t *buf;
+#if !defined(_WIN32)
+    struct stat st;
+#endif
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToIndex(ctx, &pos, argv[2]))
+        return JS_EXCEPTION;
+    if (JS_ToIndex(ctx, &len, argv[3]))
+        return JS_EXCEPTION;
+    buf = JS_GetArrayBuffer(ctx, &size, argv[1]);
+    if (!buf)
+        return JS_EXCEPTION;
+    if (pos + len > size)
+        return JS_ThrowRangeError(ctx, "read/write array buffer overflow");
+    req = js_io_new_request(ctx, magic ? JS_IO_WRITE : JS_IO_READ);
+    if (!req)
+        return JS_EXCEPTION;
+    req->fd = fd;
+    req->pos = pos;
+    req->len = len;
+    req->data = malloc(len + 1);
+    if (!req->data) {
+        js_io_free_data(req);
+        return JS_ThrowOutOfMemory(ctx);
+    }
+    if (magic)
+        memcpy(req->data, buf + pos, len);
+    else
+        req->buffer = JS_DupValue(ctx, argv[1]);
+#if !defined(_WIN32)
+    /* the regular files and block devices are always ready */
+    req->fd_wait = fstat(fd, &st) == 0 &&
+        !S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode);
+#endif
+    return js_io_submit(ctx, req);
+}
+
 static void js_free_message(JSWorkerMessage *msg);
 
+static void js_post_message(JSWorkerMessagePipe *ps, JSWorkerMessage *msg)
+{
+    msg->next = atomic_load(&ps->incoming);
+    while (!atomic_compare_exchange_strong(&ps->incoming, &msg->next, msg))
+        continue;
+    /* the receiver is not awake yet if the stack was empty */
+    if (!msg->next)
+        js_waker_signal(&ps->waker);
+}
+
+/* move the sent messages to msg_queue, must be called with ps->mutex */
+static void js_receive_messages(JSWorkerMessagePipe *ps)
+{
+    JSWorkerMessage *msg, *next;
+    struct list_head *first;
+
+    msg = atomic_exchange(&ps->incoming, NULL);
+    /* the stack is in reverse order */
+    first = ps->msg_queue.prev;
+    for(; msg != NULL; msg = next) {
+        next = msg->next;
+        list_add(&msg->link, first);
+    }
+}
+
+/* return the next message or NULL */
+static JSWorkerMessage *js_take_message(JSWorkerMessagePipe *ps)
+{
+    JSWorkerMessage *msg;
+
+    msg = NULL;
+    js_mutex_lock(&ps->mutex);
+    if (list_empty(&ps->msg_queue))
+        js_receive_messages(ps);
+    if (!list_empty(&ps->msg_queue)) {
+        msg = list_entry(ps->msg_queue.next, JSWorkerMessage, link);
+        list_del(&msg->link);
+    }
+    if (list_empty(&ps->msg_queue)) {
+        js_waker_clear(&ps->waker);
+        /* the messages sent since the batch was received may have been
+           signaled before the clear */
+        if (atomic_load(&ps->incoming))
+            js_waker_signal(&ps->waker);
+    }
+    js_mutex_unlock(&ps->mutex);
+    return msg;
+}
+
+static bool js_has_received_message(JSWorkerMessagePipe *ps)
+{
+    bool ret;
+
+    js_mutex_lock(&ps->mutex);
+    ret = !list_empty(&ps->msg_queue);
+    js_mutex_unlock(&ps->mutex);
+    return ret;
+}
+
 /* return 1 if a message was handled, 0 if no message */
 static int handle_posted_message(JSRuntime *rt, JSContext *ctx,
                                  JSWorkerMessageHandler *port)
 {
     JSWorkerMessagePipe *ps = port->recv_pipe;
     int ret;
-    struct list_head *el;
     JSWorkerMessage *msg;
     JSValue obj, data_obj, func, retval;
+    JSSABTab transfer_tab;
+    size_t i, j;
 
-    js_mutex_lock(&ps->mutex);
-    if (!list_empty(&ps->msg_queue)) {
-        el = ps->msg_queue.next;
-        msg = list_entry(el, JSWorkerMessage, link);
-
-        /* remove the message from the queue */
-        list_del(&msg->link);
-
-        // drain read end of pipe
-        if (list_empty(&ps->msg_queue))
-            js_waker_clear(&ps->waker);
-
-        js_mutex_unlock(&ps->mutex);
+    msg = js_take_message(ps);
+    if (msg) {
 
-        data_obj = JS_ReadObject(ctx, msg->data, msg->data_len,
-                                 JS_READ_OBJ_SAB | JS_READ_OBJ_REFERENCE);
+        data_obj = JS_ReadObject3(ctx, msg->data, msg->data_len,
+                                  JS_READ_OBJ_SAB | JS_READ_OBJ_REFERENCE |
+                                  JS_READ_OBJ_TRANSFER, NULL, &transfer_tab);
 
+        /* the adopted contents now belong to the new ArrayBuffers */
+        for(i = 0; i < transfer_tab.len; i++) {
+            for(j = 0; j < msg->transfer_tab_len; j++) {
+                if (msg->transfer_tab[j] == transfer_tab.tab[i]) {
+                    msg->transfer_tab[j] = NULL;
+                    break;
+                }
+            }
+        }
+        js_free(ctx, transfer_tab.tab);
         js_free_message(msg);
 
         if (JS_IsException(data_obj))
@@ -2578,12 +4274,27 @@ static int handle_posted_message(JSRuntime *rt, JSContext *ctx,
         }
         ret = 1;
     } else {
-        js_mutex_unlock(&ps->mutex);
         ret = 0;
     }
     return ret;
 }
 
+/* handle a message of a batch that was already received. The rest of
+   the batch doesn't need another poll() or wakeup. */
+static int handle_received_message(JSRuntime *rt, JSContext *ctx,
+                                   JSThreadState *ts)
+{
+    struct list_head *el;
+
+    list_for_each(el, &ts->port_list) {
+        JSWorkerMessageHandler *port = list_entry(el, JSWorkerMessageHandler, link);
+        if (!JS_IsNull(port->on_message_func) &&
+            js_has_received_message(port->recv_pipe))
+            return handle_posted_message(rt, ctx, port);
+    }
+    return 0;
+}
+
 #endif // USE_WORKER
 
 #if defined(_WIN32)
@@ -2603,8 +4314,13 @@ static int js_os_poll(JSContext *ctx)
     if (min_delay == 0)
         return 0; // expired timer
     if (min_delay < 0)
-        if (list_empty(&ts->os_rw_handlers) && list_empty(&ts->port_list))
+        if (list_empty(&ts->os_rw_handlers) && list_empty(&ts->port_list) &&
+            ts->io_pending == 0)
             return -1; /* no more events */
+#ifdef USE_WORKER
+    if (handle_received_message(rt, ctx, ts))
+        return 0;
+#endif
 
     count = 0;
     list_for_each(el, &ts->os_rw_handlers) {
@@ -2615,6 +4331,9 @@ static int js_os_poll(JSContext *ctx)
             break;
     }
 
+    if (ts->io_pending > 0 && count < (int)countof(handles))
+        handles[count++] = ts->io_waker.handle;
+
     list_for_each(el, &ts->port_list) {
         JSWorkerMessageHandler *port = list_entry(el, JSWorkerMessageHandler, link);
         if (JS_IsNull(port->on_message_func))
@@ -2630,6 +4349,9 @@ static int js_os_poll(JSContext *ctx)
             timeout = min_delay;
         ret = WaitForMultipleObjects(count, handles, FALSE, timeout);
         if (ret < count) {
+            if (ts->io_pending > 0 && handles[ret] == ts->io_waker.handle)
+                return handle_io_completion(ctx, ts) < 0 ? -1 : 0;
+
             list_for_each(el, &ts->os_rw_handlers) {
                 rh = list_entry(el, JSOSRWHandler, link);
                 if (rh->fd == 0 && !JS_IsNull(rh->rw_func[0])) {
@@ -2656,14 +4378,97 @@ done:
     return 0;
 }
 #else // !defined(_WIN32)
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+/* call the handler of the first ready event and store its result in
+   '*pret'. Return false if no event was pending. */
+static bool js_os_event_dispatch(JSContext *ctx, JSThreadState *ts, int *pret)
+{
+    JSOSRWHandler *rh;
+    int r, w;
+#if defined(USE_EPOLL)
+    struct epoll_event ev;
+
+    *pret = 0;
+    if (epoll_wait(ts->event_fd, &ev, 1, 0) != 1)
+        return false;
+    rh = find_rh_by_id(ts, ev.data.u64);
+    if (!rh)
+        return true; /* removed since the event was queued */
+    r = (EPOLLERR|EPOLLHUP|EPOLLIN) * !JS_IsNull(rh->rw_func[0]);
+    w = (EPOLLERR|EPOLLHUP|EPOLLOUT) * !JS_IsNull(rh->rw_func[1]);
+    r &= ev.events;
+    w &= ev.events;
+#else
+    static const struct timespec zero_timeout;
+    struct kevent kev;
+
+    *pret = 0;
+    if (kevent(ts->event_fd, NULL, 0, &kev, 1, &zero_timeout) != 1)
+        return false;
+    rh = find_rh_by_id(ts, (uintptr_t)kev.udata);
+    if (!rh)
+        return true; /* removed since the event was queued */
+    r = (kev.filter == EVFILT_READ) && !JS_IsNull(rh->rw_func[0]);
+    w = (kev.filter == EVFILT_WRITE) && !JS_IsNull(rh->rw_func[1]);
+#endif
+    if (r)
+        *pret = call_handler(ctx, rh->rw_func[0]);
+    else if (w)
+        *pret = call_handler(ctx, rh->rw_func[1]);
+    return true;
+}
+#endif // USE_EPOLL || USE_KQUEUE
+
+/* run incremental GC steps until the cycle is complete, an event is
+   pending or the next timer expires. A cycle is only started if GC
+   objects were allocated since the start of the previous one. Return
+   the remaining poll() timeout. */
+static int js_os_idle_gc(JSRuntime *rt, JSThreadState *ts,
+                         struct pollfd *pfds, int nfds, int min_delay)
+{
+    uint64_t cur_time, deadline;
+
+    cur_time = js__hrtime_ms();
+    if (!ts->idle_gc_running) {
+        if (cur_time - ts->idle_gc_time < JS_STD_IDLE_GC_INTERVAL)
+            return min_delay;
+        if (JS_GetGCAllocCount(rt) == ts->idle_gc_alloc_count) {
+            ts->idle_gc_time = cur_time;
+            return min_delay;
+        }
+        ts->idle_gc_alloc_count = JS_GetGCAllocCount(rt);
+    }
+    deadline = cur_time + min_delay;
+    ts->idle_gc_running = true;
+    for(;;) {
+        if (JS_RunGCStep(rt, ts->idle_gc_budget)) {
+            ts->idle_gc_running = false;
+            ts->idle_gc_time = js__hrtime_ms();
+            break;
+        }
+        if (poll(pfds, nfds, 0) != 0)
+            return 0;
+        if (min_delay > 0 && js__hrtime_ms() >= deadline)
+            return 0;
+    }
+    if (min_delay > 0) {
+        cur_time = js__hrtime_ms();
+        return deadline > cur_time ? deadline - cur_time : 0;
+    }
+    return min_delay;
+}
+
 static int js_os_poll(JSContext *ctx)
 {
     JSRuntime *rt = JS_GetRuntime(ctx);
     JSThreadState *ts = js_get_thread_state(rt);
-    int r, w, ret, nfds, min_delay;
+    int r, w, ret, n, nfds, min_delay;
     JSOSRWHandler *rh;
     struct list_head *el;
     struct pollfd *pfd, *pfds, pfds_local[64];
+#ifdef USE_WORKER
+    JSIORequest *req;
+#endif
 
     /* only check signals in the main thread */
     if (!ts->recv_pipe &&
@@ -2686,16 +4491,33 @@ static int js_os_poll(JSContext *ctx)
     if (min_delay == 0)
         return 0; // expired timer
     if (min_delay < 0)
-        if (list_empty(&ts->os_rw_handlers) && list_empty(&ts->port_list))
+        if (list_empty(&ts->os_rw_handlers) && list_empty(&ts->port_list) &&
+            ts->io_pending == 0)
             return -1; /* no more events */
+#ifdef USE_WORKER
+    if (handle_received_message(rt, ctx, ts))
+        return 0;
+#endif
 
-    nfds = 0;
-    list_for_each(el, &ts->os_rw_handlers) {
-        rh = list_entry(el, JSOSRWHandler, link);
-        nfds += (!JS_IsNull(rh->rw_func[0]) || !JS_IsNull(rh->rw_func[1]));
+    /* the handlers registered with the event backend are reported
+       by a single fd */
+    nfds = (ts->event_fd >= 0);
+    if (ts->polled_rw_count > 0) {
+        list_for_each(el, &ts->os_rw_handlers) {
+            rh = list_entry(el, JSOSRWHandler, link);
+            nfds += rh->polled &&
+                (!JS_IsNull(rh->rw_func[0]) || !JS_IsNull(rh->rw_func[1]));
+        }
     }
 
 #ifdef USE_WORKER
+    nfds += (ts->io_pending > 0);
+    if (ts->io_ready) {
+        list_for_each(el, &ts->io_fd_requests) {
+            req = list_entry(el, JSIORequest, fd_link);
+            nfds += js_io_fd_polled(ts, req);
+        }
+    }
     list_for_each(el, &ts->port_list) {
         JSWorkerMessageHandler *port = list_entry(el, JSWorkerMessageHandler, link);
         nfds += !JS_IsNull(port->on_message_func);
@@ -2709,15 +4531,32 @@ static int js_os_poll(JSContext *ctx)
             return -1;
     }
 
-    list_for_each(el, &ts->os_rw_handlers) {
-        rh = list_entry(el, JSOSRWHandler, link);
-        r = POLLIN * !JS_IsNull(rh->rw_func[0]);
-        w = POLLOUT * !JS_IsNull(rh->rw_func[1]);
-        if (r || w)
-            *pfd++ = (struct pollfd){rh->fd, r|w, 0};
+    if (ts->event_fd >= 0)
+        *pfd++ = (struct pollfd){ts->event_fd, POLLIN, 0};
+    if (ts->polled_rw_count > 0) {
+        list_for_each(el, &ts->os_rw_handlers) {
+            rh = list_entry(el, JSOSRWHandler, link);
+            if (!rh->polled)
+                continue;
+            r = POLLIN * !JS_IsNull(rh->rw_func[0]);
+            w = POLLOUT * !JS_IsNull(rh->rw_func[1]);
+            if (r || w)
+                *pfd++ = (struct pollfd){rh->fd, r|w, 0};
+        }
     }
 
 #ifdef USE_WORKER
+    if (ts->io_pending > 0)
+        *pfd++ = (struct pollfd){ts->io_waker.read_fd, POLLIN, 0};
+    if (ts->io_ready) {
+        list_for_each(el, &ts->io_fd_requests) {
+            req = list_entry(el, JSIORequest, fd_link);
+            if (js_io_fd_polled(ts, req)) {
+                *pfd++ = (struct pollfd){req->fd,
+                    req->op == JS_IO_READ ? POLLIN : POLLOUT, 0};
+            }
+        }
+    }
     list_for_each(el, &ts->port_list) {
         JSWorkerMessageHandler *port = list_entry(el, JSWorkerMessageHandler, link);
         if (!JS_IsNull(port->on_message_func)) {
@@ -2727,12 +4566,34 @@ static int js_os_poll(JSContext *ctx)
     }
 #endif // USE_WORKER
 
+    if (ts->idle_gc_budget)
+        min_delay = js_os_idle_gc(rt, ts, pfds, nfds, min_delay);
+
     // FIXME(bnoordhuis) the loop below is quadratic in theory but
     // linear-ish in practice because we bail out on the first hit,
     // i.e., it's probably good enough for now
     ret = 0;
-    nfds = poll(pfds, nfds, min_delay);
-    for (pfd = pfds; nfds-- > 0; pfd++) {
+    n = poll(pfds, nfds, min_delay);
+    for (pfd = pfds; n > 0 && pfd < pfds + nfds; pfd++) {
+        if (!pfd->revents)
+            continue;
+        n--;
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+        if (pfd->fd == ts->event_fd) {
+            if (js_os_event_dispatch(ctx, ts, &ret))
+                goto done;
+            continue;
+        }
+#endif
+#ifdef USE_WORKER
+        if (ts->io_pending > 0 && pfd->fd == ts->io_waker.read_fd) {
+            ret = handle_io_completion(ctx, ts) < 0 ? -1 : 0;
+            goto done;
+        }
+        /* a fd may have both a handler and a request */
+        if (ts->io_ready)
+            js_io_fd_ready(ts, pfd->fd, pfd->revents);
+#endif
         rh = find_rh(ts, pfd->fd);
         if (rh) {
             r = (POLLERR|POLLHUP|POLLNVAL|POLLIN) * !JS_IsNull(rh->rw_func[0]);
@@ -3070,6 +4931,56 @@ static JSValue js_os_utimes(JSContext *ctx, JSValueConst this_val,
     return JS_NewInt32(ctx, ret);
 }
 
+/* startProfiling(interval_us = 1000) */
+static JSValue js_os_startProfiling(JSContext *ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv)
+{
+    int32_t interval = 1000;
+
+    if (argc > 0 && !JS_IsUndefined(argv[0])) {
+        if (JS_ToInt32(ctx, &interval, argv[0]))
+            return JS_EXCEPTION;
+    }
+    if (JS_StartProfiling(JS_GetRuntime(ctx), interval))
+        return JS_ThrowInternalError(ctx, "could not start the profiler");
+    return JS_UNDEFINED;
+}
+
+static JSValue js_os_stopProfiling(JSContext *ctx, JSValueConst this_val,
+                                   int argc, JSValueConst *argv)
+{
+    return JS_StopProfiling(ctx);
+}
+
+/* startHeapSampling(interval = 1024) */
+static JSValue js_os_startHeapSampling(JSContext *ctx, JSValueConst this_val,
+                                       int argc, JSValueConst *argv)
+{
+    int32_t interval = 1024;
+
+    if (argc > 0 && !JS_IsUndefined(argv[0])) {
+        if (JS_ToInt32(ctx, &interval, argv[0]))
+            return JS_EXCEPTION;
+    }
+    if (interval < 1)
+        return JS_ThrowRangeError(ctx, "invalid interval");
+    if (JS_StartHeapSampling(JS_GetRuntime(ctx), interval))
+        return JS_ThrowInternalError(ctx, "could not start the heap profiler");
+    return JS_UNDEFINED;
+}
+
+static JSValue js_os_stopHeapSampling(JSContext *ctx, JSValueConst this_val,
+                                      int argc, JSValueConst *argv)
+{
+    return JS_StopHeapSampling(ctx);
+}
+
+static JSValue js_os_takeHeapSnapshot(JSContext *ctx, JSValueConst this_val,
+                                      int argc, JSValueConst *argv)
+{
+    return JS_TakeHeapSnapshot(ctx);
+}
+
 /* sleep(delay_ms) */
 static JSValue js_os_sleep(JSContext *ctx, JSValueConst this_val,
                           int argc, JSValueConst *argv)
@@ -3662,12 +5573,15 @@ typedef struct {
     JSWorkerMessagePipe *recv_pipe;
     JSWorkerMessagePipe *send_pipe;
     JSWorkerMessageHandler *msg_handler;
+    int thread_count; /* > 1 for a WorkerPool */
 } JSWorkerData;
 
 typedef struct {
     char *filename; /* module filename */
     char *basename; /* module base name */
     JSWorkerMessagePipe *recv_pipe, *send_pipe;
+    JSContext *(*new_context_func)(JSRuntime *rt, void *opaque);
+    void *new_context_opaque;
 } WorkerFuncArgs;
 
 typedef struct {
@@ -3725,6 +5639,7 @@ static JSWorkerMessagePipe *js_new_message_pipe(void)
         return NULL;
     }
     ps->ref_count = 1;
+    ps->incoming = NULL;
     init_list_head(&ps->msg_queue);
     js_mutex_init(&ps->mutex);
     return ps;
@@ -3744,6 +5659,10 @@ static void js_free_message(JSWorkerMessage *msg)
         js_sab_free(NULL, msg->sab_tab[i]);
     }
     free(msg->sab_tab);
+    for(i = 0; i < msg->transfer_tab_len; i++) {
+        free(msg->transfer_tab[i]);
+    }
+    free(msg->transfer_tab);
     free(msg->data);
     free(msg);
 }
@@ -3760,6 +5679,7 @@ static void js_free_message_pipe(JSWorkerMessagePipe *ps)
     ref_count = atomic_add_int(&ps->ref_count, -1);
     assert(ref_count >= 0);
     if (ref_count == 0) {
+        js_receive_messages(ps);
         list_for_each_safe(el, el1, &ps->msg_queue) {
             msg = list_entry(el, JSWorkerMessage, link);
             js_free_message(msg);
@@ -3821,7 +5741,10 @@ static void worker_func(void *opaque)
 
     /* function pointer to avoid linking the whole JS_NewContext() if
        not needed */
-    ctx = js_worker_new_context_func(rt);
+    if (args->new_context_func)
+        ctx = args->new_context_func(rt, args->new_context_opaque);
+    else
+        ctx = js_worker_new_context_func(rt);
     if (ctx == NULL) {
         fprintf(stderr, "JS_NewContext failure");
     }
@@ -3880,14 +5803,31 @@ static JSValue js_worker_ctor_internal(JSContext *ctx, JSValueConst new_target,
     return JS_EXCEPTION;
 }
 
-static JSValue js_worker_ctor(JSContext *ctx, JSValueConst new_target,
-                              int argc, JSValueConst *argv)
+static void free_worker_func_args(WorkerFuncArgs *args)
+{
+    if (args) {
+        free(args->filename);
+        free(args->basename);
+        js_free_message_pipe(args->recv_pipe);
+        js_free_message_pipe(args->send_pipe);
+        free(args);
+    }
+}
+
+/* start 'thread_count' threads running the module 'filename_val'. They
+   all receive the messages posted to the returned object from the same
+   queue, so that a message is handled by the first idle thread. */
+static JSValue js_worker_start(JSContext *ctx, JSValueConst new_target,
+                               JSValueConst filename_val, int thread_count)
 {
     JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = js_get_thread_state(rt);
+    JSWorkerMessagePipe *recv_pipe = NULL, *send_pipe = NULL;
     WorkerFuncArgs *args = NULL;
+    JSWorkerData *worker;
     js_thread_t thr;
     JSValue obj = JS_UNDEFINED;
-    int ret;
+    int i, ret;
     const char *filename = NULL, *basename;
     JSAtom basename_atom;
 
@@ -3908,35 +5848,49 @@ static JSValue js_worker_ctor(JSContext *ctx, JSValueConst new_target,
         goto fail;
 
     /* module name */
-    filename = JS_ToCString(ctx, argv[0]);
+    filename = JS_ToCString(ctx, filename_val);
     if (!filename)
         goto fail;
 
-    args = malloc(sizeof(*args));
-    if (!args)
-        goto oom_fail;
-    memset(args, 0, sizeof(*args));
-    args->filename = strdup(filename);
-    args->basename = strdup(basename);
-
     /* ports */
-    args->recv_pipe = js_new_message_pipe();
-    if (!args->recv_pipe)
+    recv_pipe = js_new_message_pipe();
+    if (!recv_pipe)
         goto oom_fail;
-    args->send_pipe = js_new_message_pipe();
-    if (!args->send_pipe)
+    send_pipe = js_new_message_pipe();
+    if (!send_pipe)
         goto oom_fail;
 
-    obj = js_worker_ctor_internal(ctx, new_target,
-                                  args->send_pipe, args->recv_pipe);
+    obj = js_worker_ctor_internal(ctx, new_target, send_pipe, recv_pipe);
     if (JS_IsException(obj))
         goto fail;
-
-    ret = js_thread_create(&thr, worker_func, args, JS_THREAD_CREATE_DETACHED);
-    if (ret != 0) {
-        JS_ThrowTypeError(ctx, "could not create worker");
-        goto fail;
+    worker = JS_GetOpaque(obj, ts->worker_class_id);
+    worker->thread_count = thread_count;
+
+    for(i = 0; i < thread_count; i++) {
+        args = malloc(sizeof(*args));
+        if (!args)
+            goto oom_fail;
+        memset(args, 0, sizeof(*args));
+        args->filename = strdup(filename);
+        args->basename = strdup(basename);
+        args->recv_pipe = js_dup_message_pipe(recv_pipe);
+        args->send_pipe = js_dup_message_pipe(send_pipe);
+        args->new_context_func = ts->worker_new_context_func;
+        args->new_context_opaque = ts->worker_new_context_opaque;
+        if (!args->filename || !args->basename)
+            goto oom_fail;
+
+        /* the threads already started keep running: they are only
+           reachable through the pipes, which they reference */
+        ret = js_thread_create(&thr, worker_func, args, JS_THREAD_CREATE_DETACHED);
+        if (ret != 0) {
+            JS_ThrowTypeError(ctx, "could not create worker");
+            goto fail;
+        }
+        args = NULL;
     }
+    js_free_message_pipe(recv_pipe);
+    js_free_message_pipe(send_pipe);
     JS_FreeCString(ctx, basename);
     JS_FreeCString(ctx, filename);
     return obj;
@@ -3945,17 +5899,41 @@ static JSValue js_worker_ctor(JSContext *ctx, JSValueConst new_target,
  fail:
     JS_FreeCString(ctx, basename);
     JS_FreeCString(ctx, filename);
-    if (args) {
-        free(args->filename);
-        free(args->basename);
-        js_free_message_pipe(args->recv_pipe);
-        js_free_message_pipe(args->send_pipe);
-        free(args);
-    }
+    free_worker_func_args(args);
+    js_free_message_pipe(recv_pipe);
+    js_free_message_pipe(send_pipe);
     JS_FreeValue(ctx, obj);
     return JS_EXCEPTION;
 }
 
+static JSValue js_worker_ctor(JSContext *ctx, JSValueConst new_target,
+                              int argc, JSValueConst *argv)
+{
+    return js_worker_start(ctx, new_target, argv[0], 1);
+}
+
+/* new WorkerPool(module_filename, thread_count) */
+static JSValue js_worker_pool_ctor(JSContext *ctx, JSValueConst new_target,
+                                   int argc, JSValueConst *argv)
+{
+    int thread_count;
+
+    if (JS_ToInt32(ctx, &thread_count, argv[1]))
+        return JS_EXCEPTION;
+    if (thread_count < 1 || thread_count > JS_WORKER_POOL_MAX_THREADS)
+        return JS_ThrowRangeError(ctx, "invalid thread count");
+    return js_worker_start(ctx, new_target, argv[0], thread_count);
+}
+
+static void js_free_value_list(JSContext *ctx, JSValue *tab, int len)
+{
+    int i;
+
+    for(i = 0; i < len; i++)
+        JS_FreeValue(ctx, tab[i]);
+    js_free(ctx, tab);
+}
+
 static JSValue js_worker_postMessage(JSContext *ctx, JSValueConst this_val,
                                      int argc, JSValueConst *argv)
 {
@@ -3966,29 +5944,62 @@ static JSValue js_worker_postMessage(JSContext *ctx, JSValueConst this_val,
     size_t data_len, i;
     uint8_t *data;
     JSWorkerMessage *msg;
-    JSSABTab sab_tab;
+    JSSABTab sab_tab, transfer_tab;
+    JSValue transfer_obj, *transfer;
+    int64_t len;
+    int transfer_len;
 
     if (!worker)
         return JS_EXCEPTION;
 
-    data = JS_WriteObject2(ctx, &data_len, argv[0],
-                           JS_WRITE_OBJ_SAB | JS_WRITE_OBJ_REFERENCE,
-                           &sab_tab);
+    /* postMessage(msg, transfer) or postMessage(msg, { transfer }) */
+    transfer = NULL;
+    transfer_len = 0;
+    if (argc > 1 && !JS_IsUndefined(argv[1])) {
+        if (JS_IsArray(argv[1]))
+            transfer_obj = JS_DupValue(ctx, argv[1]);
+        else
+            transfer_obj = JS_GetPropertyStr(ctx, argv[1], "transfer");
+        if (JS_IsException(transfer_obj))
+            return JS_EXCEPTION;
+        if (!JS_IsUndefined(transfer_obj)) {
+            if (JS_GetLength(ctx, transfer_obj, &len))
+                goto fail_transfer;
+            if (len > INT32_MAX) {
+                JS_ThrowRangeError(ctx, "invalid transfer list length");
+                goto fail_transfer;
+            }
+            transfer = js_mallocz(ctx, sizeof(transfer[0]) * max_int(len, 1));
+            if (!transfer)
+                goto fail_transfer;
+            for(transfer_len = 0; transfer_len < len; transfer_len++) {
+                transfer[transfer_len] =
+                    JS_GetPropertyUint32(ctx, transfer_obj, transfer_len);
+                if (JS_IsException(transfer[transfer_len]))
+                    goto fail_transfer;
+            }
+        }
+        JS_FreeValue(ctx, transfer_obj);
+    }
+
+    /* written with malloc() so that it can be stored in the message as is */
+    data = JS_WriteObject3(ctx, &data_len, argv[0],
+                           JS_WRITE_OBJ_SAB | JS_WRITE_OBJ_REFERENCE |
+                           JS_WRITE_OBJ_SYSTEM_ALLOC,
+                           &sab_tab, transfer, transfer_len, &transfer_tab);
+    js_free_value_list(ctx, transfer, transfer_len);
     if (!data)
         return JS_EXCEPTION;
 
     msg = malloc(sizeof(*msg));
     if (!msg)
         goto fail;
-    msg->data = NULL;
-    msg->sab_tab = NULL;
-
-    /* must reallocate because the allocator may be different */
-    msg->data = malloc(data_len);
-    if (!msg->data)
-        goto fail;
-    memcpy(msg->data, data, data_len);
+    msg->data = data;
     msg->data_len = data_len;
+    msg->sab_tab = NULL;
+    msg->transfer_tab = NULL;
+    msg->transfer_tab_len = 0;
+    data = NULL;
 
     if (sab_tab.len > 0) {
         msg->sab_tab = malloc(sizeof(msg->sab_tab[0]) * sab_tab.len);
@@ -3998,8 +6009,17 @@ static JSValue js_worker_postMessage(JSContext *ctx, JSValueConst this_val,
     }
     msg->sab_tab_len = sab_tab.len;
 
-    js_free(ctx, data);
+    if (transfer_tab.len > 0) {
+        msg->transfer_tab = malloc(sizeof(msg->transfer_tab[0]) * transfer_tab.len);
+        if (!msg->transfer_tab)
+            goto fail;
+        memcpy(msg->transfer_tab, transfer_tab.tab,
+               sizeof(msg->transfer_tab[0]) * transfer_tab.len);
+    }
+    msg->transfer_tab_len = transfer_tab.len;
+
     js_free(ctx, sab_tab.tab);
+    js_free(ctx, transfer_tab.tab);
 
     /* increment the SAB reference counts */
     for(i = 0; i < msg->sab_tab_len; i++) {
@@ -4007,21 +6027,25 @@ static JSValue js_worker_postMessage(JSContext *ctx, JSValueConst this_val,
     }
 
     ps = worker->send_pipe;
-    js_mutex_lock(&ps->mutex);
-    /* indicate that data is present */
-    if (list_empty(&ps->msg_queue))
-        js_waker_signal(&ps->waker);
-    list_add_tail(&msg->link, &ps->msg_queue);
-    js_mutex_unlock(&ps->mutex);
+    js_post_message(ps, msg);
     return JS_UNDEFINED;
  fail:
+    /* the ArrayBuffers are already detached, their contents are lost */
     if (msg) {
         free(msg->data);
         free(msg->sab_tab);
+        free(msg->transfer_tab);
         free(msg);
     }
-    js_free(ctx, data);
+    free(data);
+    for(i = 0; i < transfer_tab.len; i++)
+        free(transfer_tab.tab[i]);
     js_free(ctx, sab_tab.tab);
+    js_free(ctx, transfer_tab.tab);
+    return JS_ThrowOutOfMemory(ctx);
+ fail_transfer:
+    JS_FreeValue(ctx, transfer_obj);
+    js_free_value_list(ctx, transfer, transfer_len);
     return JS_EXCEPTION;
 
 }
@@ -4077,13 +6101,33 @@ static JSValue js_worker_get_onmessage(JSContext *ctx, JSValueConst this_val)
     }
 }
 
+static JSValue js_worker_pool_get_size(JSContext *ctx, JSValueConst this_val)
+{
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = js_get_thread_state(rt);
+    JSWorkerData *worker = JS_GetOpaque2(ctx, this_val, ts->worker_class_id);
+    if (!worker)
+        return JS_EXCEPTION;
+    return JS_NewInt32(ctx, worker->thread_count);
+}
+
 static const JSCFunctionListEntry js_worker_proto_funcs[] = {
     JS_CFUNC_DEF("postMessage", 1, js_worker_postMessage ),
     JS_CGETSET_DEF("onmessage", js_worker_get_onmessage, js_worker_set_onmessage ),
 };
 
+static const JSCFunctionListEntry js_worker_pool_proto_funcs[] = {
+    JS_CGETSET_DEF("size", js_worker_pool_get_size, NULL ),
+};
+
 #endif /* USE_WORKER */
 
+void js_std_set_idle_gc_budget(JSRuntime *rt, size_t budget)
+{
+    JSThreadState *ts = js_get_thread_state(rt);
+    ts->idle_gc_budget = budget;
+}
+
 void js_std_set_worker_new_runtime_func(JSRuntime *(*func)(void))
 {
 #ifdef USE_WORKER
@@ -4098,6 +6142,16 @@ void js_std_set_worker_new_context_func(JSContext *(*func)(JSRuntime *rt))
 #endif
 }
 
+void js_std_set_worker_new_context_func2(JSRuntime *rt,
+                                         JSContext *(*func)(JSRuntime *rt,
+                                                            void *opaque),
+                                         void *opaque)
+{
+    JSThreadState *ts = js_get_thread_state(rt);
+    ts->worker_new_context_func = func;
+    ts->worker_new_context_opaque = opaque;
+}
+
 #if defined(_WIN32)
 #define OS_PLATFORM "win32"
 #elif defined(__APPLE__)
@@ -4140,6 +6194,10 @@ static const JSCFunctionListEntry js_os_funcs[] = {
     JS_CFUNC_DEF("close", 1, js_os_close ),
     JS_CFUNC_DEF("seek", 3, js_os_seek ),
     JS_CFUNC_MAGIC_DEF("read", 4, js_os_read_write, 0 ),
+#ifdef USE_WORKER
+    JS_CFUNC_MAGIC_DEF("readAsync", 4, js_os_read_write_async, 0 ),
+    JS_CFUNC_MAGIC_DEF("writeAsync", 4, js_os_read_write_async, 1 ),
+#endif
     JS_CFUNC_MAGIC_DEF("write", 4, js_os_read_write, 1 ),
     JS_CFUNC_DEF("isatty", 1, js_os_isatty ),
 #if !defined(__wasi__)
@@ -4200,6 +6258,11 @@ static const JSCFunctionListEntry js_os_funcs[] = {
     JS_CFUNC_MAGIC_DEF("stat", 1, js_os_stat, 0 ),
     JS_CFUNC_DEF("utimes", 3, js_os_utimes ),
     JS_CFUNC_DEF("sleep", 1, js_os_sleep ),
+    JS_CFUNC_DEF("startProfiling", 0, js_os_startProfiling ),
+    JS_CFUNC_DEF("stopProfiling", 0, js_os_stopProfiling ),
+    JS_CFUNC_DEF("startHeapSampling", 0, js_os_startHeapSampling ),
+    JS_CFUNC_DEF("stopHeapSampling", 0, js_os_stopHeapSampling ),
+    JS_CFUNC_DEF("takeHeapSnapshot", 0, js_os_takeHeapSnapshot ),
 #if !defined(__wasi__)
     JS_CFUNC_DEF("realpath", 1, js_os_realpath ),
 #endif
@@ -4227,7 +6290,7 @@ static int js_os_init(JSContext *ctx, JSModuleDef *m)
 
 #ifdef USE_WORKER
     {
-        JSValue proto, obj;
+        JSValue proto, pool_proto, obj;
         /* Worker class */
         JS_NewClassID(rt, &ts->worker_class_id);
         JS_NewClass(rt, ts->worker_class_id, &js_worker_class);
@@ -4248,6 +6311,16 @@ static int js_os_init(JSContext *ctx, JSModuleDef *m)
         }
 
         JS_SetModuleExport(ctx, m, "Worker", obj);
+
+        /* WorkerPool class: the threads share the Worker methods */
+        pool_proto = JS_NewObjectProto(ctx, proto);
+        JS_SetPropertyFunctionList(ctx, pool_proto, js_worker_pool_proto_funcs,
+                                   countof(js_worker_pool_proto_funcs));
+        obj = JS_NewCFunction2(ctx, js_worker_pool_ctor, "WorkerPool", 2,
+                               JS_CFUNC_constructor, 0);
+        JS_SetConstructor(ctx, obj, pool_proto);
+        JS_FreeValue(ctx, pool_proto);
+        JS_SetModuleExport(ctx, m, "WorkerPool", obj);
     }
 #endif /* USE_WORKER */
 
@@ -4263,6 +6336,7 @@ JSModuleDef *js_init_module_os(JSContext *ctx, const char *module_name)
     JS_AddModuleExportList(ctx, m, js_os_funcs, countof(js_os_funcs));
 #ifdef USE_WORKER
     JS_AddModuleExport(ctx, m, "Worker");
+    JS_AddModuleExport(ctx, m, "WorkerPool");
 #endif
     return m;
 }
@@ -4359,6 +6433,9 @@ void js_std_add_helpers(JSContext *ctx, int argc, char **argv)
 static void js_std_finalize(JSRuntime *rt, void *arg)
 {
     JSThreadState *ts = arg;
+#ifdef USE_WORKER
+    js_mutex_destroy(&ts->http_mutex);
+#endif
     js_set_thread_state(rt, NULL);
     js_free_rt(rt, ts);
 }
@@ -4373,12 +6450,22 @@ void js_std_init_handlers(JSRuntime *rt)
         exit(1);
     }
     init_list_head(&ts->os_rw_handlers);
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    ts->event_fd = js_os_event_open();
+#else
+    ts->event_fd = -1;
+#endif
     init_list_head(&ts->os_signal_handlers);
-    init_list_head(&ts->os_timers);
     init_list_head(&ts->port_list);
     init_list_head(&ts->rejected_promise_list);
+    init_list_head(&ts->http_conns);
+#ifdef USE_WORKER
+    js_mutex_init(&ts->http_mutex);
+#endif
 
     ts->next_timer_id = 1;
+    ts->next_timer_seq = 1;
+    ts->idle_gc_budget = JS_STD_IDLE_GC_BUDGET;
 
     js_set_thread_state(rt, ts);
     JS_AddRuntimeFinalizer(rt, js_std_finalize, ts);
@@ -4404,7 +6491,11 @@ static void free_rp(JSRuntime *rt, JSRejectedPromiseEntry *rp)
     js_free_rt(rt, rp);
 }
 
-void js_std_free_handlers(JSRuntime *rt)
+/* Free the JS callbacks (I/O and signal handlers, timers, pending
+   asynchronous I/O) and the unhandled rejections, so that the contexts of
+   the runtime can be freed and the runtime reused with a new context. The
+   event loop state and the worker message pipes are kept. */
+void js_std_reset_handlers(JSRuntime *rt)
 {
     JSThreadState *ts = js_get_thread_state(rt);
     struct list_head *el, *el1;
@@ -4419,16 +6510,53 @@ void js_std_free_handlers(JSRuntime *rt)
         free_sh(rt, sh);
     }
 
-    list_for_each_safe(el, el1, &ts->os_timers) {
-        JSOSTimer *th = list_entry(el, JSOSTimer, link);
-        free_timer(rt, th);
-    }
+    while (ts->os_timers.count > 0)
+        free_timer(rt, ts->os_timers.tab[0]);
+    while (ts->os_expired_timers.count > 0)
+        free_timer(rt, ts->os_expired_timers.tab[0]);
+    js_free_rt(rt, ts->os_timers.tab);
+    js_free_rt(rt, ts->os_expired_timers.tab);
+    js_free_rt(rt, ts->timer_hash);
+    js_free_rt(rt, ts->rw_hash);
+    memset(&ts->os_timers, 0, sizeof(ts->os_timers));
+    memset(&ts->os_expired_timers, 0, sizeof(ts->os_expired_timers));
+    ts->timer_hash = NULL;
+    ts->timer_hash_size = 0;
+    ts->rw_hash = NULL;
+    ts->rw_hash_size = 0;
 
     list_for_each_safe(el, el1, &ts->rejected_promise_list) {
         JSRejectedPromiseEntry *rp = list_entry(el, JSRejectedPromiseEntry, link);
         free_rp(rt, rp);
     }
 
+#ifdef USE_WORKER
+    js_io_free_handlers(rt, ts);
+#endif
+    /* finish the idle GC cycle started with the previous objects */
+    while (ts->idle_gc_running) {
+        if (JS_RunGCStep(rt, ts->idle_gc_budget)) {
+            ts->idle_gc_running = false;
+            ts->idle_gc_time = js__hrtime_ms();
+        }
+    }
+    ts->next_timer_id = 1;
+}
+
+void js_std_free_handlers(JSRuntime *rt)
+{
+    JSThreadState *ts = js_get_thread_state(rt);
+
+    js_std_reset_handlers(rt);
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    if (ts->event_fd >= 0) {
+        close(ts->event_fd);
+        ts->event_fd = -1;
+    }
+#endif
+#ifdef USE_HTTP_CLIENT
+    http_free_conns(ts);
+#endif
 #ifdef USE_WORKER
     /* XXX: free port_list ? */
     js_free_message_pipe(ts->recv_pipe);
@@ -4546,14 +6674,9 @@ int js_std_loop(JSContext *ctx)
 
     for(;;) {
         /* execute the pending jobs */
-        for(;;) {
-            err = JS_ExecutePendingJob(JS_GetRuntime(ctx), &ctx1);
-            if (err <= 0) {
-                if (err < 0)
-                    goto done;
-                break;
-            }
-        }
+        err = JS_ExecutePendingJobs(rt, -1, &ctx1);
+        if (err < 0)
+            goto done;
 
         js_std_promise_rejection_check(ctx);
 
@@ -4587,14 +6710,15 @@ JSValue js_std_await(JSContext *ctx, JSValue obj)
         } else if (state == JS_PROMISE_PENDING) {
             JSContext *ctx1;
             int err;
-            err = JS_ExecutePendingJob(JS_GetRuntime(ctx), &ctx1);
+            /* drain the microtasks before checking the promise again */
+            err = JS_ExecutePendingJobs(rt, -1, &ctx1);
             if (err < 0) {
                 js_std_dump_error(ctx1);
-            }
-            if (err == 0)
+            } else if (err == 0) {
                 js_std_promise_rejection_check(ctx);
-            if (ts->can_js_os_poll)
-                js_os_poll(ctx);
+                if (ts->can_js_os_poll)
+                    js_os_poll(ctx);
+            }
         } else {
             /* not a promise */
             ret = obj;
@@ -4604,73 +6728,64 @@ JSValue js_std_await(JSContext *ctx, JSValue obj)
     return ret;
 }
 
-void js_std_eval_binary(JSContext *ctx, const uint8_t *buf, size_t buf_len,
-                        int load_only)
+/* evaluate the object returned by JS_ReadObject(). Return false if
+   exception. */
+static bool js_std_eval_binary_obj(JSContext *ctx, JSValue obj, int load_only)
 {
-    JSValue obj, val;
-    obj = JS_ReadObject(ctx, buf, buf_len, JS_READ_OBJ_BYTECODE);
+    JSValue val;
     if (JS_IsException(obj))
-        goto exception;
+        return false;
     if (load_only) {
         if (JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE) {
             if (js_module_set_import_meta(ctx, obj, false, false) < 0)
-                goto exception;
+                return false;
         }
         JS_FreeValue(ctx, obj);
     } else {
         if (JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE) {
             if (JS_ResolveModule(ctx, obj) < 0) {
                 JS_FreeValue(ctx, obj);
-                goto exception;
+                return false;
             }
             if (js_module_set_import_meta(ctx, obj, false, true) < 0)
-                goto exception;
+                return false;
             val = JS_EvalFunction(ctx, obj);
             val = js_std_await(ctx, val);
         } else {
             val = JS_EvalFunction(ctx, obj);
         }
-        if (JS_IsException(val)) {
-        exception:
-            js_std_dump_error(ctx);
-            exit(1);
-        }
+        if (JS_IsException(val))
+            return false;
         JS_FreeValue(ctx, val);
     }
+    return true;
 }
 
-bool js_std_eval_binary_bool(JSContext *ctx, const uint8_t *buf, size_t buf_len,
+void js_std_eval_binary(JSContext *ctx, const uint8_t *buf, size_t buf_len,
                         int load_only)
 {
-    JSValue obj, val;
+    JSValue obj;
     obj = JS_ReadObject(ctx, buf, buf_len, JS_READ_OBJ_BYTECODE);
-    if (JS_IsException(obj))
-        goto exception;
-    if (load_only) {
-        if (JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE) {
-            if (js_module_set_import_meta(ctx, obj, false, false) < 0)
-                goto exception;
-        }
-        JS_FreeValue(ctx, obj);
-    } else {
-        if (JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE) {
-            if (JS_ResolveModule(ctx, obj) < 0) {
-                JS_FreeValue(ctx, obj);
-                goto exception;
-            }
-            if (js_module_set_import_meta(ctx, obj, false, true) < 0)
-                goto exception;
-            val = JS_EvalFunction(ctx, obj);
-            val = js_std_await(ctx, val);
-        } else {
-            val = JS_EvalFunction(ctx, obj);
-        }
-        if (JS_IsException(val)) {
-        exception:
-            return false;
-        }
+    if (!js_std_eval_binary_obj(ctx, obj, load_only)) {
+        js_std_dump_error(ctx);
+        exit(1);
     }
-    return true;
+}
+
+bool js_std_eval_binary_bool(JSContext *ctx, const uint8_t *buf, size_t buf_len,
+                        int load_only)
+{
+    JSValue obj;
+    obj = JS_ReadObject(ctx, buf, buf_len, JS_READ_OBJ_BYTECODE);
+    return js_std_eval_binary_obj(ctx, obj, load_only);
+}
+
+bool js_std_eval_binary_stream(JSContext *ctx, JSReadObjectFunc *read_func,
+                               void *opaque, int load_only)
+{
+    JSValue obj;
+    obj = JS_ReadObjectStream(ctx, read_func, opaque, JS_READ_OBJ_BYTECODE);
+    return js_std_eval_binary_obj(ctx, obj, load_only);
 }
 
 static JSValue js_bjson_read(JSContext *ctx, JSValueConst this_val,
@@ -51,6 +51,9 @@ JS_EXTERN int js_std_loop(JSContext *ctx);
 JS_EXTERN JSValue js_std_await(JSContext *ctx, JSValue obj);
 JS_EXTERN void js_std_init_handlers(JSRuntime *rt);
 JS_EXTERN void js_std_free_handlers(JSRuntime *rt);
+// Free the timers, handlers and pending I/O of the runtime but keep it
+// usable, e.g. before replacing its context with a new one.
+JS_EXTERN void js_std_reset_handlers(JSRuntime *rt);
 JS_EXTERN void js_std_dump_error(JSContext *ctx);
 JS_EXTERN uint8_t *js_load_file(JSContext *ctx, size_t *pbuf_len,
                                 const char *filename);
@@ -62,17 +65,48 @@ JS_EXTERN void js_std_eval_binary(JSContext *ctx, const uint8_t *buf,
                                   size_t buf_len, int flags);
 JS_EXTERN bool js_std_eval_binary_bool(JSContext *ctx, const uint8_t *buf,
                                   size_t buf_len, int flags);
+// Same as js_std_eval_binary_bool() but the bytecode is deserialized
+// while it is read with 'read_func', see JS_ReadObjectStream().
+JS_EXTERN bool js_std_eval_binary_stream(JSContext *ctx,
+                                         JSReadObjectFunc *read_func,
+                                         void *opaque, int flags);
 JS_EXTERN void js_std_promise_rejection_tracker(JSContext *ctx,
                                                 JSValueConst promise,
                                                 JSValueConst reason,
                                                 bool is_handled,
                                                 void *opaque);
+// Number of GC objects visited per JS_RunGCStep() call when the event
+// loop is idle, 0 disables the idle GC steps. Defaults to 4096. An idle
+// cycle starts at most once per second and only if GC objects were
+// allocated since the previous one. The idle steps are not implemented
+// on Windows.
+JS_EXTERN void js_std_set_idle_gc_budget(JSRuntime *rt, size_t budget);
 // Defaults to JS_NewRuntime, no-op if compiled without worker support.
 // Call before creating the first worker thread.
 JS_EXTERN void js_std_set_worker_new_runtime_func(JSRuntime *(*func)(void));
 // Defaults to JS_NewContext, no-op if compiled without worker support.
 // Call before creating the first worker thread.
 JS_EXTERN void js_std_set_worker_new_context_func(JSContext *(*func)(JSRuntime *rt));
+// Same as js_std_set_worker_new_context_func() but only for the workers
+// started from 'rt', and 'opaque' is passed to 'func'. Takes precedence
+// over it when 'func' is not NULL. Call after js_std_init_handlers(rt).
+JS_EXTERN void js_std_set_worker_new_context_func2(JSRuntime *rt,
+                                                   JSContext *(*func)(JSRuntime *rt,
+                                                                      void *opaque),
+                                                   void *opaque);
+// Custom downloader for std.urlGet() and std.urlGetAsync(). 'func' appends
+// the header lines (CRLF terminated, without the status line) and the body
+// with js_std_url_response_write() and returns the HTTP status, or 0 on a
+// network error. It can be called from an I/O thread and must be thread
+// safe. Defaults to the built-in HTTP client for "http:" URLs and to curl
+// otherwise.
+typedef struct JSUrlGetResponse JSUrlGetResponse;
+typedef int JSUrlGetFunc(void *opaque, const char *url, JSUrlGetResponse *resp);
+JS_EXTERN void js_std_set_url_get_func(JSUrlGetFunc *func, void *opaque);
+// Return 0 on success or -1 if out of memory.
+JS_EXTERN int js_std_url_response_write(JSUrlGetResponse *resp,
+                                        bool is_header,
+                                        const void *buf, size_t len);
 
 #undef JS_EXTERN
 
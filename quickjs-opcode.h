@@ -265,6 +265,7 @@ DEF(     strict_neq, 1, 2, 1, none)
 DEF(is_undefined_or_null, 1, 1, 1, none)
 DEF(     private_in, 1, 2, 1, none)
 DEF(push_bigint_i32, 5, 0, 1, i32)
+DEF(   object_sized, 3, 0, 1, u16) /* object with an initial property array size */
 /* must be the last non short and non temporary opcode */
 DEF(            nop, 1, 0, 0, none)
 
@@ -366,6 +367,14 @@ DEF(        is_null, 1, 1, 1, none)
 DEF(typeof_is_undefined, 1, 1, 1, none)
 DEF( typeof_is_function, 1, 1, 1, none)
 
+/* superinstructions: same size and format as their first opcode, which
+   must still be followed by the second one (see js_fuse_superinstructions) */
+DEF(   lt_if_false8, 1, 2, 1, none)
+DEF(  lte_if_false8, 1, 2, 1, none)
+DEF(   gt_if_false8, 1, 2, 1, none)
+DEF(  gte_if_false8, 1, 2, 1, none)
+DEF(  inc_loc_goto8, 2, 0, 0, loc8)
+
 #undef DEF
 #undef def
 #endif  /* DEF */
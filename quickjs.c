@@ -215,6 +215,10 @@ typedef enum JSErrorEnum {
 // 1,024 bytes is about the cutoff point where it starts getting
 // more profitable to ref slice than to copy
 #define JS_STRING_SLICE_LEN_MAX 1024 // in bytes
+// concatenations of at least this many characters create a rope instead
+// of copying both operands, see js_concat_rope()
+#define JS_STRING_ROPE_MIN_LEN 1024
+#define JS_STRING_ROPE_LEAF_LEN 256
 
 #define __exception __attribute__((warn_unused_result))
 
@@ -230,6 +234,44 @@ typedef enum {
     JS_GC_PHASE_REMOVE_CYCLES,
 } JSGCPhaseEnum;
 
+/* phases of the incremental cycle collector (JS_RunGCStep()) */
+typedef enum {
+    JS_GC_INC_NONE,
+    JS_GC_INC_COLLECT, /* take a snapshot of gc_obj_list */
+    JS_GC_INC_COUNT, /* count the references internal to the snapshot */
+    JS_GC_INC_MARK, /* mark what is referenced from outside the snapshot */
+    JS_GC_INC_SWEEP, /* gather the unmarked objects */
+    JS_GC_INC_CLEANUP, /* reset the marks of the surviving objects */
+} JSGCIncPhaseEnum;
+
+typedef struct JSGCIncState {
+    JSGCIncPhaseEnum phase : 8;
+    uint32_t count; /* number of objects in the snapshot */
+    uint32_t size; /* allocated size of 'objs' */
+    uint32_t pos; /* position of the current phase in 'objs' */
+    uint32_t work_count;
+    uint32_t hash_size; /* power of two */
+    struct list_head *cursor; /* next gc_obj_list element to snapshot */
+    JSGCObjectHeader **objs; /* NULL once the object is freed */
+    uint32_t *counts; /* internal reference counts */
+    uint32_t *work; /* mark stack, then the unmarked objects */
+    uint32_t *hash; /* object -> index + 1 in 'objs' */
+    /* objects whose refcount reached zero while freeing the cycles */
+    struct list_head orphan_list;
+} JSGCIncState;
+
+typedef struct JSSlab JSSlab;
+typedef struct JSProfiler JSProfiler;
+typedef struct JSRegExpCache JSRegExpCache;
+
+#define JS_FUNC_LIST_SHAPE_HASH_SIZE 64
+#define JS_FUNC_LIST_SHAPE_MAX       512
+
+/* size classes of the pooled async function and generator frames:
+   8 to 256 values */
+#define JS_FRAME_POOL_CLASSES   6
+#define JS_FRAME_POOL_MAX_BYTES (32 * 1024)
+
 typedef struct JSMallocState {
     size_t malloc_count;
     size_t malloc_size;
@@ -251,6 +293,7 @@ typedef struct JSValueLink {
 struct JSRuntime {
     JSMallocFunctions mf;
     JSMallocState malloc_state;
+    JSSlab *slab; /* size-class allocator, NULL if not used */
     const char *rt_info;
 
     int atom_hash_size; /* power of two */
@@ -274,8 +317,25 @@ struct JSRuntime {
     struct list_head tmp_obj_list; /* used during GC */
     JSGCPhaseEnum gc_phase : 8;
     size_t malloc_gc_threshold;
+    JSGCPolicy gc_policy;
+    double gc_growth; /* current growth factor, see JSGCPolicy */
+    JSGCTriggerFunc *gc_trigger_func;
+    void *gc_trigger_opaque;
+    /* collection started by js_trigger_gc() */
+    bool gc_cycle_active; /* JS_RunGCStep() calls are pending */
+    size_t gc_cycle_budget;
+    size_t gc_cycle_size; /* malloc_size when the collection started */
+    uint64_t gc_cycle_time; /* time spent in the collection (ns) */
+    uint64_t gc_end_time; /* end of the last collection */
+    size_t gc_last_live_size;
+    uint64_t gc_last_duration;
+    uint64_t gc_alloc_count; /* number of add_gc_object() calls */
+    JSGCIncState gc_inc;
 #ifdef ENABLE_DUMPS // JS_DUMP_LEAKS
     struct list_head string_list; /* list of JSString.link */
+#endif
+#ifdef ENABLE_DUMPS // JS_DUMP_OPCODE_STATS
+    struct JSOpcodeStats *opcode_stats;
 #endif
     /* stack limitation */
     uintptr_t stack_size; /* in bytes, 0 if no limit */
@@ -294,6 +354,23 @@ struct JSRuntime {
 
     JSInterruptHandler *interrupt_handler;
     void *interrupt_opaque;
+    JSProfiler *profiler; /* NULL if not profiling */
+    JSProfiler *heap_profiler; /* NULL if the allocations are not sampled */
+    struct JSHeapSnapshot *heap_snapshot; /* only set in JS_TakeHeapSnapshot() */
+    JSRegExpCache *regexp_cache; /* allocated on the first RegExp compilation */
+    /* final shapes of the function lists instantiated on empty objects */
+    struct JSFuncListShape *func_list_shapes[JS_FUNC_LIST_SHAPE_HASH_SIZE];
+    int func_list_shape_count;
+    /* released async function and generator frames by size class,
+       linked by their first value */
+    JSValue *frame_pool[JS_FRAME_POOL_CLASSES];
+    size_t frame_pool_size; /* in bytes */
+    /* set by JS_RequestProfileSample() */
+#ifdef CONFIG_ATOMICS
+    _Atomic int profile_sample_pending;
+#else
+    volatile int profile_sample_pending;
+#endif
 
     JSPromiseHook *promise_hook;
     void *promise_hook_opaque;
@@ -304,7 +381,12 @@ struct JSRuntime {
     JSHostPromiseRejectionTracker *host_promise_rejection_tracker;
     void *host_promise_rejection_tracker_opaque;
 
-    struct list_head job_list; /* list of JSJobEntry.link */
+    /* pending jobs: ring buffer of job_size entries (a power of two),
+       starting at job_head */
+    struct JSJobEntry *job_queue;
+    uint32_t job_head;
+    uint32_t job_count;
+    uint32_t job_size;
 
     JSModuleNormalizeFunc *module_normalize_func;
     JSModuleLoaderFunc *module_loader_func;
@@ -323,6 +405,7 @@ struct JSRuntime {
     int shape_hash_size;
     int shape_hash_count; /* number of hashed shapes */
     JSShape **shape_hash;
+    uint32_t shape_id_counter; /* last JSShape.id handed out */
     void *user_opaque;
     void *libc_opaque;
     JSRuntimeFinalizerState *finalizers;
@@ -437,6 +520,18 @@ enum {
 /* must be large enough to have a negligible runtime cost and small
    enough to call the interrupt callback often. */
 #define JS_INTERRUPT_COUNTER_INIT 10000
+/* used instead when profiling for a better sampling accuracy */
+#define JS_PROFILE_COUNTER_INIT 1000
+
+/* atom table shared by the objects written with JS_WRITE_OBJ_SHARED_ATOMS,
+   index i is the atom JS_ATOM_END + i in the serialized data */
+typedef struct JSSharedAtoms {
+    uint32_t *atom_to_idx; /* atom - JS_ATOM_END -> index + JS_ATOM_END */
+    int atom_to_idx_size;
+    JSAtom *idx_to_atom; /* each atom holds a reference */
+    int idx_to_atom_count;
+    int idx_to_atom_size;
+} JSSharedAtoms;
 
 struct JSContext {
     JSGCObjectHeader header; /* must come first */
@@ -445,6 +540,7 @@ struct JSContext {
 
     uint16_t binary_object_count;
     int binary_object_size;
+    JSSharedAtoms shared_atoms;
 
     JSShape *array_shape;   /* initial shape for Array objects */
 
@@ -505,30 +601,33 @@ typedef struct JSWeakRefRecord {
     JSWeakRefKindEnum kind;
     struct JSWeakRefRecord *next_weak_ref;
     union {
-        struct JSMapRecord *map_record;
+        struct JSMapState *map_state;
+        JSValue map_value; /* only used by reset_weak_ref() */
         struct JSWeakRefData *weak_ref_data;
         struct JSFinRecEntry *fin_rec_entry;
     } u;
 } JSWeakRefRecord;
 
+/* The records are stored in insertion order in a dense array. A
+   deleted record leaves a hole which is only removed when the array
+   is compacted by map_resize(), so the iterators just keep an index
+   which is updated at that time. The hash table is an open addressing
+   (linear probing) index into the record array. */
 typedef struct JSMapRecord {
-    int ref_count; /* used during enumeration to avoid freeing the record */
-    bool empty; /* true if the record is deleted */
-    struct JSMapState *map;
-    struct list_head link;
-    struct list_head hash_link;
-    JSValue key;
+    JSValue key; /* JS_UNINITIALIZED if the record is deleted */
     JSValue value;
+    uint32_t hash; /* map_hash_key(key) */
 } JSMapRecord;
 
 typedef struct JSMapState {
     bool is_weak; /* true if WeakSet/WeakMap */
-    struct list_head records; /* list of JSMapRecord.link */
-    uint32_t record_count;
-    struct list_head *hash_table;
-    uint32_t hash_size; /* must be a power of two */
-    uint32_t record_count_threshold; /* count at which a hash table
-                                        resize is needed */
+    uint32_t record_count; /* number of live records */
+    uint32_t record_end; /* number of used records, including the holes */
+    uint32_t record_size; /* allocated records */
+    JSMapRecord *records;
+    uint32_t *hash_table; /* record index or MAP_HASH_FREE */
+    int hash_bits; /* the hash table has 2 * record_size entries */
+    struct list_head iterators; /* list of JSMapIteratorData.link */
 } JSMapState;
 
 enum
@@ -558,9 +657,10 @@ typedef enum {
 typedef enum {
     JS_STRING_KIND_NORMAL,
     JS_STRING_KIND_SLICE,
+    JS_STRING_KIND_ROPE,
 } JSStringKind;
 
-#define JS_ATOM_HASH_MASK  ((1 << 29) - 1)
+#define JS_ATOM_HASH_MASK  ((1 << 28) - 1)
 
 struct JSString {
     JSRefCountHeader header; /* must come first, 32-bit */
@@ -569,8 +669,8 @@ struct JSString {
     /* for JS_ATOM_TYPE_SYMBOL: hash = 0, atom_type = 3,
        for JS_ATOM_TYPE_PRIVATE: hash = 1, atom_type = 3
        XXX: could change encoding to have one more bit in hash */
-    uint32_t hash : 29;
-    uint8_t kind : 1;
+    uint32_t hash : 28;
+    uint8_t kind : 2;
     uint8_t atom_type : 2; /* != 0 if atom, JS_ATOM_TYPE_x */
     uint32_t hash_next; /* atom_index for JS_ATOM_TYPE_SYMBOL */
     JSWeakRefRecord *first_weak_ref;
@@ -584,6 +684,14 @@ typedef struct JSStringSlice {
     uint32_t start; // in bytes, not characters
 } JSStringSlice;
 
+/* Lazy concatenation of 'left' and 'right'. A rope has no contiguous
+   contents: js_string_flatten() must be called before strv() and it
+   turns the rope into a slice of a newly allocated flat string. */
+typedef struct JSStringRope {
+    JSString *left;
+    JSString *right;
+} JSStringRope;
+
 static inline void *strv(JSString *p)
 {
     JSStringSlice *slice;
@@ -688,6 +796,32 @@ typedef enum JSFunctionKindEnum {
     JS_FUNC_ASYNC_GENERATOR = (JS_FUNC_GENERATOR | JS_FUNC_ASYNC),
 } JSFunctionKindEnum;
 
+/* Inline caches for OP_get_field, OP_get_field2 and OP_put_field. Each
+   site of a function is assigned a slot in an open addressing table
+   keyed by its bytecode offset. A slot keeps up to JS_IC_WAYS
+   (shape id, holder shape id, property index) triples, most recently
+   used first. */
+#define JS_IC_WAYS    4
+#define JS_IC_WARMUP  16  /* cache misses before allocating the table */
+
+typedef struct JSInlineCacheEntry {
+    uint32_t shape_id; /* 0 = empty entry */
+    /* 0 if the property is an own property, otherwise id of the
+       shape of the prototype holding it */
+    uint32_t proto_shape_id;
+    uint32_t prop_index;
+} JSInlineCacheEntry;
+
+typedef struct JSInlineCacheSlot {
+    uint32_t pc; /* offset of the opcode in the bytecode + 1 */
+    JSInlineCacheEntry e[JS_IC_WAYS];
+} JSInlineCacheSlot;
+
+typedef struct JSInlineCache {
+    uint32_t mask; /* slot count - 1 */
+    JSInlineCacheSlot slots[];
+} JSInlineCache;
+
 typedef struct JSFunctionBytecode {
     JSGCObjectHeader header; /* must come first */
     uint8_t is_strict_mode : 1;
@@ -723,6 +857,11 @@ typedef struct JSFunctionBytecode {
     int pc2line_len;
     uint8_t *pc2line_buf;
     char *source;
+    JSInlineCache *ic; /* allocated lazily, see js_ic_find_slot() */
+    uint32_t ic_misses;
+    /* property count of the last object created by the legacy
+       constructor behavior, used as the size of the next one */
+    uint16_t ctor_prop_size;
 } JSFunctionBytecode;
 
 typedef struct JSBoundFunction {
@@ -732,6 +871,17 @@ typedef struct JSBoundFunction {
     JSValue argv[];
 } JSBoundFunction;
 
+/* Element storage of the fast arrays of class JS_CLASS_ARRAY. The
+   packed kinds store the numbers without tags in u.array.u.int32_ptr
+   and u.array.u.double_ptr. Non empty arrays only move to a more
+   general kind (INT32 -> FLOAT64 -> VALUE); an empty array takes the
+   kind of the next element added to it. */
+typedef enum JSArrayKindEnum {
+    JS_ARRAY_KIND_INT32,
+    JS_ARRAY_KIND_FLOAT64,
+    JS_ARRAY_KIND_VALUE,
+} JSArrayKindEnum;
+
 typedef enum JSIteratorKindEnum {
     JS_ITERATOR_KIND_KEY,
     JS_ITERATOR_KIND_VALUE,
@@ -793,6 +943,8 @@ typedef struct JSAsyncFunctionState {
     JSValue this_val; /* 'this' generator argument */
     int argc; /* number of function arguments */
     bool throw_flag; /* used to throw an exception in JS_CallInternal() */
+    /* size class of frame.arg_buf, JS_FRAME_POOL_CLASSES if not pooled */
+    uint8_t frame_class;
     JSStackFrame frame;
 } JSAsyncFunctionState;
 
@@ -801,6 +953,9 @@ typedef struct JSAsyncFunctionState {
 typedef struct JSAsyncFunctionData {
     JSGCObjectHeader header; /* must come first */
     JSValue resolving_funcs[2];
+    /* functions resuming the function after 'await', created on the
+       first 'await' and released when the function terminates */
+    JSValue resume_funcs[2];
     bool is_active; /* true if the async function state is valid */
     JSAsyncFunctionState func_state;
 } JSAsyncFunctionData;
@@ -896,12 +1051,19 @@ struct JSModuleDef {
     JSValue meta_obj; /* for import.meta */
 };
 
+/* enough for promise_reaction_job(), the most frequent job */
+#define JS_JOB_INLINE_ARGC 5
+/* initial size of the job queue */
+#define JS_JOB_QUEUE_MIN_SIZE 16
+/* a drained job queue larger than this is freed */
+#define JS_JOB_QUEUE_MAX_IDLE_SIZE 256
+
 typedef struct JSJobEntry {
-    struct list_head link;
     JSContext *ctx;
     JSJobFunc *job_func;
     int argc;
-    JSValue argv[];
+    JSValue *argv_ext; /* used instead of argv if argc > JS_JOB_INLINE_ARGC */
+    JSValue argv[JS_JOB_INLINE_ARGC];
 } JSJobEntry;
 
 typedef struct JSProperty {
@@ -924,6 +1086,8 @@ typedef struct JSProperty {
 
 #define JS_PROP_INITIAL_SIZE 2
 #define JS_PROP_INITIAL_HASH_SIZE 4 /* must be a power of two */
+/* maximum initial size requested by an allocation site */
+#define JS_PROP_SIZE_HINT_MAX 256
 #define JS_ARRAY_INITIAL_SIZE 2
 
 typedef struct JSShapeProperty {
@@ -944,6 +1108,10 @@ struct JSShape {
        small array index properties */
     uint8_t has_small_array_index;
     uint32_t hash; /* current hash value */
+    /* unique identifier of the shape layout. It changes each time the
+       shape is modified in place so that the inline caches can detect
+       stale entries. 0 is never used. */
+    uint32_t id;
     uint32_t prop_hash_mask;
     int prop_size; /* allocated properties */
     int prop_count; /* include deleted properties */
@@ -1034,11 +1202,12 @@ struct JSObject {
                 double *double_ptr;     /* JS_CLASS_FLOAT64_ARRAY */
             } u;
             uint32_t count; /* <= 2^31-1. 0 for a detached typed array */
-        } array;    /* 12/20 bytes */
+            uint8_t kind; /* JSArrayKindEnum, JS_CLASS_ARRAY, JS_CLASS_ARGUMENTS */
+        } array;    /* 13/21 bytes */
         JSRegExp regexp;    /* JS_CLASS_REGEXP: 8/16 bytes */
         JSValue object_data;    /* for JS_SetObjectData(): 8/16/16 bytes */
     } u;
-    /* byte sizes: 40/48/72 */
+    /* byte sizes: 44/48/72 */
 };
 
 typedef struct JSCallSiteData {
@@ -1101,6 +1270,11 @@ static JSAtom __JS_NewAtomInit(JSRuntime *rt, const char *str, int len,
                                int atom_type);
 static void JS_FreeAtomStruct(JSRuntime *rt, JSAtomStruct *p);
 static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b);
+static void js_profiler_free(JSRuntime *rt, JSProfiler *prof);
+static void js_regexp_cache_free(JSRuntime *rt);
+static void js_regexp_cache_memory_usage(JSRuntime *rt, JSMemoryUsage *s);
+static void js_func_list_shapes_free(JSRuntime *rt);
+static void js_frame_pool_free(JSRuntime *rt);
 static JSValue js_call_c_function(JSContext *ctx, JSValueConst func_obj,
                                   JSValueConst this_obj,
                                   int argc, JSValueConst *argv, int flags);
@@ -1123,12 +1297,17 @@ static __exception int JS_ToArrayLengthFree(JSContext *ctx, uint32_t *plen,
 static JSValue JS_EvalObject(JSContext *ctx, JSValueConst this_obj,
                              JSValueConst val, int flags, int scope_idx);
 static __maybe_unused void JS_DumpString(JSRuntime *rt, JSString *p);
+static int js_rope_get(JSString *p, uint32_t idx);
 static __maybe_unused void JS_DumpObjectHeader(JSRuntime *rt);
 static __maybe_unused void JS_DumpObject(JSRuntime *rt, JSObject *p);
 static __maybe_unused void JS_DumpGCObject(JSRuntime *rt, JSGCObjectHeader *p);
 static __maybe_unused void JS_DumpValue(JSRuntime *rt, JSValueConst val);
 static __maybe_unused void JS_DumpAtoms(JSRuntime *rt);
 static __maybe_unused void JS_DumpShapes(JSRuntime *rt);
+#ifdef ENABLE_DUMPS // JS_DUMP_OPCODE_STATS
+static void js_count_opcode(JSRuntime *rt, int op);
+static void js_dump_opcode_stats(JSRuntime *rt);
+#endif
 
 static JSValue js_function_apply(JSContext *ctx, JSValueConst this_val,
                                  int argc, JSValueConst *argv, int magic);
@@ -1247,7 +1426,7 @@ static int JS_CreateProperty(JSContext *ctx, JSObject *p,
                              JSValueConst getter, JSValueConst setter,
                              int flags);
 static int js_string_memcmp(JSString *p1, JSString *p2, int len);
-static void reset_weak_ref(JSRuntime *rt, JSWeakRefRecord **first_weak_ref);
+static void reset_weak_ref(JSRuntime *rt, JSValueConst target);
 static bool is_valid_weakref_target(JSValueConst val);
 static void insert_weakref_record(JSValueConst target,
                                   struct JSWeakRefRecord *wr);
@@ -1306,6 +1485,8 @@ static JSValue js_promise_then(JSContext *ctx, JSValueConst this_val,
                                int argc, JSValueConst *argv);
 static JSValue js_promise_resolve_thenable_job(JSContext *ctx,
                                                int argc, JSValueConst *argv);
+static JSValue promise_reaction_job(JSContext *ctx, int argc,
+                                    JSValueConst *argv);
 static bool js_string_eq(JSString *p1, JSString *p2);
 static int js_string_compare(JSString *p1, JSString *p2);
 static int JS_SetPropertyValue(JSContext *ctx, JSValueConst this_obj,
@@ -1334,8 +1515,8 @@ static void free_arg_list(JSContext *ctx, JSValue *tab, uint32_t len);
 static JSValue *build_arg_list(JSContext *ctx, uint32_t *plen,
                                JSValueConst array_arg);
 static JSValue js_create_array(JSContext *ctx, int len, JSValueConst *tab);
-static bool js_get_fast_array(JSContext *ctx, JSValue obj,
-                              JSValue **arrpp, uint32_t *countp);
+static bool js_get_fast_array(JSContext *ctx, JSValueConst obj,
+                              JSObject **pp, uint32_t *countp);
 static int expand_fast_array(JSContext *ctx, JSObject *p, uint32_t new_len);
 static JSValue JS_CreateAsyncFromSyncIterator(JSContext *ctx,
                                               JSValue sync_iter);
@@ -1352,7 +1533,8 @@ static JSValue js_call_c_closure(JSContext *ctx, JSValueConst func_obj,
 static JSAtom js_symbol_to_atom(JSContext *ctx, JSValueConst val);
 static void add_gc_object(JSRuntime *rt, JSGCObjectHeader *h,
                           JSGCObjectTypeEnum type);
-static void remove_gc_object(JSGCObjectHeader *h);
+static void remove_gc_object(JSRuntime *rt, JSGCObjectHeader *h);
+static void gc_inc_forget1(JSRuntime *rt, JSGCObjectHeader *h);
 static void js_async_function_free0(JSRuntime *rt, JSAsyncFunctionData *s);
 static JSValue js_instantiate_prototype(JSContext *ctx, JSObject *p, JSAtom atom, void *opaque);
 static JSValue js_module_ns_autoinit(JSContext *ctx, JSObject *p, JSAtom atom,
@@ -1462,6 +1644,94 @@ JSValue JS_DupValueRT(JSRuntime *rt, JSValueConst v)
     return js_dup(v);
 }
 
+static size_t gc_compute_threshold(JSRuntime *rt, size_t live_size)
+{
+    const JSGCPolicy *p = &rt->gc_policy;
+    double growth;
+    size_t threshold;
+
+    growth = live_size * rt->gc_growth;
+    if (p->max_growth_size != 0 && growth > p->max_growth_size)
+        growth = p->max_growth_size;
+    threshold = live_size + (size_t)growth;
+    if (threshold < p->min_threshold)
+        threshold = p->min_threshold;
+    return threshold;
+}
+
+/* adapt the growth factor to the cost and the yield of the collection
+   which just ended */
+static void gc_update_threshold(JSRuntime *rt)
+{
+    const JSGCPolicy *p = &rt->gc_policy;
+    size_t live_size = rt->malloc_state.malloc_size;
+    uint64_t cur_time = js__hrtime_ns();
+    double growth, ratio;
+
+    growth = rt->gc_growth;
+    if (p->target_gc_ratio > 0 && rt->gc_end_time != 0 &&
+        cur_time > rt->gc_end_time) {
+        ratio = (double)rt->gc_cycle_time / (cur_time - rt->gc_end_time);
+        growth *= fmin(fmax(ratio / p->target_gc_ratio, 0.5), 2);
+    }
+    /* collecting again soon would be as useless */
+    if (live_size > rt->gc_cycle_size - rt->gc_cycle_size / 10)
+        growth *= 1.5;
+    rt->gc_growth = fmin(fmax(growth, p->min_growth), p->max_growth);
+    rt->gc_last_live_size = live_size;
+    rt->gc_last_duration = rt->gc_cycle_time;
+    rt->gc_end_time = cur_time;
+    rt->malloc_gc_threshold = gc_compute_threshold(rt, live_size);
+}
+
+static void js_trigger_gc1(JSRuntime *rt)
+{
+    JSGCTriggerInfo info;
+    JSGCTriggerAction action;
+    uint64_t t0;
+    bool done;
+
+    action = JS_GC_TRIGGER_RUN;
+    if (!rt->gc_cycle_active) {
+        rt->gc_cycle_budget = rt->gc_policy.step_budget;
+        if (rt->gc_trigger_func) {
+            info.malloc_size = rt->malloc_state.malloc_size;
+            info.threshold = rt->malloc_gc_threshold;
+            info.last_live_size = rt->gc_last_live_size;
+            info.last_duration_ns = rt->gc_last_duration;
+            info.step_budget = rt->gc_cycle_budget;
+            info.next_threshold = gc_compute_threshold(rt, info.malloc_size);
+            action = rt->gc_trigger_func(rt, &info, rt->gc_trigger_opaque);
+            if (action == JS_GC_TRIGGER_DEFER) {
+                rt->malloc_gc_threshold = info.next_threshold;
+                return;
+            }
+            rt->gc_cycle_budget = info.step_budget;
+        }
+        rt->gc_cycle_size = rt->malloc_state.malloc_size;
+        rt->gc_cycle_time = 0;
+    }
+
+    t0 = js__hrtime_ns();
+    if (action == JS_GC_TRIGGER_FULL) {
+        JS_RunGC(rt);
+        done = true;
+    } else if (rt->gc_cycle_budget != 0) {
+        done = JS_RunGCStep(rt, rt->gc_cycle_budget);
+    } else if (rt->gc_inc.phase != JS_GC_INC_NONE) {
+        /* finishing the incremental cycle is cheaper than starting
+           over with JS_RunGC() */
+        done = JS_RunGCStep(rt, 0);
+    } else {
+        JS_RunGC(rt);
+        done = true;
+    }
+    rt->gc_cycle_time += js__hrtime_ns() - t0;
+    rt->gc_cycle_active = !done;
+    if (done)
+        gc_update_threshold(rt);
+}
+
 static void js_trigger_gc(JSRuntime *rt, size_t size)
 {
     bool force_gc;
@@ -1469,7 +1739,7 @@ static void js_trigger_gc(JSRuntime *rt, size_t size)
     force_gc = true;
 #else
     force_gc = ((rt->malloc_state.malloc_size + size) >
-                rt->malloc_gc_threshold);
+                rt->malloc_gc_threshold) || unlikely(rt->gc_cycle_active);
 #endif
     if (force_gc) {
 #ifdef ENABLE_DUMPS // JS_DUMP_GC
@@ -1477,9 +1747,7 @@ static void js_trigger_gc(JSRuntime *rt, size_t size)
             printf("GC: size=%zd\n", rt->malloc_state.malloc_size);
         }
 #endif
-        JS_RunGC(rt);
-        rt->malloc_gc_threshold = rt->malloc_state.malloc_size +
-            (rt->malloc_state.malloc_size >> 1);
+        js_trigger_gc1(rt);
     }
 }
 
@@ -1488,6 +1756,218 @@ static size_t js_malloc_usable_size_unknown(const void *ptr)
     return 0;
 }
 
+/* Size-class allocator (JS_RUNTIME_SLAB_ALLOC).
+
+   The blocks of up to JS_SLAB_MAX_SIZE bytes are carved out of
+   JS_SLAB_CHUNK_SIZE aligned chunks, all the blocks of a chunk having
+   the same size class. The chunk of a block is found by masking its
+   address and is looked up in a hash table of the chunks, so that
+   js_free_rt() can tell the slab blocks from the 'mf' ones. Empty
+   chunks are kept for reuse by any size class; the memory is only
+   returned to 'mf' by JS_FreeRuntime(). */
+
+#define JS_SLAB_CHUNK_SIZE   (16 * 1024)
+#define JS_SLAB_ARENA_CHUNKS 16
+#define JS_SLAB_MAX_SIZE     256
+#define JS_SLAB_CLASS_COUNT  12
+
+static const uint16_t js_slab_class_size[JS_SLAB_CLASS_COUNT] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256,
+};
+
+/* size class index by (size + 15) / 16 */
+static const uint8_t js_slab_class_index[JS_SLAB_MAX_SIZE / 16 + 1] = {
+    0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+};
+
+typedef struct JSSlabChunk {
+    struct list_head link; /* JSSlab.partial_list[] or JSSlab.free_chunks */
+    void *free_list; /* freed blocks */
+    uint8_t *bump; /* first never allocated block */
+    uint8_t *end;
+    uint32_t used; /* number of allocated blocks */
+    uint16_t block_size;
+    uint8_t class_index;
+} JSSlabChunk;
+
+#define JS_SLAB_HEADER_SIZE ((sizeof(JSSlabChunk) + 15) & ~15)
+
+typedef struct JSSlabArena {
+    struct JSSlabArena *next;
+} JSSlabArena;
+
+struct JSSlab {
+    /* chunks with free blocks, by size class */
+    struct list_head partial_list[JS_SLAB_CLASS_COUNT];
+    struct list_head free_chunks;
+    JSSlabArena *arenas;
+    uintptr_t *chunk_hash; /* 0 = empty */
+    uint32_t chunk_hash_size; /* power of two */
+    uint32_t chunk_count;
+};
+
+static inline uint32_t js_slab_hash(uintptr_t chunk, uint32_t hash_size)
+{
+    return ((uint32_t)(chunk / JS_SLAB_CHUNK_SIZE) * 0x9e3779b1) &
+        (hash_size - 1);
+}
+
+/* return the chunk of 'ptr' or NULL if 'ptr' was allocated by 'mf' */
+static inline JSSlabChunk *js_slab_find(JSSlab *sl, const void *ptr)
+{
+    uintptr_t chunk, e;
+    uint32_t h;
+
+    chunk = (uintptr_t)ptr & ~(uintptr_t)(JS_SLAB_CHUNK_SIZE - 1);
+    h = js_slab_hash(chunk, sl->chunk_hash_size);
+    while ((e = sl->chunk_hash[h]) != 0) {
+        if (e == chunk)
+            return (JSSlabChunk *)chunk;
+        h = (h + 1) & (sl->chunk_hash_size - 1);
+    }
+    return NULL;
+}
+
+static int js_slab_add_chunks(JSRuntime *rt, JSSlab *sl)
+{
+    JSSlabArena *arena;
+    uintptr_t chunk, *hash;
+    uint32_t i, h, new_size;
+
+    if (2 * (sl->chunk_count + JS_SLAB_ARENA_CHUNKS) > sl->chunk_hash_size) {
+        new_size = max_uint32(2 * sl->chunk_hash_size, 64);
+        hash = rt->mf.js_calloc(rt->malloc_state.opaque, new_size,
+                                sizeof(hash[0]));
+        if (!hash)
+            return -1;
+        for(i = 0; i < sl->chunk_hash_size; i++) {
+            chunk = sl->chunk_hash[i];
+            if (chunk != 0) {
+                h = js_slab_hash(chunk, new_size);
+                while (hash[h] != 0)
+                    h = (h + 1) & (new_size - 1);
+                hash[h] = chunk;
+            }
+        }
+        rt->mf.js_free(rt->malloc_state.opaque, sl->chunk_hash);
+        sl->chunk_hash = hash;
+        sl->chunk_hash_size = new_size;
+    }
+
+    arena = rt->mf.js_malloc(rt->malloc_state.opaque, sizeof(JSSlabArena) +
+                             (JS_SLAB_ARENA_CHUNKS + 1) * JS_SLAB_CHUNK_SIZE);
+    if (!arena)
+        return -1;
+    arena->next = sl->arenas;
+    sl->arenas = arena;
+    chunk = ((uintptr_t)(arena + 1) + JS_SLAB_CHUNK_SIZE - 1) &
+        ~(uintptr_t)(JS_SLAB_CHUNK_SIZE - 1);
+    for(i = 0; i < JS_SLAB_ARENA_CHUNKS; i++) {
+        h = js_slab_hash(chunk, sl->chunk_hash_size);
+        while (sl->chunk_hash[h] != 0)
+            h = (h + 1) & (sl->chunk_hash_size - 1);
+        sl->chunk_hash[h] = chunk;
+        list_add_tail(&((JSSlabChunk *)chunk)->link, &sl->free_chunks);
+        chunk += JS_SLAB_CHUNK_SIZE;
+    }
+    sl->chunk_count += JS_SLAB_ARENA_CHUNKS;
+    return 0;
+}
+
+static void *js_slab_alloc(JSRuntime *rt, size_t size)
+{
+    JSSlab *sl = rt->slab;
+    JSMallocState *s = &rt->malloc_state;
+    struct list_head *head;
+    JSSlabChunk *c;
+    int idx;
+    void *ptr;
+
+    idx = js_slab_class_index[(size + 15) / 16];
+    if (unlikely(s->malloc_size + js_slab_class_size[idx] > s->malloc_limit - 1))
+        return NULL;
+    head = &sl->partial_list[idx];
+    if (unlikely(list_empty(head))) {
+        if (list_empty(&sl->free_chunks)) {
+            if (js_slab_add_chunks(rt, sl))
+                return NULL;
+        }
+        c = list_entry(sl->free_chunks.next, JSSlabChunk, link);
+        list_del(&c->link);
+        c->free_list = NULL;
+        c->bump = (uint8_t *)c + JS_SLAB_HEADER_SIZE;
+        c->end = (uint8_t *)c + JS_SLAB_CHUNK_SIZE;
+        c->used = 0;
+        c->block_size = js_slab_class_size[idx];
+        c->class_index = idx;
+        list_add(&c->link, head);
+    }
+    c = list_entry(head->next, JSSlabChunk, link);
+    if (c->free_list) {
+        ptr = c->free_list;
+        c->free_list = *(void **)ptr;
+    } else {
+        ptr = c->bump;
+        c->bump += c->block_size;
+    }
+    c->used++;
+    if (!c->free_list && c->bump + c->block_size > c->end)
+        list_del(&c->link); /* full */
+    s->malloc_count++;
+    s->malloc_size += c->block_size;
+    return ptr;
+}
+
+static void js_slab_free(JSRuntime *rt, JSSlabChunk *c, void *ptr)
+{
+    JSSlab *sl = rt->slab;
+    JSMallocState *s = &rt->malloc_state;
+    bool was_full;
+
+    s->malloc_count--;
+    s->malloc_size -= c->block_size;
+    was_full = !c->free_list && c->bump + c->block_size > c->end;
+    *(void **)ptr = c->free_list;
+    c->free_list = ptr;
+    if (--c->used == 0) {
+        if (!was_full)
+            list_del(&c->link);
+        list_add(&c->link, &sl->free_chunks);
+    } else if (was_full) {
+        list_add_tail(&c->link, &sl->partial_list[c->class_index]);
+    }
+}
+
+static int js_slab_init(JSRuntime *rt)
+{
+    JSSlab *sl;
+    int i;
+
+    sl = rt->mf.js_calloc(rt->malloc_state.opaque, 1, sizeof(*sl));
+    if (!sl)
+        return -1;
+    for(i = 0; i < JS_SLAB_CLASS_COUNT; i++)
+        init_list_head(&sl->partial_list[i]);
+    init_list_head(&sl->free_chunks);
+    rt->slab = sl;
+    return 0;
+}
+
+/* release all the chunks, including the ones of leaked blocks */
+static void js_slab_free_all(JSRuntime *rt)
+{
+    JSSlab *sl = rt->slab;
+    JSSlabArena *arena, *next;
+
+    for(arena = sl->arenas; arena != NULL; arena = next) {
+        next = arena->next;
+        rt->mf.js_free(rt->malloc_state.opaque, arena);
+    }
+    rt->mf.js_free(rt->malloc_state.opaque, sl->chunk_hash);
+    rt->mf.js_free(rt->malloc_state.opaque, sl);
+    rt->slab = NULL;
+}
+
 void *js_calloc_rt(JSRuntime *rt, size_t count, size_t size)
 {
     void *ptr;
@@ -1500,6 +1980,13 @@ void *js_calloc_rt(JSRuntime *rt, size_t count, size_t size)
         if (unlikely(count != (count * size) / size))
             return NULL;
 
+    if (rt->slab && count * size <= JS_SLAB_MAX_SIZE) {
+        ptr = js_slab_alloc(rt, count * size);
+        if (ptr)
+            memset(ptr, 0, count * size);
+        return ptr;
+    }
+
     s = &rt->malloc_state;
     /* When malloc_limit is 0 (unlimited), malloc_limit - 1 will be SIZE_MAX. */
     if (unlikely(s->malloc_size + (count * size) > s->malloc_limit - 1))
@@ -1522,6 +2009,9 @@ void *js_malloc_rt(JSRuntime *rt, size_t size)
     /* Do not allocate zero bytes: behavior is platform dependent */
     assert(size != 0);
 
+    if (rt->slab && size <= JS_SLAB_MAX_SIZE)
+        return js_slab_alloc(rt, size);
+
     s = &rt->malloc_state;
     /* When malloc_limit is 0 (unlimited), malloc_limit - 1 will be SIZE_MAX. */
     if (unlikely(s->malloc_size + size > s->malloc_limit - 1))
@@ -1539,10 +2029,16 @@ void *js_malloc_rt(JSRuntime *rt, size_t size)
 void js_free_rt(JSRuntime *rt, void *ptr)
 {
     JSMallocState *s;
+    JSSlabChunk *c;
 
     if (!ptr)
         return;
 
+    if (rt->slab && (c = js_slab_find(rt->slab, ptr))) {
+        js_slab_free(rt, c, ptr);
+        return;
+    }
+
     s = &rt->malloc_state;
     s->malloc_count--;
     s->malloc_size -= rt->mf.js_malloc_usable_size(ptr) + MALLOC_OVERHEAD;
@@ -1553,6 +2049,8 @@ void *js_realloc_rt(JSRuntime *rt, void *ptr, size_t size)
 {
     size_t old_size;
     JSMallocState *s;
+    JSSlabChunk *c;
+    void *new_ptr;
 
     if (!ptr) {
         if (size == 0)
@@ -1563,6 +2061,16 @@ void *js_realloc_rt(JSRuntime *rt, void *ptr, size_t size)
         js_free_rt(rt, ptr);
         return NULL;
     }
+    if (rt->slab && (c = js_slab_find(rt->slab, ptr))) {
+        if (size <= c->block_size)
+            return ptr;
+        new_ptr = js_malloc_rt(rt, size);
+        if (!new_ptr)
+            return NULL;
+        memcpy(new_ptr, ptr, c->block_size);
+        js_slab_free(rt, c, ptr);
+        return new_ptr;
+    }
     old_size = rt->mf.js_malloc_usable_size(ptr);
     s = &rt->malloc_state;
     /* When malloc_limit is 0 (unlimited), malloc_limit - 1 will be SIZE_MAX. */
@@ -1579,6 +2087,10 @@ void *js_realloc_rt(JSRuntime *rt, void *ptr, size_t size)
 
 size_t js_malloc_usable_size_rt(JSRuntime *rt, const void *ptr)
 {
+    JSSlabChunk *c;
+
+    if (rt->slab && (c = js_slab_find(rt->slab, ptr)))
+        return c->block_size;
     return rt->mf.js_malloc_usable_size(ptr);
 }
 
@@ -1606,6 +2118,8 @@ void *js_calloc(JSContext *ctx, size_t count, size_t size)
     return ptr;
 }
 
+static void js_heap_sample(JSContext *ctx, size_t size);
+
 /* Throw out of memory in case of error */
 void *js_malloc(JSContext *ctx, size_t size)
 {
@@ -1615,6 +2129,8 @@ void *js_malloc(JSContext *ctx, size_t size)
         JS_ThrowOutOfMemory(ctx);
         return NULL;
     }
+    if (unlikely(ctx->rt->heap_profiler))
+        js_heap_sample(ctx, size);
     return ptr;
 }
 
@@ -1627,6 +2143,8 @@ void *js_mallocz(JSContext *ctx, size_t size)
         JS_ThrowOutOfMemory(ctx);
         return NULL;
     }
+    if (unlikely(ctx->rt->heap_profiler))
+        js_heap_sample(ctx, size);
     return ptr;
 }
 
@@ -1831,7 +2349,8 @@ static inline bool js_check_stack_overflow(JSRuntime *rt, size_t alloca_size)
     return unlikely(sp < rt->stack_limit);
 }
 
-JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
+JSRuntime *JS_NewRuntime3(const JSMallocFunctions *mf, void *opaque,
+                          int flags)
 {
     JSRuntime *rt;
     JSMallocState ms;
@@ -1852,17 +2371,27 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
     ms.malloc_count++;
     ms.malloc_size += rt->mf.js_malloc_usable_size(rt) + MALLOC_OVERHEAD;
     rt->malloc_state = ms;
-    rt->malloc_gc_threshold = 256 * 1024;
+    if (flags & JS_RUNTIME_SLAB_ALLOC) {
+        if (js_slab_init(rt)) {
+            mf->js_free(opaque, rt);
+            return NULL;
+        }
+    }
+    rt->gc_policy.min_threshold = 256 * 1024;
+    rt->gc_policy.min_growth = 0.5;
+    rt->gc_policy.max_growth = 0.5;
+    rt->gc_growth = 0.5;
+    rt->malloc_gc_threshold = rt->gc_policy.min_threshold;
 
     init_list_head(&rt->context_list);
     init_list_head(&rt->gc_obj_list);
     init_list_head(&rt->gc_zero_ref_count_list);
     rt->gc_phase = JS_GC_PHASE_NONE;
+    init_list_head(&rt->gc_inc.orphan_list);
 
 #ifdef ENABLE_DUMPS // JS_DUMP_LEAKS
     init_list_head(&rt->string_list);
 #endif
-    init_list_head(&rt->job_list);
 
     if (JS_InitAtoms(rt))
         goto fail;
@@ -1900,6 +2429,11 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
     return NULL;
 }
 
+JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
+{
+    return JS_NewRuntime3(mf, opaque, 0);
+}
+
 void *JS_GetRuntimeOpaque(JSRuntime *rt)
 {
     return rt->user_opaque;
@@ -1987,6 +2521,29 @@ void JS_SetGCThreshold(JSRuntime *rt, size_t gc_threshold)
     rt->malloc_gc_threshold = gc_threshold;
 }
 
+void JS_GetGCPolicy(JSRuntime *rt, JSGCPolicy *policy)
+{
+    *policy = rt->gc_policy;
+}
+
+void JS_SetGCPolicy(JSRuntime *rt, const JSGCPolicy *policy)
+{
+    JSGCPolicy *p = &rt->gc_policy;
+
+    *p = *policy;
+    if (p->max_growth < p->min_growth)
+        p->max_growth = p->min_growth;
+    rt->gc_growth = fmin(fmax(rt->gc_growth, p->min_growth), p->max_growth);
+    if (rt->malloc_gc_threshold < p->min_threshold)
+        rt->malloc_gc_threshold = p->min_threshold;
+}
+
+void JS_SetGCTriggerFunc(JSRuntime *rt, JSGCTriggerFunc *func, void *opaque)
+{
+    rt->gc_trigger_func = func;
+    rt->gc_trigger_opaque = opaque;
+}
+
 #define malloc(s) malloc_is_forbidden(s)
 #define free(p) free_is_forbidden(p)
 #define realloc(p,s) realloc_is_forbidden(p,s)
@@ -2008,63 +2565,153 @@ void JS_SetSharedArrayBufferFunctions(JSRuntime *rt,
     rt->sab_funcs = *sf;
 }
 
+static inline JSValue *js_job_argv(JSJobEntry *e)
+{
+    return e->argv_ext ? e->argv_ext : e->argv;
+}
+
+/* add a job at the end of the queue. The caller must initialize the
+   'argc' arguments, which are owned by the job. The queue only grows
+   while jobs are pending, so that no allocation is done once it is
+   large enough. */
+static JSJobEntry *js_new_job(JSContext *ctx, JSJobFunc *job_func, int argc)
+{
+    JSRuntime *rt = ctx->rt;
+    JSJobEntry *e, *tab;
+    uint32_t new_size;
+
+    assert(!rt->in_free);
+
+    if (rt->job_count == rt->job_size) {
+        new_size = max_int(rt->job_size * 2, JS_JOB_QUEUE_MIN_SIZE);
+        tab = js_realloc(ctx, rt->job_queue, sizeof(tab[0]) * new_size);
+        if (!tab)
+            return NULL;
+        /* the queue is full: move the entries which wrapped around after
+           the others */
+        memcpy(tab + rt->job_size, tab, sizeof(tab[0]) * rt->job_head);
+        rt->job_queue = tab;
+        rt->job_size = new_size;
+    }
+    e = &rt->job_queue[(rt->job_head + rt->job_count) & (rt->job_size - 1)];
+    e->argv_ext = NULL;
+    if (argc > JS_JOB_INLINE_ARGC) {
+        e->argv_ext = js_malloc(ctx, sizeof(e->argv_ext[0]) * argc);
+        if (!e->argv_ext)
+            return NULL;
+    }
+    e->ctx = ctx;
+    e->job_func = job_func;
+    e->argc = argc;
+    rt->job_count++;
+    return e;
+}
+
 /* return 0 if OK, < 0 if exception */
 int JS_EnqueueJob(JSContext *ctx, JSJobFunc *job_func,
                   int argc, JSValueConst *argv)
 {
-    JSRuntime *rt = ctx->rt;
     JSJobEntry *e;
+    JSValue *tab;
     int i;
 
-    assert(!rt->in_free);
-
-    e = js_malloc(ctx, sizeof(*e) + argc * sizeof(JSValue));
+    e = js_new_job(ctx, job_func, argc);
     if (!e)
         return -1;
-    e->ctx = ctx;
-    e->job_func = job_func;
-    e->argc = argc;
+    tab = js_job_argv(e);
     for(i = 0; i < argc; i++) {
-        e->argv[i] = js_dup(argv[i]);
+        tab[i] = js_dup(argv[i]);
     }
-    list_add_tail(&e->link, &rt->job_list);
     return 0;
 }
 
 bool JS_IsJobPending(JSRuntime *rt)
 {
-    return !list_empty(&rt->job_list);
+    return rt->job_count != 0;
+}
+
+/* free the pending jobs without executing them. The queue is kept. */
+void JS_DiscardPendingJobs(JSRuntime *rt)
+{
+    JSJobEntry *e;
+    JSValue *argv;
+    int i;
+
+    while (rt->job_count != 0) {
+        e = &rt->job_queue[rt->job_head];
+        argv = js_job_argv(e);
+        for(i = 0; i < e->argc; i++)
+            JS_FreeValueRT(rt, argv[i]);
+        js_free_rt(rt, e->argv_ext);
+        rt->job_head = (rt->job_head + 1) & (rt->job_size - 1);
+        rt->job_count--;
+    }
+}
+
+/* execute the first pending job */
+static int js_execute_job(JSRuntime *rt, JSContext **pctx)
+{
+    JSContext *ctx;
+    JSJobEntry e;
+    JSValue res, *argv;
+    int i;
+
+    /* copied because the job can enqueue jobs and move the queue */
+    e = rt->job_queue[rt->job_head];
+    rt->job_head = (rt->job_head + 1) & (rt->job_size - 1);
+    rt->job_count--;
+    ctx = e.ctx;
+    argv = js_job_argv(&e);
+    res = e.job_func(ctx, e.argc, vc(argv));
+    for(i = 0; i < e.argc; i++)
+        JS_FreeValue(ctx, argv[i]);
+    if (e.argv_ext)
+        js_free(ctx, e.argv_ext);
+    *pctx = ctx;
+    if (JS_IsException(res))
+        return -1;
+    JS_FreeValue(ctx, res);
+    return 1;
+}
+
+/* free the queue once drained if a burst of jobs made it large */
+static void js_shrink_job_queue(JSRuntime *rt)
+{
+    if (rt->job_count == 0 && rt->job_size > JS_JOB_QUEUE_MAX_IDLE_SIZE) {
+        js_free_rt(rt, rt->job_queue);
+        rt->job_queue = NULL;
+        rt->job_head = 0;
+        rt->job_size = 0;
+    }
 }
 
 /* return < 0 if exception, 0 if no job pending, 1 if a job was
    executed successfully. the context of the job is stored in '*pctx' */
 int JS_ExecutePendingJob(JSRuntime *rt, JSContext **pctx)
 {
-    JSContext *ctx;
-    JSJobEntry *e;
-    JSValue res;
-    int i, ret;
-
-    if (list_empty(&rt->job_list)) {
+    if (rt->job_count == 0) {
+        js_shrink_job_queue(rt);
         *pctx = NULL;
         return 0;
     }
+    return js_execute_job(rt, pctx);
+}
 
-    /* get the first pending job and execute it */
-    e = list_entry(rt->job_list.next, JSJobEntry, link);
-    list_del(&e->link);
-    ctx = e->ctx;
-    res = e->job_func(e->ctx, e->argc, vc(e->argv));
-    for(i = 0; i < e->argc; i++)
-        JS_FreeValue(ctx, e->argv[i]);
-    if (JS_IsException(res))
-        ret = -1;
-    else
-        ret = 1;
-    JS_FreeValue(ctx, res);
-    js_free(ctx, e);
-    *pctx = ctx;
-    return ret;
+/* execute at most 'max' jobs (no limit if max < 0), including the jobs
+   they enqueue. Return the number of executed jobs or < 0 if a job
+   raised an exception. The context of the last job is stored in
+   '*pctx'. */
+int JS_ExecutePendingJobs(JSRuntime *rt, int max, JSContext **pctx)
+{
+    int n;
+
+    *pctx = NULL;
+    for(n = 0; n != max && rt->job_count != 0; n++) {
+        if (js_execute_job(rt, pctx) < 0)
+            return -1;
+    }
+    js_shrink_job_queue(rt);
+    return n;
 }
 
 static inline uint32_t atom_get_free(const JSAtomStruct *p)
@@ -2114,6 +2761,7 @@ static JSString *js_alloc_string(JSContext *ctx, int max_len, int is_wide_char)
 }
 
 static inline void js_free_string0(JSRuntime *rt, JSString *str);
+static void js_free_rope(JSRuntime *rt, JSString *p);
 
 /* same as JS_FreeValueRT() but faster */
 static inline void js_free_string(JSRuntime *rt, JSString *str)
@@ -2133,11 +2781,120 @@ static inline void js_free_string0(JSRuntime *rt, JSString *str)
         if (str->kind == JS_STRING_KIND_SLICE) {
             JSStringSlice *slice = (void *)&str[1];
             js_free_string(rt, slice->parent); // safe, recurses only 1 level
+        } else if (str->kind == JS_STRING_KIND_ROPE) {
+            js_free_rope(rt, str);
+            return;
         }
         js_free_rt(rt, str);
     }
 }
 
+/* Ropes built by repeated concatenation can be arbitrarily deep: only
+   recurse into the shorter branch and iterate on the longer one so that
+   the recursion depth is bounded by log2(len). */
+static void js_free_rope(JSRuntime *rt, JSString *p)
+{
+    JSStringRope *r;
+    JSString *left, *right;
+
+    for(;;) {
+        r = (void *)&p[1];
+        left = r->left;
+        right = r->right;
+        js_free_rt(rt, p);
+        if (left->len < right->len) {
+            js_free_string(rt, left);
+            p = right;
+        } else {
+            js_free_string(rt, right);
+            p = left;
+        }
+        if (--p->header.ref_count > 0)
+            return;
+        if (p->atom_type || p->kind != JS_STRING_KIND_ROPE) {
+            js_free_string0(rt, p);
+            return;
+        }
+#ifdef ENABLE_DUMPS // JS_DUMP_LEAKS
+        list_del(&p->link);
+#endif
+    }
+}
+
+/* copy the contents of 'p' to 'dst' which has the character width of
+   'is_wide_char'. Same recursion scheme as js_free_rope(). */
+static void js_rope_copy(uint8_t *dst, int is_wide_char, JSString *p)
+{
+    JSStringRope *r;
+    uint32_t i;
+
+    while (p->kind == JS_STRING_KIND_ROPE) {
+        r = (void *)&p[1];
+        if (r->left->len <= r->right->len) {
+            js_rope_copy(dst, is_wide_char, r->left);
+            dst += r->left->len << is_wide_char;
+            p = r->right;
+        } else {
+            js_rope_copy(dst + (r->left->len << is_wide_char), is_wide_char,
+                         r->right);
+            p = r->left;
+        }
+    }
+    if (p->is_wide_char == is_wide_char) {
+        memcpy(dst, strv(p), p->len << is_wide_char);
+    } else {
+        const uint8_t *src = str8(p);
+        uint16_t *dst16 = (uint16_t *)dst;
+        for(i = 0; i < p->len; i++)
+            dst16[i] = src[i];
+    }
+}
+
+/* Convert a rope to a slice of a flat copy of its contents. Return -1
+   if there is not enough memory. */
+static int js_string_flatten_rt(JSRuntime *rt, JSString *p)
+{
+    JSStringRope *r;
+    JSStringSlice *slice;
+    JSString *q, *left, *right;
+
+    if (likely(p->kind != JS_STRING_KIND_ROPE))
+        return 0;
+    q = js_alloc_string_rt(rt, p->len, p->is_wide_char);
+    if (!q)
+        return -1;
+    js_rope_copy(str8(q), p->is_wide_char, p);
+    if (!p->is_wide_char)
+        str8(q)[p->len] = '\0';
+    r = (void *)&p[1];
+    left = r->left;
+    right = r->right;
+    p->kind = JS_STRING_KIND_SLICE;
+    slice = (void *)&p[1];
+    slice->parent = q;
+    slice->start = 0;
+    js_free_string(rt, left);
+    js_free_string(rt, right);
+    return 0;
+}
+
+static int js_string_flatten(JSContext *ctx, JSString *p)
+{
+    if (unlikely(js_string_flatten_rt(ctx->rt, p))) {
+        JS_ThrowOutOfMemory(ctx);
+        return -1;
+    }
+    return 0;
+}
+
+/* flatten 'val' if it is a rope string */
+static inline int js_flatten_value(JSContext *ctx, JSValueConst val)
+{
+    if (JS_VALUE_GET_TAG(val) != JS_TAG_STRING)
+        return 0;
+    return js_string_flatten(ctx, JS_VALUE_GET_STRING(val));
+}
+
 void JS_SetRuntimeInfo(JSRuntime *rt, const char *s)
 {
     if (rt)
@@ -2146,21 +2903,32 @@ void JS_SetRuntimeInfo(JSRuntime *rt, const char *s)
 
 void JS_FreeRuntime(JSRuntime *rt)
 {
+#ifdef ENABLE_DUMPS // JS_DUMP_LEAKS
     struct list_head *el, *el1;
+#endif
     int i;
 
     rt->in_free = true;
     JS_FreeValueRT(rt, rt->current_exception);
 
-    list_for_each_safe(el, el1, &rt->job_list) {
-        JSJobEntry *e = list_entry(el, JSJobEntry, link);
-        for(i = 0; i < e->argc; i++)
-            JS_FreeValueRT(rt, e->argv[i]);
-        js_free_rt(rt, e);
+    JS_DiscardPendingJobs(rt);
+    js_free_rt(rt, rt->job_queue);
+    rt->job_queue = NULL;
+    rt->job_size = 0;
+
+    if (rt->heap_profiler) {
+        js_profiler_free(rt, rt->heap_profiler);
+        rt->heap_profiler = NULL;
+    }
+    if (rt->profiler) {
+        js_profiler_free(rt, rt->profiler);
+        rt->profiler = NULL;
     }
-    init_list_head(&rt->job_list);
+    js_regexp_cache_free(rt);
+    js_func_list_shapes_free(rt);
 
     JS_RunGC(rt);
+    js_frame_pool_free(rt);
 
 #ifdef ENABLE_DUMPS // JS_DUMP_LEAKS
     /* leaking objects */
@@ -2321,6 +3089,13 @@ void JS_FreeRuntime(JSRuntime *rt)
         js_free_rt(rt, fs);
     }
 
+#ifdef ENABLE_DUMPS // JS_DUMP_OPCODE_STATS
+    if (rt->opcode_stats) {
+        js_dump_opcode_stats(rt);
+        rt->mf.js_free(rt->malloc_state.opaque, rt->opcode_stats);
+    }
+#endif
+
 #ifdef ENABLE_DUMPS // JS_DUMP_LEAKS
     if (check_dump_flag(rt, JS_DUMP_LEAKS)) {
         JSMallocState *s = &rt->malloc_state;
@@ -2334,6 +3109,9 @@ void JS_FreeRuntime(JSRuntime *rt)
     }
 #endif
 
+    if (rt->slab)
+        js_slab_free_all(rt);
+
     {
         JSMallocState *ms = &rt->malloc_state;
         rt->mf.js_free(ms->opaque, rt);
@@ -2422,6 +3200,142 @@ static inline void set_value(JSContext *ctx, JSValue *pval, JSValue new_val)
     JS_FreeValue(ctx, old_val);
 }
 
+static const uint8_t js_array_kind_size[] = {
+    [JS_ARRAY_KIND_INT32] = sizeof(int32_t),
+    [JS_ARRAY_KIND_FLOAT64] = sizeof(double),
+    [JS_ARRAY_KIND_VALUE] = sizeof(JSValue),
+};
+
+/* kind of the fast array elements needed to store 'val' */
+static inline JSArrayKindEnum js_array_value_kind(JSValueConst val)
+{
+    uint32_t tag = JS_VALUE_GET_TAG(val);
+    if (tag == JS_TAG_INT)
+        return JS_ARRAY_KIND_INT32;
+    if (JS_TAG_IS_FLOAT64(tag))
+        return JS_ARRAY_KIND_FLOAT64;
+    return JS_ARRAY_KIND_VALUE;
+}
+
+/* element 'idx' of a fast Array or Arguments object */
+static inline JSValue js_array_get(JSObject *p, uint32_t idx)
+{
+    switch(p->u.array.kind) {
+    case JS_ARRAY_KIND_INT32:
+        return js_int32(p->u.array.u.int32_ptr[idx]);
+    case JS_ARRAY_KIND_FLOAT64:
+        return js_number(p->u.array.u.double_ptr[idx]);
+    default:
+        return js_dup(p->u.array.u.values[idx]);
+    }
+}
+
+/* same as js_array_get() but transfers the reference held by the array */
+static inline JSValue js_array_take(JSObject *p, uint32_t idx)
+{
+    if (p->u.array.kind == JS_ARRAY_KIND_VALUE)
+        return p->u.array.u.values[idx];
+    return js_array_get(p, idx);
+}
+
+/* store 'val' in an unused element. The kind of the array must be able
+   to hold it. */
+static inline void js_array_store(JSObject *p, uint32_t idx, JSValue val)
+{
+    switch(p->u.array.kind) {
+    case JS_ARRAY_KIND_INT32:
+        p->u.array.u.int32_ptr[idx] = JS_VALUE_GET_INT(val);
+        break;
+    case JS_ARRAY_KIND_FLOAT64:
+        if (JS_VALUE_GET_TAG(val) == JS_TAG_INT)
+            p->u.array.u.double_ptr[idx] = JS_VALUE_GET_INT(val);
+        else
+            p->u.array.u.double_ptr[idx] = JS_VALUE_GET_FLOAT64(val);
+        break;
+    default:
+        p->u.array.u.values[idx] = val;
+        break;
+    }
+}
+
+/* Change the element kind of a fast Array. 'kind' must be more general
+   than the current one unless the array is empty. Return -1 if memory
+   allocation error (no exception is raised). */
+static int js_array_set_kind(JSRuntime *rt, JSObject *p, JSArrayKindEnum kind)
+{
+    JSArrayKindEnum old_kind = p->u.array.kind;
+    size_t old_size = js_array_kind_size[old_kind];
+    size_t new_size = js_array_kind_size[kind];
+    uint32_t i, count = p->u.array.count;
+    void *tab;
+
+    if (count == 0) {
+        if (new_size > old_size && p->u.array.u1.size != 0) {
+            tab = js_realloc_rt(rt, p->u.array.u.ptr,
+                                p->u.array.u1.size * new_size);
+            if (!tab)
+                return -1;
+            p->u.array.u.ptr = tab;
+        } else {
+            p->u.array.u1.size = p->u.array.u1.size * old_size / new_size;
+        }
+        p->u.array.kind = kind;
+        return 0;
+    }
+    tab = js_malloc_rt(rt, p->u.array.u1.size * new_size);
+    if (!tab)
+        return -1;
+    if (kind == JS_ARRAY_KIND_VALUE) {
+        JSValue *values = tab;
+        for(i = 0; i < count; i++)
+            values[i] = js_array_get(p, i);
+    } else {
+        double *d = tab;
+        for(i = 0; i < count; i++)
+            d[i] = p->u.array.u.int32_ptr[i];
+    }
+    js_free_rt(rt, p->u.array.u.ptr);
+    p->u.array.u.ptr = tab;
+    p->u.array.kind = kind;
+    return 0;
+}
+
+/* set the existing element 'idx' of a fast Array or Arguments object,
+   changing the kind of the array if needed. Return -1 if exception. */
+static inline int js_array_set(JSContext *ctx, JSObject *p, uint32_t idx,
+                               JSValue val)
+{
+    uint32_t tag = JS_VALUE_GET_TAG(val);
+
+    switch(p->u.array.kind) {
+    case JS_ARRAY_KIND_INT32:
+        if (likely(tag == JS_TAG_INT)) {
+            p->u.array.u.int32_ptr[idx] = JS_VALUE_GET_INT(val);
+            return 0;
+        }
+        break;
+    case JS_ARRAY_KIND_FLOAT64:
+        if (tag == JS_TAG_INT) {
+            p->u.array.u.double_ptr[idx] = JS_VALUE_GET_INT(val);
+            return 0;
+        } else if (JS_TAG_IS_FLOAT64(tag)) {
+            p->u.array.u.double_ptr[idx] = JS_VALUE_GET_FLOAT64(val);
+            return 0;
+        }
+        break;
+    default:
+        set_value(ctx, &p->u.array.u.values[idx], val);
+        return 0;
+    }
+    if (js_array_set_kind(ctx->rt, p, js_array_value_kind(val))) {
+        JS_FreeValue(ctx, val);
+        JS_ThrowOutOfMemory(ctx);
+        return -1;
+    }
+    js_array_store(p, idx, val);
+    return 0;
+}
+
 void JS_SetClassProto(JSContext *ctx, JSClassID class_id, JSValue obj)
 {
     assert(class_id < ctx->rt->class_count);
@@ -2507,6 +3421,18 @@ static void JS_MarkContext(JSRuntime *rt, JSContext *ctx,
         mark_func(rt, &ctx->array_shape->header);
 }
 
+static void js_free_shared_atoms(JSContext *ctx)
+{
+    JSSharedAtoms *sa = &ctx->shared_atoms;
+    int i;
+
+    for(i = 0; i < sa->idx_to_atom_count; i++)
+        JS_FreeAtom(ctx, sa->idx_to_atom[i]);
+    js_free(ctx, sa->idx_to_atom);
+    js_free(ctx, sa->atom_to_idx);
+    memset(sa, 0, sizeof(*sa));
+}
+
 void JS_FreeContext(JSContext *ctx)
 {
     JSRuntime *rt = ctx->rt;
@@ -2546,6 +3472,7 @@ void JS_FreeContext(JSContext *ctx)
 #endif
 
     js_free_modules(ctx, JS_FREE_MODULE_ALL);
+    js_free_shared_atoms(ctx);
 
     JS_FreeValue(ctx, ctx->global_obj);
     JS_FreeValue(ctx, ctx->global_var_obj);
@@ -2577,7 +3504,7 @@ void JS_FreeContext(JSContext *ctx)
     js_free_shape_null(ctx->rt, ctx->array_shape);
 
     list_del(&ctx->link);
-    remove_gc_object(&ctx->header);
+    remove_gc_object(ctx->rt, &ctx->header);
     js_free_rt(ctx->rt, ctx);
 }
 
@@ -2727,10 +3654,12 @@ static __maybe_unused void JS_DumpString(JSRuntime *rt, JSString *p)
         printf("%d", p->header.ref_count);
     if (p->is_wide_char)
         putchar('L');
+    /* if the rope cannot be flattened, read it in place */
+    js_string_flatten_rt(rt, p);
     sep = '\"';
     putchar(sep);
     for(i = 0; i < p->len; i++) {
-        c = string_get(p, i);
+        c = js_rope_get(p, i);
         if (c == sep || c == '\\') {
             putchar('\\');
             putchar(c);
@@ -3004,7 +3933,8 @@ static JSAtom __JS_NewAtom(JSRuntime *rt, JSString *str, int atom_type)
     }
 
     if (str) {
-        if (str->atom_type == 0) {
+        /* slices are copied: atoms do not hold a reference to a parent */
+        if (str->atom_type == 0 && str->kind == JS_STRING_KIND_NORMAL) {
             p = str;
             p->atom_type = atom_type;
         } else {
@@ -3137,7 +4067,7 @@ static void JS_FreeAtomStruct(JSRuntime *rt, JSAtomStruct *p)
     rt->atom_array[i] = atom_set_free(rt->atom_free_index);
     rt->atom_free_index = i;
     if (unlikely(p->first_weak_ref)) {
-        reset_weak_ref(rt, &p->first_weak_ref);
+        reset_weak_ref(rt, JS_MKPTR(JS_TAG_SYMBOL, p));
     }
     /* free the string structure */
 #ifdef ENABLE_DUMPS // JS_DUMP_LEAKS
@@ -3163,6 +4093,10 @@ static JSAtom JS_NewAtomStr(JSContext *ctx, JSString *p)
 {
     JSRuntime *rt = ctx->rt;
     uint32_t n;
+    if (js_string_flatten(ctx, p)) {
+        js_free_string(rt, p);
+        return JS_ATOM_NULL;
+    }
     if (is_num_string(&n, p)) {
         if (n <= JS_ATOM_MAX_INT) {
             js_free_string(rt, p);
@@ -4038,6 +4972,10 @@ static int string_buffer_concat(StringBuffer *s, JSString *p,
 {
     if (to <= from)
         return 0;
+    if (unlikely(p->kind == JS_STRING_KIND_ROPE)) {
+        if (js_string_flatten(s->ctx, p))
+            return string_buffer_set_error(s);
+    }
     if (p->is_wide_char)
         return string_buffer_write16(s, str16(p) + from, to - from);
     else
@@ -4240,7 +5178,7 @@ const char *JS_ToCStringLen2(JSContext *ctx, size_t *plen, JSValueConst val1,
 {
     JSValue val;
     JSString *str, *str_new;
-    int pos, len, c, c1;
+    int pos, len;
     JSObject *p;
     uint8_t *q;
 
@@ -4272,6 +5210,10 @@ const char *JS_ToCStringLen2(JSContext *ctx, size_t *plen, JSValueConst val1,
 
 go:
     str = JS_VALUE_GET_STRING(val);
+    if (js_string_flatten(ctx, str)) {
+        JS_FreeValue(ctx, val);
+        goto fail;
+    }
     len = str->len;
     if (!str->is_wide_char) {
         const uint8_t *src = str8(str);
@@ -4296,48 +5238,27 @@ go:
         if (!str_new)
             goto fail;
         q = str8(str_new);
-        for (pos = 0; pos < len; pos++) {
-            c = src[pos];
-            if (c < 0x80) {
-                *q++ = c;
-            } else {
-                *q++ = (c >> 6) | 0xc0;
-                *q++ = (c & 0x3f) | 0x80;
-            }
-        }
-    } else {
+        q += utf8_encode_buf8((char *)q, len + count + 1, src, len);
+    } else if (!cesu8) {
         const uint16_t *src = str16(str);
         /* Allocate 3 bytes per 16 bit code point. Surrogate pairs may
-           produce 4 bytes but use 2 code points.
+           produce 4 bytes but use 2 code points. Unmatched surrogate
+           code points are kept.
          */
         str_new = js_alloc_string(ctx, len * 3, 0);
         if (!str_new)
             goto fail;
         q = str8(str_new);
-        pos = 0;
-        while (pos < len) {
-            c = src[pos++];
-            if (c < 0x80) {
-                *q++ = c;
-            } else {
-                if (is_hi_surrogate(c)) {
-                    if (pos < len && !cesu8) {
-                        c1 = src[pos];
-                        if (is_lo_surrogate(c1)) {
-                            pos++;
-                            c = from_surrogate(c, c1);
-                        } else {
-                            /* Keep unmatched surrogate code points */
-                            /* c = 0xfffd; */ /* error */
-                        }
-                    } else {
-                        /* Keep unmatched surrogate code points */
-                        /* c = 0xfffd; */ /* error */
-                    }
-                }
-                q += utf8_encode(q, c);
-            }
-        }
+        q += utf8_encode_buf16((char *)q, len * 3 + 1, src, len);
+    } else {
+        const uint16_t *src = str16(str);
+        /* CESU-8: surrogate pairs are encoded as two 3 byte sequences */
+        str_new = js_alloc_string(ctx, len * 3, 0);
+        if (!str_new)
+            goto fail;
+        q = str8(str_new);
+        for (pos = 0; pos < len; pos++)
+            q += utf8_encode(q, src[pos]);
     }
 
     *q = '\0';
@@ -4417,6 +5338,53 @@ static int js_string_compare(JSString *p1, JSString *p2)
     return res;
 }
 
+/* return the character at 'idx' without flattening 'p'. Only used when
+   a rope cannot be flattened because there is not enough memory. */
+static int js_rope_get(JSString *p, uint32_t idx)
+{
+    JSStringRope *r;
+
+    while (p->kind == JS_STRING_KIND_ROPE) {
+        r = (void *)&p[1];
+        if (idx < r->left->len) {
+            p = r->left;
+        } else {
+            idx -= r->left->len;
+            p = r->right;
+        }
+    }
+    return string_get(p, idx);
+}
+
+/* same as js_string_eq() but 'p1' and 'p2' may be ropes. Does not raise
+   exceptions. */
+static bool js_string_eq_rt(JSRuntime *rt, JSString *p1, JSString *p2)
+{
+    uint32_t i;
+
+    if (p1->len != p2->len)
+        return false;
+    if (likely(!js_string_flatten_rt(rt, p1) && !js_string_flatten_rt(rt, p2)))
+        return js_string_memcmp(p1, p2, p1->len) == 0;
+    for(i = 0; i < p1->len; i++) {
+        if (js_rope_get(p1, i) != js_rope_get(p2, i))
+            return false;
+    }
+    return true;
+}
+
+/* same as hash_string() but 'str' may be a rope */
+static uint32_t hash_string_rt(JSRuntime *rt, JSString *str, uint32_t h)
+{
+    uint32_t i;
+
+    if (likely(!js_string_flatten_rt(rt, str)))
+        return hash_string(str, h);
+    for(i = 0; i < str->len; i++)
+        h = h * 263 + js_rope_get(str, i);
+    return h;
+}
+
 static void copy_str16(uint16_t *dst, JSString *p, int offset, int len)
 {
     if (p->is_wide_char) {
@@ -4454,6 +5422,63 @@ static JSValue JS_ConcatString1(JSContext *ctx, JSString *p1, JSString *p2)
     return JS_MKPTR(JS_TAG_STRING, p);
 }
 
+/* 'left' and 'right' are freed */
+static JSValue js_new_rope(JSContext *ctx, JSString *left, JSString *right)
+{
+    JSStringRope *r;
+    JSString *p;
+
+    /* allocate as 16 bit wide string to avoid wastage, see js_sub_string() */
+    p = js_alloc_string(ctx, sizeof(*r) / 2, true);
+    if (!p) {
+        js_free_string(ctx->rt, left);
+        js_free_string(ctx->rt, right);
+        return JS_EXCEPTION;
+    }
+    p->is_wide_char = left->is_wide_char | right->is_wide_char;
+    p->kind = JS_STRING_KIND_ROPE;
+    p->len = left->len + right->len;
+    r = (void *)&p[1];
+    r->left = left;
+    r->right = right;
+    return JS_MKPTR(JS_TAG_STRING, p);
+}
+
+/* op1 and op2 are non empty strings and are freed */
+static JSValue js_concat_rope(JSContext *ctx, JSValue op1, JSValue op2)
+{
+    JSString *p1, *p2, *left;
+    JSStringRope *r;
+    JSValue right;
+
+    p1 = JS_VALUE_GET_STRING(op1);
+    p2 = JS_VALUE_GET_STRING(op2);
+    if (p1->len + p2->len > JS_STRING_LEN_MAX) {
+        JS_FreeValue(ctx, op1);
+        JS_FreeValue(ctx, op2);
+        return JS_ThrowRangeError(ctx, "invalid string length");
+    }
+    /* (a + b) + c -> a + (b + c) if b and c are short, so that appending
+       small strings in a loop does not create one node per character */
+    if (p1->kind == JS_STRING_KIND_ROPE) {
+        r = (void *)&p1[1];
+        if (r->right->kind != JS_STRING_KIND_ROPE &&
+            r->right->len + p2->len <= JS_STRING_ROPE_LEAF_LEN) {
+            right = JS_ConcatString1(ctx, r->right, p2);
+            JS_FreeValue(ctx, op2);
+            if (JS_IsException(right)) {
+                JS_FreeValue(ctx, op1);
+                return JS_EXCEPTION;
+            }
+            left = r->left;
+            left->header.ref_count++;
+            JS_FreeValue(ctx, op1);
+            return js_new_rope(ctx, left, JS_VALUE_GET_STRING(right));
+        }
+    }
+    return js_new_rope(ctx, p1, p2);
+}
+
 /* op1 and op2 are converted to strings. For convience, op1 or op2 =
    JS_EXCEPTION are accepted and return JS_EXCEPTION.  */
 static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2)
@@ -4482,7 +5507,10 @@ static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2)
     if (p2->len == 0) {
         goto ret_op1;
     }
+    if (p1->len + p2->len >= JS_STRING_ROPE_MIN_LEN)
+        return js_concat_rope(ctx, op1, op2);
     if (p1->header.ref_count == 1 && p1->is_wide_char == p2->is_wide_char
+    &&  p1->kind == JS_STRING_KIND_NORMAL
     &&  js_malloc_usable_size(ctx, p1) >= sizeof(*p1) + ((p1->len + p2->len) << p2->is_wide_char) + 1 - p1->is_wide_char) {
         /* Concatenate in place in available space at the end of p1 */
         if (p1->is_wide_char) {
@@ -4612,6 +5640,20 @@ static void js_shape_hash_unlink(JSRuntime *rt, JSShape *sh)
     rt->shape_hash_count--;
 }
 
+static void js_ic_flush_all(JSRuntime *rt);
+
+/* give a new identity to 'sh'. Must be called each time the shape
+   layout (properties, flags or prototype) is modified in place. */
+static inline void js_shape_set_id(JSRuntime *rt, JSShape *sh)
+{
+    if (unlikely(++rt->shape_id_counter == 0)) {
+        /* stale cache entries could match the recycled ids */
+        js_ic_flush_all(rt);
+        rt->shape_id_counter = 1;
+    }
+    sh->id = rt->shape_id_counter;
+}
+
 /* create a new empty shape with prototype 'proto' */
 static no_inline JSShape *js_new_shape2(JSContext *ctx, JSObject *proto,
                                         int hash_size, int prop_size)
@@ -4645,6 +5687,7 @@ static no_inline JSShape *js_new_shape2(JSContext *ctx, JSObject *proto,
     sh->hash = shape_initial_hash(proto);
     sh->is_hashed = true;
     sh->has_small_array_index = false;
+    js_shape_set_id(rt, sh);
     js_shape_hash_link(ctx->rt, sh);
     return sh;
 }
@@ -4676,6 +5719,7 @@ static JSShape *js_clone_shape(JSContext *ctx, JSShape *sh1)
     sh->header.ref_count = 1;
     add_gc_object(ctx->rt, &sh->header, JS_GC_OBJ_TYPE_SHAPE);
     sh->is_hashed = false;
+    js_shape_set_id(ctx->rt, sh);
     if (sh->proto) {
         js_dup(JS_MKPTR(JS_TAG_OBJECT, sh->proto));
     }
@@ -4707,7 +5751,7 @@ static void js_free_shape0(JSRuntime *rt, JSShape *sh)
         JS_FreeAtomRT(rt, pr->atom);
         pr++;
     }
-    remove_gc_object(&sh->header);
+    remove_gc_object(rt, &sh->header);
     js_free_rt(rt, get_alloc_from_shape(sh));
 }
 
@@ -4756,11 +5800,11 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
         if (!sh_alloc)
             return -1;
         sh = get_shape_from_alloc(sh_alloc, new_hash_size);
-        list_del(&old_sh->header.link);
+        remove_gc_object(ctx->rt, &old_sh->header);
         /* copy all the fields and the properties */
         memcpy(sh, old_sh,
                sizeof(JSShape) + sizeof(sh->prop[0]) * old_sh->prop_count);
-        list_add_tail(&sh->header.link, &ctx->rt->gc_obj_list);
+        add_gc_object(ctx->rt, &sh->header, JS_GC_OBJ_TYPE_SHAPE);
         new_hash_mask = new_hash_size - 1;
         sh->prop_hash_mask = new_hash_mask;
         memset(prop_hash_end(sh) - new_hash_size, 0,
@@ -4775,16 +5819,16 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
         js_free(ctx, get_alloc_from_shape(old_sh));
     } else {
         /* only resize the properties */
-        list_del(&sh->header.link);
+        remove_gc_object(ctx->rt, &sh->header);
         sh_alloc = js_realloc(ctx, get_alloc_from_shape(sh),
                               get_shape_size(new_hash_size, new_size));
         if (unlikely(!sh_alloc)) {
             /* insert again in the GC list */
-            list_add_tail(&sh->header.link, &ctx->rt->gc_obj_list);
+            add_gc_object(ctx->rt, &sh->header, JS_GC_OBJ_TYPE_SHAPE);
             return -1;
         }
         sh = get_shape_from_alloc(sh_alloc, new_hash_size);
-        list_add_tail(&sh->header.link, &ctx->rt->gc_obj_list);
+        add_gc_object(ctx->rt, &sh->header, JS_GC_OBJ_TYPE_SHAPE);
     }
     *psh = sh;
     sh->prop_size = new_size;
@@ -4819,9 +5863,9 @@ static int compact_properties(JSContext *ctx, JSObject *p)
     if (!sh_alloc)
         return -1;
     sh = get_shape_from_alloc(sh_alloc, new_hash_size);
-    list_del(&old_sh->header.link);
+    remove_gc_object(ctx->rt, &old_sh->header);
     memcpy(sh, old_sh, sizeof(JSShape));
-    list_add_tail(&sh->header.link, &ctx->rt->gc_obj_list);
+    add_gc_object(ctx->rt, &sh->header, JS_GC_OBJ_TYPE_SHAPE);
 
     memset(prop_hash_end(sh) - new_hash_size, 0,
            sizeof(prop_hash_end(sh)[0]) * new_hash_size);
@@ -4848,6 +5892,7 @@ static int compact_properties(JSContext *ctx, JSObject *p)
     sh->prop_size = new_size;
     sh->deleted_prop_count = 0;
     sh->prop_count = j;
+    js_shape_set_id(ctx->rt, sh);
 
     p->shape = sh;
     js_free(ctx, get_alloc_from_shape(old_sh));
@@ -4900,6 +5945,7 @@ static int add_shape_property(JSContext *ctx, JSShape **psh,
     h = atom & hash_mask;
     pr->hash_next = prop_hash_end(sh)[-h - 1];
     prop_hash_end(sh)[-h - 1] = sh->prop_count;
+    js_shape_set_id(rt, sh);
     return 0;
 }
 
@@ -5039,6 +6085,7 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
             p->u.array.u.values = NULL;
             p->u.array.count = 0;
             p->u.array.u1.size = 0;
+            p->u.array.kind = JS_ARRAY_KIND_VALUE;
             /* the length property is always the first one */
             if (likely(sh == ctx->array_shape)) {
                 pr = &p->prop[0];
@@ -5071,6 +6118,7 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
         p->fast_array = 1;
         p->u.array.u.ptr = NULL;
         p->u.array.count = 0;
+        p->u.array.kind = JS_ARRAY_KIND_VALUE;
         break;
     case JS_CLASS_DATAVIEW:
         p->u.array.u.ptr = NULL;
@@ -5127,6 +6175,32 @@ JSValue JS_NewObjectProtoClass(JSContext *ctx, JSValueConst proto_val,
     return JS_NewObjectFromShape(ctx, sh, class_id);
 }
 
+/* same as JS_NewObjectProtoClass() with room for 'prop_size'
+   properties so that the allocation sites which know the final size of
+   their objects avoid the intermediate resizes */
+static JSValue js_new_object_sized(JSContext *ctx, JSValueConst proto_val,
+                                   JSClassID class_id, int prop_size)
+{
+    JSShape *sh;
+    JSObject *proto;
+    int hash_size;
+
+    proto = get_proto_obj(proto_val);
+    sh = find_hashed_shape_proto(ctx->rt, proto);
+    if (likely(sh && sh->prop_size >= prop_size)) {
+        sh = js_dup_shape(sh);
+    } else {
+        hash_size = JS_PROP_INITIAL_HASH_SIZE;
+        while (hash_size < prop_size)
+            hash_size *= 2;
+        sh = js_new_shape2(ctx, proto, hash_size,
+                           max_int(prop_size, JS_PROP_INITIAL_SIZE));
+        if (!sh)
+            return JS_EXCEPTION;
+    }
+    return JS_NewObjectFromShape(ctx, sh, class_id);
+}
+
 static int JS_SetObjectData(JSContext *ctx, JSValueConst obj, JSValue val)
 {
     JSObject *p;
@@ -5203,6 +6277,7 @@ JSValue JS_NewObjectFrom(JSContext *ctx, int count, const JSAtom *props,
             pr->flags = JS_PROP_C_W_E;
             p->prop[i].u.value = values[i];
         }
+        js_shape_set_id(rt, sh);
         js_shape_hash_link(rt, sh);
         sh->prop_count = count;
     }
@@ -5250,6 +6325,7 @@ JSValue JS_NewArrayFrom(JSContext *ctx, int count, const JSValue *values)
 {
     JSObject *p;
     JSValue obj;
+    JSArrayKindEnum kind;
     int i;
 
     obj = JS_NewArray(ctx);
@@ -5257,13 +6333,23 @@ JSValue JS_NewArrayFrom(JSContext *ctx, int count, const JSValue *values)
         goto exception;
     if (count > 0) {
         p = JS_VALUE_GET_OBJ(obj);
+        /* pack the arrays of numbers */
+        kind = JS_ARRAY_KIND_INT32;
+        for(i = 0; i < count && kind != JS_ARRAY_KIND_VALUE; i++)
+            kind = max_int(kind, js_array_value_kind(values[i]));
+        p->u.array.kind = kind;
         if (expand_fast_array(ctx, p, count)) {
             JS_FreeValue(ctx, obj);
             goto exception;
         }
         p->u.array.count = count;
         p->prop[0].u.value = js_int32(count);
-        memcpy(p->u.array.u.values, values, count * sizeof(*values));
+        if (kind == JS_ARRAY_KIND_VALUE) {
+            memcpy(p->u.array.u.values, values, count * sizeof(*values));
+        } else {
+            for(i = 0; i < count; i++)
+                js_array_store(p, i, values[i]);
+        }
     }
     return obj;
 exception:
@@ -5719,7 +6805,7 @@ static void free_var_ref(JSRuntime *rt, JSVarRef *var_ref)
         if (--var_ref->header.ref_count == 0) {
             if (var_ref->is_detached) {
                 JS_FreeValueRT(rt, var_ref->value);
-                remove_gc_object(&var_ref->header);
+                remove_gc_object(rt, &var_ref->header);
             } else {
                 list_del(&var_ref->header.link); /* still on the stack */
             }
@@ -5733,8 +6819,10 @@ static void js_array_finalizer(JSRuntime *rt, JSValueConst val)
     JSObject *p = JS_VALUE_GET_OBJ(val);
     int i;
 
-    for(i = 0; i < p->u.array.count; i++) {
-        JS_FreeValueRT(rt, p->u.array.u.values[i]);
+    if (p->u.array.kind == JS_ARRAY_KIND_VALUE) {
+        for(i = 0; i < p->u.array.count; i++) {
+            JS_FreeValueRT(rt, p->u.array.u.values[i]);
+        }
     }
     js_free_rt(rt, p->u.array.u.values);
 }
@@ -5745,6 +6833,8 @@ static void js_array_mark(JSRuntime *rt, JSValueConst val,
     JSObject *p = JS_VALUE_GET_OBJ(val);
     int i;
 
+    if (p->u.array.kind != JS_ARRAY_KIND_VALUE)
+        return;
     for(i = 0; i < p->u.array.count; i++) {
         JS_MarkValue(rt, p->u.array.u.values[i], mark_func);
     }
@@ -5900,7 +6990,7 @@ static void free_object(JSRuntime *rt, JSObject *p)
     p->prop = NULL;
 
     if (unlikely(p->first_weak_ref)) {
-        reset_weak_ref(rt, &p->first_weak_ref);
+        reset_weak_ref(rt, JS_MKPTR(JS_TAG_OBJECT, p));
     }
 
     finalizer = rt->class_array[p->class_id].finalizer;
@@ -5913,7 +7003,7 @@ static void free_object(JSRuntime *rt, JSObject *p)
     p->u.func.var_refs = NULL;
     p->u.func.home_object = NULL;
 
-    remove_gc_object(&p->header);
+    remove_gc_object(rt, &p->header);
     if (rt->gc_phase == JS_GC_PHASE_REMOVE_CYCLES && p->header.ref_count != 0) {
         list_add_tail(&p->header.link, &rt->gc_zero_ref_count_list);
     } else {
@@ -5952,6 +7042,13 @@ static void free_zero_refcount(JSRuntime *rt)
     rt->gc_phase = JS_GC_PHASE_NONE;
 }
 
+/* must be called before a GC object leaves gc_obj_list */
+static inline void gc_inc_forget(JSRuntime *rt, JSGCObjectHeader *h)
+{
+    if (unlikely(rt->gc_inc.phase != JS_GC_INC_NONE))
+        gc_inc_forget1(rt, h);
+}
+
 /* called with the ref_count of 'v' reaches zero. */
 static void js_free_value_rt(JSRuntime *rt, JSValue v)
 {
@@ -5982,11 +7079,19 @@ static void js_free_value_rt(JSRuntime *rt, JSValue v)
         {
             JSGCObjectHeader *p = JS_VALUE_GET_PTR(v);
             if (rt->gc_phase != JS_GC_PHASE_REMOVE_CYCLES) {
+                gc_inc_forget(rt, p);
                 list_del(&p->link);
                 list_add(&p->link, &rt->gc_zero_ref_count_list);
                 if (rt->gc_phase == JS_GC_PHASE_NONE) {
                     free_zero_refcount(rt);
                 }
+            } else if (unlikely(rt->gc_inc.phase != JS_GC_INC_NONE &&
+                                !(p->mark & 1))) {
+                /* referenced only by the cycles freed by
+                   gc_inc_free_cycles(): freed once they are gone */
+                gc_inc_forget(rt, p);
+                list_del(&p->link);
+                list_add_tail(&p->link, &rt->gc_inc.orphan_list);
             }
         }
         break;
@@ -6033,11 +7138,58 @@ static void add_gc_object(JSRuntime *rt, JSGCObjectHeader *h,
 {
     h->mark = 0;
     h->gc_obj_type = type;
-    list_add_tail(&h->link, &rt->gc_obj_list);
+    rt->gc_alloc_count++;
+    if (unlikely(rt->gc_inc.phase != JS_GC_INC_NONE)) {
+        /* out of reach of the snapshot cursor so that the snapshot
+           ends even if the mutator allocates faster than it */
+        list_add(&h->link, &rt->gc_obj_list);
+    } else {
+        list_add_tail(&h->link, &rt->gc_obj_list);
+    }
 }
 
-static void remove_gc_object(JSGCObjectHeader *h)
+/* header.mark bits of the incremental cycle collector. Bit 0 is the
+   mark of JS_RunGC() and gc_inc_free_cycles(). */
+#define GC_INC_MEMBER (1 << 1) /* the object is in the snapshot */
+#define GC_INC_LIVE   (1 << 2) /* referenced from outside the snapshot */
+
+static inline uint32_t gc_inc_hash(JSGCObjectHeader *h, uint32_t hash_size)
 {
+    return ((uint32_t)((uintptr_t)h >> 3) * 0x9e3779b1) & (hash_size - 1);
+}
+
+/* return the index of 'h' in the snapshot. 'h' must be a member. */
+static uint32_t gc_inc_find(JSGCIncState *s, JSGCObjectHeader *h)
+{
+    uint32_t i, e;
+
+    i = gc_inc_hash(h, s->hash_size);
+    for(;;) {
+        e = s->hash[i];
+        assert(e != 0);
+        if (s->objs[e - 1] == h)
+            return e - 1;
+        i = (i + 1) & (s->hash_size - 1);
+    }
+}
+
+/* called before 'h' leaves gc_obj_list, usually because it is about
+   to be freed: it must no longer be referenced from the snapshot */
+static void gc_inc_forget1(JSRuntime *rt, JSGCObjectHeader *h)
+{
+    JSGCIncState *s = &rt->gc_inc;
+
+    if (s->cursor == &h->link)
+        s->cursor = h->link.next;
+    if (h->mark & GC_INC_MEMBER) {
+        s->objs[gc_inc_find(s, h)] = NULL;
+        h->mark &= ~(GC_INC_MEMBER | GC_INC_LIVE);
+    }
+}
+
+static void remove_gc_object(JSRuntime *rt, JSGCObjectHeader *h)
+{
+    gc_inc_forget(rt, h);
     list_del(&h->link);
 }
 
@@ -6055,17 +7207,18 @@ void JS_MarkValue(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func)
     }
 }
 
-static void mark_weak_map_value(JSRuntime *rt, JSWeakRefRecord *first_weak_ref, JS_MarkFunc *mark_func) {
+static JSMapRecord *map_find_weak_record(JSRuntime *rt, JSMapState *s,
+                                         JSValueConst key);
+
+static void mark_weak_map_value(JSRuntime *rt, JSWeakRefRecord *first_weak_ref,
+                                JSValueConst key, JS_MarkFunc *mark_func) {
     JSWeakRefRecord *wr;
     JSMapRecord *mr;
-    JSMapState *s;
 
     for (wr = first_weak_ref; wr != NULL; wr = wr->next_weak_ref) {
         if (wr->kind == JS_WEAK_REF_KIND_MAP) {
-            mr = wr->u.map_record;
-            s = mr->map;
-            assert(s->is_weak);
-            assert(!mr->empty); /* no iterator on WeakMap/WeakSet */
+            mr = map_find_weak_record(rt, wr->u.map_state, key);
+            assert(mr != NULL);
             JS_MarkValue(rt, mr->value, mark_func);
         }
     }
@@ -6111,7 +7264,8 @@ static void mark_children(JSRuntime *rt, JSGCObjectHeader *gp,
             }
 
             if (unlikely(p->first_weak_ref)) {
-                mark_weak_map_value(rt, p->first_weak_ref, mark_func);
+                mark_weak_map_value(rt, p->first_weak_ref,
+                                    JS_MKPTR(JS_TAG_OBJECT, p), mark_func);
             }
 
             if (p->class_id != JS_CLASS_OBJECT) {
@@ -6149,6 +7303,8 @@ static void mark_children(JSRuntime *rt, JSGCObjectHeader *gp,
                 async_func_mark(rt, &s->func_state, mark_func);
             JS_MarkValue(rt, s->resolving_funcs[0], mark_func);
             JS_MarkValue(rt, s->resolving_funcs[1], mark_func);
+            JS_MarkValue(rt, s->resume_funcs[0], mark_func);
+            JS_MarkValue(rt, s->resume_funcs[1], mark_func);
         }
         break;
     case JS_GC_OBJ_TYPE_SHAPE:
@@ -6290,8 +7446,14 @@ static void gc_free_cycles(JSRuntime *rt)
     init_list_head(&rt->gc_zero_ref_count_list);
 }
 
+static void gc_inc_abort(JSRuntime *rt);
+
 void JS_RunGC(JSRuntime *rt)
 {
+    /* a full collection supersedes the incremental one */
+    if (rt->gc_inc.phase != JS_GC_INC_NONE)
+        gc_inc_abort(rt);
+
     /* decrement the reference of the children of each object. mark =
        1 after this pass. */
     gc_decref(rt);
@@ -6303,6 +7465,307 @@ void JS_RunGC(JSRuntime *rt)
     gc_free_cycles(rt);
 }
 
+/* Incremental cycle collector.
+
+   JS_RunGCStep() runs the same trial deletion as JS_RunGC() in bounded
+   steps between which the mutator runs. The steps never modify the
+   reference counts: the objects of gc_obj_list are recorded in a
+   snapshot, the references between snapshot members are counted in a
+   side table, and the members with more references than the counted
+   ones are marked live, as well as what they reference. What remains
+   is likely to be garbage cycles but the mutator may have changed the
+   graph in the meantime, so the final step runs the exact trial
+   deletion restricted to these candidates, atomically. Any reference
+   from outside the candidate set (including from the objects
+   allocated after the snapshot) keeps the referenced candidate alive,
+   hence a stale snapshot can only delay collection. The only barrier
+   is gc_inc_forget() which removes the freed objects from the
+   snapshot. */
+
+static void gc_inc_free_state(JSRuntime *rt)
+{
+    JSGCIncState *s = &rt->gc_inc;
+
+    js_free_rt(rt, s->objs);
+    js_free_rt(rt, s->counts);
+    js_free_rt(rt, s->work);
+    js_free_rt(rt, s->hash);
+    s->objs = NULL;
+    s->counts = NULL;
+    s->work = NULL;
+    s->hash = NULL;
+    s->count = s->size = s->hash_size = 0;
+    s->cursor = NULL;
+    s->phase = JS_GC_INC_NONE;
+}
+
+static void gc_inc_abort(JSRuntime *rt)
+{
+    JSGCIncState *s = &rt->gc_inc;
+    uint32_t i;
+
+    for(i = 0; i < s->count; i++) {
+        if (s->objs[i])
+            s->objs[i]->mark = 0;
+    }
+    gc_inc_free_state(rt);
+}
+
+static int gc_inc_resize_hash(JSRuntime *rt, uint32_t new_hash_size)
+{
+    JSGCIncState *s = &rt->gc_inc;
+    uint32_t *hash, i, h;
+
+    hash = js_mallocz_rt(rt, sizeof(hash[0]) * new_hash_size);
+    if (!hash)
+        return -1;
+    for(i = 0; i < s->count; i++) {
+        if (s->objs[i]) {
+            h = gc_inc_hash(s->objs[i], new_hash_size);
+            while (hash[h] != 0)
+                h = (h + 1) & (new_hash_size - 1);
+            hash[h] = i + 1;
+        }
+    }
+    js_free_rt(rt, s->hash);
+    s->hash = hash;
+    s->hash_size = new_hash_size;
+    return 0;
+}
+
+static int gc_inc_add(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    JSGCIncState *s = &rt->gc_inc;
+    JSGCObjectHeader **objs;
+    uint32_t new_size, h;
+
+    if (s->count >= s->size) {
+        new_size = max_int(s->size * 3 / 2, 256);
+        objs = js_realloc_rt(rt, s->objs, sizeof(objs[0]) * new_size);
+        if (!objs)
+            return -1;
+        s->objs = objs;
+        s->size = new_size;
+    }
+    if (2 * (s->count + 1) > s->hash_size) {
+        if (gc_inc_resize_hash(rt, max_int(2 * s->hash_size, 512)))
+            return -1;
+    }
+    assert(!(p->mark & GC_INC_MEMBER));
+    p->mark |= GC_INC_MEMBER;
+    s->objs[s->count] = p;
+    h = gc_inc_hash(p, s->hash_size);
+    while (s->hash[h] != 0)
+        h = (h + 1) & (s->hash_size - 1);
+    s->hash[h] = ++s->count;
+    return 0;
+}
+
+static void gc_inc_count_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    JSGCIncState *s = &rt->gc_inc;
+
+    if (p->mark & GC_INC_MEMBER)
+        s->counts[gc_inc_find(s, p)]++;
+}
+
+static void gc_inc_mark_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    JSGCIncState *s = &rt->gc_inc;
+
+    if ((p->mark & (GC_INC_MEMBER | GC_INC_LIVE)) == GC_INC_MEMBER) {
+        p->mark |= GC_INC_LIVE;
+        s->work[s->work_count++] = gc_inc_find(s, p);
+    }
+}
+
+static void gc_inc_decref_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (p->mark & 1) {
+        assert(p->ref_count > 0);
+        p->ref_count--;
+    }
+}
+
+static void gc_inc_incref_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (p->mark & 1)
+        p->ref_count++;
+}
+
+static void gc_inc_scan_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    JSGCIncState *s = &rt->gc_inc;
+
+    if ((p->mark & (1 | GC_INC_LIVE)) == 1) {
+        p->mark |= GC_INC_LIVE;
+        s->counts[s->pos++] = gc_inc_find(s, p);
+    }
+}
+
+/* JS_RunGC() restricted to the unmarked members of the snapshot.
+   'counts' is reused as the mark stack. */
+static void gc_inc_free_cycles(JSRuntime *rt)
+{
+    JSGCIncState *s = &rt->gc_inc;
+    JSGCObjectHeader *p;
+    struct list_head *el;
+    uint32_t i, n;
+
+    n = 0;
+    for(i = 0; i < s->work_count; i++) {
+        p = s->objs[s->work[i]];
+        if (p && !(p->mark & GC_INC_LIVE)) {
+            p->mark |= 1;
+            s->work[n++] = s->work[i];
+        }
+    }
+    s->work_count = n;
+
+    for(i = 0; i < n; i++)
+        mark_children(rt, s->objs[s->work[i]], gc_inc_decref_child);
+    s->pos = 0;
+    for(i = 0; i < n; i++) {
+        p = s->objs[s->work[i]];
+        if (p->ref_count > 0) {
+            p->mark |= GC_INC_LIVE;
+            s->counts[s->pos++] = s->work[i];
+        }
+    }
+    for(i = 0; i < n; i++)
+        mark_children(rt, s->objs[s->work[i]], gc_inc_incref_child);
+    while (s->pos > 0) {
+        p = s->objs[s->counts[--s->pos]];
+        mark_children(rt, p, gc_inc_scan_child);
+    }
+
+    init_list_head(&rt->tmp_obj_list);
+    for(i = 0; i < n; i++) {
+        p = s->objs[s->work[i]];
+        if (p->mark & GC_INC_LIVE) {
+            p->mark &= ~1;
+        } else {
+            s->objs[s->work[i]] = NULL;
+            p->mark = 1;
+            list_del(&p->link);
+            list_add_tail(&p->link, &rt->tmp_obj_list);
+        }
+    }
+    gc_free_cycles(rt);
+
+    if (!list_empty(&s->orphan_list)) {
+        while (!list_empty(&s->orphan_list)) {
+            el = s->orphan_list.next;
+            list_del(el);
+            list_add_tail(el, &rt->gc_zero_ref_count_list);
+        }
+        free_zero_refcount(rt);
+    }
+}
+
+bool JS_RunGCStep(JSRuntime *rt, size_t budget)
+{
+    JSGCIncState *s = &rt->gc_inc;
+    JSGCObjectHeader *p;
+
+    if (budget == 0)
+        budget = SIZE_MAX;
+
+    switch(s->phase) {
+    case JS_GC_INC_NONE:
+        s->phase = JS_GC_INC_COLLECT;
+        s->cursor = rt->gc_obj_list.next;
+        /* fall through */
+    case JS_GC_INC_COLLECT:
+        while (s->cursor != &rt->gc_obj_list) {
+            if (budget == 0)
+                return false;
+            budget--;
+            p = list_entry(s->cursor, JSGCObjectHeader, link);
+            s->cursor = s->cursor->next;
+            if (gc_inc_add(rt, p))
+                goto fail;
+        }
+        s->cursor = NULL;
+        s->counts = js_mallocz_rt(rt, sizeof(s->counts[0]) * max_int(s->count, 1));
+        s->work = js_malloc_rt(rt, sizeof(s->work[0]) * max_int(s->count, 1));
+        if (!s->counts || !s->work)
+            goto fail;
+        s->pos = 0;
+        s->phase = JS_GC_INC_COUNT;
+        /* fall through */
+    case JS_GC_INC_COUNT:
+        while (s->pos < s->count) {
+            if (budget == 0)
+                return false;
+            budget--;
+            p = s->objs[s->pos++];
+            if (p)
+                mark_children(rt, p, gc_inc_count_child);
+        }
+        s->pos = 0;
+        s->work_count = 0;
+        s->phase = JS_GC_INC_MARK;
+        /* fall through */
+    case JS_GC_INC_MARK:
+        for(;;) {
+            while (s->work_count > 0) {
+                if (budget == 0)
+                    return false;
+                budget--;
+                p = s->objs[s->work[--s->work_count]];
+                if (p)
+                    mark_children(rt, p, gc_inc_mark_child);
+            }
+            if (s->pos >= s->count)
+                break;
+            if (budget == 0)
+                return false;
+            budget--;
+            p = s->objs[s->pos];
+            if (p && !(p->mark & GC_INC_LIVE) &&
+                (uint32_t)p->ref_count > s->counts[s->pos]) {
+                p->mark |= GC_INC_LIVE;
+                s->work[s->work_count++] = s->pos;
+            }
+            s->pos++;
+        }
+        s->pos = 0;
+        s->phase = JS_GC_INC_SWEEP;
+        /* fall through */
+    case JS_GC_INC_SWEEP:
+        while (s->pos < s->count) {
+            if (budget == 0)
+                return false;
+            budget--;
+            p = s->objs[s->pos];
+            if (p && !(p->mark & GC_INC_LIVE))
+                s->work[s->work_count++] = s->pos;
+            s->pos++;
+        }
+        s->phase = JS_GC_INC_CLEANUP;
+        gc_inc_free_cycles(rt);
+        s->pos = 0;
+        /* fall through */
+    case JS_GC_INC_CLEANUP:
+        while (s->pos < s->count) {
+            if (budget == 0)
+                return false;
+            budget--;
+            p = s->objs[s->pos++];
+            if (p)
+                p->mark = 0;
+        }
+        gc_inc_free_state(rt);
+        return true;
+    default:
+        abort();
+    }
+ fail:
+    gc_inc_abort(rt);
+    return true;
+}
+
 /* Return false if not an object or if the object has already been
    freed (zombie objects are visible in finalizers when freeing
    cycles). */
@@ -6315,6 +7778,11 @@ bool JS_IsLiveObject(JSRuntime *rt, JSValueConst obj)
     return !p->free_mark;
 }
 
+uint64_t JS_GetGCAllocCount(JSRuntime *rt)
+{
+    return rt->gc_alloc_count;
+}
+
 /* Compute memory used by various object types */
 /* XXX: poor man's approach to handling multiply referenced objects */
 typedef struct JSMemoryUsage_helper {
@@ -6332,11 +7800,29 @@ static void compute_value_size(JSValue val, JSMemoryUsage_helper *hp);
 
 static void compute_jsstring_size(JSString *str, JSMemoryUsage_helper *hp)
 {
-    if (!str->atom_type) {  /* atoms are handled separately */
-        double s_ref_count = str->header.ref_count;
+    JSStringRope *r;
+    double s_ref_count;
+
+    /* atoms are handled separately */
+    while (!str->atom_type) {
+        s_ref_count = str->header.ref_count;
         hp->str_count += 1 / s_ref_count;
-        hp->str_size += ((sizeof(*str) + (str->len << str->is_wide_char) +
-                          1 - str->is_wide_char) / s_ref_count);
+        if (str->kind != JS_STRING_KIND_ROPE) {
+            hp->str_size += ((sizeof(*str) + (str->len << str->is_wide_char) +
+                              1 - str->is_wide_char) / s_ref_count);
+            break;
+        }
+        /* the nodes are counted but the leaves are not weighted by the
+           reference count of their parents */
+        hp->str_size += (sizeof(*str) + sizeof(*r)) / s_ref_count;
+        r = (void *)&str[1];
+        if (r->left->len < r->right->len) {
+            compute_jsstring_size(r->left, hp);
+            str = r->right;
+        } else {
+            compute_jsstring_size(r->right, hp);
+            str = r->left;
+        }
     }
 }
 
@@ -6362,6 +7848,11 @@ static void compute_bytecode_size(JSFunctionBytecode *b, JSMemoryUsage_helper *h
     if (b->byte_code_buf) {
         hp->js_func_code_size += b->byte_code_len;
     }
+    if (b->ic) {
+        memory_used_count++;
+        js_func_size += sizeof(*b->ic) +
+            (b->ic->mask + 1) * sizeof(b->ic->slots[0]);
+    }
     memory_used_count++;
     js_func_size += b->source_len + 1;
     if (b->pc2line_len) {
@@ -6493,10 +7984,12 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
                 if (p->u.array.u.values) {
                     s->memory_used_count++;
                     s->memory_used_size += p->u.array.count *
-                        sizeof(*p->u.array.u.values);
+                        js_array_kind_size[p->u.array.kind];
                     s->fast_array_elements += p->u.array.count;
-                    for (i = 0; i < p->u.array.count; i++) {
-                        compute_value_size(p->u.array.u.values[i], hp);
+                    if (p->u.array.kind == JS_ARRAY_KIND_VALUE) {
+                        for (i = 0; i < p->u.array.count; i++) {
+                            compute_value_size(p->u.array.u.values[i], hp);
+                        }
                     }
                 }
             }
@@ -6661,6 +8154,7 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
                              1 - p->is_wide_char);
         }
     }
+    js_regexp_cache_memory_usage(rt, s);
     s->str_count = round(mem.str_count);
     s->str_size = round(mem.str_size);
     s->js_func_count = mem.js_func_count;
@@ -6798,6 +8292,11 @@ void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt)
         fprintf(fp, "%-20s %8"PRId64" %8"PRId64"\n",
                 "binary objects", s->binary_object_count, s->binary_object_size);
     }
+    if (s->regexp_cache_count) {
+        fprintf(fp, "%-20s %8"PRId64"           (%"PRId64" hits, %"PRId64" misses)\n",
+                "RegExp cache", s->regexp_cache_count,
+                s->regexp_cache_hits, s->regexp_cache_misses);
+    }
 }
 
 JSValue JS_GetGlobalObject(JSContext *ctx)
@@ -7425,6 +8924,1310 @@ static JSValue JS_ThrowTypeErrorInvalidClass(JSContext *ctx, int class_id)
     return JS_ThrowTypeErrorAtom(ctx, "%s object expected", name);
 }
 
+/* Sampling profiler. The samples are stored as a tree of call frames
+   which maps directly to the .cpuprofile format. A node is identified by
+   its parent and by the function name and definition position. */
+#define JS_PROFILE_MAX_DEPTH 256
+
+typedef struct JSProfileLine {
+    int line_num;
+    int ticks;
+} JSProfileLine;
+
+typedef struct JSProfileNode {
+    int parent; /* index of the parent node, -1 for the root */
+    int hash_next; /* next node in the hash chain, 0 = end */
+    JSAtom func_name; /* JS_ATOM_NULL for anonymous functions */
+    JSAtom filename; /* JS_ATOM_NULL for native functions */
+    int line_num; /* position of the function definition */
+    int col_num;
+    int hit_count;
+    int64_t self_size; /* heap sampling: estimated allocated bytes */
+    /* hits per line of the function when it is on the top of the stack */
+    JSProfileLine *lines;
+    int line_count;
+    int line_size;
+} JSProfileNode;
+
+struct JSProfiler {
+    /* CPU profiler: ns, 0 if only sampled on request. Heap sampling:
+       number of js_malloc() calls between two samples */
+    uint64_t interval;
+    uint64_t countdown; /* heap sampling: calls before the next sample */
+    uint64_t start_time; /* ns */
+    uint64_t last_time; /* ns */
+    JSProfileNode *nodes; /* nodes[0] is the root */
+    int node_count;
+    int node_size;
+    int *hash; /* index of the first node of each chain, 0 = empty */
+    int hash_size; /* power of two */
+    int *samples; /* node of each sample */
+    int *time_deltas; /* us since the previous sample, size for the heap */
+    int sample_count;
+    int sample_size;
+    int time_delta_size;
+};
+
+/* same as js_resize_array() but does not throw */
+static int js_profiler_resize(JSRuntime *rt, void **parray, int elem_size,
+                              int *psize, int req_size)
+{
+    int new_size;
+    void *new_array;
+
+    if (likely(req_size <= *psize))
+        return 0;
+    new_size = max_int(req_size, max_int(*psize * 3 / 2, 16));
+    new_array = js_realloc_rt(rt, *parray, (size_t)new_size * elem_size);
+    if (!new_array)
+        return -1;
+    *parray = new_array;
+    *psize = new_size;
+    return 0;
+}
+
+static uint32_t js_profiler_hash(int parent, JSAtom func_name,
+                                 JSAtom filename, int line_num, int col_num)
+{
+    uint32_t h;
+
+    h = parent;
+    h = h * 31 + func_name;
+    h = h * 31 + filename;
+    h = h * 31 + line_num;
+    h = h * 31 + col_num;
+    return h * 0x9E3779B1;
+}
+
+/* return the child of 'parent' for the function or -1 if out of
+   memory. The references to the atoms are kept. */
+static int js_profiler_get_node(JSRuntime *rt, JSProfiler *prof, int parent,
+                                JSAtom func_name, JSAtom filename,
+                                int line_num, int col_num)
+{
+    JSProfileNode *n;
+    int i, *new_hash;
+    uint32_t h, new_hash_size;
+
+    h = js_profiler_hash(parent, func_name, filename, line_num, col_num);
+    for(i = prof->hash[h & (prof->hash_size - 1)]; i != 0;
+        i = prof->nodes[i].hash_next) {
+        n = &prof->nodes[i];
+        if (n->parent == parent && n->func_name == func_name &&
+            n->filename == filename && n->line_num == line_num &&
+            n->col_num == col_num)
+            return i;
+    }
+    if (js_profiler_resize(rt, (void **)&prof->nodes, sizeof(prof->nodes[0]),
+                           &prof->node_size, prof->node_count + 1))
+        return -1;
+    if (prof->node_count >= prof->hash_size) {
+        new_hash_size = prof->hash_size * 2;
+        new_hash = js_mallocz_rt(rt, sizeof(new_hash[0]) * new_hash_size);
+        if (!new_hash)
+            return -1;
+        for(i = 1; i < prof->node_count; i++) {
+            n = &prof->nodes[i];
+            h = js_profiler_hash(n->parent, n->func_name, n->filename,
+                                 n->line_num, n->col_num) & (new_hash_size - 1);
+            n->hash_next = new_hash[h];
+            new_hash[h] = i;
+        }
+        js_free_rt(rt, prof->hash);
+        prof->hash = new_hash;
+        prof->hash_size = new_hash_size;
+        h = js_profiler_hash(parent, func_name, filename, line_num, col_num);
+    }
+    i = prof->node_count++;
+    n = &prof->nodes[i];
+    memset(n, 0, sizeof(*n));
+    n->parent = parent;
+    n->func_name = JS_DupAtomRT(rt, func_name);
+    n->filename = JS_DupAtomRT(rt, filename);
+    n->line_num = line_num;
+    n->col_num = col_num;
+    h &= prof->hash_size - 1;
+    n->hash_next = prof->hash[h];
+    prof->hash[h] = i;
+    return i;
+}
+
+/* return the atom of the 'name' property of a native function or
+   JS_ATOM_NULL. Like get_func_name(), no JS code is executed. */
+static JSAtom js_profiler_native_name(JSRuntime *rt, JSObject *p)
+{
+    JSProperty *pr;
+    JSShapeProperty *prs;
+    JSString *str;
+    uint32_t n;
+
+    prs = find_own_property(&pr, p, JS_ATOM_name);
+    if (!prs || (prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL ||
+        JS_VALUE_GET_TAG(pr->u.value) != JS_TAG_STRING)
+        return JS_ATOM_NULL;
+    str = JS_VALUE_GET_STRING(js_dup(pr->u.value));
+    if (js_string_flatten_rt(rt, str) || is_num_string(&n, str)) {
+        js_free_string(rt, str);
+        return JS_ATOM_NULL;
+    }
+    return __JS_NewAtom(rt, str, JS_ATOM_TYPE_STRING);
+}
+
+/* return the node of the current JS stack (0 if there is no JS frame)
+   or -1 if out of memory. '*psf' and '*pb' are set to the innermost
+   frame and its bytecode (NULL for a native function). */
+static int js_profiler_stack_node(JSContext *ctx, JSProfiler *prof,
+                                  JSStackFrame **psf, JSFunctionBytecode **pb)
+{
+    JSRuntime *rt = ctx->rt;
+    JSStackFrame *sf, *frames[JS_PROFILE_MAX_DEPTH];
+    JSFunctionBytecode *b;
+    JSObject *p;
+    JSAtom func_name;
+    int depth, node;
+
+    /* the outermost frames are dropped if the stack is too deep */
+    depth = 0;
+    for(sf = rt->current_stack_frame; sf != NULL; sf = sf->prev_frame) {
+        if (JS_VALUE_GET_TAG(sf->cur_func) != JS_TAG_OBJECT)
+            continue;
+        frames[depth++] = sf;
+        if (depth == JS_PROFILE_MAX_DEPTH)
+            break;
+    }
+    node = 0;
+    sf = NULL;
+    b = NULL;
+    while (depth > 0) {
+        sf = frames[--depth];
+        p = JS_VALUE_GET_OBJ(sf->cur_func);
+        if (js_class_has_bytecode(p->class_id)) {
+            b = p->u.func.function_bytecode;
+            node = js_profiler_get_node(rt, prof, node, b->func_name,
+                                        b->filename, b->line_num, b->col_num);
+        } else {
+            b = NULL;
+            func_name = js_profiler_native_name(rt, p);
+            node = js_profiler_get_node(rt, prof, node, func_name,
+                                        JS_ATOM_NULL, 0, 0);
+            JS_FreeAtomRT(rt, func_name);
+        }
+        if (node < 0)
+            return -1;
+    }
+    *psf = sf;
+    *pb = b;
+    return node;
+}
+
+static void js_profiler_sample(JSContext *ctx, JSProfiler *prof, uint64_t now)
+{
+    JSRuntime *rt = ctx->rt;
+    JSStackFrame *sf;
+    JSFunctionBytecode *b;
+    JSProfileNode *n;
+    int i, node, line_num, col_num;
+
+    if (js_profiler_resize(rt, (void **)&prof->samples,
+                           sizeof(prof->samples[0]), &prof->sample_size,
+                           prof->sample_count + 1) ||
+        js_profiler_resize(rt, (void **)&prof->time_deltas,
+                           sizeof(prof->time_deltas[0]),
+                           &prof->time_delta_size, prof->sample_count + 1))
+        return;
+    node = js_profiler_stack_node(ctx, prof, &sf, &b);
+    if (node < 0)
+        return;
+    n = &prof->nodes[node];
+    n->hit_count++;
+    if (b && sf->cur_pc) {
+        line_num = find_line_num(ctx, b, sf->cur_pc - b->byte_code_buf - 1,
+                                 &col_num);
+        for(i = 0; i < n->line_count; i++) {
+            if (n->lines[i].line_num == line_num)
+                break;
+        }
+        if (i == n->line_count) {
+            if (js_profiler_resize(rt, (void **)&n->lines, sizeof(n->lines[0]),
+                                   &n->line_size, n->line_count + 1))
+                goto done;
+            n->lines[i].line_num = line_num;
+            n->lines[i].ticks = 0;
+            n->line_count++;
+        }
+        n->lines[i].ticks++;
+    }
+ done:
+    prof->samples[prof->sample_count] = node;
+    prof->time_deltas[prof->sample_count] = (now - prof->last_time) / 1000;
+    prof->sample_count++;
+    prof->last_time = now;
+}
+
+static void js_profiler_poll(JSContext *ctx, JSProfiler *prof)
+{
+    JSRuntime *rt = ctx->rt;
+    uint64_t now;
+    int pending;
+
+    /* called before entering the first function: wait for a JS frame */
+    if (!rt->current_stack_frame)
+        return;
+#ifdef CONFIG_ATOMICS
+    pending = atomic_exchange(&rt->profile_sample_pending, 0);
+#else
+    pending = rt->profile_sample_pending;
+    rt->profile_sample_pending = 0;
+#endif
+    now = js__hrtime_ns();
+    if (pending || (prof->interval && now - prof->last_time >= prof->interval))
+        js_profiler_sample(ctx, prof, now);
+}
+
+static void js_profiler_free(JSRuntime *rt, JSProfiler *prof)
+{
+    JSProfileNode *n;
+    int i;
+
+    for(i = 0; i < prof->node_count; i++) {
+        n = &prof->nodes[i];
+        JS_FreeAtomRT(rt, n->func_name);
+        JS_FreeAtomRT(rt, n->filename);
+        js_free_rt(rt, n->lines);
+    }
+    js_free_rt(rt, prof->nodes);
+    js_free_rt(rt, prof->hash);
+    js_free_rt(rt, prof->samples);
+    js_free_rt(rt, prof->time_deltas);
+    js_free_rt(rt, prof);
+}
+
+static JSProfiler *js_profiler_new(JSRuntime *rt)
+{
+    JSProfiler *prof;
+
+    prof = js_mallocz_rt(rt, sizeof(*prof));
+    if (!prof)
+        return NULL;
+    prof->hash_size = 64;
+    prof->hash = js_mallocz_rt(rt, sizeof(prof->hash[0]) * prof->hash_size);
+    if (!prof->hash ||
+        js_profiler_resize(rt, (void **)&prof->nodes, sizeof(prof->nodes[0]),
+                           &prof->node_size, 1)) {
+        js_profiler_free(rt, prof);
+        return NULL;
+    }
+    /* root node, never inserted in the hash table */
+    memset(&prof->nodes[0], 0, sizeof(prof->nodes[0]));
+    prof->nodes[0].parent = -1;
+    prof->node_count = 1;
+    prof->start_time = js__hrtime_ns();
+    prof->last_time = prof->start_time;
+    return prof;
+}
+
+int JS_StartProfiling(JSRuntime *rt, int interval_us)
+{
+    JSProfiler *prof;
+
+    if (rt->profiler)
+        return -1;
+    prof = js_profiler_new(rt);
+    if (!prof)
+        return -1;
+    prof->interval = (uint64_t)max_int(interval_us, 0) * 1000;
+    rt->profiler = prof;
+    return 0;
+}
+
+void JS_RequestProfileSample(JSRuntime *rt)
+{
+#ifdef CONFIG_ATOMICS
+    atomic_store(&rt->profile_sample_pending, 1);
+#else
+    rt->profile_sample_pending = 1;
+#endif
+}
+
+static JSValue js_profiler_call_frame(JSContext *ctx, JSProfileNode *n,
+                                      int index)
+{
+    JSValue obj;
+    char buf[16];
+
+    obj = JS_NewObject(ctx);
+    if (JS_IsException(obj))
+        return obj;
+    if (index == 0) {
+        JS_SetPropertyStr(ctx, obj, "functionName",
+                          JS_NewString(ctx, "(root)"));
+    } else if (n->func_name == JS_ATOM_NULL) {
+        JS_SetPropertyStr(ctx, obj, "functionName",
+                          JS_NewString(ctx, n->filename ? "" : "(native)"));
+    } else {
+        JS_SetPropertyStr(ctx, obj, "functionName",
+                          JS_AtomToString(ctx, n->func_name));
+    }
+    /* one script per file name */
+    snprintf(buf, sizeof(buf), "%u", n->filename);
+    JS_SetPropertyStr(ctx, obj, "scriptId", JS_NewString(ctx, buf));
+    if (n->filename == JS_ATOM_NULL)
+        JS_SetPropertyStr(ctx, obj, "url", JS_NewString(ctx, ""));
+    else
+        JS_SetPropertyStr(ctx, obj, "url", JS_AtomToString(ctx, n->filename));
+    /* zero based */
+    JS_SetPropertyStr(ctx, obj, "lineNumber", js_int32(n->line_num - 1));
+    JS_SetPropertyStr(ctx, obj, "columnNumber", js_int32(n->col_num - 1));
+    return obj;
+}
+
+JSValue JS_StopProfiling(JSContext *ctx)
+{
+    JSRuntime *rt = ctx->rt;
+    JSProfiler *prof = rt->profiler;
+    JSProfileNode *n;
+    JSValue profile, nodes, samples, deltas, node, ticks, tick, ret;
+    JSValue *children;
+    int i, j, *child_count;
+
+    if (!prof)
+        return JS_UNDEFINED;
+    rt->profiler = NULL;
+    ret = JS_EXCEPTION;
+    profile = JS_NewObject(ctx);
+    nodes = JS_NewArray(ctx);
+    samples = JS_NewArray(ctx);
+    deltas = JS_NewArray(ctx);
+    children = js_mallocz(ctx, sizeof(children[0]) * prof->node_count);
+    child_count = js_mallocz(ctx, sizeof(child_count[0]) * prof->node_count);
+    if (JS_IsException(profile) || JS_IsException(nodes) ||
+        JS_IsException(samples) || JS_IsException(deltas) || !children ||
+        !child_count)
+        goto done;
+    for(i = 0; i < prof->node_count; i++) {
+        n = &prof->nodes[i];
+        node = JS_NewObject(ctx);
+        if (JS_IsException(node))
+            goto done;
+        JS_SetPropertyUint32(ctx, nodes, i, node);
+        JS_SetPropertyStr(ctx, node, "id", js_int32(i + 1));
+        JS_SetPropertyStr(ctx, node, "callFrame",
+                          js_profiler_call_frame(ctx, n, i));
+        JS_SetPropertyStr(ctx, node, "hitCount", js_int32(n->hit_count));
+        children[i] = JS_NewArray(ctx);
+        if (JS_IsException(children[i]))
+            goto done;
+        JS_SetPropertyStr(ctx, node, "children", js_dup(children[i]));
+        if (n->parent >= 0) {
+            JS_SetPropertyUint32(ctx, children[n->parent],
+                                 child_count[n->parent]++, js_int32(i + 1));
+        }
+        if (n->line_count > 0) {
+            ticks = JS_NewArray(ctx);
+            JS_SetPropertyStr(ctx, node, "positionTicks", ticks);
+            for(j = 0; j < n->line_count; j++) {
+                tick = JS_NewObject(ctx);
+                JS_SetPropertyStr(ctx, tick, "line",
+                                  js_int32(n->lines[j].line_num));
+                JS_SetPropertyStr(ctx, tick, "ticks",
+                                  js_int32(n->lines[j].ticks));
+                JS_SetPropertyUint32(ctx, ticks, j, tick);
+            }
+        }
+    }
+    for(i = 0; i < prof->sample_count; i++) {
+        JS_SetPropertyUint32(ctx, samples, i, js_int32(prof->samples[i] + 1));
+        JS_SetPropertyUint32(ctx, deltas, i, js_int32(prof->time_deltas[i]));
+    }
+    JS_SetPropertyStr(ctx, profile, "nodes", js_dup(nodes));
+    JS_SetPropertyStr(ctx, profile, "startTime",
+                      js_int64(prof->start_time / 1000));
+    JS_SetPropertyStr(ctx, profile, "endTime",
+                      js_int64(js__hrtime_ns() / 1000));
+    JS_SetPropertyStr(ctx, profile, "samples", js_dup(samples));
+    JS_SetPropertyStr(ctx, profile, "timeDeltas", js_dup(deltas));
+    ret = JS_JSONStringify(ctx, profile, JS_UNDEFINED, JS_UNDEFINED);
+ done:
+    if (children) {
+        for(i = 0; i < prof->node_count; i++)
+            JS_FreeValue(ctx, children[i]);
+        js_free(ctx, children);
+    }
+    js_free(ctx, child_count);
+    JS_FreeValue(ctx, profile);
+    JS_FreeValue(ctx, nodes);
+    JS_FreeValue(ctx, samples);
+    JS_FreeValue(ctx, deltas);
+    js_profiler_free(rt, prof);
+    return ret;
+}
+
+/* Sampling heap profiler: every 'interval'-th js_malloc() call records
+   the JS stack in the same call tree as the CPU profiler. hit_count is
+   the number of samples of a node and self_size the estimated number of
+   bytes allocated by it (sampled size * interval). */
+static no_inline void js_heap_sample(JSContext *ctx, size_t size)
+{
+    JSRuntime *rt = ctx->rt;
+    JSProfiler *prof = rt->heap_profiler;
+    JSStackFrame *sf;
+    JSFunctionBytecode *b;
+    JSProfileNode *n;
+    int node;
+
+    if (--prof->countdown != 0)
+        return;
+    prof->countdown = prof->interval;
+    if (js_profiler_resize(rt, (void **)&prof->samples,
+                           sizeof(prof->samples[0]), &prof->sample_size,
+                           prof->sample_count + 1) ||
+        js_profiler_resize(rt, (void **)&prof->time_deltas,
+                           sizeof(prof->time_deltas[0]),
+                           &prof->time_delta_size, prof->sample_count + 1))
+        return;
+    /* the allocations made while sampling are not sampled */
+    rt->heap_profiler = NULL;
+    node = js_profiler_stack_node(ctx, prof, &sf, &b);
+    rt->heap_profiler = prof;
+    if (node < 0)
+        return;
+    n = &prof->nodes[node];
+    n->hit_count++;
+    n->self_size += (int64_t)size * prof->interval;
+    prof->samples[prof->sample_count] = node;
+    prof->time_deltas[prof->sample_count] = min_int64(size, INT32_MAX);
+    prof->sample_count++;
+}
+
+int JS_StartHeapSampling(JSRuntime *rt, int interval)
+{
+    JSProfiler *prof;
+
+    if (rt->heap_profiler || interval < 1)
+        return -1;
+    prof = js_profiler_new(rt);
+    if (!prof)
+        return -1;
+    prof->interval = interval;
+    prof->countdown = interval;
+    rt->heap_profiler = prof;
+    return 0;
+}
+
+JSValue JS_StopHeapSampling(JSContext *ctx)
+{
+    JSRuntime *rt = ctx->rt;
+    JSProfiler *prof = rt->heap_profiler;
+    JSProfileNode *n;
+    JSValue profile, samples, sample, ret;
+    JSValue *nodes, *children;
+    int i, *child_count;
+
+    if (!prof)
+        return JS_UNDEFINED;
+    rt->heap_profiler = NULL;
+    ret = JS_EXCEPTION;
+    profile = JS_NewObject(ctx);
+    samples = JS_NewArray(ctx);
+    nodes = js_mallocz(ctx, sizeof(nodes[0]) * prof->node_count);
+    children = js_mallocz(ctx, sizeof(children[0]) * prof->node_count);
+    child_count = js_mallocz(ctx, sizeof(child_count[0]) * prof->node_count);
+    if (JS_IsException(profile) || JS_IsException(samples) || !nodes ||
+        !children || !child_count)
+        goto done;
+    /* the .heapprofile call tree is nested: the parent of a node is
+       always created before it */
+    for(i = 0; i < prof->node_count; i++) {
+        n = &prof->nodes[i];
+        nodes[i] = JS_NewObject(ctx);
+        if (JS_IsException(nodes[i]))
+            goto done;
+        JS_SetPropertyStr(ctx, nodes[i], "callFrame",
+                          js_profiler_call_frame(ctx, n, i));
+        JS_SetPropertyStr(ctx, nodes[i], "selfSize", js_int64(n->self_size));
+        JS_SetPropertyStr(ctx, nodes[i], "id", js_int32(i + 1));
+        children[i] = JS_NewArray(ctx);
+        if (JS_IsException(children[i]))
+            goto done;
+        JS_SetPropertyStr(ctx, nodes[i], "children", js_dup(children[i]));
+        if (n->parent >= 0) {
+            JS_SetPropertyUint32(ctx, children[n->parent],
+                                 child_count[n->parent]++, js_dup(nodes[i]));
+        }
+    }
+    for(i = 0; i < prof->sample_count; i++) {
+        sample = JS_NewObject(ctx);
+        if (JS_IsException(sample))
+            goto done;
+        JS_SetPropertyStr(ctx, sample, "size", js_int32(prof->time_deltas[i]));
+        JS_SetPropertyStr(ctx, sample, "nodeId", js_int32(prof->samples[i] + 1));
+        JS_SetPropertyStr(ctx, sample, "ordinal", js_int32(i + 1));
+        JS_SetPropertyUint32(ctx, samples, i, sample);
+    }
+    JS_SetPropertyStr(ctx, profile, "head", js_dup(nodes[0]));
+    JS_SetPropertyStr(ctx, profile, "samples", js_dup(samples));
+    ret = JS_JSONStringify(ctx, profile, JS_UNDEFINED, JS_UNDEFINED);
+ done:
+    for(i = 0; i < prof->node_count; i++) {
+        if (nodes)
+            JS_FreeValue(ctx, nodes[i]);
+        if (children)
+            JS_FreeValue(ctx, children[i]);
+    }
+    js_free(ctx, nodes);
+    js_free(ctx, children);
+    js_free(ctx, child_count);
+    JS_FreeValue(ctx, profile);
+    JS_FreeValue(ctx, samples);
+    js_profiler_free(rt, prof);
+    return ret;
+}
+
+/* Heap snapshot in the Chrome DevTools .heapsnapshot format. The nodes
+   are the GC objects of gc_obj_list and the strings referenced by their
+   properties, the edges are the references reported by mark_children(),
+   named after the property or closure variable when there is one. Node
+   0 is a synthetic root referencing the GC objects which are also
+   referenced from outside the GC heap (C code, stack frames), i.e. whose
+   reference count is larger than their number of references from other
+   GC objects, the same criterion as gc_decref(). */
+
+/* index in the node_types and edge_types of the snapshot metadata */
+typedef enum {
+    JS_HEAP_NODE_HIDDEN,
+    JS_HEAP_NODE_ARRAY,
+    JS_HEAP_NODE_STRING,
+    JS_HEAP_NODE_OBJECT,
+    JS_HEAP_NODE_CODE,
+    JS_HEAP_NODE_CLOSURE,
+    JS_HEAP_NODE_REGEXP,
+    JS_HEAP_NODE_NUMBER,
+    JS_HEAP_NODE_NATIVE,
+    JS_HEAP_NODE_SYNTHETIC,
+    JS_HEAP_NODE_CONCATENATED_STRING,
+    JS_HEAP_NODE_SLICED_STRING,
+    JS_HEAP_NODE_SYMBOL,
+    JS_HEAP_NODE_BIGINT,
+    JS_HEAP_NODE_OBJECT_SHAPE,
+} JSHeapNodeTypeEnum;
+
+typedef enum {
+    JS_HEAP_EDGE_CONTEXT,
+    JS_HEAP_EDGE_ELEMENT,
+    JS_HEAP_EDGE_PROPERTY,
+    JS_HEAP_EDGE_INTERNAL,
+    JS_HEAP_EDGE_HIDDEN,
+    JS_HEAP_EDGE_SHORTCUT,
+    JS_HEAP_EDGE_WEAK,
+} JSHeapEdgeTypeEnum;
+
+/* longest string node name, in characters */
+#define JS_HEAP_STRING_NAME_MAX 1024
+
+typedef struct JSHeapNode {
+    void *ptr; /* JSGCObjectHeader or JSString, NULL for the root */
+    JSHeapNodeTypeEnum type : 8;
+    uint32_t name; /* index in the string table */
+    uint32_t self_size;
+    int first_edge;
+    int edge_count;
+    int gc_ref_count; /* references from the other GC objects */
+    int stamp; /* 1 + last node with an edge to this one */
+} JSHeapNode;
+
+typedef struct JSHeapEdge {
+    JSHeapEdgeTypeEnum type : 8;
+    uint32_t name_or_index; /* string index or element index */
+    int to;
+} JSHeapEdge;
+
+typedef struct JSHeapString {
+    uint32_t offset; /* JSON escaped contents in JSHeapSnapshot.strings */
+    uint32_t len;
+    uint32_t hash_next; /* 1 + next string in the hash chain, 0 = end */
+} JSHeapString;
+
+typedef struct JSHeapSnapshot {
+    JSRuntime *rt;
+    JSHeapNode *nodes;
+    int node_count;
+    int node_size;
+    JSHeapEdge *edges;
+    int edge_count;
+    int edge_size;
+    int *node_hash; /* 1 + node index, 0 = empty */
+    int node_hash_size; /* power of two */
+    JSHeapString *strings;
+    int string_count;
+    int string_size;
+    uint32_t *string_hash; /* 1 + string index, 0 = empty */
+    int string_hash_size; /* power of two */
+    DynBuf string_buf;
+    int cur; /* node whose edges are being added */
+    bool error; /* out of memory */
+    /* frequent names */
+    uint32_t name_empty, name_map, name_code, name_context, name_realm;
+    uint32_t name_internal, name_value, name_proto;
+} JSHeapSnapshot;
+
+static void *js_heap_snapshot_dbuf_realloc(void *opaque, void *ptr, size_t size)
+{
+    return js_realloc_rt(opaque, ptr, size);
+}
+
+static inline uint32_t js_heap_snapshot_ptr_hash(const void *ptr,
+                                                 uint32_t hash_size)
+{
+    return ((uint32_t)((uintptr_t)ptr >> 3) * 0x9e3779b1) & (hash_size - 1);
+}
+
+/* return the string index of the contents added to string_buf from
+   'start': an existing string with the same contents or a new one */
+static uint32_t js_heap_snapshot_intern(JSHeapSnapshot *s, size_t start)
+{
+    JSRuntime *rt = s->rt;
+    JSHeapString *hs;
+    const uint8_t *str;
+    uint32_t h, *new_hash;
+    int i, new_hash_size;
+    size_t len;
+
+    if (s->string_buf.error) {
+        s->error = true;
+        return s->name_empty;
+    }
+    str = s->string_buf.buf + start;
+    len = s->string_buf.size - start;
+    h = 1;
+    for(i = 0; i < len; i++)
+        h = h * 263 + str[i];
+    for(i = s->string_hash[h & (s->string_hash_size - 1)]; i != 0;
+        i = hs->hash_next) {
+        hs = &s->strings[i - 1];
+        if (hs->len == len &&
+            !memcmp(s->string_buf.buf + hs->offset, str, len)) {
+            s->string_buf.size = start;
+            return i - 1;
+        }
+    }
+    if (js_profiler_resize(rt, (void **)&s->strings, sizeof(s->strings[0]),
+                           &s->string_size, s->string_count + 1)) {
+        s->error = true;
+        return s->name_empty;
+    }
+    if (s->string_count >= s->string_hash_size) {
+        /* rehash with the lengths and offsets of the existing strings */
+        new_hash_size = s->string_hash_size * 2;
+        new_hash = js_mallocz_rt(rt, sizeof(new_hash[0]) * new_hash_size);
+        if (!new_hash) {
+            s->error = true;
+            return s->name_empty;
+        }
+        for(i = 0; i < s->string_count; i++) {
+            const uint8_t *p;
+            uint32_t h1, j;
+            hs = &s->strings[i];
+            p = s->string_buf.buf + hs->offset;
+            h1 = 1;
+            for(j = 0; j < hs->len; j++)
+                h1 = h1 * 263 + p[j];
+            h1 &= new_hash_size - 1;
+            hs->hash_next = new_hash[h1];
+            new_hash[h1] = i + 1;
+        }
+        js_free_rt(rt, s->string_hash);
+        s->string_hash = new_hash;
+        s->string_hash_size = new_hash_size;
+    }
+    h &= s->string_hash_size - 1;
+    hs = &s->strings[s->string_count];
+    hs->offset = start;
+    hs->len = len;
+    hs->hash_next = s->string_hash[h];
+    s->string_hash[h] = ++s->string_count;
+    return s->string_count - 1;
+}
+
+static void js_heap_snapshot_put_char(DynBuf *b, uint32_t c)
+{
+    if (c == '"' || c == '\\') {
+        dbuf_putc(b, '\\');
+        dbuf_putc(b, c);
+    } else if (c < 0x20 || c >= 0x7f) {
+        /* UTF-16 code units are valid JSON escapes */
+        dbuf_printf(b, "\\u%04x", c);
+    } else {
+        dbuf_putc(b, c);
+    }
+}
+
+static uint32_t js_heap_snapshot_cstr(JSHeapSnapshot *s, const char *str)
+{
+    size_t start = s->string_buf.size;
+    while (*str)
+        js_heap_snapshot_put_char(&s->string_buf, (uint8_t)*str++);
+    return js_heap_snapshot_intern(s, start);
+}
+
+/* ropes have no contiguous contents and are given an empty name */
+static uint32_t js_heap_snapshot_jsstr(JSHeapSnapshot *s, JSString *p)
+{
+    size_t start = s->string_buf.size;
+    uint32_t i, len;
+
+    if (p->kind != JS_STRING_KIND_ROPE) {
+        len = min_uint32(p->len, JS_HEAP_STRING_NAME_MAX);
+        for(i = 0; i < len; i++)
+            js_heap_snapshot_put_char(&s->string_buf, string_get(p, i));
+    }
+    return js_heap_snapshot_intern(s, start);
+}
+
+static uint32_t js_heap_snapshot_atom(JSHeapSnapshot *s, JSAtom atom)
+{
+    char buf[16];
+
+    if (atom == JS_ATOM_NULL)
+        return s->name_empty;
+    if (__JS_AtomIsTaggedInt(atom)) {
+        snprintf(buf, sizeof(buf), "%u", __JS_AtomToUInt32(atom));
+        return js_heap_snapshot_cstr(s, buf);
+    }
+    return js_heap_snapshot_jsstr(s, s->rt->atom_array[atom]);
+}
+
+static int js_heap_snapshot_find(JSHeapSnapshot *s, const void *ptr)
+{
+    uint32_t h;
+    int i;
+
+    h = js_heap_snapshot_ptr_hash(ptr, s->node_hash_size);
+    while ((i = s->node_hash[h]) != 0) {
+        if (s->nodes[i - 1].ptr == ptr)
+            return i - 1;
+        h = (h + 1) & (s->node_hash_size - 1);
+    }
+    return -1;
+}
+
+/* return the index of the new node or -1 if out of memory */
+static int js_heap_snapshot_add_node(JSHeapSnapshot *s, void *ptr,
+                                     JSHeapNodeTypeEnum type, uint32_t name,
+                                     size_t self_size)
+{
+    JSRuntime *rt = s->rt;
+    JSHeapNode *n;
+    int i, *new_hash, new_hash_size;
+    uint32_t h;
+
+    if (js_profiler_resize(rt, (void **)&s->nodes, sizeof(s->nodes[0]),
+                           &s->node_size, s->node_count + 1))
+        goto fail;
+    /* open addressing, at most half full */
+    if (2 * (s->node_count + 1) > s->node_hash_size) {
+        new_hash_size = max_int(s->node_hash_size * 2, 1024);
+        new_hash = js_mallocz_rt(rt, sizeof(new_hash[0]) * new_hash_size);
+        if (!new_hash)
+            goto fail;
+        for(i = 0; i < s->node_count; i++) {
+            if (!s->nodes[i].ptr)
+                continue;
+            h = js_heap_snapshot_ptr_hash(s->nodes[i].ptr, new_hash_size);
+            while (new_hash[h] != 0)
+                h = (h + 1) & (new_hash_size - 1);
+            new_hash[h] = i + 1;
+        }
+        js_free_rt(rt, s->node_hash);
+        s->node_hash = new_hash;
+        s->node_hash_size = new_hash_size;
+    }
+    i = s->node_count++;
+    n = &s->nodes[i];
+    memset(n, 0, sizeof(*n));
+    n->ptr = ptr;
+    n->type = type;
+    n->name = name;
+    n->self_size = min_int64(self_size, UINT32_MAX);
+    if (ptr) {
+        h = js_heap_snapshot_ptr_hash(ptr, s->node_hash_size);
+        while (s->node_hash[h] != 0)
+            h = (h + 1) & (s->node_hash_size - 1);
+        s->node_hash[h] = i + 1;
+    }
+    return i;
+ fail:
+    s->error = true;
+    return -1;
+}
+
+static void js_heap_snapshot_add_edge(JSHeapSnapshot *s,
+                                      JSHeapEdgeTypeEnum type,
+                                      uint32_t name_or_index, int to)
+{
+    JSHeapEdge *e;
+
+    if (js_profiler_resize(s->rt, (void **)&s->edges, sizeof(s->edges[0]),
+                           &s->edge_size, s->edge_count + 1)) {
+        s->error = true;
+        return;
+    }
+    e = &s->edges[s->edge_count++];
+    e->type = type;
+    e->name_or_index = name_or_index;
+    e->to = to;
+    s->nodes[s->cur].edge_count++;
+    s->nodes[to].stamp = s->cur + 1;
+}
+
+static void js_heap_snapshot_value_edge(JSHeapSnapshot *s,
+                                        JSHeapEdgeTypeEnum type,
+                                        uint32_t name_or_index,
+                                        JSValueConst val)
+{
+    JSString *p;
+    JSHeapNodeTypeEnum str_type;
+    size_t size;
+    int to;
+
+    switch(JS_VALUE_GET_TAG(val)) {
+    case JS_TAG_OBJECT:
+    case JS_TAG_FUNCTION_BYTECODE:
+        to = js_heap_snapshot_find(s, JS_VALUE_GET_PTR(val));
+        /* each reference is also reported by mark_children() */
+        if (to >= 0 && s->nodes[to].stamp != s->cur + 1)
+            js_heap_snapshot_add_edge(s, type, name_or_index, to);
+        break;
+    case JS_TAG_STRING:
+        p = JS_VALUE_GET_STRING(val);
+        to = js_heap_snapshot_find(s, p);
+        if (to < 0) {
+            switch(p->kind) {
+            case JS_STRING_KIND_SLICE:
+                str_type = JS_HEAP_NODE_SLICED_STRING;
+                size = sizeof(JSString) + sizeof(JSStringSlice);
+                break;
+            case JS_STRING_KIND_ROPE:
+                str_type = JS_HEAP_NODE_CONCATENATED_STRING;
+                size = sizeof(JSString) + sizeof(JSStringRope);
+                break;
+            default:
+                str_type = JS_HEAP_NODE_STRING;
+                size = sizeof(JSString) + (p->len << p->is_wide_char) + 1 -
+                    p->is_wide_char;
+                break;
+            }
+            to = js_heap_snapshot_add_node(s, p, str_type,
+                                           js_heap_snapshot_jsstr(s, p), size);
+            if (to < 0)
+                return;
+        }
+        js_heap_snapshot_add_edge(s, type, name_or_index, to);
+        break;
+    default:
+        break;
+    }
+}
+
+/* JS_MarkFunc: every call is a reference from the current node */
+static void js_heap_snapshot_mark(JSRuntime *rt, JSGCObjectHeader *gp)
+{
+    JSHeapSnapshot *s = rt->heap_snapshot;
+    uint32_t name;
+    int to;
+
+    to = js_heap_snapshot_find(s, gp);
+    if (to < 0)
+        return;
+    s->nodes[to].gc_ref_count++;
+    if (s->nodes[to].stamp == s->cur + 1)
+        return;
+    switch(gp->gc_obj_type) {
+    case JS_GC_OBJ_TYPE_SHAPE:
+        name = s->name_map;
+        break;
+    case JS_GC_OBJ_TYPE_FUNCTION_BYTECODE:
+        name = s->name_code;
+        break;
+    case JS_GC_OBJ_TYPE_VAR_REF:
+        name = s->name_context;
+        break;
+    case JS_GC_OBJ_TYPE_JS_CONTEXT:
+        name = s->name_realm;
+        break;
+    default:
+        name = s->name_internal;
+        break;
+    }
+    js_heap_snapshot_add_edge(s, JS_HEAP_EDGE_INTERNAL, name, to);
+}
+
+/* the 'name' property of a function if it is a string. Like
+   get_func_name(), no JS code is executed. */
+static JSString *js_heap_snapshot_func_name(JSObject *p)
+{
+    JSProperty *pr;
+    JSShapeProperty *prs;
+
+    prs = find_own_property(&pr, p, JS_ATOM_name);
+    if (!prs || (prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL ||
+        JS_VALUE_GET_TAG(pr->u.value) != JS_TAG_STRING)
+        return NULL;
+    return JS_VALUE_GET_STRING(pr->u.value);
+}
+
+/* name of a function object */
+static uint32_t js_heap_snapshot_closure_name(JSHeapSnapshot *s, JSObject *p)
+{
+    JSString *str;
+
+    if (js_class_has_bytecode(p->class_id) &&
+        p->u.func.function_bytecode->func_name != JS_ATOM_NULL)
+        return js_heap_snapshot_atom(s, p->u.func.function_bytecode->func_name);
+    str = js_heap_snapshot_func_name(p);
+    if (str && str->len > 0)
+        return js_heap_snapshot_jsstr(s, str);
+    return js_heap_snapshot_cstr(s, "(anonymous)");
+}
+
+/* plain objects are named after the constructor of their prototype, so
+   that the instances of a class are grouped together */
+static uint32_t js_heap_snapshot_object_name(JSHeapSnapshot *s, JSObject *p)
+{
+    JSProperty *pr;
+    JSShapeProperty *prs;
+    JSObject *ctor;
+    JSString *str;
+
+    if (p->class_id == JS_CLASS_OBJECT && p->shape->proto) {
+        prs = find_own_property(&pr, p->shape->proto, JS_ATOM_constructor);
+        if (prs && (prs->flags & JS_PROP_TMASK) == JS_PROP_NORMAL &&
+            JS_VALUE_GET_TAG(pr->u.value) == JS_TAG_OBJECT) {
+            ctor = JS_VALUE_GET_OBJ(pr->u.value);
+            if (js_class_has_bytecode(ctor->class_id) &&
+                ctor->u.func.function_bytecode->func_name != JS_ATOM_NULL)
+                return js_heap_snapshot_atom(s, ctor->u.func.function_bytecode->func_name);
+            str = js_heap_snapshot_func_name(ctor);
+            if (str && str->len > 0)
+                return js_heap_snapshot_jsstr(s, str);
+        }
+    }
+    return js_heap_snapshot_atom(s, s->rt->class_array[p->class_id].class_name);
+}
+
+static void js_heap_snapshot_add_gc_object(JSHeapSnapshot *s,
+                                           JSGCObjectHeader *gp)
+{
+    JSRuntime *rt = s->rt;
+    JSHeapNodeTypeEnum type;
+    uint32_t name;
+    size_t size;
+
+    switch(gp->gc_obj_type) {
+    case JS_GC_OBJ_TYPE_JS_OBJECT:
+        {
+            JSObject *p = (JSObject *)gp;
+            size = sizeof(*p) + p->shape->prop_size * sizeof(*p->prop);
+            switch(p->class_id) {
+            case JS_CLASS_ARRAY:
+            case JS_CLASS_ARGUMENTS:
+                if (p->fast_array)
+                    size += p->u.array.u1.size *
+                        js_array_kind_size[p->u.array.kind];
+                type = JS_HEAP_NODE_OBJECT;
+                name = js_heap_snapshot_object_name(s, p);
+                break;
+            case JS_CLASS_REGEXP:
+                type = JS_HEAP_NODE_REGEXP;
+                name = js_heap_snapshot_jsstr(s, p->u.regexp.pattern);
+                break;
+            case JS_CLASS_ARRAY_BUFFER:
+            case JS_CLASS_SHARED_ARRAY_BUFFER:
+                size += p->u.array_buffer->byte_length;
+                type = JS_HEAP_NODE_OBJECT;
+                name = js_heap_snapshot_object_name(s, p);
+                break;
+            default:
+                if (js_class_has_bytecode(p->class_id) ||
+                    rt->class_array[p->class_id].call != NULL) {
+                    type = JS_HEAP_NODE_CLOSURE;
+                    name = js_heap_snapshot_closure_name(s, p);
+                } else {
+                    type = JS_HEAP_NODE_OBJECT;
+                    name = js_heap_snapshot_object_name(s, p);
+                }
+                break;
+            }
+        }
+        break;
+    case JS_GC_OBJ_TYPE_FUNCTION_BYTECODE:
+        {
+            JSFunctionBytecode *b = (JSFunctionBytecode *)gp;
+            size = sizeof(*b) + b->byte_code_len +
+                b->cpool_count * sizeof(*b->cpool) +
+                (b->arg_count + b->var_count) * sizeof(*b->vardefs) +
+                b->closure_var_count * sizeof(*b->closure_var) +
+                b->pc2line_len + b->source_len;
+            type = JS_HEAP_NODE_CODE;
+            if (b->func_name != JS_ATOM_NULL)
+                name = js_heap_snapshot_atom(s, b->func_name);
+            else
+                name = js_heap_snapshot_cstr(s, "(anonymous)");
+        }
+        break;
+    case JS_GC_OBJ_TYPE_SHAPE:
+        {
+            JSShape *sh = (JSShape *)gp;
+            size = get_shape_size(sh->prop_hash_mask + 1, sh->prop_size);
+            type = JS_HEAP_NODE_OBJECT_SHAPE;
+            name = js_heap_snapshot_cstr(s, "(shape)");
+        }
+        break;
+    case JS_GC_OBJ_TYPE_VAR_REF:
+        size = sizeof(JSVarRef);
+        type = JS_HEAP_NODE_HIDDEN;
+        name = js_heap_snapshot_cstr(s, "(closure variable)");
+        break;
+    case JS_GC_OBJ_TYPE_ASYNC_FUNCTION:
+        size = sizeof(JSAsyncFunctionData);
+        type = JS_HEAP_NODE_HIDDEN;
+        name = js_heap_snapshot_cstr(s, "(async function)");
+        break;
+    case JS_GC_OBJ_TYPE_JS_CONTEXT:
+        size = sizeof(JSContext) + sizeof(JSValue) * rt->class_count;
+        type = JS_HEAP_NODE_SYNTHETIC;
+        name = js_heap_snapshot_cstr(s, "(context)");
+        break;
+    default:
+        abort();
+    }
+    js_heap_snapshot_add_node(s, gp, type, name, size);
+}
+
+/* add the edges of the GC object of node 's->cur' */
+static void js_heap_snapshot_add_edges(JSHeapSnapshot *s, JSGCObjectHeader *gp)
+{
+    JSRuntime *rt = s->rt;
+    JSHeapNode *n = &s->nodes[s->cur];
+    uint32_t i;
+
+    n->first_edge = s->edge_count;
+    /* the named references first: mark_children() reports them again
+       but they are not duplicated */
+    if (gp->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT) {
+        JSObject *p = (JSObject *)gp;
+        JSShape *sh = p->shape;
+        JSShapeProperty *prs;
+        JSProperty *pr;
+        JSHeapEdgeTypeEnum type;
+        uint32_t name;
+
+        for(i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++) {
+            pr = &p->prop[i];
+            if (prs->atom == JS_ATOM_NULL)
+                continue;
+            if (__JS_AtomIsTaggedInt(prs->atom)) {
+                type = JS_HEAP_EDGE_ELEMENT;
+                name = __JS_AtomToUInt32(prs->atom);
+            } else {
+                type = JS_HEAP_EDGE_PROPERTY;
+                name = js_heap_snapshot_atom(s, prs->atom);
+            }
+            switch(prs->flags & JS_PROP_TMASK) {
+            case JS_PROP_NORMAL:
+                js_heap_snapshot_value_edge(s, type, name, pr->u.value);
+                break;
+            case JS_PROP_GETSET:
+                if (pr->u.getset.getter)
+                    js_heap_snapshot_value_edge(s, type, name,
+                        JS_MKPTR(JS_TAG_OBJECT, pr->u.getset.getter));
+                if (pr->u.getset.setter)
+                    js_heap_snapshot_value_edge(s, type, name,
+                        JS_MKPTR(JS_TAG_OBJECT, pr->u.getset.setter));
+                break;
+            case JS_PROP_VARREF:
+                if (pr->u.var_ref->is_detached)
+                    js_heap_snapshot_value_edge(s, type, name, *pr->u.var_ref->pvalue);
+                break;
+            default:
+                break;
+            }
+        }
+        if ((p->class_id == JS_CLASS_ARRAY ||
+             p->class_id == JS_CLASS_ARGUMENTS) && p->fast_array &&
+            p->u.array.kind == JS_ARRAY_KIND_VALUE) {
+            for(i = 0; i < p->u.array.count; i++) {
+                js_heap_snapshot_value_edge(s, JS_HEAP_EDGE_ELEMENT, i,
+                                            p->u.array.u.values[i]);
+            }
+        }
+        if (js_class_has_bytecode(p->class_id) && p->u.func.var_refs) {
+            JSFunctionBytecode *b = p->u.func.function_bytecode;
+            JSVarRef *var_ref;
+            int to;
+            for(i = 0; i < b->closure_var_count; i++) {
+                var_ref = p->u.func.var_refs[i];
+                if (!var_ref || !var_ref->is_detached)
+                    continue;
+                to = js_heap_snapshot_find(s, var_ref);
+                if (to >= 0 && s->nodes[to].stamp != s->cur + 1) {
+                    js_heap_snapshot_add_edge(s, JS_HEAP_EDGE_CONTEXT,
+                        js_heap_snapshot_atom(s, b->closure_var[i].var_name), to);
+                }
+            }
+        }
+        if (sh->proto) {
+            js_heap_snapshot_value_edge(s, JS_HEAP_EDGE_PROPERTY, s->name_proto,
+                                        JS_MKPTR(JS_TAG_OBJECT, sh->proto));
+        }
+    } else if (gp->gc_obj_type == JS_GC_OBJ_TYPE_VAR_REF) {
+        js_heap_snapshot_value_edge(s, JS_HEAP_EDGE_INTERNAL, s->name_value,
+                                    *((JSVarRef *)gp)->pvalue);
+    }
+    mark_children(rt, gp, js_heap_snapshot_mark);
+}
+
+static void js_heap_snapshot_free(JSHeapSnapshot *s)
+{
+    JSRuntime *rt = s->rt;
+
+    js_free_rt(rt, s->nodes);
+    js_free_rt(rt, s->edges);
+    js_free_rt(rt, s->node_hash);
+    js_free_rt(rt, s->strings);
+    js_free_rt(rt, s->string_hash);
+    dbuf_free(&s->string_buf);
+}
+
+static void js_heap_snapshot_write(JSHeapSnapshot *s, DynBuf *b)
+{
+    JSHeapNode *n;
+    JSHeapEdge *e;
+    int i, j;
+    const char *sep;
+
+    dbuf_printf(b, "{\"snapshot\":{\"meta\":{"
+                "\"node_fields\":[\"type\",\"name\",\"id\",\"self_size\","
+                "\"edge_count\",\"trace_node_id\"],"
+                "\"node_types\":[[\"hidden\",\"array\",\"string\",\"object\","
+                "\"code\",\"closure\",\"regexp\",\"number\",\"native\","
+                "\"synthetic\",\"concatenated string\",\"sliced string\","
+                "\"symbol\",\"bigint\",\"object shape\"],\"string\",\"number\","
+                "\"number\",\"number\",\"number\"],"
+                "\"edge_fields\":[\"type\",\"name_or_index\",\"to_node\"],"
+                "\"edge_types\":[[\"context\",\"element\",\"property\","
+                "\"internal\",\"hidden\",\"shortcut\",\"weak\"],"
+                "\"string_or_number\",\"node\"],"
+                "\"trace_function_info_fields\":[\"function_id\",\"name\","
+                "\"script_name\",\"script_id\",\"line\",\"column\"],"
+                "\"trace_node_fields\":[\"id\",\"function_info_index\","
+                "\"count\",\"size\",\"children\"],"
+                "\"sample_fields\":[\"timestamp_us\",\"last_assigned_id\"],"
+                "\"location_fields\":[\"object_index\",\"script_id\","
+                "\"line\",\"column\"]},"
+                "\"node_count\":%d,\"edge_count\":%d,"
+                "\"trace_function_count\":0},\n\"nodes\":[",
+                s->node_count, s->edge_count);
+    for(i = 0; i < s->node_count; i++) {
+        n = &s->nodes[i];
+        /* odd ids like V8 */
+        dbuf_printf(b, "%s%d,%u,%d,%u,%d,0", i ? ",\n" : "", n->type,
+                    n->name, 2 * i + 1, n->self_size, n->edge_count);
+    }
+    dbuf_putstr(b, "],\n\"edges\":[");
+    sep = "";
+    for(i = 0; i < s->node_count; i++) {
+        n = &s->nodes[i];
+        for(j = 0; j < n->edge_count; j++) {
+            e = &s->edges[n->first_edge + j];
+            /* to_node is the index of the first field of the node */
+            dbuf_printf(b, "%s%d,%u,%d", sep, e->type, e->name_or_index,
+                        e->to * 6);
+            sep = ",\n";
+        }
+    }
+    dbuf_putstr(b, "],\n\"trace_function_infos\":[],\"trace_tree\":[],"
+                "\"samples\":[],\"locations\":[],\n\"strings\":[");
+    for(i = 0; i < s->string_count; i++) {
+        dbuf_putstr(b, i ? ",\n\"" : "\"");
+        dbuf_put(b, s->string_buf.buf + s->strings[i].offset,
+                 s->strings[i].len);
+        dbuf_putc(b, '"');
+    }
+    dbuf_putstr(b, "]}\n");
+}
+
+JSValue JS_TakeHeapSnapshot(JSContext *ctx)
+{
+    JSRuntime *rt = ctx->rt;
+    JSHeapSnapshot s_s, *s = &s_s;
+    struct list_head *el;
+    JSGCObjectHeader *gp;
+    DynBuf out;
+    JSValue ret;
+    int i, gc_count, root_count;
+
+    memset(s, 0, sizeof(*s));
+    s->rt = rt;
+    dbuf_init2(&s->string_buf, rt, js_heap_snapshot_dbuf_realloc);
+    s->string_hash_size = 256;
+    s->string_hash = js_mallocz_rt(rt, sizeof(s->string_hash[0]) *
+                                   s->string_hash_size);
+    if (!s->string_hash)
+        goto oom;
+    s->name_empty = js_heap_snapshot_cstr(s, "");
+    s->name_map = js_heap_snapshot_cstr(s, "map");
+    s->name_code = js_heap_snapshot_cstr(s, "code");
+    s->name_context = js_heap_snapshot_cstr(s, "context");
+    s->name_realm = js_heap_snapshot_cstr(s, "realm");
+    s->name_internal = js_heap_snapshot_cstr(s, "internal");
+    s->name_value = js_heap_snapshot_cstr(s, "value");
+    s->name_proto = js_heap_snapshot_cstr(s, "__proto__");
+
+    /* no JS code runs and no GC object is allocated until the end of
+       the walk, so that gc_obj_list does not change */
+    js_heap_snapshot_add_node(s, NULL, JS_HEAP_NODE_SYNTHETIC,
+                              js_heap_snapshot_cstr(s, "(GC roots)"), 0);
+    list_for_each(el, &rt->gc_obj_list) {
+        gp = list_entry(el, JSGCObjectHeader, link);
+        js_heap_snapshot_add_gc_object(s, gp);
+        if (s->error)
+            goto oom;
+    }
+    /* the string nodes are added after the GC objects */
+    gc_count = s->node_count;
+    rt->heap_snapshot = s;
+    for(i = 1; i < gc_count && !s->error; i++) {
+        s->cur = i;
+        js_heap_snapshot_add_edges(s, s->nodes[i].ptr);
+    }
+    rt->heap_snapshot = NULL;
+    s->cur = 0;
+    s->nodes[0].first_edge = s->edge_count;
+    root_count = 0;
+    for(i = 1; i < gc_count && !s->error; i++) {
+        gp = s->nodes[i].ptr;
+        if (gp->ref_count > s->nodes[i].gc_ref_count)
+            js_heap_snapshot_add_edge(s, JS_HEAP_EDGE_ELEMENT, root_count++, i);
+    }
+    if (s->error || s->string_buf.error)
+        goto oom;
+
+    dbuf_init2(&out, rt, js_heap_snapshot_dbuf_realloc);
+    js_heap_snapshot_write(s, &out);
+    js_heap_snapshot_free(s);
+    if (out.error) {
+        dbuf_free(&out);
+        return JS_ThrowOutOfMemory(ctx);
+    }
+    ret = JS_NewStringLen(ctx, (const char *)out.buf, out.size);
+    dbuf_free(&out);
+    return ret;
+ oom:
+    rt->heap_snapshot = NULL;
+    js_heap_snapshot_free(s);
+    return JS_ThrowOutOfMemory(ctx);
+}
+
 static void JS_ThrowInterrupted(JSContext *ctx)
 {
     JS_ThrowInternalError(ctx, "interrupted");
@@ -7435,6 +10238,10 @@ static no_inline __exception int __js_poll_interrupts(JSContext *ctx)
 {
     JSRuntime *rt = ctx->rt;
     ctx->interrupt_counter = JS_INTERRUPT_COUNTER_INIT;
+    if (rt->profiler) {
+        ctx->interrupt_counter = JS_PROFILE_COUNTER_INIT;
+        js_profiler_poll(ctx, rt->profiler);
+    }
     if (rt->interrupt_handler) {
         if (rt->interrupt_handler(rt, rt->interrupt_opaque)) {
             JS_ThrowInterrupted(ctx);
@@ -7453,6 +10260,20 @@ static inline __exception int js_poll_interrupts(JSContext *ctx)
     }
 }
 
+/* same as js_poll_interrupts() in a bytecode function: 'pc' is recorded
+   for the backtrace and the profiler */
+static inline __exception int js_poll_interrupts_pc(JSContext *ctx,
+                                                    JSStackFrame *sf,
+                                                    const uint8_t *pc)
+{
+    if (unlikely(--ctx->interrupt_counter <= 0)) {
+        sf->cur_pc = (uint8_t *)pc;
+        return __js_poll_interrupts(ctx);
+    } else {
+        return 0;
+    }
+}
+
 /* return -1 (exception) or true/false */
 static int JS_SetPrototypeInternal(JSContext *ctx, JSValueConst obj,
                                    JSValueConst proto_val, bool throw_flag)
@@ -7810,6 +10631,8 @@ static JSValue JS_GetPropertyInternal(JSContext *ctx, JSValueConst obj,
                     uint32_t idx, ch;
                     idx = __JS_AtomToUInt32(prop);
                     if (idx < p1->len) {
+                        if (js_string_flatten(ctx, p1))
+                            return JS_EXCEPTION;
                         ch = string_get(p1, idx);
                         return js_new_string_char(ctx, ch);
                     }
@@ -8580,7 +11403,7 @@ static bool js_get_fast_array_element(JSContext *ctx, JSObject *p,
     case JS_CLASS_ARRAY:
     case JS_CLASS_ARGUMENTS:
         if (unlikely(idx >= p->u.array.count)) return false;
-        *pval = js_dup(p->u.array.u.values[idx]);
+        *pval = js_array_get(p, idx);
         return true;
     case JS_CLASS_INT8_ARRAY:
         if (unlikely(idx >= p->u.array.count)) return false;
@@ -8801,7 +11624,6 @@ static no_inline __exception int convert_fast_array_to_array(JSContext *ctx,
 {
     JSProperty *pr;
     JSShape *sh;
-    JSValue *tab;
     uint32_t i, len, new_count;
 
     if (js_shape_prepare_update(ctx, p, NULL))
@@ -8815,17 +11637,17 @@ static no_inline __exception int convert_fast_array_to_array(JSContext *ctx,
             return -1;
     }
 
-    tab = p->u.array.u.values;
     for(i = 0; i < len; i++) {
         /* add_property cannot fail here but
            __JS_AtomFromUInt32(i) fails for i > INT32_MAX */
         pr = add_property(ctx, p, __JS_AtomFromUInt32(i), JS_PROP_C_W_E);
-        pr->u.value = *tab++;
+        pr->u.value = js_array_take(p, i);
     }
     js_free(ctx, p->u.array.u.values);
     p->u.array.count = 0;
     p->u.array.u.values = NULL; /* fail safe */
     p->u.array.u1.size = 0;
+    p->u.array.kind = JS_ARRAY_KIND_VALUE;
     p->fast_array = 0;
     return 0;
 }
@@ -8894,7 +11716,7 @@ static int delete_property(JSContext *ctx, JSObject *p, JSAtom atom)
                     p->class_id == JS_CLASS_ARGUMENTS) {
                     /* Special case deleting the last element of a fast Array */
                     if (idx == p->u.array.count - 1) {
-                        JS_FreeValue(ctx, p->u.array.u.values[idx]);
+                        JS_FreeValue(ctx, js_array_take(p, idx));
                         p->u.array.count = idx;
                         return true;
                     }
@@ -8959,8 +11781,10 @@ static int set_array_length(JSContext *ctx, JSObject *p, JSValue val,
     if (likely(p->fast_array)) {
         uint32_t old_len = p->u.array.count;
         if (len < old_len) {
-            for(i = len; i < old_len; i++) {
-                JS_FreeValue(ctx, p->u.array.u.values[i]);
+            if (p->u.array.kind == JS_ARRAY_KIND_VALUE) {
+                for(i = len; i < old_len; i++) {
+                    JS_FreeValue(ctx, p->u.array.u.values[i]);
+                }
             }
             p->u.array.count = len;
         }
@@ -9036,15 +11860,16 @@ static int set_array_length(JSContext *ctx, JSObject *p, JSValue val,
 static int expand_fast_array(JSContext *ctx, JSObject *p, uint32_t new_len)
 {
     uint32_t new_size;
-    size_t slack;
-    JSValue *new_array_prop;
+    size_t slack, elt_size;
+    void *new_array_prop;
     /* XXX: potential arithmetic overflow */
     new_size = max_int(new_len, p->u.array.u1.size * 3 / 2);
-    new_array_prop = js_realloc2(ctx, p->u.array.u.values, sizeof(JSValue) * new_size, &slack);
+    elt_size = js_array_kind_size[p->u.array.kind];
+    new_array_prop = js_realloc2(ctx, p->u.array.u.ptr, elt_size * new_size, &slack);
     if (!new_array_prop)
         return -1;
-    new_size += slack / sizeof(*new_array_prop);
-    p->u.array.u.values = new_array_prop;
+    new_size += slack / elt_size;
+    p->u.array.u.ptr = new_array_prop;
     p->u.array.u1.size = new_size;
     return 0;
 }
@@ -9055,6 +11880,7 @@ static int add_fast_array_element(JSContext *ctx, JSObject *p,
                                   JSValue val, int flags)
 {
     uint32_t new_len, array_len;
+    JSArrayKindEnum kind;
     /* extend the array by one */
     /* XXX: convert to slow array if new_len > 2^31-1 elements */
     new_len = p->u.array.count + 1;
@@ -9070,13 +11896,24 @@ static int add_fast_array_element(JSContext *ctx, JSObject *p,
             p->prop[0].u.value = js_int32(new_len);
         }
     }
+    /* an empty array takes the kind of its first element */
+    kind = js_array_value_kind(val);
+    if (new_len > 1)
+        kind = max_int(kind, p->u.array.kind);
+    if (unlikely(kind != p->u.array.kind)) {
+        if (js_array_set_kind(ctx->rt, p, kind)) {
+            JS_FreeValue(ctx, val);
+            JS_ThrowOutOfMemory(ctx);
+            return -1;
+        }
+    }
     if (unlikely(new_len > p->u.array.u1.size)) {
         if (expand_fast_array(ctx, p, new_len)) {
             JS_FreeValue(ctx, val);
             return -1;
         }
     }
-    p->u.array.u.values[new_len - 1] = val;
+    js_array_store(p, new_len - 1, val);
     p->u.array.count = new_len;
     return true;
 }
@@ -9394,7 +12231,8 @@ static int JS_SetPropertyValue(JSContext *ctx, JSValueConst this_obj,
                 /* add element */
                 return add_fast_array_element(ctx, p, val, flags);
             }
-            set_value(ctx, &p->u.array.u.values[idx], val);
+            if (unlikely(js_array_set(ctx, p, idx, val)))
+                return -1;
             break;
         case JS_CLASS_ARGUMENTS:
             if (unlikely(idx >= (uint32_t)p->u.array.count))
@@ -9721,6 +12559,8 @@ static int js_shape_prepare_update(JSContext *ctx, JSObject *p,
             sh->is_hashed = false;
         }
     }
+    /* the caller modifies the shape in place */
+    js_shape_set_id(ctx->rt, sh);
     return 0;
 }
 
@@ -9955,7 +12795,8 @@ int JS_DefineProperty(JSContext *ctx, JSValueConst this_obj,
                             goto redo_prop_update;
                     }
                     if (flags & JS_PROP_HAS_VALUE) {
-                        set_value(ctx, &p->u.array.u.values[idx], js_dup(val));
+                        if (js_array_set(ctx, p, idx, js_dup(val)))
+                            return -1;
                     }
                     return true;
                 }
@@ -13086,6 +15927,9 @@ static JSValue JS_ToStringInternal(JSContext *ctx, JSValueConst val,
     tag = JS_VALUE_GET_NORM_TAG(val);
     switch(tag) {
     case JS_TAG_STRING:
+        /* callers access the contents of the result */
+        if (js_string_flatten(ctx, JS_VALUE_GET_STRING(val)))
+            return JS_EXCEPTION;
         return js_dup(val);
     case JS_TAG_INT:
         len = i32toa(buf, JS_VALUE_GET_INT(val));
@@ -13172,26 +16016,31 @@ static JSValue JS_ToStringCheckObject(JSContext *ctx, JSValueConst val)
     return JS_ToString(ctx, val);
 }
 
-static JSValue JS_ToQuotedString(JSContext *ctx, JSValueConst val1)
+/* append the JSON quoted form of the flat string 'p' */
+static int string_buffer_quote(StringBuffer *b, JSString *p)
 {
-    JSValue val;
-    JSString *p;
-    int i;
+    int i, j;
     uint32_t c;
-    StringBuffer b_s, *b = &b_s;
     char buf[16];
 
-    val = JS_ToStringCheckObject(ctx, val1);
-    if (JS_IsException(val))
-        return val;
-    p = JS_VALUE_GET_STRING(val);
-
-    if (string_buffer_init(ctx, b, p->len + 2))
-        goto fail;
-
     if (string_buffer_putc8(b, '\"'))
-        goto fail;
+        return -1;
     for(i = 0; i < p->len; ) {
+        if (!p->is_wide_char) {
+            /* copy the characters which need no escape at once */
+            for(j = i; j < p->len; j++) {
+                c = str8(p)[j];
+                if (c < 32 || c == '\"' || c == '\\')
+                    break;
+            }
+            if (j > i) {
+                if (string_buffer_write8(b, str8(p) + i, j - i))
+                    return -1;
+                i = j;
+                if (i >= p->len)
+                    break;
+            }
+        }
         c = string_getc(p, &i);
         switch(c) {
         case '\t':
@@ -13213,23 +16062,39 @@ static JSValue JS_ToQuotedString(JSContext *ctx, JSValueConst val1)
         case '\\':
         quote:
             if (string_buffer_putc8(b, '\\'))
-                goto fail;
+                return -1;
             if (string_buffer_putc8(b, c))
-                goto fail;
+                return -1;
             break;
         default:
             if (c < 32 || is_surrogate(c)) {
                 snprintf(buf, sizeof(buf), "\\u%04x", c);
                 if (string_buffer_write8(b, (uint8_t*)buf, 6))
-                    goto fail;
+                    return -1;
             } else {
                 if (string_buffer_putc(b, c))
-                    goto fail;
+                    return -1;
             }
             break;
         }
     }
-    if (string_buffer_putc8(b, '\"'))
+    return string_buffer_putc8(b, '\"');
+}
+
+static JSValue JS_ToQuotedString(JSContext *ctx, JSValueConst val1)
+{
+    JSValue val;
+    JSString *p;
+    StringBuffer b_s, *b = &b_s;
+
+    val = JS_ToStringCheckObject(ctx, val1);
+    if (JS_IsException(val))
+        return val;
+    p = JS_VALUE_GET_STRING(val);
+
+    if (string_buffer_init(ctx, b, p->len + 2))
+        goto fail;
+    if (string_buffer_quote(b, p))
         goto fail;
     JS_FreeValue(ctx, val);
     return string_buffer_end(b);
@@ -13278,7 +16143,11 @@ static __maybe_unused void JS_DumpObject(JSRuntime *rt, JSObject *p)
             switch (p->class_id) {
             case JS_CLASS_ARRAY:
             case JS_CLASS_ARGUMENTS:
-                JS_DumpValue(rt, p->u.array.u.values[i]);
+                {
+                    JSValue v = js_array_get(p, i);
+                    JS_DumpValue(rt, v);
+                    JS_FreeValueRT(rt, v);
+                }
                 break;
             case JS_CLASS_UINT8C_ARRAY:
             case JS_CLASS_INT8_ARRAY:
@@ -14440,6 +17309,11 @@ static no_inline int js_relational_slow(JSContext *ctx, JSValue *sp,
         JSString *p1, *p2;
         p1 = JS_VALUE_GET_STRING(op1);
         p2 = JS_VALUE_GET_STRING(op2);
+        if (js_string_flatten(ctx, p1) || js_string_flatten(ctx, p2)) {
+            JS_FreeValue(ctx, op1);
+            JS_FreeValue(ctx, op2);
+            goto exception;
+        }
         res = js_string_compare(p1, p2);
         switch(op) {
         case OP_lt:
@@ -14739,7 +17613,7 @@ static bool js_strict_eq2(JSContext *ctx, JSValue op1, JSValue op2,
             } else {
                 p1 = JS_VALUE_GET_STRING(op1);
                 p2 = JS_VALUE_GET_STRING(op2);
-                res = js_string_eq(p1, p2);
+                res = js_string_eq_rt(ctx->rt, p1, p2);
             }
         }
         break;
@@ -15669,16 +18543,18 @@ static bool js_is_fast_array(JSContext *ctx, JSValue obj)
     return false;
 }
 
-/* Access an Array's internal JSValue array if available */
-static bool js_get_fast_array(JSContext *ctx, JSValue obj,
-                              JSValue **arrpp, uint32_t *countp)
+/* Access an Array's internal element storage if available. The
+   elements are read with js_array_get() or, depending on
+   p->u.array.kind, directly. */
+static bool js_get_fast_array(JSContext *ctx, JSValueConst obj,
+                              JSObject **pp, uint32_t *countp)
 {
     /* Try and handle fast arrays explicitly */
     if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT) {
         JSObject *p = JS_VALUE_GET_OBJ(obj);
         if (p->class_id == JS_CLASS_ARRAY && p->fast_array) {
             *countp = p->u.array.count;
-            *arrpp = p->u.array.u.values;
+            *pp = p;
             return true;
         }
     }
@@ -15689,7 +18565,7 @@ static __exception int js_append_enumerate(JSContext *ctx, JSValue *sp)
 {
     JSValue iterator, enumobj, method, value;
     int is_array_iterator;
-    JSValue *arrp;
+    JSObject *arrp;
     uint32_t i, count32, pos;
 
     if (JS_VALUE_GET_TAG(sp[-2]) != JS_TAG_INT) {
@@ -15738,7 +18614,8 @@ static __exception int js_append_enumerate(JSContext *ctx, JSValue *sp)
         /* Handle fast arrays explicitly */
         for (i = 0; i < count32; i++) {
             if (JS_DefinePropertyValueUint32(ctx, sp[-3], pos++,
-                                             js_dup(arrp[i]), JS_PROP_C_W_E) < 0)
+                                             js_array_get(arrp, i),
+                                             JS_PROP_C_W_E) < 0)
                 goto exception;
         }
     } else {
@@ -16332,6 +19209,196 @@ static bool needs_backtrace(JSValue exc)
     return !find_own_property1(p, JS_ATOM_stack);
 }
 
+/* Inline caches */
+
+static JSInlineCache *js_ic_new(JSRuntime *rt, JSFunctionBytecode *b);
+
+static void js_ic_flush_all(JSRuntime *rt)
+{
+    struct list_head *el;
+    JSGCObjectHeader *gp;
+    JSFunctionBytecode *b;
+
+    list_for_each(el, &rt->gc_obj_list) {
+        gp = list_entry(el, JSGCObjectHeader, link);
+        if (gp->gc_obj_type == JS_GC_OBJ_TYPE_FUNCTION_BYTECODE) {
+            b = (JSFunctionBytecode *)gp;
+            js_free_rt(rt, b->ic);
+            b->ic = NULL;
+            b->ic_misses = 0;
+        }
+    }
+}
+
+static inline uint32_t js_ic_hash(uint32_t pc, uint32_t mask)
+{
+    return ((pc * 0x9E3779B1) >> 8) & mask;
+}
+
+/* 'pc' is the offset of the opcode + 1. Every site of the function is
+   inserted when the table is allocated, so the loop terminates. */
+static inline JSInlineCacheSlot *js_ic_find_slot(JSInlineCache *ic,
+                                                 uint32_t pc)
+{
+    uint32_t h;
+
+    h = js_ic_hash(pc, ic->mask);
+    while (ic->slots[h].pc != pc)
+        h = (h + 1) & ic->mask;
+    return &ic->slots[h];
+}
+
+/* return the cached data property of 'p' or NULL if not found */
+static force_inline JSProperty *js_ic_lookup(JSInlineCache *ic, uint32_t pc,
+                                             JSObject *p)
+{
+    JSInlineCacheSlot *slot;
+    JSInlineCacheEntry *e;
+    JSObject *p1;
+    uint32_t shape_id;
+    int i;
+
+    slot = js_ic_find_slot(ic, pc);
+    shape_id = p->shape->id;
+    for(i = 0; i < JS_IC_WAYS; i++) {
+        e = &slot->e[i];
+        if (e->shape_id != shape_id)
+            continue;
+        if (likely(!e->proto_shape_id))
+            return &p->prop[e->prop_index];
+        /* the exotic behaviors are not reflected by the shape */
+        if (unlikely(p->is_exotic) &&
+            (!p->fast_array || is_typed_array(p->class_id)))
+            return NULL;
+        p1 = p->shape->proto;
+        if (p1->shape->id == e->proto_shape_id)
+            return &p1->prop[e->prop_index];
+    }
+    return NULL;
+}
+
+static void js_ic_add(JSInlineCache *ic, uint32_t pc, JSShape *sh,
+                      JSShape *proto_sh, JSShapeProperty *prs)
+{
+    JSInlineCacheSlot *slot;
+    JSInlineCacheEntry *e;
+
+    slot = js_ic_find_slot(ic, pc);
+    memmove(&slot->e[1], &slot->e[0], sizeof(slot->e[0]) * (JS_IC_WAYS - 1));
+    e = &slot->e[0];
+    e->shape_id = sh->id;
+    if (proto_sh) {
+        e->proto_shape_id = proto_sh->id;
+        e->prop_index = prs - get_shape_prop(proto_sh);
+    } else {
+        e->proto_shape_id = 0;
+        e->prop_index = prs - get_shape_prop(sh);
+    }
+}
+
+/* return true if the inline cache of 'b' can be filled */
+static bool js_ic_prepare(JSRuntime *rt, JSFunctionBytecode *b)
+{
+    if (likely(b->ic))
+        return true;
+    /* do not bother for code which is executed only a few times */
+    if (++b->ic_misses < JS_IC_WARMUP)
+        return false;
+    b->ic_misses = 0;
+    b->ic = js_ic_new(rt, b);
+    return b->ic != NULL;
+}
+
+static no_inline JSValue js_get_field_ic_miss(JSContext *ctx,
+                                              JSFunctionBytecode *b,
+                                              uint32_t pc, JSValueConst obj,
+                                              JSAtom atom)
+{
+    JSObject *p, *p1;
+    JSProperty *pr;
+    JSShapeProperty *prs;
+
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT ||
+        !js_ic_prepare(ctx->rt, b))
+        goto slow_path;
+    p = JS_VALUE_GET_OBJ(obj);
+    prs = find_own_property(&pr, p, atom);
+    if (prs) {
+        if (!(prs->flags & JS_PROP_TMASK)) {
+            js_ic_add(b->ic, pc, p->shape, NULL, prs);
+            return js_dup(pr->u.value);
+        }
+    } else if ((!p->is_exotic ||
+                (p->fast_array && !is_typed_array(p->class_id))) &&
+               !__JS_AtomIsTaggedInt(atom) && p->shape->proto) {
+        /* only the direct prototype is cached */
+        p1 = p->shape->proto;
+        prs = find_own_property(&pr, p1, atom);
+        if (prs && !(prs->flags & JS_PROP_TMASK)) {
+            js_ic_add(b->ic, pc, p->shape, p1->shape, prs);
+            return js_dup(pr->u.value);
+        }
+    }
+ slow_path:
+    return JS_GetPropertyInternal(ctx, obj, atom, obj, false);
+}
+
+static force_inline JSValue js_get_field_ic(JSContext *ctx,
+                                            JSFunctionBytecode *b,
+                                            uint32_t pc, JSValueConst obj,
+                                            JSAtom atom)
+{
+    JSProperty *pr;
+
+    if (likely(JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT && b->ic)) {
+        pr = js_ic_lookup(b->ic, pc, JS_VALUE_GET_OBJ(obj));
+        if (pr)
+            return js_dup(pr->u.value);
+    }
+    return js_get_field_ic_miss(ctx, b, pc, obj, atom);
+}
+
+/* only writable own data properties are cached */
+static no_inline int js_put_field_ic_miss(JSContext *ctx,
+                                          JSFunctionBytecode *b,
+                                          uint32_t pc, JSValueConst obj,
+                                          JSAtom atom, JSValue val)
+{
+    JSObject *p;
+    JSProperty *pr;
+    JSShapeProperty *prs;
+
+    if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT &&
+        js_ic_prepare(ctx->rt, b)) {
+        p = JS_VALUE_GET_OBJ(obj);
+        prs = find_own_property(&pr, p, atom);
+        if (prs && (prs->flags & (JS_PROP_TMASK | JS_PROP_WRITABLE |
+                                  JS_PROP_LENGTH)) == JS_PROP_WRITABLE) {
+            js_ic_add(b->ic, pc, p->shape, NULL, prs);
+            set_value(ctx, &pr->u.value, val);
+            return true;
+        }
+    }
+    return JS_SetPropertyInternal2(ctx, obj, atom, val, obj,
+                                   JS_PROP_THROW_STRICT);
+}
+
+static force_inline int js_put_field_ic(JSContext *ctx, JSFunctionBytecode *b,
+                                        uint32_t pc, JSValueConst obj,
+                                        JSAtom atom, JSValue val)
+{
+    JSProperty *pr;
+
+    if (likely(JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT && b->ic)) {
+        pr = js_ic_lookup(b->ic, pc, JS_VALUE_GET_OBJ(obj));
+        if (pr) {
+            set_value(ctx, &pr->u.value, val);
+            return true;
+        }
+    }
+    return js_put_field_ic_miss(ctx, b, pc, obj, atom, val);
+}
+
 /* argv[] is modified if (flags & JS_CALL_FLAG_COPY_ARGV) = 0. */
 static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                                JSValueConst this_obj, JSValueConst new_target,
@@ -16348,9 +19415,10 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
     JSVarRef **var_refs;
     size_t alloca_size;
 
-#ifdef ENABLE_DUMPS // JS_DUMP_BYTECODE_STEP
+#ifdef ENABLE_DUMPS // JS_DUMP_BYTECODE_STEP, JS_DUMP_OPCODE_STATS
 #define DUMP_BYTECODE_OR_DONT(pc) \
-    if (check_dump_flag(ctx->rt, JS_DUMP_BYTECODE_STEP)) dump_single_byte_code(ctx, pc, b, 0);
+    if (check_dump_flag(ctx->rt, JS_DUMP_BYTECODE_STEP)) dump_single_byte_code(ctx, pc, b, 0); \
+    if (check_dump_flag(ctx->rt, JS_DUMP_OPCODE_STATS)) js_count_opcode(ctx->rt, *pc);
 #else
 #define DUMP_BYTECODE_OR_DONT(pc)
 #endif
@@ -16566,6 +19634,13 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             if (unlikely(JS_IsException(sp[-1])))
                 goto exception;
             BREAK;
+        CASE(OP_object_sized):
+            *sp++ = js_new_object_sized(ctx, ctx->class_proto[JS_CLASS_OBJECT],
+                                        JS_CLASS_OBJECT, get_u16(pc));
+            pc += 2;
+            if (unlikely(JS_IsException(sp[-1])))
+                goto exception;
+            BREAK;
         CASE(OP_special_object):
             {
                 int arg = *pc++;
@@ -17444,17 +20519,17 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
 
         CASE(OP_goto):
             pc += (int32_t)get_u32(pc);
-            if (unlikely(js_poll_interrupts(ctx)))
+            if (unlikely(js_poll_interrupts_pc(ctx, sf, pc)))
                 goto exception;
             BREAK;
         CASE(OP_goto16):
             pc += (int16_t)get_u16(pc);
-            if (unlikely(js_poll_interrupts(ctx)))
+            if (unlikely(js_poll_interrupts_pc(ctx, sf, pc)))
                 goto exception;
             BREAK;
         CASE(OP_goto8):
             pc += (int8_t)pc[0];
-            if (unlikely(js_poll_interrupts(ctx)))
+            if (unlikely(js_poll_interrupts_pc(ctx, sf, pc)))
                 goto exception;
             BREAK;
         CASE(OP_if_true):
@@ -17473,7 +20548,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 if (res) {
                     pc += (int32_t)get_u32(pc - 4) - 4;
                 }
-                if (unlikely(js_poll_interrupts(ctx)))
+                if (unlikely(js_poll_interrupts_pc(ctx, sf, pc)))
                     goto exception;
             }
             BREAK;
@@ -17493,7 +20568,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 if (!res) {
                     pc += (int32_t)get_u32(pc - 4) - 4;
                 }
-                if (unlikely(js_poll_interrupts(ctx)))
+                if (unlikely(js_poll_interrupts_pc(ctx, sf, pc)))
                     goto exception;
             }
             BREAK;
@@ -17513,7 +20588,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 if (res) {
                     pc += (int8_t)pc[-1] - 1;
                 }
-                if (unlikely(js_poll_interrupts(ctx)))
+                if (unlikely(js_poll_interrupts_pc(ctx, sf, pc)))
                     goto exception;
             }
             BREAK;
@@ -17533,7 +20608,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 if (!res) {
                     pc += (int8_t)pc[-1] - 1;
                 }
-                if (unlikely(js_poll_interrupts(ctx)))
+                if (unlikely(js_poll_interrupts_pc(ctx, sf, pc)))
                     goto exception;
             }
             BREAK;
@@ -17719,10 +20794,11 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 JSValue val;
                 JSAtom atom;
+                uint32_t ic_pc = pc - b->byte_code_buf;
                 atom = get_u32(pc);
                 pc += 4;
                 sf->cur_pc = pc;
-                val = JS_GetPropertyInternal(ctx, sp[-1], atom, sp[-1], false);
+                val = js_get_field_ic(ctx, b, ic_pc, sp[-1], atom);
                 if (unlikely(JS_IsException(val)))
                     goto exception;
                 JS_FreeValue(ctx, sp[-1]);
@@ -17734,10 +20810,11 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 JSValue val;
                 JSAtom atom;
+                uint32_t ic_pc = pc - b->byte_code_buf;
                 atom = get_u32(pc);
                 pc += 4;
                 sf->cur_pc = pc;
-                val = JS_GetPropertyInternal(ctx, sp[-1], atom, sp[-1], false);
+                val = js_get_field_ic(ctx, b, ic_pc, sp[-1], atom);
                 if (unlikely(JS_IsException(val)))
                     goto exception;
                 *sp++ = val;
@@ -17748,13 +20825,11 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 int ret;
                 JSAtom atom;
+                uint32_t ic_pc = pc - b->byte_code_buf;
                 atom = get_u32(pc);
                 pc += 4;
                 sf->cur_pc = pc;
-                ret = JS_SetPropertyInternal2(ctx,
-                                              sp[-2], atom,
-                                              sp[-1], sp[-2],
-                                              JS_PROP_THROW_STRICT);
+                ret = js_put_field_ic(ctx, b, ic_pc, sp[-2], atom, sp[-1]);
                 JS_FreeValue(ctx, sp[-2]);
                 sp -= 2;
                 if (unlikely(ret < 0))
@@ -18397,6 +21472,34 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 }
             }
             BREAK;
+        CASE(OP_inc_loc_goto8):
+            {
+                JSValue op1;
+                int val;
+                int idx;
+                idx = *pc;
+                pc += 1;
+
+                op1 = var_buf[idx];
+                if (likely(JS_VALUE_GET_TAG(op1) == JS_TAG_INT &&
+                           JS_VALUE_GET_INT(op1) != INT32_MAX)) {
+                    val = JS_VALUE_GET_INT(op1);
+                    var_buf[idx] = js_int32(val + 1);
+                    pc += 1;
+                    pc += (int8_t)pc[0];
+                    if (unlikely(js_poll_interrupts_pc(ctx, sf, pc)))
+                        goto exception;
+                } else {
+                    /* the goto8 instruction is executed by the normal
+                       dispatch */
+                    sf->cur_pc = pc;
+                    op1 = js_dup(op1);
+                    if (js_unary_arith_slow(ctx, &op1 + 1, OP_inc))
+                        goto exception;
+                    set_value(ctx, &var_buf[idx], op1);
+                }
+            }
+            BREAK;
         CASE(OP_dec_loc):
             {
                 JSValue op1;
@@ -18573,6 +21676,35 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             OP_CMP(OP_strict_eq, ==, js_strict_eq_slow(ctx, sp, 0));
             OP_CMP(OP_strict_neq, !=, js_strict_eq_slow(ctx, sp, 1));
 
+            /* the if_false8 instruction is executed by the normal
+               dispatch on the slow path */
+#define OP_CMP_IF_FALSE8(opcode, cmp_opcode, binary_op)                 \
+            CASE(opcode):                                               \
+                {                                                       \
+                JSValue op1, op2;                                       \
+                op1 = sp[-2];                                           \
+                op2 = sp[-1];                                           \
+                if (likely(JS_VALUE_IS_BOTH_INT(op1, op2))) {           \
+                    sp -= 2;                                            \
+                    pc += 2;                                            \
+                    if (!(JS_VALUE_GET_INT(op1) binary_op JS_VALUE_GET_INT(op2))) \
+                        pc += (int8_t)pc[-1] - 1;                       \
+                    if (unlikely(js_poll_interrupts_pc(ctx, sf, pc)))              \
+                        goto exception;                                 \
+                } else {                                                \
+                    sf->cur_pc = pc;                                    \
+                    if (js_relational_slow(ctx, sp, cmp_opcode))        \
+                        goto exception;                                 \
+                    sp--;                                               \
+                }                                                       \
+                }                                                       \
+            BREAK
+
+            OP_CMP_IF_FALSE8(OP_lt_if_false8, OP_lt, <);
+            OP_CMP_IF_FALSE8(OP_lte_if_false8, OP_lte, <=);
+            OP_CMP_IF_FALSE8(OP_gt_if_false8, OP_gt, >);
+            OP_CMP_IF_FALSE8(OP_gte_if_false8, OP_gte, >=);
+
         CASE(OP_in):
             sf->cur_pc = pc;
             if (js_operator_in(ctx, sp))
@@ -18939,8 +22071,8 @@ static JSContext *JS_GetFunctionRealm(JSContext *ctx, JSValueConst func_obj)
     return realm;
 }
 
-static JSValue js_create_from_ctor(JSContext *ctx, JSValueConst ctor,
-                                   int class_id)
+static JSValue js_create_from_ctor_sized(JSContext *ctx, JSValueConst ctor,
+                                         int class_id, int prop_size)
 {
     JSValue proto, obj;
     JSContext *realm;
@@ -18959,11 +22091,17 @@ static JSValue js_create_from_ctor(JSContext *ctx, JSValueConst ctor,
             proto = js_dup(realm->class_proto[class_id]);
         }
     }
-    obj = JS_NewObjectProtoClass(ctx, proto, class_id);
+    obj = js_new_object_sized(ctx, proto, class_id, prop_size);
     JS_FreeValue(ctx, proto);
     return obj;
 }
 
+static JSValue js_create_from_ctor(JSContext *ctx, JSValueConst ctor,
+                                   int class_id)
+{
+    return js_create_from_ctor_sized(ctx, ctor, class_id, 0);
+}
+
 /* argv[] is modified if (flags & JS_CALL_FLAG_COPY_ARGV) = 0. */
 static JSValue JS_CallConstructorInternal(JSContext *ctx,
                                           JSValueConst func_obj,
@@ -18999,7 +22137,8 @@ static JSValue JS_CallConstructorInternal(JSContext *ctx,
     } else {
         JSValue obj, ret;
         /* legacy constructor behavior */
-        obj = js_create_from_ctor(ctx, new_target, JS_CLASS_OBJECT);
+        obj = js_create_from_ctor_sized(ctx, new_target, JS_CLASS_OBJECT,
+                                        b->ctor_prop_size);
         if (JS_IsException(obj))
             return JS_EXCEPTION;
         ret = JS_CallInternal(ctx, func_obj, obj, new_target, argc, argv, flags);
@@ -19009,6 +22148,8 @@ static JSValue JS_CallConstructorInternal(JSContext *ctx,
             return ret;
         } else {
             JS_FreeValue(ctx, ret);
+            b->ctor_prop_size = min_int(JS_VALUE_GET_OBJ(obj)->shape->prop_count,
+                                        JS_PROP_SIZE_HINT_MAX);
             return obj;
         }
     }
@@ -19049,6 +22190,60 @@ static JSValue JS_InvokeFree(JSContext *ctx, JSValue this_val, JSAtom atom,
     return res;
 }
 
+/* The frames of the generator and async functions are heap allocated.
+   Most of them are short lived, so the released frames of up to 256
+   values are kept in per size class free lists for reuse. */
+static JSValue *js_frame_alloc(JSContext *ctx, int count, uint8_t *pclass)
+{
+    JSRuntime *rt = ctx->rt;
+    JSValue *buf;
+    int k;
+
+    k = 32 - clz32(max_int(count, 8) - 1) - 3;
+    if (k >= JS_FRAME_POOL_CLASSES) {
+        *pclass = JS_FRAME_POOL_CLASSES;
+        return js_malloc(ctx, sizeof(JSValue) * count);
+    }
+    *pclass = k;
+    buf = rt->frame_pool[k];
+    if (buf) {
+        rt->frame_pool[k] = *(JSValue **)buf;
+        rt->frame_pool_size -= sizeof(JSValue) << (k + 3);
+        return buf;
+    }
+    return js_malloc(ctx, sizeof(JSValue) << (k + 3));
+}
+
+static void js_frame_free(JSRuntime *rt, JSValue *buf, int k)
+{
+    size_t size;
+
+    if (k < JS_FRAME_POOL_CLASSES) {
+        size = sizeof(JSValue) << (k + 3);
+        if (rt->frame_pool_size + size <= JS_FRAME_POOL_MAX_BYTES) {
+            *(JSValue **)buf = rt->frame_pool[k];
+            rt->frame_pool[k] = buf;
+            rt->frame_pool_size += size;
+            return;
+        }
+    }
+    js_free_rt(rt, buf);
+}
+
+static void js_frame_pool_free(JSRuntime *rt)
+{
+    JSValue *buf;
+    int k;
+
+    for(k = 0; k < JS_FRAME_POOL_CLASSES; k++) {
+        while ((buf = rt->frame_pool[k]) != NULL) {
+            rt->frame_pool[k] = *(JSValue **)buf;
+            js_free_rt(rt, buf);
+        }
+    }
+    rt->frame_pool_size = 0;
+}
+
 /* JSAsyncFunctionState (used by generator and async functions) */
 static __exception int async_func_init(JSContext *ctx, JSAsyncFunctionState *s,
                                        JSValueConst func_obj,
@@ -19068,7 +22263,7 @@ static __exception int async_func_init(JSContext *ctx, JSAsyncFunctionState *s,
     sf->cur_pc = b->byte_code_buf;
     arg_buf_len = max_int(b->arg_count, argc);
     local_count = arg_buf_len + b->var_count + b->stack_size;
-    sf->arg_buf = js_malloc(ctx, sizeof(JSValue) * max_int(local_count, 1));
+    sf->arg_buf = js_frame_alloc(ctx, local_count, &s->frame_class);
     if (!sf->arg_buf)
         return -1;
     sf->cur_func = js_dup(func_obj);
@@ -19120,7 +22315,7 @@ static void async_func_free(JSRuntime *rt, JSAsyncFunctionState *s)
         for(sp = sf->arg_buf; sp < sf->cur_sp; sp++) {
             JS_FreeValueRT(rt, *sp);
         }
-        js_free_rt(rt, sf->arg_buf);
+        js_frame_free(rt, sf->arg_buf, s->frame_class);
     }
     JS_FreeValueRT(rt, sf->cur_func);
     JS_FreeValueRT(rt, s->this_val);
@@ -19320,10 +22515,19 @@ static JSValue js_call_generator_function(JSContext *ctx, JSValueConst func_obj,
 
 static void js_async_function_terminate(JSRuntime *rt, JSAsyncFunctionData *s)
 {
+    JSValue resume_funcs[2];
+
     if (s->is_active) {
         async_func_free(rt, &s->func_state);
         s->is_active = false;
     }
+    /* the resume functions reference 's' */
+    resume_funcs[0] = s->resume_funcs[0];
+    resume_funcs[1] = s->resume_funcs[1];
+    s->resume_funcs[0] = JS_UNDEFINED;
+    s->resume_funcs[1] = JS_UNDEFINED;
+    JS_FreeValueRT(rt, resume_funcs[0]);
+    JS_FreeValueRT(rt, resume_funcs[1]);
 }
 
 static void js_async_function_free0(JSRuntime *rt, JSAsyncFunctionData *s)
@@ -19331,7 +22535,7 @@ static void js_async_function_free0(JSRuntime *rt, JSAsyncFunctionData *s)
     js_async_function_terminate(rt, s);
     JS_FreeValueRT(rt, s->resolving_funcs[0]);
     JS_FreeValueRT(rt, s->resolving_funcs[1]);
-    remove_gc_object(&s->header);
+    remove_gc_object(rt, &s->header);
     js_free_rt(rt, s);
 }
 
@@ -19362,13 +22566,16 @@ static void js_async_function_resolve_mark(JSRuntime *rt, JSValueConst val,
     }
 }
 
+/* create the resume functions of 's' if they do not exist yet */
 static int js_async_function_resolve_create(JSContext *ctx,
-                                            JSAsyncFunctionData *s,
-                                            JSValue *resolving_funcs)
+                                            JSAsyncFunctionData *s)
 {
+    JSValue resolving_funcs[2];
     int i;
     JSObject *p;
 
+    if (!JS_IsUndefined(s->resume_funcs[0]))
+        return 0;
     for(i = 0; i < 2; i++) {
         resolving_funcs[i] =
             JS_NewObjectProtoClass(ctx, ctx->function_proto,
@@ -19382,6 +22589,8 @@ static int js_async_function_resolve_create(JSContext *ctx,
         s->header.ref_count++;
         p->u.async_function_data = s;
     }
+    s->resume_funcs[0] = resolving_funcs[0];
+    s->resume_funcs[1] = resolving_funcs[1];
     return 0;
 }
 
@@ -19422,31 +22631,45 @@ static bool js_async_function_resume(JSContext *ctx, JSAsyncFunctionData *s)
             JS_FreeValue(ctx, value);
             goto resolved;
         } else {
-            JSValue promise, resolving_funcs[2], resolving_funcs1[2];
+            JSValue promise, resolving_funcs1[2];
+            JSJobEntry *e;
             int i, res;
 
             /* await */
             JS_FreeValue(ctx, func_ret); /* not used */
+            if (js_async_function_resolve_create(ctx, s)) {
+                JS_FreeValue(ctx, value);
+                goto fail;
+            }
+            if (!JS_IsObject(value) && !ctx->rt->promise_hook) {
+                /* same reaction job as for the already fulfilled
+                   promise that PromiseResolve() would create */
+                e = js_new_job(ctx, promise_reaction_job, 5);
+                if (!e) {
+                    JS_FreeValue(ctx, value);
+                    goto fail;
+                }
+                e->argv[0] = JS_UNDEFINED;
+                e->argv[1] = JS_UNDEFINED;
+                e->argv[2] = js_dup(s->resume_funcs[0]);
+                e->argv[3] = JS_FALSE;
+                e->argv[4] = value;
+                return is_success;
+            }
             promise = js_promise_resolve(ctx, ctx->promise_ctor,
                                          1, vc(&value), 0);
             JS_FreeValue(ctx, value);
             if (JS_IsException(promise))
                 goto fail;
-            if (js_async_function_resolve_create(ctx, s, resolving_funcs)) {
-                JS_FreeValue(ctx, promise);
-                goto fail;
-            }
 
             /* Note: no need to create 'thrownawayCapability' as in
                the spec */
             for(i = 0; i < 2; i++)
                 resolving_funcs1[i] = JS_UNDEFINED;
             res = perform_promise_then(ctx, promise,
-                                       vc(resolving_funcs),
+                                       vc(s->resume_funcs),
                                        vc(resolving_funcs1));
             JS_FreeValue(ctx, promise);
-            for(i = 0; i < 2; i++)
-                JS_FreeValue(ctx, resolving_funcs[i]);
             if (res)
                 goto fail;
         }
@@ -19496,6 +22719,8 @@ static JSValue js_async_function_call(JSContext *ctx, JSValueConst func_obj,
     s->is_active = false;
     s->resolving_funcs[0] = JS_UNDEFINED;
     s->resolving_funcs[1] = JS_UNDEFINED;
+    s->resume_funcs[0] = JS_UNDEFINED;
+    s->resume_funcs[1] = JS_UNDEFINED;
 
     promise = JS_NewPromiseCapability(ctx, s->resolving_funcs);
     if (JS_IsException(promise))
@@ -20302,6 +23527,8 @@ typedef struct JSParseState {
     JSFunctionDef *cur_func;
     bool is_module; /* parsing a module */
     bool allow_html_comments;
+    /* JSON.parse() shape transitions, allocated on the first object */
+    struct JSONShapeCacheEntry *json_shape_cache;
 } JSParseState;
 
 typedef struct JSOpCode {
@@ -20336,6 +23563,90 @@ static const JSOpCode opcode_info[OP_COUNT + (OP_TEMP_END - OP_TEMP_START)] = {
     opcode_info[(op) >= OP_TEMP_START ? \
                 (op) + (OP_TEMP_END - OP_TEMP_START) : (op)]
 
+/* allocate the inline cache table of 'b' and insert all its sites */
+static JSInlineCache *js_ic_new(JSRuntime *rt, JSFunctionBytecode *b)
+{
+    JSInlineCache *ic;
+    uint32_t size, h;
+    int pos, op, count;
+
+    count = 0;
+    for(pos = 0; pos < b->byte_code_len; pos += short_opcode_info(op).size) {
+        op = b->byte_code_buf[pos];
+        if (op == OP_get_field || op == OP_get_field2 || op == OP_put_field)
+            count++;
+    }
+    /* keep the load factor below 1/2 */
+    size = 2;
+    while (size < 2 * count)
+        size *= 2;
+    ic = js_mallocz_rt(rt, sizeof(*ic) + size * sizeof(ic->slots[0]));
+    if (!ic)
+        return NULL;
+    ic->mask = size - 1;
+    for(pos = 0; pos < b->byte_code_len; pos += short_opcode_info(op).size) {
+        op = b->byte_code_buf[pos];
+        if (op == OP_get_field || op == OP_get_field2 || op == OP_put_field) {
+            h = js_ic_hash(pos + 1, ic->mask);
+            while (ic->slots[h].pc != 0)
+                h = (h + 1) & ic->mask;
+            ic->slots[h].pc = pos + 1;
+        }
+    }
+    return ic;
+}
+
+/* Pairs of instructions replaced by a superinstruction, chosen from the
+   JS_DUMP_OPCODE_STATS counts of tests/microbench.js. Only the opcode of
+   the first instruction is replaced, so the bytecode layout (labels, line
+   numbers and inline cache sites) does not change and the second
+   instruction is still executed by the superinstruction slow path. */
+static const uint8_t js_superinstructions[][3] = {
+    { OP_lt, OP_if_false8, OP_lt_if_false8 },
+    { OP_lte, OP_if_false8, OP_lte_if_false8 },
+    { OP_gt, OP_if_false8, OP_gt_if_false8 },
+    { OP_gte, OP_if_false8, OP_gte_if_false8 },
+    { OP_inc_loc, OP_goto8, OP_inc_loc_goto8 },
+};
+
+/* return the first opcode of the superinstruction 'op' or 'op' */
+static int js_unfuse_opcode(int op)
+{
+    int i;
+
+    if (op < js_superinstructions[0][2])
+        return op;
+    for(i = 0; i < (int)countof(js_superinstructions); i++) {
+        if (js_superinstructions[i][2] == op)
+            return js_superinstructions[i][0];
+    }
+    return op;
+}
+
+static void js_fuse_superinstructions(uint8_t *bc_buf, int bc_len)
+{
+    int pos, len, op, i;
+
+    pos = 0;
+    while (pos < bc_len) {
+        op = bc_buf[pos];
+        len = short_opcode_info(op).size;
+        if (pos + len < bc_len) {
+            for(i = 0; i < (int)countof(js_superinstructions); i++) {
+                if (js_superinstructions[i][0] == op &&
+                    js_superinstructions[i][1] == bc_buf[pos + len]) {
+                    bc_buf[pos] = js_superinstructions[i][2];
+                    /* the second instruction is not fused again */
+                    pos += len;
+                    len = short_opcode_info(bc_buf[pos]).size;
+                    break;
+                }
+            }
+        }
+        pos += len;
+    }
+}
+
 static void free_token(JSParseState *s, JSToken *token)
 {
     switch(token->val) {
@@ -21410,6 +24721,31 @@ static int json_parse_error(JSParseState *s, const uint8_t *curp, const char *ms
                           msg, position, line, (int)(p - line_start) + 1);
 }
 
+/* return the position of the first '"', '\\', control or non ASCII
+   character in [p, end). Eight characters are tested at a time. */
+static const uint8_t *json_skip_plain_chars(const uint8_t *p,
+                                            const uint8_t *end)
+{
+    const uint64_t ones = 0x0101010101010101;
+    const uint64_t high = 0x8080808080808080;
+    uint64_t v, x, y;
+
+    while (end - p >= 8) {
+        memcpy(&v, p, 8);
+        x = v ^ (ones * '"');
+        y = v ^ (ones * '\\');
+        /* borrows may only flag bytes after a real match */
+        if ((((v - ones * 0x20) & ~v) | ((x - ones) & ~x) |
+             ((y - ones) & ~y) | v) & high) {
+            break;
+        }
+        p += 8;
+    }
+    while (p < end && *p != '"' && *p != '\\' && *p >= 0x20 && *p < 0x80)
+        p++;
+    return p;
+}
+
 static int json_parse_string(JSParseState *s, const uint8_t **pp)
 {
     const uint8_t *p, *p_next;
@@ -21417,11 +24753,30 @@ static int json_parse_string(JSParseState *s, const uint8_t **pp)
     uint32_t c;
     StringBuffer b_s, *b = &b_s;
 
-    if (string_buffer_init(s->ctx, b, 32))
+    p = *pp;
+    p_next = json_skip_plain_chars(p, s->buf_end);
+    if (p_next < s->buf_end && *p_next == '"') {
+        /* pure ASCII without escape sequences */
+        s->token.u.str.str = js_new_string8_len(s->ctx, (const char *)p,
+                                                p_next - p);
+        if (JS_IsException(s->token.u.str.str))
+            return -1;
+        s->token.val = TOK_STRING;
+        s->token.u.str.sep = '"';
+        *pp = p_next + 1;
+        return 0;
+    }
+
+    if (string_buffer_init(s->ctx, b, max_int(32, p_next - p)))
         goto fail;
 
-    p = *pp;
     for(;;) {
+        p_next = json_skip_plain_chars(p, s->buf_end);
+        if (p_next > p) {
+            if (string_buffer_write8(b, p, p_next - p))
+                goto fail;
+            p = p_next;
+        }
         if (p >= s->buf_end) {
             goto end_of_input;
         }
@@ -21490,6 +24845,8 @@ static int json_parse_number(JSParseState *s, const uint8_t **pp)
     const uint8_t *p = *pp;
     const uint8_t *p_start = p;
 
+    uint32_t v;
+
     if (*p == '+' || *p == '-')
         p++;
 
@@ -21499,8 +24856,18 @@ static int json_parse_number(JSParseState *s, const uint8_t **pp)
     if (p[0] == '0' && is_digit(p[1]))
         return json_parse_error(s, p, "Unexpected number");
 
+    v = 0;
     while (is_digit(*p))
-        p++;
+        v = v * 10 + (*p++ - '0');
+
+    /* small integers do not need strtod() and are stored as int32 */
+    if (p - p_start <= 9 && *p != '.' && *p != 'e' && *p != 'E' &&
+        !(*p_start == '-' && v == 0)) {
+        s->token.val = TOK_NUMBER;
+        s->token.u.num.val = js_int32(*p_start == '-' ? -(int32_t)v : v);
+        *pp = p;
+        return 0;
+    }
 
     if (*p == '.') {
         p++;
@@ -21613,6 +24980,8 @@ static __exception int json_next_token(JSParseState *s)
     case ' ':
     case '\t':
         p++;
+        while (*p == ' ' || *p == '\t')
+            p++;
         s->mark = p;
         goto redo;
     case '/':
@@ -23068,13 +26437,16 @@ static __exception int js_parse_object_literal(JSParseState *s)
 {
     JSAtom name = JS_ATOM_NULL;
     const uint8_t *start_ptr;
-    int start_line, start_col, prop_type;
+    int start_line, start_col, prop_type, object_pos, prop_count;
     bool has_proto;
 
     if (next_token(s))
         goto fail;
-    /* XXX: add an initial length that will be patched back */
-    emit_op(s, OP_object);
+    /* the initial property array size is patched back at the end */
+    object_pos = s->cur_func->byte_code.size;
+    emit_op(s, OP_object_sized);
+    emit_u16(s, 0);
+    prop_count = 0;
     has_proto = false;
     while (s->token.val != '}') {
         /* specific case for getter/setter */
@@ -23106,6 +26478,7 @@ static __exception int js_parse_object_literal(JSParseState *s)
             emit_u16(s, s->cur_func->scope_level);
             emit_op(s, OP_define_field);
             emit_atom(s, name);
+            prop_count++;
         } else if (s->token.val == '(') {
             bool is_getset = (prop_type == PROP_TYPE_GET ||
                               prop_type == PROP_TYPE_SET);
@@ -23141,6 +26514,7 @@ static __exception int js_parse_object_literal(JSParseState *s)
                 op_flags = OP_DEFINE_METHOD_METHOD;
             }
             emit_u8(s, op_flags | OP_DEFINE_METHOD_ENUMERABLE);
+            prop_count++;
         } else {
             if (js_parse_expect(s, ':'))
                 goto fail;
@@ -23150,6 +26524,7 @@ static __exception int js_parse_object_literal(JSParseState *s)
                 set_object_name_computed(s);
                 emit_op(s, OP_define_array_el);
                 emit_op(s, OP_drop);
+                prop_count++;
             } else if (name == JS_ATOM___proto__) {
                 if (has_proto) {
                     js_parse_error(s, "duplicate __proto__ property name");
@@ -23161,6 +26536,7 @@ static __exception int js_parse_object_literal(JSParseState *s)
                 set_object_name(s, name);
                 emit_op(s, OP_define_field);
                 emit_atom(s, name);
+                prop_count++;
             }
         }
         JS_FreeAtom(s->ctx, name);
@@ -23173,6 +26549,8 @@ static __exception int js_parse_object_literal(JSParseState *s)
     }
     if (js_parse_expect(s, '}'))
         goto fail;
+    put_u16(s->cur_func->byte_code.buf + object_pos + 1,
+            min_int(prop_count, JS_PROP_SIZE_HINT_MAX));
     return 0;
  fail:
     JS_FreeAtom(s->ctx, name);
@@ -30381,6 +33759,94 @@ static __maybe_unused void print_func_name(JSFunctionBytecode *b)
     print_lines(b->source, 0, 1);
 }
 
+#ifdef ENABLE_DUMPS // JS_DUMP_OPCODE_STATS
+/* Counts of the executed sequences of 2 to 4 opcodes, used to choose the
+   superinstructions (see js_fuse_superinstructions()). When the table is
+   full, new sequences are ignored. */
+#define JS_OPCODE_STATS_SIZE (1 << 16)
+
+typedef struct JSOpcodeNGram {
+    uint64_t key; /* n << 32 | opcodes, 0 if the entry is free */
+    uint64_t count;
+} JSOpcodeNGram;
+
+typedef struct JSOpcodeStats {
+    uint32_t history; /* last executed opcodes, most recent in the low byte */
+    uint32_t history_len;
+    uint32_t count;
+    JSOpcodeNGram tab[JS_OPCODE_STATS_SIZE];
+} JSOpcodeStats;
+
+static void js_count_opcode(JSRuntime *rt, int op)
+{
+    JSOpcodeStats *st = rt->opcode_stats;
+    JSOpcodeNGram *e;
+    uint64_t key;
+    uint32_t h, n;
+
+    if (!st) {
+        /* not accounted in the runtime memory usage */
+        st = rt->mf.js_calloc(rt->malloc_state.opaque, 1, sizeof(*st));
+        if (!st)
+            return;
+        rt->opcode_stats = st;
+    }
+    st->history = (st->history << 8) | op;
+    if (st->history_len < 4)
+        st->history_len++;
+    for(n = 2; n <= st->history_len; n++) {
+        key = ((uint64_t)n << 32) |
+            (st->history & (uint32_t)(((uint64_t)1 << (8 * n)) - 1));
+        h = (uint32_t)((key * 0x9e3779b97f4a7c15) >> 48);
+        for(;;) {
+            e = &st->tab[h];
+            if (e->key == key) {
+                e->count++;
+                break;
+            }
+            if (e->key == 0) {
+                if (st->count < JS_OPCODE_STATS_SIZE / 4 * 3) {
+                    e->key = key;
+                    e->count = 1;
+                    st->count++;
+                }
+                break;
+            }
+            h = (h + 1) & (JS_OPCODE_STATS_SIZE - 1);
+        }
+    }
+}
+
+static int js_opcode_ngram_cmp(const void *a, const void *b)
+{
+    const JSOpcodeNGram *e1 = a, *e2 = b;
+    return (e1->count < e2->count) - (e1->count > e2->count);
+}
+
+static void js_dump_opcode_stats(JSRuntime *rt)
+{
+    JSOpcodeStats *st = rt->opcode_stats;
+    JSOpcodeNGram *e;
+    int i, j, n, k;
+
+    qsort(st->tab, JS_OPCODE_STATS_SIZE, sizeof(st->tab[0]),
+          js_opcode_ngram_cmp);
+    for(n = 2; n <= 4; n++) {
+        printf("most executed %d-opcode sequences:\n", n);
+        for(i = k = 0; i < JS_OPCODE_STATS_SIZE && k < 20; i++) {
+            e = &st->tab[i];
+            if ((e->key >> 32) != n)
+                continue;
+            printf("%14" PRIu64 " ", e->count);
+            for(j = n - 1; j >= 0; j--)
+                printf(" %s", short_opcode_info((e->key >> (8 * j)) & 0xff).name);
+            printf("\n");
+            k++;
+        }
+    }
+}
+#endif
+
 static __maybe_unused void dump_pc2line(JSContext *ctx,
                                         const uint8_t *buf, int len,
                                         int line_num, int col_num)
@@ -33390,6 +36856,7 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
             goto no_change;
 
         case OP_object:
+        case OP_object_sized:
             if (code_match(&cc, pos_next, OP_null, OP_set_proto, -1)) {
                 if (cc.line_num >= 0) line_num = cc.line_num;
                 if (cc.col_num >= 0) col_num = cc.col_num;
@@ -33399,6 +36866,13 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                 pos_next = cc.pos;
                 break;
             }
+            if (op == OP_object_sized &&
+                get_u16(bc_buf + pos + 1) <= JS_PROP_INITIAL_SIZE) {
+                /* the default size is enough */
+                add_pc2line_info(s, bc_out.size, line_num, col_num);
+                dbuf_putc(&bc_out, OP_object);
+                break;
+            }
             goto no_change;
 
         default:
@@ -33918,6 +37392,7 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
     memcpy(b->byte_code_buf, fd->byte_code.buf, fd->byte_code.size);
     js_free(ctx, fd->byte_code.buf);
     fd->byte_code.buf = NULL;
+    js_fuse_superinstructions(b->byte_code_buf, b->byte_code_len);
 
     b->func_name = fd->func_name;
     if (fd->arg_count + fd->var_count > 0) {
@@ -34029,8 +37504,9 @@ static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b)
     JS_FreeAtomRT(rt, b->filename);
     js_free_rt(rt, b->pc2line_buf);
     js_free_rt(rt, b->source);
+    js_free_rt(rt, b->ic);
 
-    remove_gc_object(&b->header);
+    remove_gc_object(rt, &b->header);
     if (rt->gc_phase == JS_GC_PHASE_REMOVE_CYCLES && b->header.ref_count != 0) {
         list_add_tail(&b->header.link, &rt->gc_zero_ref_count_list);
     } else {
@@ -35262,9 +38738,12 @@ typedef enum BCTagEnum {
     BC_TAG_MAP,
     BC_TAG_SET,
     BC_TAG_SYMBOL,
+    BC_TAG_ARRAY_BUFFER_TRANSFER,
 } BCTagEnum;
 
-#define BC_VERSION 21
+#define BC_VERSION 22
+/* first byte of the objects written with JS_WRITE_OBJ_SHARED_ATOMS */
+#define BC_VERSION_SHARED_ATOMS (BC_VERSION | 0x80)
 
 typedef struct BCWriterState {
     JSContext *ctx;
@@ -35274,6 +38753,7 @@ typedef struct BCWriterState {
     bool allow_reference;
     bool allow_source;
     bool allow_debug;
+    bool shared_atoms; /* the atom table is ctx->shared_atoms */
     uint32_t first_atom;
     uint32_t *atom_to_idx;
     int atom_to_idx_size;
@@ -35283,6 +38763,11 @@ typedef struct BCWriterState {
     uint8_t **sab_tab;
     int sab_tab_len;
     int sab_tab_size;
+    /* ArrayBuffers whose contents are moved, transfer_tab[i] is the
+       malloc() block holding the contents of transfer[i] */
+    JSValueConst *transfer;
+    int transfer_len;
+    uint8_t **transfer_tab;
     /* list of referenced objects (used if allow_reference = true) */
     JSObjectList object_list;
 } BCWriterState;
@@ -35313,6 +38798,7 @@ static const char * const bc_tag_str[] = {
     "Map",
     "Set",
     "Symbol",
+    "ArrayBufferTransfer",
 };
 
 static const char *bc_tag_name(uint8_t tag)
@@ -35396,6 +38882,9 @@ static int bc_atom_to_idx(BCWriterState *s, uint32_t *pres, JSAtom atom)
 
     v = s->idx_to_atom_count++;
     s->idx_to_atom[v] = atom + s->first_atom;
+    /* the shared table outlives the written object */
+    if (s->shared_atoms)
+        JS_DupAtom(s->ctx, atom + s->first_atom);
     v += s->first_atom;
     s->atom_to_idx[atom] = v;
     *pres = v;
@@ -35496,7 +38985,9 @@ static int JS_WriteFunctionBytecode(BCWriterState *s,
 
     pos = 0;
     while (pos < bc_len) {
-        op = bc_buf[pos];
+        /* the superinstructions are not part of the file format */
+        op = js_unfuse_opcode(bc_buf[pos]);
+        bc_buf[pos] = op;
         len = short_opcode_info(op).size;
         switch(short_opcode_info(op).fmt) {
         case OP_FMT_atom:
@@ -35827,10 +39318,21 @@ static int JS_WriteArrayBuffer(BCWriterState *s, JSValueConst obj)
 {
     JSObject *p = JS_VALUE_GET_OBJ(obj);
     JSArrayBuffer *abuf = p->u.array_buffer;
+    int i;
+
     if (abuf->detached) {
         JS_ThrowTypeErrorDetachedArrayBuffer(s->ctx);
         return -1;
     }
+    for(i = 0; i < s->transfer_len; i++) {
+        if (JS_VALUE_GET_OBJ(s->transfer[i]) == p) {
+            bc_put_u8(s, BC_TAG_ARRAY_BUFFER_TRANSFER);
+            bc_put_leb128(s, abuf->byte_length);
+            bc_put_leb128(s, abuf->max_byte_length);
+            bc_put_u64(s, (uintptr_t)s->transfer_tab[i]);
+            return 0;
+        }
+    }
     bc_put_u8(s, BC_TAG_ARRAY_BUFFER);
     bc_put_leb128(s, abuf->byte_length);
     bc_put_leb128(s, abuf->max_byte_length);
@@ -35911,6 +39413,8 @@ static int JS_WriteObjectRec(BCWriterState *s, JSValueConst obj)
     case JS_TAG_STRING:
         {
             JSString *p = JS_VALUE_GET_STRING(obj);
+            if (js_string_flatten(s->ctx, p))
+                goto fail;
             bc_put_u8(s, BC_TAG_STRING);
             JS_WriteString(s, p);
         }
@@ -36029,16 +39533,10 @@ static int JS_WriteObjectRec(BCWriterState *s, JSValueConst obj)
     return -1;
 }
 
-/* create the atom table */
-static int JS_WriteObjectAtoms(BCWriterState *s)
+static void bc_put_atom_list(BCWriterState *s)
 {
     JSRuntime *rt = s->ctx->rt;
-    DynBuf dbuf1;
-    int i, atoms_size;
-
-    dbuf1 = s->dbuf;
-    js_dbuf_init(s->ctx, &s->dbuf);
-    bc_put_u8(s, BC_VERSION);
+    int i;
 
     bc_put_leb128(s, s->idx_to_atom_count);
     for(i = 0; i < s->idx_to_atom_count; i++) {
@@ -36056,6 +39554,25 @@ static int JS_WriteObjectAtoms(BCWriterState *s)
             JS_WriteString(s, p);
         }
     }
+}
+
+/* create the atom table */
+static int JS_WriteObjectAtoms(BCWriterState *s)
+{
+    DynBuf dbuf1;
+    int atoms_size;
+
+    dbuf1 = s->dbuf;
+    js_dbuf_init(s->ctx, &s->dbuf);
+    if (s->shared_atoms) {
+        /* only the size of the shared table, so that the reader can
+           check that it has all the atoms */
+        bc_put_u8(s, BC_VERSION_SHARED_ATOMS);
+        bc_put_leb128(s, s->idx_to_atom_count);
+    } else {
+        bc_put_u8(s, BC_VERSION);
+        bc_put_atom_list(s);
+    }
     /* XXX: should check for OOM in above phase */
 
     /* move the atoms at the start */
@@ -36075,8 +39592,120 @@ static int JS_WriteObjectAtoms(BCWriterState *s)
     return -1;
 }
 
+/* true if the contents of 'abuf' come from malloc() and can be handed
+   over as is */
+static bool js_array_buffer_is_movable(JSRuntime *rt, JSArrayBuffer *abuf)
+{
+    return abuf->free_func == js_array_buffer_free &&
+        rt->mf.js_malloc == js_def_malloc &&
+        !(rt->slab && js_slab_find(rt->slab, abuf->data));
+}
+
+/* check the transfer list and get a malloc() block with the contents of
+   each ArrayBuffer. Nothing is detached yet. */
+static int js_transfer_prepare(BCWriterState *s)
+{
+    JSContext *ctx = s->ctx;
+    JSArrayBuffer *abuf;
+    int i, j;
+
+    s->transfer_tab = js_mallocz(ctx, sizeof(s->transfer_tab[0]) *
+                                 s->transfer_len);
+    if (!s->transfer_tab)
+        return -1;
+    for(i = 0; i < s->transfer_len; i++) {
+        abuf = JS_GetOpaque(s->transfer[i], JS_CLASS_ARRAY_BUFFER);
+        if (!abuf) {
+            JS_ThrowTypeError(ctx, "only ArrayBuffers can be transferred");
+            return -1;
+        }
+        if (abuf->detached) {
+            JS_ThrowTypeErrorDetachedArrayBuffer(ctx);
+            return -1;
+        }
+        for(j = 0; j < i; j++) {
+            if (JS_VALUE_GET_OBJ(s->transfer[j]) ==
+                JS_VALUE_GET_OBJ(s->transfer[i])) {
+                JS_ThrowTypeError(ctx, "duplicate ArrayBuffer in transfer list");
+                return -1;
+            }
+        }
+        if (js_array_buffer_is_movable(ctx->rt, abuf)) {
+            s->transfer_tab[i] = abuf->data;
+        } else {
+            s->transfer_tab[i] = js_def_malloc(NULL, max_int(abuf->byte_length, 1));
+            if (!s->transfer_tab[i]) {
+                JS_ThrowOutOfMemory(ctx);
+                return -1;
+            }
+            memcpy(s->transfer_tab[i], abuf->data, abuf->byte_length);
+        }
+    }
+    return 0;
+}
+
+static void js_transfer_finish(BCWriterState *s, bool success)
+{
+    JSContext *ctx = s->ctx;
+    JSMallocState *ms = &ctx->rt->malloc_state;
+    JSArrayBuffer *abuf;
+    int i;
+
+    if (!s->transfer_tab)
+        return;
+    for(i = 0; i < s->transfer_len; i++) {
+        abuf = JS_GetOpaque(s->transfer[i], JS_CLASS_ARRAY_BUFFER);
+        if (!s->transfer_tab[i])
+            break; /* js_transfer_prepare() failed here */
+        if (s->transfer_tab[i] == abuf->data) {
+            if (success) {
+                /* the block leaves the runtime without being freed */
+                ms->malloc_count--;
+                ms->malloc_size -= ctx->rt->mf.js_malloc_usable_size(abuf->data) +
+                    MALLOC_OVERHEAD;
+                abuf->free_func = NULL;
+                JS_DetachArrayBuffer(ctx, s->transfer[i]);
+            }
+        } else {
+            if (success)
+                JS_DetachArrayBuffer(ctx, s->transfer[i]);
+            else
+                js_def_free(NULL, s->transfer_tab[i]);
+        }
+    }
+    if (!success) {
+        js_free(ctx, s->transfer_tab);
+        s->transfer_tab = NULL;
+    }
+}
+
+/* give the atom table back to the context if it is shared */
+static void bc_writer_free_atoms(BCWriterState *s)
+{
+    JSSharedAtoms *sa = &s->ctx->shared_atoms;
+
+    if (s->shared_atoms) {
+        sa->atom_to_idx = s->atom_to_idx;
+        sa->atom_to_idx_size = s->atom_to_idx_size;
+        sa->idx_to_atom = s->idx_to_atom;
+        sa->idx_to_atom_count = s->idx_to_atom_count;
+        sa->idx_to_atom_size = s->idx_to_atom_size;
+    } else {
+        js_free(s->ctx, s->atom_to_idx);
+        js_free(s->ctx, s->idx_to_atom);
+    }
+}
+
 uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
                          int flags, JSSABTab *psab_tab)
+{
+    return JS_WriteObject3(ctx, psize, obj, flags, psab_tab, NULL, 0, NULL);
+}
+
+uint8_t *JS_WriteObject3(JSContext *ctx, size_t *psize, JSValueConst obj,
+                         int flags, JSSABTab *psab_tab,
+                         JSValueConst *transfer, int transfer_len,
+                         JSSABTab *ptransfer_tab)
 {
     BCWriterState ss, *s = &ss;
 
@@ -36092,16 +39721,46 @@ uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
         s->first_atom = JS_ATOM_END;
     else
         s->first_atom = 1;
-    js_dbuf_init(ctx, &s->dbuf);
+    if (flags & JS_WRITE_OBJ_SHARED_ATOMS) {
+        JSSharedAtoms *sa = &ctx->shared_atoms;
+        /* the indexes must not depend on JS_WRITE_OBJ_BYTECODE */
+        s->shared_atoms = true;
+        s->first_atom = JS_ATOM_END;
+        s->atom_to_idx = sa->atom_to_idx;
+        s->atom_to_idx_size = sa->atom_to_idx_size;
+        s->idx_to_atom = sa->idx_to_atom;
+        s->idx_to_atom_count = sa->idx_to_atom_count;
+        s->idx_to_atom_size = sa->idx_to_atom_size;
+    }
+    if (flags & JS_WRITE_OBJ_SYSTEM_ALLOC)
+        dbuf_init(&s->dbuf);
+    else
+        js_dbuf_init(ctx, &s->dbuf);
     js_object_list_init(&s->object_list);
-
+    s->transfer = transfer;
+    s->transfer_len = transfer_len;
+
+    if (transfer_len > 0) {
+        /* without references, an ArrayBuffer reachable twice would be
+           given away twice */
+        if (!s->allow_reference) {
+            JS_ThrowTypeError(ctx, "transfer requires object references");
+            goto fail;
+        }
+        if (js_transfer_prepare(s))
+            goto fail;
+    }
     if (JS_WriteObjectRec(s, obj))
         goto fail;
     if (JS_WriteObjectAtoms(s))
         goto fail;
+    if (s->dbuf.error) {
+        JS_ThrowOutOfMemory(ctx);
+        goto fail;
+    }
+    js_transfer_finish(s, true);
     js_object_list_end(ctx, &s->object_list);
-    js_free(ctx, s->atom_to_idx);
-    js_free(ctx, s->idx_to_atom);
+    bc_writer_free_atoms(s);
     *psize = s->dbuf.size;
     if (psab_tab) {
         psab_tab->tab = s->sab_tab;
@@ -36109,17 +39768,28 @@ uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
     } else {
         js_free(ctx, s->sab_tab);
     }
+    if (ptransfer_tab) {
+        ptransfer_tab->tab = s->transfer_tab;
+        ptransfer_tab->len = s->transfer_tab ? s->transfer_len : 0;
+    } else {
+        js_free(ctx, s->transfer_tab);
+    }
     return s->dbuf.buf;
  fail:
+    js_transfer_finish(s, false);
     js_object_list_end(ctx, &s->object_list);
-    js_free(ctx, s->atom_to_idx);
-    js_free(ctx, s->idx_to_atom);
+    bc_writer_free_atoms(s);
+    js_free(ctx, s->sab_tab);
     dbuf_free(&s->dbuf);
     *psize = 0;
     if (psab_tab) {
         psab_tab->tab = NULL;
         psab_tab->len = 0;
     }
+    if (ptransfer_tab) {
+        ptransfer_tab->tab = NULL;
+        ptransfer_tab->len = 0;
+    }
     return NULL;
 }
 
@@ -36129,9 +39799,42 @@ uint8_t *JS_WriteObject(JSContext *ctx, size_t *psize, JSValueConst obj,
     return JS_WriteObject2(ctx, psize, obj, flags, NULL);
 }
 
+uint8_t *JS_WriteAtomTable(JSContext *ctx, size_t *psize)
+{
+    JSSharedAtoms *sa = &ctx->shared_atoms;
+    BCWriterState ss, *s = &ss;
+
+    memset(s, 0, sizeof(*s));
+    s->ctx = ctx;
+    s->idx_to_atom = sa->idx_to_atom;
+    s->idx_to_atom_count = sa->idx_to_atom_count;
+    js_dbuf_init(ctx, &s->dbuf);
+    bc_put_u8(s, BC_VERSION);
+    bc_put_atom_list(s);
+    if (s->dbuf.error) {
+        JS_ThrowOutOfMemory(ctx);
+        dbuf_free(&s->dbuf);
+        *psize = 0;
+        return NULL;
+    }
+    *psize = s->dbuf.size;
+    return s->dbuf.buf;
+}
+
+/* initial size of the input window of JS_ReadObjectStream() */
+#define BC_STREAM_BUF_SIZE 16384
+
 typedef struct BCReaderState {
     JSContext *ctx;
     const uint8_t *buf_start, *ptr, *buf_end;
+    /* JS_ReadObjectStream(): [buf_start, buf_end) is a window of the
+       input in stream_buf, starting at stream_pos */
+    JSReadObjectFunc *read_func;
+    void *read_opaque;
+    uint8_t *stream_buf;
+    size_t stream_buf_size;
+    size_t stream_pos;
+    bool stream_end;
     uint32_t first_atom;
     uint32_t idx_to_atom_count;
     JSAtom *idx_to_atom;
@@ -36139,6 +39842,8 @@ typedef struct BCReaderState {
     bool allow_sab;
     bool allow_bytecode;
     bool allow_reference;
+    bool allow_transfer;
+    bool shared_atoms; /* idx_to_atom belongs to ctx->shared_atoms */
     /* object references */
     JSObject **objects;
     int objects_count;
@@ -36147,6 +39852,10 @@ typedef struct BCReaderState {
     uint8_t **sab_tab;
     int sab_tab_len;
     int sab_tab_size;
+    /* adopted transferred ArrayBuffer contents */
+    uint8_t **transfer_tab;
+    int transfer_tab_len;
+    int transfer_tab_size;
     /* used for JS_DUMP_READ_OBJECT */
     const uint8_t *ptr_last;
     int level;
@@ -36198,9 +39907,74 @@ static int bc_read_error_end(BCReaderState *s)
     return s->error_state = -1;
 }
 
+/* position in the whole input */
+static size_t bc_get_pos(BCReaderState *s)
+{
+    return s->stream_pos + (s->ptr - s->buf_start);
+}
+
+/* move the unread input to the start of stream_buf and read more of it
+   until at least 'n' bytes are available. 'n' comes from the input, so
+   stream_buf only grows with the data actually read. Return -1 if the
+   end of the input is reached first, or in case of error. */
+static no_inline int bc_read_fill(BCReaderState *s, size_t n)
+{
+    size_t avail, size;
+    int64_t ret;
+    uint8_t *buf;
+
+    if (!s->read_func || s->error_state)
+        return -1;
+    avail = s->buf_end - s->ptr;
+    if (avail)
+        memmove(s->stream_buf, s->ptr, avail);
+#ifdef ENABLE_DUMPS // JS_DUMP_READ_OBJECT
+    if (s->ptr_last)
+        s->ptr_last = s->stream_buf - min_int(s->ptr - s->ptr_last, 0);
+#endif
+    s->stream_pos += s->ptr - s->buf_start;
+    s->buf_start = s->ptr = s->stream_buf;
+    s->buf_end = s->stream_buf + avail;
+    while (avail < n) {
+        if (s->stream_end)
+            return -1;
+        if (avail == s->stream_buf_size) {
+#ifdef ENABLE_DUMPS // JS_DUMP_READ_OBJECT
+            ptrdiff_t last = s->ptr_last - s->stream_buf;
+#endif
+            size = s->stream_buf_size * 2;
+            if (size < BC_STREAM_BUF_SIZE)
+                size = BC_STREAM_BUF_SIZE;
+            buf = js_realloc(s->ctx, s->stream_buf, size);
+            if (!buf)
+                return s->error_state = -1;
+#ifdef ENABLE_DUMPS // JS_DUMP_READ_OBJECT
+            if (s->ptr_last)
+                s->ptr_last = buf + last;
+#endif
+            s->stream_buf = buf;
+            s->stream_buf_size = size;
+            s->buf_start = s->ptr = buf;
+            s->buf_end = buf + avail;
+        }
+        ret = s->read_func(s->read_opaque, s->stream_buf + avail,
+                           s->stream_buf_size - avail);
+        if (ret < 0) {
+            if (!JS_HasException(s->ctx))
+                JS_ThrowInternalError(s->ctx, "bytecode read error");
+            return s->error_state = -1;
+        }
+        if (ret == 0)
+            s->stream_end = true;
+        avail += ret;
+        s->buf_end = s->stream_buf + avail;
+    }
+    return 0;
+}
+
 static int bc_get_u8(BCReaderState *s, uint8_t *pval)
 {
-    if (unlikely(s->buf_end - s->ptr < 1)) {
+    if (unlikely(s->buf_end - s->ptr < 1) && bc_read_fill(s, 1)) {
         *pval = 0; /* avoid warning */
         return bc_read_error_end(s);
     }
@@ -36211,7 +39985,7 @@ static int bc_get_u8(BCReaderState *s, uint8_t *pval)
 static int bc_get_u16(BCReaderState *s, uint16_t *pval)
 {
     uint16_t v;
-    if (unlikely(s->buf_end - s->ptr < 2)) {
+    if (unlikely(s->buf_end - s->ptr < 2) && bc_read_fill(s, 2)) {
         *pval = 0; /* avoid warning */
         return bc_read_error_end(s);
     }
@@ -36226,7 +40000,7 @@ static int bc_get_u16(BCReaderState *s, uint16_t *pval)
 static __maybe_unused int bc_get_u32(BCReaderState *s, uint32_t *pval)
 {
     uint32_t v;
-    if (unlikely(s->buf_end - s->ptr < 4)) {
+    if (unlikely(s->buf_end - s->ptr < 4) && bc_read_fill(s, 4)) {
         *pval = 0; /* avoid warning */
         return bc_read_error_end(s);
     }
@@ -36241,7 +40015,7 @@ static __maybe_unused int bc_get_u32(BCReaderState *s, uint32_t *pval)
 static int bc_get_u64(BCReaderState *s, uint64_t *pval)
 {
     uint64_t v;
-    if (unlikely(s->buf_end - s->ptr < 8)) {
+    if (unlikely(s->buf_end - s->ptr < 8) && bc_read_fill(s, 8)) {
         *pval = 0; /* avoid warning */
         return bc_read_error_end(s);
     }
@@ -36256,6 +40030,9 @@ static int bc_get_u64(BCReaderState *s, uint64_t *pval)
 static int bc_get_leb128(BCReaderState *s, uint32_t *pval)
 {
     int ret;
+    /* a leb128 number is at most 5 bytes long */
+    if (unlikely(s->buf_end - s->ptr < 5))
+        bc_read_fill(s, 5);
     ret = get_leb128(pval, s->ptr, s->buf_end);
     if (unlikely(ret < 0))
         return bc_read_error_end(s);
@@ -36266,6 +40043,8 @@ static int bc_get_leb128(BCReaderState *s, uint32_t *pval)
 static int bc_get_sleb128(BCReaderState *s, int32_t *pval)
 {
     int ret;
+    if (unlikely(s->buf_end - s->ptr < 5))
+        bc_read_fill(s, 5);
     ret = get_sleb128(pval, s->ptr, s->buf_end);
     if (unlikely(ret < 0))
         return bc_read_error_end(s);
@@ -36290,11 +40069,22 @@ static int bc_get_leb128_u16(BCReaderState *s, uint16_t *pval)
     return 0;
 }
 
+/* check that 'len' bytes of input are left before a buffer of this
+   size is allocated for them */
+static int bc_check_avail(BCReaderState *s, size_t len)
+{
+    if (unlikely(s->buf_end - s->ptr < len) && bc_read_fill(s, len))
+        return bc_read_error_end(s);
+    return 0;
+}
+
 static int bc_get_buf(BCReaderState *s, void *buf, uint32_t buf_len)
 {
     if (buf_len != 0) {
-        if (unlikely(!buf || s->buf_end - s->ptr < buf_len))
+        if (unlikely(!buf))
             return bc_read_error_end(s);
+        if (bc_check_avail(s, buf_len))
+            return -1;
         memcpy(buf, s->ptr, buf_len);
         s->ptr += buf_len;
     }
@@ -36313,7 +40103,7 @@ static int bc_idx_to_atom(BCReaderState *s, JSAtom *patom, uint32_t idx)
         idx -= s->first_atom;
         if (idx >= s->idx_to_atom_count) {
             JS_ThrowSyntaxError(s->ctx, "invalid atom index (pos=%u)",
-                                (unsigned int)(s->ptr - s->buf_start));
+                                (unsigned int)bc_get_pos(s));
             *patom = JS_ATOM_NULL;
             return s->error_state = -1;
         }
@@ -36351,19 +40141,18 @@ static JSString *JS_ReadString(BCReaderState *s)
         JS_ThrowInternalError(s->ctx, "string too long");
         return NULL;
     }
+    size = (size_t)len << is_wide_char;
+    if (bc_check_avail(s, size))
+        return NULL;
     p = js_alloc_string(s->ctx, len, is_wide_char);
     if (!p) {
         s->error_state = -1;
         return NULL;
     }
-    size = (size_t)len << is_wide_char;
-    if ((s->buf_end - s->ptr) < size) {
-        bc_read_error_end(s);
+    if (bc_get_buf(s, str8(p), size)) {
         js_free_string(s->ctx->rt, p);
         return NULL;
     }
-    memcpy(str8(p), s->ptr, size);
-    s->ptr += size;
     if (is_wide_char) {
         if (is_be()) {
             uint32_t i;
@@ -36410,7 +40199,10 @@ static int JS_ReadFunctionBytecode(BCReaderState *s, JSFunctionBytecode *b,
 
     pos = 0;
     while (pos < bc_len) {
-        op = bc_buf[pos];
+        /* a superinstruction is only valid when followed by its second
+           opcode, so it is recomputed from the plain opcodes */
+        op = js_unfuse_opcode(bc_buf[pos]);
+        bc_buf[pos] = op;
         len = short_opcode_info(op).size;
         switch(short_opcode_info(op).fmt) {
         case OP_FMT_atom:
@@ -36443,6 +40235,7 @@ static int JS_ReadFunctionBytecode(BCReaderState *s, JSFunctionBytecode *b,
 #endif
         pos += len;
     }
+    js_fuse_superinstructions(bc_buf, bc_len);
     return 0;
 }
 
@@ -36562,6 +40355,8 @@ static JSValue JS_ReadFunctionTag(BCReaderState *s)
         goto fail;
     if (bc_get_leb128_int(s, &local_count))
         goto fail;
+    if (bc_check_avail(s, (uint32_t)bc.byte_code_len))
+        goto fail;
 
     function_size = sizeof(*b);
     cpool_offset = function_size;
@@ -36717,6 +40512,8 @@ static JSValue JS_ReadFunctionTag(BCReaderState *s)
         goto fail;
     if (b->pc2line_len) {
         bc_read_trace(s, "positions: %d bytes\n", b->pc2line_len);
+        if (bc_check_avail(s, (uint32_t)b->pc2line_len))
+            goto fail;
         b->pc2line_buf = js_mallocz(ctx, b->pc2line_len);
         if (!b->pc2line_buf)
             goto fail;
@@ -36730,6 +40527,8 @@ static JSValue JS_ReadFunctionTag(BCReaderState *s)
         if (s->ptr_last)
             s->ptr_last += b->source_len;  // omit source code hex dump
         /* b->source is a UTF-8 encoded null terminated C string */
+        if (bc_check_avail(s, (uint32_t)b->source_len))
+            goto fail;
         b->source = js_mallocz(ctx, b->source_len + 1);
         if (!b->source)
             goto fail;
@@ -37020,10 +40819,8 @@ static JSValue JS_ReadArrayBuffer(BCReaderState *s)
         max_byte_length_u64 = max_byte_length;
         pmax_byte_length = &max_byte_length_u64;
     }
-    if (unlikely(s->buf_end - s->ptr < byte_length)) {
-        bc_read_error_end(s);
+    if (bc_check_avail(s, byte_length))
         return JS_EXCEPTION;
-    }
     // makes a copy of the input
     obj = js_array_buffer_constructor3(ctx, JS_UNDEFINED,
                                        byte_length, pmax_byte_length,
@@ -37085,6 +40882,67 @@ static JSValue JS_ReadSharedArrayBuffer(BCReaderState *s)
     return JS_EXCEPTION;
 }
 
+static void js_array_buffer_free_transfer(JSRuntime *rt, void *opaque,
+                                          void *ptr)
+{
+    js_def_free(NULL, ptr);
+}
+
+static JSValue JS_ReadTransferredArrayBuffer(BCReaderState *s)
+{
+    JSContext *ctx = s->ctx;
+    JSRuntime *rt = ctx->rt;
+    uint32_t byte_length, max_byte_length;
+    uint64_t max_byte_length_u64, *pmax_byte_length = NULL;
+    uint8_t *data_ptr;
+    JSValue obj;
+    uint64_t u64;
+    bool adopt;
+
+    if (bc_get_leb128(s, &byte_length))
+        return JS_EXCEPTION;
+    if (bc_get_leb128(s, &max_byte_length))
+        return JS_EXCEPTION;
+    if (max_byte_length < byte_length)
+        return JS_ThrowTypeError(ctx, "invalid array buffer");
+    if (bc_get_u64(s, &u64))
+        return JS_EXCEPTION;
+    data_ptr = (uint8_t *)(uintptr_t)u64;
+    if (js_resize_array(s->ctx, (void **)&s->transfer_tab,
+                        sizeof(s->transfer_tab[0]),
+                        &s->transfer_tab_size, s->transfer_tab_len + 1))
+        return JS_EXCEPTION;
+    /* a malloc() block becomes a regular runtime allocation when the
+       runtime uses malloc() too, otherwise it stays external and the
+       ArrayBuffer cannot be resized */
+    adopt = (rt->mf.js_malloc == js_def_malloc);
+    if (adopt && max_byte_length != UINT32_MAX) {
+        max_byte_length_u64 = max_byte_length;
+        pmax_byte_length = &max_byte_length_u64;
+    }
+    obj = js_array_buffer_constructor3(ctx, JS_UNDEFINED,
+                                       byte_length, pmax_byte_length,
+                                       JS_CLASS_ARRAY_BUFFER,
+                                       data_ptr,
+                                       adopt ? js_array_buffer_free :
+                                       js_array_buffer_free_transfer,
+                                       NULL, false);
+    if (JS_IsException(obj))
+        return obj;
+    if (adopt) {
+        rt->malloc_state.malloc_count++;
+        rt->malloc_state.malloc_size += rt->mf.js_malloc_usable_size(data_ptr) +
+            MALLOC_OVERHEAD;
+    }
+    s->transfer_tab[s->transfer_tab_len++] = data_ptr;
+    if (BC_add_object_ref(s, obj))
+        goto fail;
+    return obj;
+ fail:
+    JS_FreeValue(ctx, obj);
+    return JS_EXCEPTION;
+}
+
 static JSValue JS_ReadRegExp(BCReaderState *s)
 {
     JSContext *ctx = s->ctx;
@@ -37247,6 +41105,11 @@ static JSValue JS_ReadObjectRec(BCReaderState *s)
             goto invalid_tag;
         obj = JS_ReadSharedArrayBuffer(s);
         break;
+    case BC_TAG_ARRAY_BUFFER_TRANSFER:
+        if (!s->allow_transfer)
+            goto invalid_tag;
+        obj = JS_ReadTransferredArrayBuffer(s);
+        break;
     case BC_TAG_REGEXP:
         obj = JS_ReadRegExp(s);
         break;
@@ -37296,7 +41159,7 @@ static JSValue JS_ReadObjectRec(BCReaderState *s)
     default:
     invalid_tag:
         return JS_ThrowSyntaxError(ctx, "invalid tag (tag=%d pos=%u)",
-                                   tag, (unsigned int)(s->ptr - s->buf_start));
+                                   tag, (unsigned int)bc_get_pos(s));
     }
     bc_read_trace(s, "}\n");
     return obj;
@@ -37311,6 +41174,20 @@ static int JS_ReadObjectAtoms(BCReaderState *s)
 
     if (bc_get_u8(s, &v8))
         return -1;
+    if (v8 == BC_VERSION_SHARED_ATOMS) {
+        JSSharedAtoms *sa = &s->ctx->shared_atoms;
+        if (bc_get_leb128(s, &s->idx_to_atom_count))
+            return -1;
+        if (s->idx_to_atom_count > sa->idx_to_atom_count) {
+            JS_ThrowSyntaxError(s->ctx, "missing shared atom table (%u atoms expected, %d present)",
+                                s->idx_to_atom_count, sa->idx_to_atom_count);
+            return -1;
+        }
+        s->shared_atoms = true;
+        s->first_atom = JS_ATOM_END;
+        s->idx_to_atom = sa->idx_to_atom;
+        return 0;
+    }
     if (v8 != BC_VERSION) {
         JS_ThrowSyntaxError(s->ctx, "invalid version (%d expected=%d)",
                             v8, BC_VERSION);
@@ -37364,7 +41241,7 @@ static int JS_ReadObjectAtoms(BCReaderState *s)
 static void bc_reader_free(BCReaderState *s)
 {
     int i;
-    if (s->idx_to_atom) {
+    if (s->idx_to_atom && !s->shared_atoms) {
         for(i = 0; i < s->idx_to_atom_count; i++) {
             JS_FreeAtom(s->ctx, s->idx_to_atom[i]);
         }
@@ -37376,20 +41253,19 @@ static void bc_reader_free(BCReaderState *s)
 JSValue JS_ReadObject2(JSContext *ctx, const uint8_t *buf, size_t buf_len,
                        int flags, JSSABTab *psab_tab)
 {
-    BCReaderState ss, *s = &ss;
-    JSValue obj;
+    return JS_ReadObject3(ctx, buf, buf_len, flags, psab_tab, NULL);
+}
 
-    ctx->binary_object_count += 1;
-    ctx->binary_object_size += buf_len;
+static JSValue bc_read_object(BCReaderState *s, int flags,
+                              JSSABTab *psab_tab, JSSABTab *ptransfer_tab)
+{
+    JSContext *ctx = s->ctx;
+    JSValue obj;
 
-    memset(s, 0, sizeof(*s));
-    s->ctx = ctx;
-    s->buf_start = buf;
-    s->buf_end = buf + buf_len;
-    s->ptr = buf;
     s->allow_bytecode = ((flags & JS_READ_OBJ_BYTECODE) != 0);
     s->allow_sab = ((flags & JS_READ_OBJ_SAB) != 0);
     s->allow_reference = ((flags & JS_READ_OBJ_REFERENCE) != 0);
+    s->allow_transfer = ((flags & JS_READ_OBJ_TRANSFER) != 0);
     if (s->allow_bytecode)
         s->first_atom = JS_ATOM_END;
     else
@@ -37405,16 +41281,112 @@ JSValue JS_ReadObject2(JSContext *ctx, const uint8_t *buf, size_t buf_len,
     } else {
         js_free(ctx, s->sab_tab);
     }
+    if (ptransfer_tab) {
+        ptransfer_tab->tab = s->transfer_tab;
+        ptransfer_tab->len = s->transfer_tab_len;
+    } else {
+        js_free(ctx, s->transfer_tab);
+    }
     bc_reader_free(s);
     return obj;
 }
 
+JSValue JS_ReadObject3(JSContext *ctx, const uint8_t *buf, size_t buf_len,
+                       int flags, JSSABTab *psab_tab,
+                       JSSABTab *ptransfer_tab)
+{
+    BCReaderState ss, *s = &ss;
+
+    ctx->binary_object_count += 1;
+    ctx->binary_object_size += buf_len;
+
+    memset(s, 0, sizeof(*s));
+    s->ctx = ctx;
+    s->buf_start = buf;
+    s->buf_end = buf + buf_len;
+    s->ptr = buf;
+    return bc_read_object(s, flags, psab_tab, ptransfer_tab);
+}
+
+JSValue JS_ReadObjectStream(JSContext *ctx, JSReadObjectFunc *read_func,
+                            void *opaque, int flags)
+{
+    BCReaderState ss, *s = &ss;
+    JSValue obj;
+
+    memset(s, 0, sizeof(*s));
+    s->ctx = ctx;
+    s->read_func = read_func;
+    s->read_opaque = opaque;
+    /* the SharedArrayBuffer and transferred ArrayBuffer pointers are
+       only meaningful in the same process */
+    flags &= ~(JS_READ_OBJ_SAB | JS_READ_OBJ_TRANSFER);
+    obj = bc_read_object(s, flags, NULL, NULL);
+    /* a read error may have been hidden by a successful read of the
+       last bytes */
+    if (s->error_state && !JS_IsException(obj)) {
+        JS_FreeValue(ctx, obj);
+        obj = JS_EXCEPTION;
+    }
+    ctx->binary_object_count += 1;
+    ctx->binary_object_size += bc_get_pos(s);
+    js_free(ctx, s->stream_buf);
+    return obj;
+}
+
 JSValue JS_ReadObject(JSContext *ctx, const uint8_t *buf, size_t buf_len,
                       int flags)
 {
     return JS_ReadObject2(ctx, buf, buf_len, flags, NULL);
 }
 
+int JS_ReadAtomTable(JSContext *ctx, const uint8_t *buf, size_t buf_len)
+{
+    JSSharedAtoms *sa = &ctx->shared_atoms;
+    BCReaderState ss, *s = &ss;
+    uint32_t idx;
+    JSAtom atom;
+    int i;
+
+    memset(s, 0, sizeof(*s));
+    s->ctx = ctx;
+    s->buf_start = buf;
+    s->buf_end = buf + buf_len;
+    s->ptr = buf;
+    if (buf_len > 0 && buf[0] == BC_VERSION_SHARED_ATOMS) {
+        JS_ThrowSyntaxError(ctx, "not an atom table");
+        return -1;
+    }
+    if (JS_ReadObjectAtoms(s)) {
+        bc_reader_free(s);
+        return -1;
+    }
+    js_free_shared_atoms(ctx);
+    sa->idx_to_atom = s->idx_to_atom;
+    sa->idx_to_atom_count = sa->idx_to_atom_size = s->idx_to_atom_count;
+    /* index the table so that more objects can be written with it */
+    for(i = 0; i < sa->idx_to_atom_count; i++) {
+        atom = sa->idx_to_atom[i];
+        if (atom < JS_ATOM_END || __JS_AtomIsTaggedInt(atom))
+            continue;
+        idx = atom - JS_ATOM_END;
+        if (idx >= sa->atom_to_idx_size) {
+            int old_size = sa->atom_to_idx_size;
+            if (js_resize_array(ctx, (void **)&sa->atom_to_idx,
+                                sizeof(sa->atom_to_idx[0]),
+                                &sa->atom_to_idx_size, idx + 1)) {
+                js_free_shared_atoms(ctx);
+                return -1;
+            }
+            memset(sa->atom_to_idx + old_size, 0,
+                   sizeof(sa->atom_to_idx[0]) * (sa->atom_to_idx_size - old_size));
+        }
+        if (sa->atom_to_idx[idx] == 0)
+            sa->atom_to_idx[idx] = i + JS_ATOM_END;
+    }
+    return 0;
+}
+
 /*******************************************************************/
 /* runtime functions & objects */
 
@@ -37487,6 +41459,52 @@ static JSValue JS_InstantiateFunctionListItem2(JSContext *ctx, JSObject *p,
     return val;
 }
 
+static JSValue js_func_list_alias_value(JSContext *ctx, JSValueConst obj,
+                                        const JSCFunctionListEntry *e)
+{
+    JSAtom atom1 = find_atom(ctx, e->u.alias.name);
+    JSValue val;
+
+    switch (e->u.alias.base) {
+    case -1:
+        val = JS_GetProperty(ctx, obj, atom1);
+        break;
+    case 0:
+        val = JS_GetProperty(ctx, ctx->global_obj, atom1);
+        break;
+    case 1:
+        val = JS_GetProperty(ctx, ctx->class_proto[JS_CLASS_ARRAY], atom1);
+        break;
+    default:
+        abort();
+    }
+    JS_FreeAtom(ctx, atom1);
+    return val;
+}
+
+/* the functions are JS_UNDEFINED if absent or JS_EXCEPTION */
+static void js_func_list_new_getset(JSContext *ctx,
+                                    const JSCFunctionListEntry *e,
+                                    JSValue *pgetter, JSValue *psetter)
+{
+    char buf[64];
+
+    *pgetter = JS_UNDEFINED;
+    if (e->u.getset.get.generic) {
+        snprintf(buf, sizeof(buf), "get %s", e->name);
+        *pgetter = JS_NewCFunction2(ctx, e->u.getset.get.generic,
+                                    buf, 0, e->def_type == JS_DEF_CGETSET_MAGIC ? JS_CFUNC_getter_magic : JS_CFUNC_getter,
+                                    e->magic);
+    }
+    *psetter = JS_UNDEFINED;
+    if (e->u.getset.set.generic) {
+        snprintf(buf, sizeof(buf), "set %s", e->name);
+        *psetter = JS_NewCFunction2(ctx, e->u.getset.set.generic,
+                                    buf, 1, e->def_type == JS_DEF_CGETSET_MAGIC ? JS_CFUNC_setter_magic : JS_CFUNC_setter,
+                                    e->magic);
+    }
+}
+
 static int JS_InstantiateFunctionListItem(JSContext *ctx, JSValueConst obj,
                                           JSAtom atom,
                                           const JSCFunctionListEntry *e)
@@ -37497,21 +41515,7 @@ static int JS_InstantiateFunctionListItem(JSContext *ctx, JSValueConst obj,
     switch(e->def_type) {
     case JS_DEF_ALIAS: /* using autoinit for aliases is not safe */
         {
-            JSAtom atom1 = find_atom(ctx, e->u.alias.name);
-            switch (e->u.alias.base) {
-            case -1:
-                val = JS_GetProperty(ctx, obj, atom1);
-                break;
-            case 0:
-                val = JS_GetProperty(ctx, ctx->global_obj, atom1);
-                break;
-            case 1:
-                val = JS_GetProperty(ctx, ctx->class_proto[JS_CLASS_ARRAY], atom1);
-                break;
-            default:
-                abort();
-            }
-            JS_FreeAtom(ctx, atom1);
+            val = js_func_list_alias_value(ctx, obj, e);
             if (atom == JS_ATOM_Symbol_toPrimitive) {
                 /* Symbol.toPrimitive functions are not writable */
                 prop_flags = JS_PROP_CONFIGURABLE;
@@ -37536,22 +41540,8 @@ static int JS_InstantiateFunctionListItem(JSContext *ctx, JSValueConst obj,
     case JS_DEF_CGETSET_MAGIC:
         {
             JSValue getter, setter;
-            char buf[64];
-
-            getter = JS_UNDEFINED;
-            if (e->u.getset.get.generic) {
-                snprintf(buf, sizeof(buf), "get %s", e->name);
-                getter = JS_NewCFunction2(ctx, e->u.getset.get.generic,
-                                          buf, 0, e->def_type == JS_DEF_CGETSET_MAGIC ? JS_CFUNC_getter_magic : JS_CFUNC_getter,
-                                          e->magic);
-            }
-            setter = JS_UNDEFINED;
-            if (e->u.getset.set.generic) {
-                snprintf(buf, sizeof(buf), "set %s", e->name);
-                setter = JS_NewCFunction2(ctx, e->u.getset.set.generic,
-                                          buf, 1, e->def_type == JS_DEF_CGETSET_MAGIC ? JS_CFUNC_setter_magic : JS_CFUNC_setter,
-                                          e->magic);
-            }
+
+            js_func_list_new_getset(ctx, e, &getter, &setter);
             JS_DefinePropertyGetSet(ctx, obj, atom, getter, setter, prop_flags);
             return 0;
         }
@@ -37580,21 +41570,250 @@ static int JS_InstantiateFunctionListItem(JSContext *ctx, JSValueConst obj,
     return 0;
 }
 
+/* The builtin objects are rebuilt in every context from the same
+   function lists. The first time a list is instantiated on an object,
+   its final shape is saved in the runtime without prototype. The next
+   instantiations on an object with the same initial properties clone it
+   instead of adding the properties one by one, which also avoids the
+   atom lookups. A copy of the list is kept to detect a list whose memory
+   was reused. */
+typedef struct JSFuncListShape {
+    struct JSFuncListShape *hash_next;
+    const JSCFunctionListEntry *tab;
+    int len;
+    int prop_count0; /* number of properties before the list */
+    JSShape *sh; /* not hashed, proto = NULL */
+    JSCFunctionListEntry entries[];
+} JSFuncListShape;
+
+static inline uint32_t js_func_list_shape_hash(const JSCFunctionListEntry *tab)
+{
+    return ((uintptr_t)tab * 0x9E3779B1) >> 16 &
+        (JS_FUNC_LIST_SHAPE_HASH_SIZE - 1);
+}
+
+static JSFuncListShape *js_func_list_shape_find(JSRuntime *rt, JSShape *sh,
+                                                const JSCFunctionListEntry *tab,
+                                                int len)
+{
+    JSFuncListShape *fs;
+    JSShapeProperty *prs, *prs1;
+    int i;
+
+    for(fs = rt->func_list_shapes[js_func_list_shape_hash(tab)]; fs != NULL;
+        fs = fs->hash_next) {
+        if (fs->tab != tab || fs->len != len ||
+            fs->prop_count0 != sh->prop_count ||
+            memcmp(fs->entries, tab, sizeof(tab[0]) * len))
+            continue;
+        prs = get_shape_prop(sh);
+        prs1 = get_shape_prop(fs->sh);
+        for(i = 0; i < sh->prop_count; i++) {
+            if (prs[i].atom != prs1[i].atom || prs[i].flags != prs1[i].flags)
+                break;
+        }
+        if (i == sh->prop_count)
+            return fs;
+    }
+    return NULL;
+}
+
+/* 'sh1' is the final shape of an object whose last 'len' properties
+   were created by 'tab' in order. Failures are ignored. */
+static void js_func_list_shape_add(JSContext *ctx,
+                                   const JSCFunctionListEntry *tab, int len,
+                                   JSShape *sh1)
+{
+    JSRuntime *rt = ctx->rt;
+    JSFuncListShape *fs, **pfs;
+    JSShapeProperty *prs;
+    JSShape *sh;
+    int i;
+
+    if (rt->func_list_shape_count >= JS_FUNC_LIST_SHAPE_MAX)
+        return;
+    fs = js_malloc_rt(rt, sizeof(*fs) + sizeof(tab[0]) * len);
+    if (!fs)
+        return;
+    sh = js_clone_shape(ctx, sh1);
+    if (!sh) {
+        js_free_rt(rt, fs);
+        return;
+    }
+    if (sh->proto) {
+        JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_OBJECT, sh->proto));
+        sh->proto = NULL;
+    }
+    /* an alias may have already instantiated an autoinit property */
+    prs = get_shape_prop(sh) + sh->prop_count - len;
+    for(i = 0; i < len; i++, prs++) {
+        switch(tab[i].def_type) {
+        case JS_DEF_CFUNC:
+        case JS_DEF_PROP_STRING:
+        case JS_DEF_OBJECT:
+            prs->flags = (prs->flags & JS_PROP_C_W_E) | JS_PROP_AUTOINIT;
+            break;
+        default:
+            break;
+        }
+    }
+    fs->tab = tab;
+    fs->len = len;
+    fs->prop_count0 = sh->prop_count - len;
+    fs->sh = sh;
+    memcpy(fs->entries, tab, sizeof(tab[0]) * len);
+    pfs = &rt->func_list_shapes[js_func_list_shape_hash(tab)];
+    fs->hash_next = *pfs;
+    *pfs = fs;
+    rt->func_list_shape_count++;
+}
+
+static void js_func_list_shapes_free(JSRuntime *rt)
+{
+    JSFuncListShape *fs, *fs_next;
+    int i;
+
+    for(i = 0; i < JS_FUNC_LIST_SHAPE_HASH_SIZE; i++) {
+        for(fs = rt->func_list_shapes[i]; fs != NULL; fs = fs_next) {
+            fs_next = fs->hash_next;
+            js_free_shape(rt, fs->sh);
+            js_free_rt(rt, fs);
+        }
+        rt->func_list_shapes[i] = NULL;
+    }
+    rt->func_list_shape_count = 0;
+}
+
+/* instantiate the function list of 'fs' on 'p' whose properties match
+   the first ones of fs->sh */
+static int js_func_list_shape_instantiate(JSContext *ctx, JSObject *p,
+                                          JSFuncListShape *fs)
+{
+    const JSCFunctionListEntry *e;
+    JSProperty *prop, *pr;
+    JSShape *sh;
+    JSValue val, getter, setter;
+    int i, n;
+
+    sh = js_clone_shape(ctx, fs->sh);
+    if (!sh)
+        return -1;
+    prop = js_realloc(ctx, p->prop, sizeof(JSProperty) * sh->prop_size);
+    if (!prop) {
+        js_free_shape(ctx->rt, sh);
+        return -1;
+    }
+    sh->proto = p->shape->proto;
+    if (sh->proto)
+        js_dup(JS_MKPTR(JS_TAG_OBJECT, sh->proto));
+    js_free_shape(ctx->rt, p->shape);
+    p->shape = sh;
+    p->prop = prop;
+
+    /* the properties must be valid before anything can fail */
+    n = fs->prop_count0;
+    for(i = 0; i < fs->len; i++) {
+        e = &fs->tab[i];
+        pr = &p->prop[n + i];
+        switch(e->def_type) {
+        case JS_DEF_CFUNC:
+        case JS_DEF_PROP_STRING:
+        case JS_DEF_OBJECT:
+            pr->u.init.realm_and_id = (uintptr_t)JS_DupContext(ctx) |
+                JS_AUTOINIT_ID_PROP;
+            pr->u.init.opaque = (void *)e;
+            break;
+        case JS_DEF_CGETSET:
+        case JS_DEF_CGETSET_MAGIC:
+            pr->u.getset.getter = NULL;
+            pr->u.getset.setter = NULL;
+            break;
+        case JS_DEF_PROP_INT32:
+            pr->u.value = js_int32(e->u.i32);
+            break;
+        case JS_DEF_PROP_INT64:
+            pr->u.value = js_int64(e->u.i64);
+            break;
+        case JS_DEF_PROP_DOUBLE:
+            pr->u.value = js_float64(e->u.f64);
+            break;
+        case JS_DEF_PROP_UNDEFINED:
+        case JS_DEF_ALIAS:
+            pr->u.value = JS_UNDEFINED;
+            break;
+        default:
+            abort();
+        }
+    }
+    for(i = 0; i < fs->len; i++) {
+        e = &fs->tab[i];
+        pr = &p->prop[n + i];
+        switch(e->def_type) {
+        case JS_DEF_CGETSET:
+        case JS_DEF_CGETSET_MAGIC:
+            js_func_list_new_getset(ctx, e, &getter, &setter);
+            if (JS_IsObject(getter))
+                pr->u.getset.getter = JS_VALUE_GET_OBJ(getter);
+            if (JS_IsObject(setter))
+                pr->u.getset.setter = JS_VALUE_GET_OBJ(setter);
+            if (JS_IsException(getter) || JS_IsException(setter))
+                return -1;
+            break;
+        case JS_DEF_ALIAS:
+            val = js_func_list_alias_value(ctx, JS_MKPTR(JS_TAG_OBJECT, p), e);
+            if (JS_IsException(val))
+                return -1;
+            pr->u.value = val;
+            break;
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
 int JS_SetPropertyFunctionList(JSContext *ctx, JSValueConst obj,
                                 const JSCFunctionListEntry *tab, int len)
 {
-    int i, ret;
+    JSFuncListShape *fs;
+    JSObject *p;
+    bool cacheable;
+    int i, ret, n;
 
+    p = NULL;
+    n = 0;
+    if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT && len > 0) {
+        p = JS_VALUE_GET_OBJ(obj);
+        /* the array and string exotic behaviors only concern indexes */
+        if (!p->extensible ||
+            (ctx->rt->class_array[p->class_id].exotic &&
+             p->class_id != JS_CLASS_ARRAY &&
+             p->class_id != JS_CLASS_STRING)) {
+            p = NULL;
+        } else {
+            fs = js_func_list_shape_find(ctx->rt, p->shape, tab, len);
+            if (fs)
+                return js_func_list_shape_instantiate(ctx, p, fs);
+            n = p->shape->prop_count;
+        }
+    }
+    cacheable = (p != NULL);
     for (i = 0; i < len; i++) {
         const JSCFunctionListEntry *e = &tab[i];
         JSAtom atom = find_atom(ctx, e->name);
         if (atom == JS_ATOM_NULL)
             return -1;
         ret = JS_InstantiateFunctionListItem(ctx, obj, atom, e);
+        /* each entry must have appended its own property */
+        if (cacheable && (p->shape->prop_count != n + i + 1 ||
+                          get_shape_prop(p->shape)[n + i].atom != atom))
+            cacheable = false;
         JS_FreeAtom(ctx, atom);
         if (ret)
             return -1;
     }
+    if (cacheable)
+        js_func_list_shape_add(ctx, tab, len, p->shape);
     return 0;
 }
 
@@ -37769,6 +41988,8 @@ JSValue JS_ToObject(JSContext *ctx, JSValueConst val)
         /* XXX: should call the string constructor */
         {
             JSString *p1 = JS_VALUE_GET_STRING(val);
+            if (js_string_flatten(ctx, p1))
+                return JS_EXCEPTION;
             obj = JS_NewObjectClass(ctx, JS_CLASS_STRING);
             JS_DefinePropertyValue(ctx, obj, JS_ATOM_length, js_int32(p1->len), 0);
         }
@@ -39166,7 +43387,7 @@ static JSValue *build_arg_list(JSContext *ctx, uint32_t *plen,
         p->fast_array &&
         len == p->u.array.count) {
         for(i = 0; i < len; i++) {
-            tab[i] = js_dup(p->u.array.u.values[i]);
+            tab[i] = js_array_get(p, i);
         }
     } else {
         for(i = 0; i < len; i++) {
@@ -39642,13 +43863,28 @@ static int JS_CopySubArray(JSContext *ctx,
             if (dir < 0) {
                 l = min_int64(l, from + 1);
                 l = min_int64(l, to + 1);
+            } else {
+                l = min_int64(l, len - from);
+                l = min_int64(l, len - to);
+            }
+            if (p->u.array.kind != JS_ARRAY_KIND_VALUE) {
+                /* the packed elements have no side effects when
+                   overwritten */
+                size_t elt_size = js_array_kind_size[p->u.array.kind];
+                uint8_t *tab = p->u.array.u.uint8_ptr;
+                if (dir < 0) {
+                    memmove(tab + (to - l + 1) * elt_size,
+                            tab + (from - l + 1) * elt_size, l * elt_size);
+                } else {
+                    memmove(tab + to * elt_size, tab + from * elt_size,
+                            l * elt_size);
+                }
+            } else if (dir < 0) {
                 for(j = 0; j < l; j++) {
                     set_value(ctx, &p->u.array.u.values[to - j],
                               js_dup(p->u.array.u.values[from - j]));
                 }
             } else {
-                l = min_int64(l, len - from);
-                l = min_int64(l, len - to);
                 for(j = 0; j < l; j++) {
                     set_value(ctx, &p->u.array.u.values[to + j],
                               js_dup(p->u.array.u.values[from + j]));
@@ -39958,8 +44194,8 @@ static JSValue js_array_at(JSContext *ctx, JSValueConst this_val,
 static JSValue js_array_with(JSContext *ctx, JSValueConst this_val,
                              int argc, JSValueConst *argv)
 {
-    JSValue arr, obj, ret, *arrp, *pval;
-    JSObject *p;
+    JSValue arr, obj, ret, *pval;
+    JSObject *p, *arrp;
     int64_t i, len, idx;
     uint32_t count32;
 
@@ -39998,10 +44234,10 @@ static JSValue js_array_with(JSContext *ctx, JSValueConst this_val,
     pval = p->u.array.u.values;
     if (js_get_fast_array(ctx, obj, &arrp, &count32) && count32 == len) {
         for (; i < idx; i++, pval++)
-            *pval = js_dup(arrp[i]);
+            *pval = js_array_get(arrp, i);
         *pval = js_dup(argv[1]);
         for (i++, pval++; i < len; i++, pval++)
-            *pval = js_dup(arrp[i]);
+            *pval = js_array_get(arrp, i);
     } else {
         for (; i < idx; i++, pval++)
             if (-1 == JS_TryGetPropertyInt64(ctx, obj, i, pval))
@@ -40420,12 +44656,61 @@ static JSValue js_array_fill(JSContext *ctx, JSValueConst this_val,
     return JS_EXCEPTION;
 }
 
+/* Search 'val' in the packed elements of 'p' from 'n' (included) in
+   the direction 'dir' (+1 or -1). The elements are numbers so they can
+   only be equal to a number. 'nan_eq' is true for SameValueZero.
+   Return the index or -1 if not found. */
+static int64_t js_array_find_number(JSObject *p, JSValueConst val,
+                                    int64_t n, int dir, bool nan_eq)
+{
+    int64_t count = p->u.array.count;
+    uint32_t tag = JS_VALUE_GET_NORM_TAG(val);
+    double d;
+
+    if (tag == JS_TAG_INT)
+        d = JS_VALUE_GET_INT(val);
+    else if (tag == JS_TAG_FLOAT64)
+        d = JS_VALUE_GET_FLOAT64(val);
+    else
+        return -1;
+    if (p->u.array.kind == JS_ARRAY_KIND_INT32) {
+        const int32_t *tab = p->u.array.u.int32_ptr;
+        int32_t v;
+        /* -0 is equal to 0, NaN and the non integers are never found */
+        if (!(d >= INT32_MIN && d <= INT32_MAX))
+            return -1;
+        v = (int32_t)d;
+        if (v != d)
+            return -1;
+        for (; n >= 0 && n < count; n += dir) {
+            if (tab[n] == v)
+                return n;
+        }
+    } else {
+        const double *tab = p->u.array.u.double_ptr;
+        if (isnan(d)) {
+            if (!nan_eq)
+                return -1;
+            for (; n >= 0 && n < count; n += dir) {
+                if (isnan(tab[n]))
+                    return n;
+            }
+        } else {
+            for (; n >= 0 && n < count; n += dir) {
+                if (tab[n] == d)
+                    return n;
+            }
+        }
+    }
+    return -1;
+}
+
 static JSValue js_array_includes(JSContext *ctx, JSValueConst this_val,
                                  int argc, JSValueConst *argv)
 {
     JSValue obj, val;
     int64_t len, n;
-    JSValue *arrp;
+    JSObject *arrp;
     uint32_t count;
     int res;
 
@@ -40441,8 +44726,14 @@ static JSValue js_array_includes(JSContext *ctx, JSValueConst this_val,
                 goto exception;
         }
         if (js_get_fast_array(ctx, obj, &arrp, &count)) {
+            if (arrp->u.array.kind != JS_ARRAY_KIND_VALUE) {
+                if (js_array_find_number(arrp, argv[0], n, +1, true) >= 0)
+                    goto done;
+                n = max_int64(n, count);
+            }
             for (; n < count; n++) {
-                if (js_strict_eq2(ctx, js_dup(argv[0]), js_dup(arrp[n]),
+                if (js_strict_eq2(ctx, js_dup(argv[0]),
+                                  js_dup(arrp->u.array.u.values[n]),
                                   JS_EQ_SAME_VALUE_ZERO)) {
                     goto done;
                 }
@@ -40473,7 +44764,7 @@ static JSValue js_array_indexOf(JSContext *ctx, JSValueConst this_val,
 {
     JSValue obj, val;
     int64_t len, n;
-    JSValue *arrp;
+    JSObject *arrp;
     uint32_t count;
 
     obj = JS_ToObject(ctx, this_val);
@@ -40487,8 +44778,17 @@ static JSValue js_array_indexOf(JSContext *ctx, JSValueConst this_val,
                 goto exception;
         }
         if (js_get_fast_array(ctx, obj, &arrp, &count)) {
+            if (arrp->u.array.kind != JS_ARRAY_KIND_VALUE) {
+                int64_t k = js_array_find_number(arrp, argv[0], n, +1, false);
+                if (k >= 0) {
+                    n = k;
+                    goto done;
+                }
+                n = max_int64(n, count);
+            }
             for (; n < count; n++) {
-                if (js_strict_eq2(ctx, js_dup(argv[0]), js_dup(arrp[n]),
+                if (js_strict_eq2(ctx, js_dup(argv[0]),
+                                  js_dup(arrp->u.array.u.values[n]),
                                   JS_EQ_STRICT)) {
                     goto done;
                 }
@@ -40520,7 +44820,7 @@ static JSValue js_array_lastIndexOf(JSContext *ctx, JSValueConst this_val,
 {
     JSValue obj, val;
     int64_t len, n;
-    JSValue *arrp;
+    JSObject *arrp;
     uint32_t count;
 
     obj = JS_ToObject(ctx, this_val);
@@ -40534,8 +44834,13 @@ static JSValue js_array_lastIndexOf(JSContext *ctx, JSValueConst this_val,
                 goto exception;
         }
         if (js_get_fast_array(ctx, obj, &arrp, &count) && count == len) {
+            if (arrp->u.array.kind != JS_ARRAY_KIND_VALUE) {
+                n = js_array_find_number(arrp, argv[0], n, -1, false);
+                goto done;
+            }
             for (; n >= 0; n--) {
-                if (js_strict_eq2(ctx, js_dup(argv[0]), js_dup(arrp[n]),
+                if (js_strict_eq2(ctx, js_dup(argv[0]),
+                                  js_dup(arrp->u.array.u.values[n]),
                                   JS_EQ_STRICT)) {
                     goto done;
                 }
@@ -40725,7 +45030,7 @@ static JSValue js_array_pop(JSContext *ctx, JSValueConst this_val,
 {
     JSValue obj, res = JS_UNDEFINED;
     int64_t len, newLen;
-    JSValue *arrp;
+    JSObject *arrp;
     uint32_t count32;
 
     obj = JS_ToObject(ctx, this_val);
@@ -40736,14 +45041,15 @@ static JSValue js_array_pop(JSContext *ctx, JSValueConst this_val,
         newLen = len - 1;
         /* Special case fast arrays */
         if (js_get_fast_array(ctx, obj, &arrp, &count32) && count32 == len) {
-            JSObject *p = JS_VALUE_GET_OBJ(obj);
             if (shift) {
-                res = arrp[0];
-                memmove(arrp, arrp + 1, (count32 - 1) * sizeof(*arrp));
-                p->u.array.count--;
+                size_t elt_size = js_array_kind_size[arrp->u.array.kind];
+                uint8_t *tab = arrp->u.array.u.uint8_ptr;
+                res = js_array_take(arrp, 0);
+                memmove(tab, tab + elt_size, (count32 - 1) * elt_size);
+                arrp->u.array.count--;
             } else {
-                res = arrp[count32 - 1];
-                p->u.array.count--;
+                res = js_array_take(arrp, count32 - 1);
+                arrp->u.array.count--;
             }
         } else {
             if (shift) {
@@ -40813,7 +45119,7 @@ static JSValue js_array_reverse(JSContext *ctx, JSValueConst this_val,
                                 int argc, JSValueConst *argv)
 {
     JSValue obj, lval, hval;
-    JSValue *arrp;
+    JSObject *arrp;
     int64_t len, l, h;
     int l_present, h_present;
     uint32_t count32;
@@ -40828,10 +45134,37 @@ static JSValue js_array_reverse(JSContext *ctx, JSValueConst this_val,
         uint32_t ll, hh;
 
         if (count32 > 1) {
-            for (ll = 0, hh = count32 - 1; ll < hh; ll++, hh--) {
-                lval = arrp[ll];
-                arrp[ll] = arrp[hh];
-                arrp[hh] = lval;
+            switch(arrp->u.array.kind) {
+            case JS_ARRAY_KIND_INT32:
+                {
+                    int32_t *tab = arrp->u.array.u.int32_ptr, v;
+                    for (ll = 0, hh = count32 - 1; ll < hh; ll++, hh--) {
+                        v = tab[ll];
+                        tab[ll] = tab[hh];
+                        tab[hh] = v;
+                    }
+                }
+                break;
+            case JS_ARRAY_KIND_FLOAT64:
+                {
+                    double *tab = arrp->u.array.u.double_ptr, v;
+                    for (ll = 0, hh = count32 - 1; ll < hh; ll++, hh--) {
+                        v = tab[ll];
+                        tab[ll] = tab[hh];
+                        tab[hh] = v;
+                    }
+                }
+                break;
+            default:
+                {
+                    JSValue *tab = arrp->u.array.u.values;
+                    for (ll = 0, hh = count32 - 1; ll < hh; ll++, hh--) {
+                        lval = tab[ll];
+                        tab[ll] = tab[hh];
+                        tab[hh] = lval;
+                    }
+                }
+                break;
             }
         }
         return obj;
@@ -40885,8 +45218,8 @@ static JSValue js_array_reverse(JSContext *ctx, JSValueConst this_val,
 static JSValue js_array_toReversed(JSContext *ctx, JSValueConst this_val,
                                    int argc, JSValueConst *argv)
 {
-    JSValue arr, obj, ret, *arrp, *pval;
-    JSObject *p;
+    JSValue arr, obj, ret, *pval;
+    JSObject *p, *arrp;
     int64_t i, len;
     uint32_t count32;
 
@@ -40915,7 +45248,7 @@ static JSValue js_array_toReversed(JSContext *ctx, JSValueConst this_val,
         pval = p->u.array.u.values;
         if (js_get_fast_array(ctx, obj, &arrp, &count32) && count32 == len) {
             for (; i >= 0; i--, pval++)
-                *pval = js_dup(arrp[i]);
+                *pval = js_array_get(arrp, i);
         } else {
             // Query order is observable; test262 expects descending order.
             for (; i >= 0; i--, pval++) {
@@ -40947,7 +45280,7 @@ static JSValue js_array_slice(JSContext *ctx, JSValueConst this_val,
     JSValue obj, arr, val, len_val;
     int64_t len, start, k, final, n, count, del_count, new_len;
     int kPresent;
-    JSValue *arrp;
+    JSObject *arrp;
     uint32_t count32, i, item_count;
 
     arr = JS_UNDEFINED;
@@ -41001,7 +45334,7 @@ static JSValue js_array_slice(JSContext *ctx, JSValueConst this_val,
         js_is_fast_array(ctx, arr)) {
         /* XXX: should share code with fast array constructor */
         for (; k < final && k < count32; k++, n++) {
-            if (JS_CreateDataPropertyUint32(ctx, arr, n, js_dup(arrp[k]), JS_PROP_THROW) < 0)
+            if (JS_CreateDataPropertyUint32(ctx, arr, n, js_array_get(arrp, k), JS_PROP_THROW) < 0)
                 goto exception;
         }
     }
@@ -41050,8 +45383,8 @@ static JSValue js_array_slice(JSContext *ctx, JSValueConst this_val,
 static JSValue js_array_toSpliced(JSContext *ctx, JSValueConst this_val,
                                   int argc, JSValueConst *argv)
 {
-    JSValue arr, obj, ret, *arrp, *pval, *last;
-    JSObject *p;
+    JSValue arr, obj, ret, *pval, *last;
+    JSObject *p, *arrp;
     int64_t i, j, len, newlen, start, add, del;
     uint32_t count32;
 
@@ -41108,11 +45441,11 @@ static JSValue js_array_toSpliced(JSContext *ctx, JSValueConst this_val,
 
     if (js_get_fast_array(ctx, obj, &arrp, &count32) && count32 == len) {
         for (i = 0; i < start; i++, pval++)
-            *pval = js_dup(arrp[i]);
+            *pval = js_array_get(arrp, i);
         for (j = 0; j < add; j++, pval++)
             *pval = js_dup(argv[2 + j]);
         for (i += del; i < len; i++, pval++)
-            *pval = js_dup(arrp[i]);
+            *pval = js_array_get(arrp, i);
     } else {
         for (i = 0; i < start; i++, pval++)
             if (-1 == JS_TryGetPropertyInt64(ctx, obj, i, pval))
@@ -41287,6 +45620,81 @@ exception:
 
 /* Array sort */
 
+/* Stable LSD radix sort of 'tab', one byte per pass. The elements are
+   converted to unsigned keys and back according to 'kind'. For floats,
+   'nan_min' is the smallest NaN encoding. 'tmp' must hold 'len'
+   elements. */
+typedef enum {
+    JS_RADIX_KEY_UNSIGNED,
+    JS_RADIX_KEY_SIGNED,
+    JS_RADIX_KEY_FLOAT,
+} JSRadixKeyEnum;
+
+#define DEF_RADIX_SORT(name, type)                                          \
+static void name(type *tab, type *tmp, size_t len, JSRadixKeyEnum kind,     \
+                 type nan_min)                                              \
+{                                                                           \
+    const type sign = (type)1 << (sizeof(type) * 8 - 1);                    \
+    uint32_t count[sizeof(type)][256], pos[256];                            \
+    type *src, *dst, *t, v;                                                 \
+    size_t i, k;                                                            \
+    uint32_t sum;                                                           \
+                                                                            \
+    memset(count, 0, sizeof(count));                                        \
+    for(i = 0; i < len; i++) {                                              \
+        v = tab[i];                                                         \
+        if (kind == JS_RADIX_KEY_SIGNED) {                                  \
+            v ^= sign;                                                      \
+        } else if (kind == JS_RADIX_KEY_FLOAT) {                            \
+            /* NaNs are last, -0 is before +0 */                            \
+            if ((v & ~sign) >= nan_min)                                     \
+                v = (type)-1;                                               \
+            else if (v & sign)                                              \
+                v = ~v;                                                     \
+            else                                                            \
+                v |= sign;                                                  \
+        }                                                                   \
+        tab[i] = v;                                                         \
+        for(k = 0; k < sizeof(type); k++)                                   \
+            count[k][(v >> (k * 8)) & 0xff]++;                              \
+    }                                                                       \
+    src = tab;                                                              \
+    dst = tmp;                                                              \
+    for(k = 0; k < sizeof(type); k++) {                                     \
+        /* skip the byte if it is the same for all the keys */              \
+        if (count[k][(src[0] >> (k * 8)) & 0xff] == len)                    \
+            continue;                                                       \
+        sum = 0;                                                            \
+        for(i = 0; i < 256; i++) {                                          \
+            pos[i] = sum;                                                   \
+            sum += count[k][i];                                             \
+        }                                                                   \
+        for(i = 0; i < len; i++) {                                          \
+            v = src[i];                                                     \
+            dst[pos[(v >> (k * 8)) & 0xff]++] = v;                          \
+        }                                                                   \
+        t = src;                                                            \
+        src = dst;                                                          \
+        dst = t;                                                            \
+    }                                                                       \
+    for(i = 0; i < len; i++) {                                              \
+        v = src[i];                                                         \
+        if (kind == JS_RADIX_KEY_SIGNED) {                                  \
+            v ^= sign;                                                      \
+        } else if (kind == JS_RADIX_KEY_FLOAT) {                            \
+            if (v & sign)                                                   \
+                v &= ~sign;                                                 \
+            else                                                            \
+                v = ~v;                                                     \
+        }                                                                   \
+        tab[i] = v;                                                         \
+    }                                                                       \
+}
+
+DEF_RADIX_SORT(js_radix_sort16, uint16_t)
+DEF_RADIX_SORT(js_radix_sort32, uint32_t)
+DEF_RADIX_SORT(js_radix_sort64, uint64_t)
+
 typedef struct ValueSlot {
     JSValue val;
     JSString *str;
@@ -41361,6 +45769,235 @@ exception:
     return 0;
 }
 
+/* return true if 'func' is (a, b) => a - b, or b - a if '*pdesc' is
+   set, so that it can be replaced by a numeric comparison */
+static bool js_is_sub_comparator(JSValueConst func, bool *pdesc)
+{
+    JSObject *p;
+    JSFunctionBytecode *b;
+    const uint8_t *pc;
+
+    if (JS_VALUE_GET_TAG(func) != JS_TAG_OBJECT)
+        return false;
+    p = JS_VALUE_GET_OBJ(func);
+    if (p->class_id != JS_CLASS_BYTECODE_FUNCTION)
+        return false;
+    b = p->u.func.function_bytecode;
+    if (b->func_kind != JS_FUNC_NORMAL || b->arg_count != 2 ||
+        b->byte_code_len != 4)
+        return false;
+    pc = b->byte_code_buf;
+    if (pc[2] != OP_sub || pc[3] != OP_return)
+        return false;
+    if (pc[0] == OP_get_arg0 && pc[1] == OP_get_arg1)
+        *pdesc = false;
+    else if (pc[0] == OP_get_arg1 && pc[1] == OP_get_arg0)
+        *pdesc = true;
+    else
+        return false;
+    return true;
+}
+
+static int js_u32_digits(uint32_t v)
+{
+    int n = 1;
+    while (v >= 10) {
+        v /= 10;
+        n++;
+    }
+    return n;
+}
+
+/* default order of two int32 values, i.e. of their decimal strings,
+   without converting them */
+static int js_cmp_int_str(int32_t x, int32_t y)
+{
+    static const uint64_t pow10[10] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+        1000000000,
+    };
+    uint64_t ux, uy;
+    int nx, ny;
+
+    /* '-' is before the digits */
+    if ((x < 0) != (y < 0))
+        return x < 0 ? -1 : 1;
+    ux = x < 0 ? -(uint32_t)x : (uint32_t)x;
+    uy = y < 0 ? -(uint32_t)y : (uint32_t)y;
+    nx = js_u32_digits(ux);
+    ny = js_u32_digits(uy);
+    /* compare the digits padded to the same length, then the lengths */
+    if (nx < ny)
+        ux *= pow10[ny - nx];
+    else
+        uy *= pow10[nx - ny];
+    if (ux != uy)
+        return ux < uy ? -1 : 1;
+    return (nx > ny) - (nx < ny);
+}
+
+static int js_array_cmp_int_str(const void *a, const void *b, void *opaque)
+{
+    return js_cmp_int_str(JS_VALUE_GET_INT(*(const JSValue *)a),
+                          JS_VALUE_GET_INT(*(const JSValue *)b));
+}
+
+static int js_array_cmp_int32_str(const void *a, const void *b, void *opaque)
+{
+    return js_cmp_int_str(*(const int32_t *)a, *(const int32_t *)b);
+}
+
+static int js_array_cmp_str(const void *a, const void *b, void *opaque)
+{
+    return js_string_compare(JS_VALUE_GET_STRING(*(const JSValue *)a),
+                             JS_VALUE_GET_STRING(*(const JSValue *)b));
+}
+
+/* js_array_sort_fast() for the packed element kinds */
+static int js_array_sort_packed(JSContext *ctx, JSObject *p,
+                                JSValueConst method)
+{
+    uint32_t i, count = p->u.array.count;
+    bool desc;
+
+    if (p->u.array.kind == JS_ARRAY_KIND_INT32) {
+        int32_t *tab = p->u.array.u.int32_ptr, v;
+        uint32_t *tmp;
+
+        if (JS_IsUndefined(method)) {
+            rqsort(tab, count, sizeof(tab[0]), js_array_cmp_int32_str, NULL);
+            return 1;
+        }
+        if (!js_is_sub_comparator(method, &desc))
+            return 0;
+        tmp = js_malloc(ctx, sizeof(tmp[0]) * count);
+        if (!tmp)
+            return -1;
+        js_radix_sort32((uint32_t *)tab, tmp, count, JS_RADIX_KEY_SIGNED, 0);
+        js_free(ctx, tmp);
+        if (desc) {
+            for(i = 0; i < count / 2; i++) {
+                v = tab[i];
+                tab[i] = tab[count - 1 - i];
+                tab[count - 1 - i] = v;
+            }
+        }
+    } else {
+        double *tab = p->u.array.u.double_ptr;
+        uint64_t *keys;
+
+        if (JS_IsUndefined(method) || !js_is_sub_comparator(method, &desc))
+            return 0;
+        for(i = 0; i < count; i++) {
+            /* -0 compares equal to +0 with a - b */
+            if (isnan(tab[i]) || (tab[i] == 0 && signbit(tab[i])))
+                return 0;
+        }
+        keys = js_malloc(ctx, sizeof(keys[0]) * count * 2);
+        if (!keys)
+            return -1;
+        for(i = 0; i < count; i++)
+            keys[i] = float64_as_uint64(tab[i]);
+        js_radix_sort64(keys, keys + count, count, JS_RADIX_KEY_FLOAT,
+                        0x7ff0000000000001);
+        for(i = 0; i < count; i++)
+            tab[desc ? count - 1 - i : i] = uint64_as_float64(keys[i]);
+        js_free(ctx, keys);
+    }
+    return 1;
+}
+
+/* Sort in place the fast arrays of strings or numbers for which no JS
+   code needs to be called: the default order for strings and int32, and
+   the a - b comparators for numbers. With these, the elements which
+   compare equal are indistinguishable so the sort does not need to be
+   stable. Return 1 if sorted, 0 if not applicable, -1 if exception. */
+static int js_array_sort_fast(JSContext *ctx, JSValueConst obj, int64_t len,
+                              JSValueConst method)
+{
+    JSObject *p;
+    JSValue *tab;
+    uint32_t i, count;
+    bool all_int, all_num, all_str, desc;
+    uint64_t *keys;
+    double d;
+
+    if (!js_get_fast_array(ctx, obj, &p, &count) || count != len ||
+        count < 2)
+        return 0;
+    if (p->u.array.kind != JS_ARRAY_KIND_VALUE)
+        return js_array_sort_packed(ctx, p, method);
+    tab = p->u.array.u.values;
+    all_int = all_num = all_str = true;
+    for(i = 0; i < count; i++) {
+        switch(JS_VALUE_GET_NORM_TAG(tab[i])) {
+        case JS_TAG_INT:
+            all_str = false;
+            break;
+        case JS_TAG_FLOAT64:
+            d = JS_VALUE_GET_FLOAT64(tab[i]);
+            /* -0 compares equal to +0 with a - b */
+            if (isnan(d) || (d == 0 && signbit(d)))
+                return 0;
+            all_int = all_str = false;
+            break;
+        case JS_TAG_STRING:
+            all_int = all_num = false;
+            break;
+        default:
+            return 0;
+        }
+        if (!all_num && !all_str)
+            return 0;
+    }
+
+    if (JS_IsUndefined(method)) {
+        if (all_str) {
+            for(i = 0; i < count; i++) {
+                if (js_flatten_value(ctx, tab[i]))
+                    return -1;
+            }
+            rqsort(tab, count, sizeof(tab[0]), js_array_cmp_str, NULL);
+        } else if (all_int) {
+            rqsort(tab, count, sizeof(tab[0]), js_array_cmp_int_str, NULL);
+        } else {
+            return 0;
+        }
+        return 1;
+    }
+
+    if (!all_num || !js_is_sub_comparator(method, &desc))
+        return 0;
+    keys = js_malloc(ctx, sizeof(keys[0]) * count * 2);
+    if (!keys)
+        return -1;
+    if (all_int) {
+        uint32_t *keys32 = (uint32_t *)keys;
+        for(i = 0; i < count; i++)
+            keys32[i] = JS_VALUE_GET_INT(tab[i]);
+        js_radix_sort32(keys32, keys32 + count, count,
+                        JS_RADIX_KEY_SIGNED, 0);
+        for(i = 0; i < count; i++)
+            tab[desc ? count - 1 - i : i] = js_int32(keys32[i]);
+    } else {
+        for(i = 0; i < count; i++) {
+            if (JS_VALUE_GET_TAG(tab[i]) == JS_TAG_INT)
+                d = JS_VALUE_GET_INT(tab[i]);
+            else
+                d = JS_VALUE_GET_FLOAT64(tab[i]);
+            keys[i] = float64_as_uint64(d);
+        }
+        js_radix_sort64(keys, keys + count, count, JS_RADIX_KEY_FLOAT,
+                        0x7ff0000000000001);
+        for(i = 0; i < count; i++) {
+            d = uint64_as_float64(keys[i]);
+            tab[desc ? count - 1 - i : i] = js_number(d);
+        }
+    }
+    js_free(ctx, keys);
+    return 1;
+}
+
 static JSValue js_array_sort(JSContext *ctx, JSValueConst this_val,
                              int argc, JSValueConst *argv)
 {
@@ -41380,7 +46017,12 @@ static JSValue js_array_sort(JSContext *ctx, JSValueConst this_val,
     if (js_get_length64(ctx, &len, obj))
         goto exception;
 
-    /* XXX: should special case fast arrays */
+    present = js_array_sort_fast(ctx, obj, len, asc.method);
+    if (present < 0)
+        goto exception;
+    if (present)
+        return obj;
+
     for (i = 0; i < len; i++) {
         if (pos >= array_size) {
             size_t new_size, slack;
@@ -41454,8 +46096,8 @@ fail:
 static JSValue js_array_toSorted(JSContext *ctx, JSValueConst this_val,
                                  int argc, JSValueConst *argv)
 {
-    JSValue arr, obj, ret, *arrp, *pval;
-    JSObject *p;
+    JSValue arr, obj, ret, *pval;
+    JSObject *p, *arrp;
     int64_t i, len;
     uint32_t count32;
 
@@ -41488,7 +46130,7 @@ static JSValue js_array_toSorted(JSContext *ctx, JSValueConst this_val,
         pval = p->u.array.u.values;
         if (js_get_fast_array(ctx, obj, &arrp, &count32) && count32 == len) {
             for (; i < len; i++, pval++)
-                *pval = js_dup(arrp[i]);
+                *pval = js_array_get(arrp, i);
         } else {
             for (; i < len; i++, pval++) {
                 if (-1 == JS_TryGetPropertyInt64(ctx, obj, i, pval)) {
@@ -43518,10 +48160,9 @@ static int string_indexof_char(JSString *p, int c, int from)
         }
     } else {
         if ((c & ~0xff) == 0) {
-            for (i = from; i < len; i++) {
-                if (str8(p)[i] == (uint8_t)c)
-                    return i;
-            }
+            const uint8_t *q = memchr(str8(p) + from, c, len - from);
+            if (q)
+                return q - str8(p);
         }
     }
     return -1;
@@ -43533,6 +48174,20 @@ static int string_indexof(JSString *p1, JSString *p2, int from)
     int c, i, j, len1 = p1->len, len2 = p2->len;
     if (len2 == 0)
         return from;
+    if (len2 > len1 - from)
+        return -1;
+    if (!p1->is_wide_char && !p2->is_wide_char) {
+        /* memchr() the first character, memcmp() the rest */
+        const uint8_t *s1 = str8(p1), *s2 = str8(p2), *q, *q_end;
+        q = s1 + from;
+        q_end = s1 + len1 - len2 + 1;
+        while ((q = memchr(q, s2[0], q_end - q)) != NULL) {
+            if (!memcmp(q + 1, s2 + 1, len2 - 1))
+                return q - s1;
+            q++;
+        }
+        return -1;
+    }
     for (i = from, c = string_get(p2, 0); i + len2 <= len1; i = j + 1) {
         j = string_indexof_char(p1, c, i);
         if (j < 0 || j + len2 > len1)
@@ -43675,7 +48330,9 @@ static JSValue js_string_indexOf(JSContext *ctx, JSValueConst this_val,
         inc = 1;
     }
     ret = -1;
-    if (len >= v_len && inc * (stop - start) >= 0) {
+    if (inc > 0) {
+        ret = string_indexof(p, p1, start);
+    } else if (len >= v_len && inc * (stop - start) >= 0) {
         for (i = start;; i += inc) {
             if (!string_cmp(p, p1, i, 0, v_len)) {
                 ret = i;
@@ -43730,8 +48387,8 @@ static JSValue js_string_includes(JSContext *ctx, JSValueConst this_val,
     len -= v_len;
     ret = 0;
     if (magic == 0) {
-        start = pos;
-        stop = len;
+        ret = string_indexof(p, p1, pos) >= 0;
+        goto done;
     } else {
         if (magic == 1) {
             if (pos > len)
@@ -43864,6 +48521,8 @@ static JSValue js_string___GetSubstitution(JSContext *ctx, JSValueConst this_val
 
     sp = JS_VALUE_GET_STRING(str);
     rp = JS_VALUE_GET_STRING(rep);
+    if (js_string_flatten(ctx, sp) || js_string_flatten(ctx, rp))
+        return JS_EXCEPTION;
 
     string_buffer_init(ctx, b, 0);
 
@@ -44512,10 +49171,75 @@ exception:
     return ret;
 }
 
+/* Latin-1 letters that have a single 8-bit lower / upper case mapping,
+   written without tables so that the conversion loops vectorize */
+static inline int is_latin1_upper(int c)
+{
+    return (unsigned)(c - 'A') < 26 || ((unsigned)(c - 0xC0) < 0x1F && c != 0xD7);
+}
+
+static inline int is_latin1_lower(int c)
+{
+    return (unsigned)(c - 'a') < 26 || ((unsigned)(c - 0xE0) < 0x1F && c != 0xF7);
+}
+
+/* U+00B5, U+00DF and U+00FF upper case to non Latin-1 characters */
+static inline int is_latin1_upper_special(int c)
+{
+    return c == 0xB5 || c == 0xDF || c == 0xFF;
+}
+
+/* Case conversion of the 8-bit string 'val'. Return 'val' if no
+   character changes and JS_UNDEFINED if the result is not an 8-bit
+   string. */
+static JSValue js_string_case_conv8(JSContext *ctx, JSValue val, int to_lower)
+{
+    JSString *p = JS_VALUE_GET_STRING(val), *q;
+    const uint8_t *src = str8(p);
+    uint8_t *dst;
+    uint32_t i, len = p->len;
+    int special;
+
+    if (to_lower) {
+        for (i = 0; i < len && !is_latin1_upper(src[i]); i++)
+            continue;
+    } else {
+        for (i = 0; i < len && !is_latin1_lower(src[i]) &&
+             !is_latin1_upper_special(src[i]); i++)
+            continue;
+    }
+    if (i == len)
+        return val;
+    q = js_alloc_string(ctx, len, 0);
+    if (!q) {
+        JS_FreeValue(ctx, val);
+        return JS_EXCEPTION;
+    }
+    dst = str8(q);
+    memcpy(dst, src, i);
+    special = 0;
+    if (to_lower) {
+        for (; i < len; i++)
+            dst[i] = src[i] + (is_latin1_upper(src[i]) << 5);
+    } else {
+        for (; i < len; i++) {
+            dst[i] = src[i] - (is_latin1_lower(src[i]) << 5);
+            special |= is_latin1_upper_special(src[i]);
+        }
+    }
+    if (special) {
+        js_free_string(ctx->rt, q);
+        return JS_UNDEFINED;
+    }
+    dst[len] = '\0';
+    JS_FreeValue(ctx, val);
+    return JS_MKPTR(JS_TAG_STRING, q);
+}
+
 static JSValue js_string_toLowerCase(JSContext *ctx, JSValueConst this_val,
                                      int argc, JSValueConst *argv, int to_lower)
 {
-    JSValue val;
+    JSValue val, ret;
     StringBuffer b_s, *b = &b_s;
     JSString *p;
     int i, c, j, l;
@@ -44527,6 +49251,11 @@ static JSValue js_string_toLowerCase(JSContext *ctx, JSValueConst this_val,
     p = JS_VALUE_GET_STRING(val);
     if (p->len == 0)
         return val;
+    if (!p->is_wide_char) {
+        ret = js_string_case_conv8(ctx, val, to_lower);
+        if (!JS_IsUndefined(ret))
+            return ret;
+    }
     if (string_buffer_init(ctx, b, p->len))
         goto fail;
     for(i = 0; i < p->len;) {
@@ -45438,6 +50167,131 @@ static void js_regexp_finalizer(JSRuntime *rt, JSValueConst val)
 }
 
 /* create a string containing the RegExp bytecode */
+/* Compiled RegExp bytecode of the last used (pattern, flags) pairs. The
+   bytecode strings are immutable so they are shared with the RegExp
+   objects. */
+#define JS_REGEXP_CACHE_SIZE      64
+#define JS_REGEXP_CACHE_HASH_SIZE 128 /* power of two */
+
+typedef struct JSRegExpCacheEntry {
+    struct list_head link; /* in JSRegExpCache.lru_list */
+    struct JSRegExpCacheEntry *hash_next;
+    JSAtom pattern;
+    int re_flags;
+    JSValue bytecode; /* string */
+} JSRegExpCacheEntry;
+
+struct JSRegExpCache {
+    struct list_head lru_list; /* most recently used first */
+    int count;
+    int64_t hits;
+    int64_t misses;
+    JSRegExpCacheEntry *hash[JS_REGEXP_CACHE_HASH_SIZE];
+};
+
+static inline uint32_t js_regexp_cache_hash(JSAtom pattern, int re_flags)
+{
+    return ((pattern * 0x9E3779B1) ^ re_flags) & (JS_REGEXP_CACHE_HASH_SIZE - 1);
+}
+
+/* return the cached bytecode or JS_UNDEFINED */
+static JSValue js_regexp_cache_find(JSRuntime *rt, JSAtom pattern,
+                                    int re_flags)
+{
+    JSRegExpCache *rc = rt->regexp_cache;
+    JSRegExpCacheEntry *e;
+
+    if (!rc) {
+        rc = js_mallocz_rt(rt, sizeof(*rc));
+        if (!rc)
+            return JS_UNDEFINED;
+        init_list_head(&rc->lru_list);
+        rt->regexp_cache = rc;
+    }
+    for(e = rc->hash[js_regexp_cache_hash(pattern, re_flags)]; e != NULL;
+        e = e->hash_next) {
+        if (e->pattern == pattern && e->re_flags == re_flags) {
+            list_del(&e->link);
+            list_add(&e->link, &rc->lru_list);
+            rc->hits++;
+            return js_dup(e->bytecode);
+        }
+    }
+    rc->misses++;
+    return JS_UNDEFINED;
+}
+
+static void js_regexp_cache_remove(JSRuntime *rt, JSRegExpCacheEntry *e)
+{
+    JSRegExpCache *rc = rt->regexp_cache;
+    JSRegExpCacheEntry **pe;
+
+    pe = &rc->hash[js_regexp_cache_hash(e->pattern, e->re_flags)];
+    while (*pe != e)
+        pe = &(*pe)->hash_next;
+    *pe = e->hash_next;
+    list_del(&e->link);
+    rc->count--;
+    JS_FreeAtomRT(rt, e->pattern);
+    JS_FreeValueRT(rt, e->bytecode);
+    js_free_rt(rt, e);
+}
+
+/* add a new entry after a failed js_regexp_cache_find(), evicting the least recently used one if needed. Out
+   of memory errors are ignored. */
+static void js_regexp_cache_add(JSRuntime *rt, JSAtom pattern, int re_flags,
+                                JSValueConst bytecode)
+{
+    JSRegExpCache *rc = rt->regexp_cache;
+    JSRegExpCacheEntry *e;
+    uint32_t h;
+
+    if (!rc)
+        return;
+    if (rc->count >= JS_REGEXP_CACHE_SIZE) {
+        js_regexp_cache_remove(rt, list_entry(rc->lru_list.prev,
+                                               JSRegExpCacheEntry, link));
+    }
+    e = js_malloc_rt(rt, sizeof(*e));
+    if (!e)
+        return;
+    e->pattern = JS_DupAtomRT(rt, pattern);
+    e->re_flags = re_flags;
+    e->bytecode = js_dup(bytecode);
+    h = js_regexp_cache_hash(pattern, re_flags);
+    e->hash_next = rc->hash[h];
+    rc->hash[h] = e;
+    list_add(&e->link, &rc->lru_list);
+    rc->count++;
+}
+
+static void js_regexp_cache_free(JSRuntime *rt)
+{
+    JSRegExpCache *rc = rt->regexp_cache;
+    struct list_head *el, *el1;
+
+    if (!rc)
+        return;
+    list_for_each_safe(el, el1, &rc->lru_list) {
+        js_regexp_cache_remove(rt, list_entry(el, JSRegExpCacheEntry, link));
+    }
+    js_free_rt(rt, rc);
+    rt->regexp_cache = NULL;
+}
+
+static void js_regexp_cache_memory_usage(JSRuntime *rt, JSMemoryUsage *s)
+{
+    JSRegExpCache *rc = rt->regexp_cache;
+
+    if (!rc)
+        return;
+    s->regexp_cache_count = rc->count;
+    s->regexp_cache_hits = rc->hits;
+    s->regexp_cache_misses = rc->misses;
+    s->memory_used_count += 1 + rc->count;
+    s->memory_used_size += sizeof(*rc) + rc->count * sizeof(JSRegExpCacheEntry);
+}
+
 static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
                                  JSValueConst flags)
 {
@@ -45447,6 +50301,7 @@ static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
     size_t i, len;
     int re_bytecode_len;
     JSValue ret;
+    JSAtom atom;
     char error_msg[64];
 
     re_flags = 0;
@@ -45498,19 +50353,34 @@ static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
         if (re_flags & LRE_FLAG_UNICODE_SETS)
             return JS_ThrowSyntaxError(ctx, "invalid regular expression flags");
 
+    atom = JS_ATOM_NULL;
+    if (JS_VALUE_GET_TAG(pattern) == JS_TAG_STRING) {
+        atom = JS_NewAtomStr(ctx, JS_VALUE_GET_STRING(js_dup(pattern)));
+        if (atom == JS_ATOM_NULL)
+            return JS_EXCEPTION;
+        ret = js_regexp_cache_find(ctx->rt, atom, re_flags);
+        if (!JS_IsUndefined(ret))
+            goto done;
+    }
+
+    ret = JS_EXCEPTION;
     str = JS_ToCStringLen2(ctx, &len, pattern, !(re_flags & LRE_FLAG_UNICODE));
     if (!str)
-        return JS_EXCEPTION;
+        goto done;
     re_bytecode_buf = lre_compile(&re_bytecode_len, error_msg,
                                   sizeof(error_msg), str, len, re_flags, ctx);
     JS_FreeCString(ctx, str);
     if (!re_bytecode_buf) {
         JS_ThrowSyntaxError(ctx, "%s", error_msg);
-        return JS_EXCEPTION;
+        goto done;
     }
 
     ret = js_new_string8_len(ctx, (char *)re_bytecode_buf, re_bytecode_len);
     js_free(ctx, re_bytecode_buf);
+    if (atom != JS_ATOM_NULL && !JS_IsException(ret))
+        js_regexp_cache_add(ctx->rt, atom, re_flags, ret);
+ done:
+    JS_FreeAtom(ctx, atom);
     return ret;
 }
 
@@ -45895,6 +50765,8 @@ static JSValue js_regexp_escape(JSContext *ctx, JSValueConst this_val,
     if (!JS_IsString(argv[0]))
         return JS_ThrowTypeError(ctx, "not a string");
     p = JS_VALUE_GET_STRING(argv[0]);
+    if (js_string_flatten(ctx, p))
+        return JS_EXCEPTION;
     string_buffer_init2(ctx, b, 0, p->is_wide_char);
     for (i = 0; i < p->len; i++) {
         c = p->is_wide_char ? (uint32_t)str16(p)[i] : (uint32_t)str8(p)[i];
@@ -47027,6 +51899,99 @@ void JS_AddIntrinsicRegExp(JSContext *ctx)
 
 /* JSON */
 
+/* JSON.parse() records of the same layout go through the same chain of
+   shapes. The transitions are memoized during a parse so that they do
+   not require a lookup in the shape hash table. */
+#define JSON_SHAPE_CACHE_SIZE 256 /* power of two */
+
+typedef struct JSONShapeCacheEntry {
+    JSShape *parent; /* NULL if the entry is unused */
+    JSShape *child;
+    JSAtom atom;
+} JSONShapeCacheEntry;
+
+static void json_free_shape_cache(JSParseState *s)
+{
+    JSRuntime *rt = s->ctx->rt;
+    JSONShapeCacheEntry *e;
+    int i;
+
+    if (!s->json_shape_cache)
+        return;
+    for(i = 0; i < JSON_SHAPE_CACHE_SIZE; i++) {
+        e = &s->json_shape_cache[i];
+        if (e->parent) {
+            js_free_shape(rt, e->parent);
+            js_free_shape(rt, e->child);
+        }
+    }
+    js_free_rt(rt, s->json_shape_cache);
+    s->json_shape_cache = NULL;
+}
+
+/* define the enumerable, configurable and writable property 'atom' of
+   the plain object 'obj'. 'val' is freed. Return -1 if exception. */
+static int json_define_property(JSParseState *s, JSValueConst obj,
+                                JSAtom atom, JSValue val)
+{
+    JSContext *ctx = s->ctx;
+    JSObject *p = JS_VALUE_GET_OBJ(obj);
+    JSShape *sh, *new_sh;
+    JSProperty *new_prop;
+    JSONShapeCacheEntry *e;
+    int ret;
+
+    if (!s->json_shape_cache) {
+        s->json_shape_cache = js_mallocz(ctx, sizeof(*e) * JSON_SHAPE_CACHE_SIZE);
+        if (!s->json_shape_cache) {
+            JS_FreeValue(ctx, val);
+            return -1;
+        }
+    }
+    sh = p->shape;
+    e = &s->json_shape_cache[(((uintptr_t)sh >> 4) ^ atom) &
+                             (JSON_SHAPE_CACHE_SIZE - 1)];
+    if (e->parent == sh && e->atom == atom) {
+        /* 'child' was built by adding 'atom' to 'sh' */
+        new_sh = e->child;
+        if (new_sh->prop_size != sh->prop_size) {
+            new_prop = js_realloc(ctx, p->prop, sizeof(p->prop[0]) *
+                                  new_sh->prop_size);
+            if (!new_prop) {
+                JS_FreeValue(ctx, val);
+                return -1;
+            }
+            p->prop = new_prop;
+        }
+        p->shape = js_dup_shape(new_sh);
+        js_free_shape(ctx->rt, sh);
+        p->prop[new_sh->prop_count - 1].u.value = val;
+        return 0;
+    }
+
+    if (!sh->is_hashed)
+        return JS_DefinePropertyValue(ctx, obj, atom, val, JS_PROP_C_W_E);
+    /* keep 'sh' alive so that it stays a valid cache key */
+    js_dup_shape(sh);
+    ret = JS_DefinePropertyValue(ctx, obj, atom, val, JS_PROP_C_W_E);
+    new_sh = p->shape;
+    if (ret >= 0 && new_sh != sh && new_sh->is_hashed &&
+        new_sh->prop_count == sh->prop_count + 1 &&
+        new_sh->prop[sh->prop_count].atom == atom &&
+        new_sh->prop[sh->prop_count].flags == JS_PROP_C_W_E) {
+        if (e->parent) {
+            js_free_shape(ctx->rt, e->parent);
+            js_free_shape(ctx->rt, e->child);
+        }
+        e->parent = sh;
+        e->child = js_dup_shape(new_sh);
+        e->atom = atom;
+    } else {
+        js_free_shape(ctx->rt, sh);
+    }
+    return ret;
+}
+
 static JSValue json_parse_value(JSParseState *s)
 {
     JSContext *ctx = s->ctx;
@@ -47068,8 +52033,7 @@ static JSValue json_parse_value(JSParseState *s)
                         JS_FreeAtom(ctx, prop_name);
                         goto fail;
                     }
-                    ret = JS_DefinePropertyValue(ctx, val, prop_name,
-                                                 prop_val, JS_PROP_C_W_E);
+                    ret = json_define_property(s, val, prop_name, prop_val);
                     JS_FreeAtom(ctx, prop_name);
                     if (ret < 0)
                         goto fail;
@@ -47091,6 +52055,7 @@ static JSValue json_parse_value(JSParseState *s)
     case '[':
         {
             JSValue el;
+            JSObject *p;
             uint32_t idx;
 
             if (json_next_token(s))
@@ -47103,7 +52068,11 @@ static JSValue json_parse_value(JSParseState *s)
                     el = json_parse_value(s);
                     if (JS_IsException(el))
                         goto fail;
-                    ret = JS_DefinePropertyValueUint32(ctx, val, idx, el, JS_PROP_C_W_E);
+                    p = JS_VALUE_GET_OBJ(val);
+                    if (likely(p->fast_array))
+                        ret = add_fast_array_element(ctx, p, el, JS_PROP_THROW);
+                    else
+                        ret = JS_DefinePropertyValueUint32(ctx, val, idx, el, JS_PROP_C_W_E);
                     if (ret < 0)
                         goto fail;
                     if (s->token.val == ']')
@@ -47174,10 +52143,12 @@ JSValue JS_ParseJSON(JSContext *ctx, const char *buf, size_t buf_len, const char
         if (js_parse_error(s, "unexpected data at the end"))
             goto fail;
     }
+    json_free_shape_cache(s);
     return val;
  fail:
     JS_FreeValue(ctx, val);
     free_token(s, &s->token);
+    json_free_shape_cache(s);
     return JS_EXCEPTION;
 }
 
@@ -47291,6 +52262,8 @@ typedef struct JSONStringifyContext {
     JSValue gap;
     JSValue empty;
     StringBuffer *b;
+    /* incremented before anything which may run JS code */
+    uint32_t side_effects;
 } JSONStringifyContext;
 
 static JSValue JS_ToQuotedStringFree(JSContext *ctx, JSValue val) {
@@ -47307,6 +52280,7 @@ static JSValue js_json_check(JSContext *ctx, JSONStringifyContext *jsc,
     JSValueConst args[2];
 
     if (JS_IsObject(val) || JS_IsBigInt(val)) {
+        jsc->side_effects++;
 		JSValue f = JS_GetProperty(ctx, val, JS_ATOM_toJSON);
 		if (JS_IsException(f))
 			goto exception;
@@ -47322,6 +52296,7 @@ static JSValue js_json_check(JSContext *ctx, JSONStringifyContext *jsc,
 	}
 
     if (!JS_IsUndefined(jsc->replacer_func)) {
+        jsc->side_effects++;
         args[0] = key;
         args[1] = val;
         v = JS_Call(ctx, jsc->replacer_func, holder, 2, args);
@@ -47355,6 +52330,196 @@ exception:
     return JS_EXCEPTION;
 }
 
+/* true if 'p' and its prototypes are ordinary objects without a toJSON
+   property, so that js_json_check() would return it unchanged */
+static bool js_json_is_plain(JSObject *p)
+{
+    JSShapeProperty *prs;
+    JSProperty *pr;
+
+    for(; p != NULL; p = p->shape->proto) {
+        if (p->class_id != JS_CLASS_OBJECT && p->class_id != JS_CLASS_ARRAY)
+            return false;
+        prs = find_own_property(&pr, p, JS_ATOM_toJSON);
+        if (prs)
+            return false;
+    }
+    return true;
+}
+
+/* js_json_check() without replacer function. The key is only converted
+   to a string if toJSON() may be called: it is 'key_atom' or the
+   index 'key_idx' if 'key_atom' is JS_ATOM_NULL. */
+static JSValue js_json_check_fast(JSContext *ctx, JSONStringifyContext *jsc,
+                                  JSValueConst holder, JSValue val,
+                                  JSAtom key_atom, int64_t key_idx)
+{
+    JSValue key;
+
+    switch (JS_VALUE_GET_NORM_TAG(val)) {
+    case JS_TAG_OBJECT:
+        if (js_json_is_plain(JS_VALUE_GET_OBJ(val)))
+            return val;
+        break;
+    case JS_TAG_STRING:
+    case JS_TAG_INT:
+    case JS_TAG_FLOAT64:
+    case JS_TAG_BOOL:
+    case JS_TAG_NULL:
+        return val;
+    case JS_TAG_SHORT_BIG_INT:
+    case JS_TAG_BIG_INT:
+        break;
+    default:
+        JS_FreeValue(ctx, val);
+        return JS_UNDEFINED;
+    }
+    if (key_atom != JS_ATOM_NULL)
+        key = JS_AtomToString(ctx, key_atom);
+    else
+        key = JS_ToStringFree(ctx, js_int64(key_idx));
+    if (JS_IsException(key)) {
+        JS_FreeValue(ctx, val);
+        return JS_EXCEPTION;
+    }
+    val = js_json_check(ctx, jsc, holder, val, key);
+    JS_FreeValue(ctx, key);
+    return val;
+}
+
+static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
+                          JSValueConst holder, JSValue val,
+                          JSValueConst indent);
+
+/* Serialize the fast arrays and the ordinary objects whose enumerable
+   own properties are plain data properties with string keys, walking
+   the shape directly. As long as no JS code runs, the properties are
+   read without lookup. Return 0 if 'val' is not such an object and
+   nothing was output, 1 if it was serialized and -1 if exception. */
+static int js_json_to_str_fast(JSContext *ctx, JSONStringifyContext *jsc,
+                               JSValueConst val, JSValueConst indent,
+                               JSValueConst indent1, JSValueConst sep,
+                               JSValueConst sep1)
+{
+    JSRuntime *rt = ctx->rt;
+    JSObject *p = JS_VALUE_GET_OBJ(val);
+    JSShape *sh;
+    JSShapeProperty *prs;
+    JSAtomStruct *key;
+    JSValue v;
+    uint32_t side_effects, idx;
+    int64_t i, len;
+    bool has_content, has_objects;
+
+    side_effects = jsc->side_effects;
+    if (p->class_id == JS_CLASS_ARRAY) {
+        if (!p->fast_array ||
+            JS_VALUE_GET_TAG(p->prop[0].u.value) != JS_TAG_INT ||
+            JS_VALUE_GET_INT(p->prop[0].u.value) != p->u.array.count)
+            return 0;
+        len = p->u.array.count;
+        string_buffer_putc8(jsc->b, '[');
+        for(i = 0; i < len; i++) {
+            if (i > 0)
+                string_buffer_putc8(jsc->b, ',');
+            string_buffer_concat_value(jsc->b, sep);
+            if (jsc->side_effects == side_effects) {
+                v = js_array_get(p, i);
+            } else {
+                /* the array may have been modified */
+                v = JS_GetPropertyInt64(ctx, val, i);
+                if (JS_IsException(v))
+                    return -1;
+            }
+            v = js_json_check_fast(ctx, jsc, val, v, JS_ATOM_NULL, i);
+            if (JS_IsException(v))
+                return -1;
+            if (JS_IsUndefined(v))
+                v = JS_NULL;
+            if (js_json_to_str(ctx, jsc, val, v, indent1))
+                return -1;
+        }
+        if (len > 0 && !JS_IsEmptyString(jsc->gap)) {
+            string_buffer_putc8(jsc->b, '\n');
+            string_buffer_concat_value(jsc->b, indent);
+        }
+        string_buffer_putc8(jsc->b, ']');
+        return 1;
+    }
+
+    if (p->class_id != JS_CLASS_OBJECT)
+        return 0;
+    sh = p->shape;
+    has_objects = false;
+    for(i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++) {
+        if (prs->atom == JS_ATOM_NULL || !(prs->flags & JS_PROP_ENUMERABLE))
+            continue;
+        /* integer keys are enumerated first */
+        if ((prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL ||
+            JS_AtomIsArrayIndex(ctx, &idx, prs->atom))
+            return 0;
+        /* toJSON() may only be called for these values */
+        switch(JS_VALUE_GET_NORM_TAG(p->prop[i].u.value)) {
+        case JS_TAG_OBJECT:
+        case JS_TAG_SHORT_BIG_INT:
+        case JS_TAG_BIG_INT:
+            has_objects = true;
+            break;
+        default:
+            break;
+        }
+    }
+    if (has_objects) {
+        /* the keys must be those of the object before any JS code runs:
+           a shared shape is not modified, so it is used as snapshot */
+        if (!sh->is_hashed)
+            return 0;
+        js_dup_shape(sh);
+    }
+    string_buffer_putc8(jsc->b, '{');
+    has_content = false;
+    for(i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++) {
+        if (prs->atom == JS_ATOM_NULL || !(prs->flags & JS_PROP_ENUMERABLE))
+            continue;
+        key = rt->atom_array[prs->atom];
+        if (key->atom_type != JS_ATOM_TYPE_STRING)
+            continue;
+        if (jsc->side_effects == side_effects) {
+            v = js_dup(p->prop[i].u.value);
+        } else {
+            v = JS_GetProperty(ctx, val, prs->atom);
+            if (JS_IsException(v))
+                goto fail;
+        }
+        v = js_json_check_fast(ctx, jsc, val, v, prs->atom, 0);
+        if (JS_IsException(v))
+            goto fail;
+        if (JS_IsUndefined(v))
+            continue;
+        if (has_content)
+            string_buffer_putc8(jsc->b, ',');
+        string_buffer_concat_value(jsc->b, sep);
+        string_buffer_quote(jsc->b, key);
+        string_buffer_putc8(jsc->b, ':');
+        string_buffer_concat_value(jsc->b, sep1);
+        if (js_json_to_str(ctx, jsc, val, v, indent1))
+            goto fail;
+        has_content = true;
+    }
+    if (has_content && !JS_IsEmptyString(jsc->gap)) {
+        string_buffer_putc8(jsc->b, '\n');
+        string_buffer_concat_value(jsc->b, indent);
+    }
+    string_buffer_putc8(jsc->b, '}');
+    if (has_objects)
+        js_free_shape(rt, sh);
+    return 1;
+ fail:
+    if (has_objects)
+        js_free_shape(rt, sh);
+    return -1;
+}
+
 static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
                           JSValueConst holder, JSValue val,
                           JSValueConst indent)
@@ -47380,11 +52545,13 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
         p = JS_VALUE_GET_OBJ(val);
         cl = p->class_id;
         if (cl == JS_CLASS_STRING) {
+            jsc->side_effects++;
             val = JS_ToStringFree(ctx, val);
             if (JS_IsException(val))
                 goto exception;
             goto concat_primitive;
         } else if (cl == JS_CLASS_NUMBER) {
+            jsc->side_effects++;
             val = JS_ToNumberFree(ctx, val);
             if (JS_IsException(val))
                 goto exception;
@@ -47417,6 +52584,17 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
         v = js_array_push(ctx, jsc->stack, 1, vc(&val), 0);
         if (check_exception_free(ctx, v))
             goto exception;
+        if (JS_IsUndefined(jsc->replacer_func) &&
+            JS_IsUndefined(jsc->property_list)) {
+            ret = js_json_to_str_fast(ctx, jsc, val, indent, indent1,
+                                      sep, sep1);
+            if (ret < 0)
+                goto exception;
+            if (ret)
+                goto done;
+        }
+        /* getters and proxies may run JS code */
+        jsc->side_effects++;
         ret = js_is_array(ctx, val);
         if (ret < 0)
             goto exception;
@@ -47496,6 +52674,7 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
             }
             string_buffer_putc8(jsc->b, '}');
         }
+    done:
         if (check_exception_free(ctx, js_array_pop(ctx, jsc->stack, 0, NULL, 0)))
             goto exception;
         JS_FreeValue(ctx, val);
@@ -47509,20 +52688,31 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
  concat_primitive:
     switch (JS_VALUE_GET_NORM_TAG(val)) {
     case JS_TAG_STRING:
-        val = JS_ToQuotedStringFree(ctx, val);
-        if (JS_IsException(val))
+        if (js_string_flatten(ctx, JS_VALUE_GET_STRING(val)))
             goto exception;
-        goto concat_value;
+        ret = string_buffer_quote(jsc->b, JS_VALUE_GET_STRING(val));
+        JS_FreeValue(ctx, val);
+        return ret;
     case JS_TAG_FLOAT64:
         if (!isfinite(JS_VALUE_GET_FLOAT64(val))) {
-            val = JS_NULL;
+            return string_buffer_puts8(jsc->b, "null");
+        } else {
+            char buf[128];
+            JSDTOATempMem dtoa_mem;
+            len = js_dtoa(buf, JS_VALUE_GET_FLOAT64(val), 10, 0,
+                          JS_DTOA_FORMAT_FREE, &dtoa_mem);
+            return string_buffer_write8(jsc->b, (uint8_t *)buf, len);
         }
-        goto concat_value;
     case JS_TAG_INT:
+        {
+            char buf[16];
+            len = i32toa(buf, JS_VALUE_GET_INT(val));
+            return string_buffer_write8(jsc->b, (uint8_t *)buf, len);
+        }
     case JS_TAG_BOOL:
+        return string_buffer_puts8(jsc->b, JS_VALUE_GET_BOOL(val) ? "true" : "false");
     case JS_TAG_NULL:
-    concat_value:
-        return string_buffer_concat_value_free(jsc->b, val);
+        return string_buffer_puts8(jsc->b, "null");
     case JS_TAG_SHORT_BIG_INT:
     case JS_TAG_BIG_INT:
         JS_ThrowTypeError(ctx, "BigInt are forbidden in JSON.stringify");
@@ -47542,22 +52732,24 @@ exception:
     return -1;
 }
 
-JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
-                         JSValueConst replacer, JSValueConst space0)
+/* Serialize 'obj' to 'b'. Return -1 if exception, 0 if the result is
+   undefined and 1 otherwise. 'b' must only be freed in the latter case. */
+static int js_json_stringify_to_buf(JSContext *ctx, StringBuffer *b,
+                                    JSValueConst obj, JSValueConst replacer,
+                                    JSValueConst space0)
 {
-    StringBuffer b_s;
     JSONStringifyContext jsc_s, *jsc = &jsc_s;
-    JSValue val, v, space, ret, wrapper;
-    int res;
+    JSValue val, v, space, wrapper;
+    int res, ret;
     int64_t i, j, n;
 
     jsc->replacer_func = JS_UNDEFINED;
     jsc->stack = JS_UNDEFINED;
     jsc->property_list = JS_UNDEFINED;
     jsc->gap = JS_UNDEFINED;
-    jsc->b = &b_s;
+    jsc->b = b;
     jsc->empty = js_empty_string(ctx->rt);
-    ret = JS_UNDEFINED;
+    jsc->side_effects = 0;
     wrapper = JS_UNDEFINED;
 
     string_buffer_init(ctx, jsc->b, 0);
@@ -47635,6 +52827,8 @@ JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
         jsc->gap = JS_NewStringLen(ctx, "          ", n);
     } else if (JS_IsString(space)) {
         JSString *p = JS_VALUE_GET_STRING(space);
+        if (js_string_flatten(ctx, p))
+            goto exception;
         jsc->gap = js_sub_string(ctx, p, 0, min_int(p->len, 10));
     } else {
         jsc->gap = js_dup(jsc->empty);
@@ -47654,17 +52848,19 @@ JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
     if (JS_IsException(val))
         goto exception;
     if (JS_IsUndefined(val)) {
-        ret = JS_UNDEFINED;
+        ret = 0;
         goto done1;
     }
     if (js_json_to_str(ctx, jsc, wrapper, val, jsc->empty))
         goto exception;
+    if (jsc->b->error_status)
+        goto exception;
 
-    ret = string_buffer_end(jsc->b);
+    ret = 1;
     goto done;
 
 exception:
-    ret = JS_EXCEPTION;
+    ret = -1;
 done1:
     string_buffer_free(jsc->b);
 done:
@@ -47676,6 +52872,54 @@ done:
     return ret;
 }
 
+JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
+                         JSValueConst replacer, JSValueConst space0)
+{
+    StringBuffer b_s, *b = &b_s;
+    int ret;
+
+    ret = js_json_stringify_to_buf(ctx, b, obj, replacer, space0);
+    if (ret < 0)
+        return JS_EXCEPTION;
+    if (ret == 0)
+        return JS_UNDEFINED;
+    return string_buffer_end(b);
+}
+
+char *JS_JSONStringifyUTF8(JSContext *ctx, JSValueConst obj,
+                           JSValueConst replacer, JSValueConst space0,
+                           char *buf, size_t buf_size, size_t *plen)
+{
+    StringBuffer b_s, *b = &b_s;
+    char *out;
+    size_t len;
+    int ret;
+
+    *plen = 0;
+    ret = js_json_stringify_to_buf(ctx, b, obj, replacer, space0);
+    if (ret <= 0)
+        return NULL;
+    /* the encoders return the needed length if 'buf' is too small */
+    if (b->is_wide_char)
+        len = utf8_encode_buf16(buf, buf_size, str16(b->str), b->len);
+    else
+        len = utf8_encode_buf8(buf, buf_size, str8(b->str), b->len);
+    out = buf;
+    if (len >= buf_size) {
+        out = js_malloc(ctx, len + 1);
+        if (!out)
+            goto done;
+        if (b->is_wide_char)
+            utf8_encode_buf16(out, len + 1, str16(b->str), b->len);
+        else
+            utf8_encode_buf8(out, len + 1, str8(b->str), b->len);
+    }
+    *plen = len;
+ done:
+    string_buffer_free(b);
+    return out;
+}
+
 static JSValue js_json_stringify(JSContext *ctx, JSValueConst this_val,
                                  int argc, JSValueConst *argv)
 {
@@ -48978,6 +54222,13 @@ static const JSCFunctionListEntry js_symbol_funcs[] = {
 #define MAGIC_SET (1 << 0)
 #define MAGIC_WEAK (1 << 1)
 
+typedef struct JSMapIteratorData {
+    JSValue obj; /* JS_UNDEFINED when the iteration is done */
+    JSIteratorKindEnum kind;
+    uint32_t pos; /* index of the next record */
+    struct list_head link; /* in JSMapState.iterators until the end */
+} JSMapIteratorData;
+
 static JSValue js_map_constructor(JSContext *ctx, JSValueConst new_target,
                                   int argc, JSValueConst *argv, int magic)
 {
@@ -48991,18 +54242,13 @@ static JSValue js_map_constructor(JSContext *ctx, JSValueConst new_target,
     obj = js_create_from_ctor(ctx, new_target, JS_CLASS_MAP + magic);
     if (JS_IsException(obj))
         return JS_EXCEPTION;
+    /* the tables are allocated by the first insertion */
     s = js_mallocz(ctx, sizeof(*s));
     if (!s)
         goto fail;
-    init_list_head(&s->records);
+    init_list_head(&s->iterators);
     s->is_weak = is_weak;
     JS_SetOpaqueInternal(obj, s);
-    s->hash_size = 1;
-    s->hash_table = js_malloc(ctx, sizeof(s->hash_table[0]) * s->hash_size);
-    if (!s->hash_table)
-        goto fail;
-    init_list_head(&s->hash_table[0]);
-    s->record_count_threshold = 4;
 
     arr = JS_UNDEFINED;
     if (argc > 0)
@@ -49103,7 +54349,7 @@ static JSValueConst map_normalize_key_const(JSContext *ctx, JSValueConst key)
 }
 
 /* XXX: better hash ? */
-static uint32_t map_hash_key(JSContext *ctx, JSValueConst key)
+static uint32_t map_hash_key(JSRuntime *rt, JSValueConst key)
 {
     uint32_t tag = JS_VALUE_GET_NORM_TAG(key);
     uint32_t h;
@@ -49116,7 +54362,7 @@ static uint32_t map_hash_key(JSContext *ctx, JSValueConst key)
         h = JS_VALUE_GET_INT(key);
         break;
     case JS_TAG_STRING:
-        h = hash_string(JS_VALUE_GET_STRING(key), 0);
+        h = hash_string_rt(rt, JS_VALUE_GET_STRING(key), 0);
         break;
     case JS_TAG_OBJECT:
     case JS_TAG_SYMBOL:
@@ -49149,50 +54395,155 @@ static uint32_t map_hash_key(JSContext *ctx, JSValueConst key)
     return h;
 }
 
+#define MAP_HASH_FREE    UINT32_MAX
+#define MAP_MIN_RECORDS  4
+#define MAP_MAX_RECORDS  (1 << 30)
+
+/* Fibonacci hashing: the low bits of the object hashes are zero */
+static inline uint32_t map_hash_slot(uint32_t h, int hash_bits)
+{
+    return (h * 0x9E3779B1) >> (32 - hash_bits);
+}
+
+static inline bool map_same_key(JSContext *ctx, JSValueConst a, JSValueConst b)
+{
+    uint32_t tag = JS_VALUE_GET_TAG(a);
+
+    /* fast path for the most usual keys. 'a' may be a deleted record. */
+    if (tag == JS_VALUE_GET_TAG(b)) {
+        switch(tag) {
+        case JS_TAG_OBJECT:
+        case JS_TAG_SYMBOL:
+            return JS_VALUE_GET_PTR(a) == JS_VALUE_GET_PTR(b);
+        case JS_TAG_INT:
+            return JS_VALUE_GET_INT(a) == JS_VALUE_GET_INT(b);
+        default:
+            break;
+        }
+    } else if (tag == JS_TAG_UNINITIALIZED) {
+        return false;
+    }
+    return js_same_value_zero(ctx, a, b);
+}
+
 static JSMapRecord *map_find_record(JSContext *ctx, JSMapState *s,
                                     JSValueConst key)
 {
-    struct list_head *el;
     JSMapRecord *mr;
-    uint32_t h;
-    h = map_hash_key(ctx, key) & (s->hash_size - 1);
-    list_for_each(el, &s->hash_table[h]) {
-        mr = list_entry(el, JSMapRecord, hash_link);
-        if (js_same_value_zero(ctx, mr->key, key))
+    uint32_t h, i, idx, mask;
+
+    if (s->record_count == 0)
+        return NULL;
+    h = map_hash_key(ctx->rt, key);
+    mask = (1 << s->hash_bits) - 1;
+    for(i = map_hash_slot(h, s->hash_bits);; i = (i + 1) & mask) {
+        idx = s->hash_table[i];
+        if (idx == MAP_HASH_FREE)
+            return NULL;
+        mr = &s->records[idx];
+        if (mr->hash == h && map_same_key(ctx, mr->key, key))
             return mr;
     }
-    return NULL;
 }
 
-static void map_hash_resize(JSContext *ctx, JSMapState *s)
+/* same as map_find_record() for a WeakMap/WeakSet key, without context */
+static JSMapRecord *map_find_weak_record(JSRuntime *rt, JSMapState *s,
+                                         JSValueConst key)
 {
-    uint32_t new_hash_size, i, h;
-    struct list_head *new_hash_table, *el;
     JSMapRecord *mr;
+    uint32_t h, i, idx, mask;
 
-    /* XXX: no reporting of memory allocation failure */
-    if (s->hash_size == 1)
-        new_hash_size = 4;
-    else
-        new_hash_size = s->hash_size * 2;
-    new_hash_table = js_realloc(ctx, s->hash_table,
-                                sizeof(new_hash_table[0]) * new_hash_size);
-    if (!new_hash_table)
-        return;
+    if (s->record_count == 0)
+        return NULL;
+    h = map_hash_key(rt, key);
+    mask = (1 << s->hash_bits) - 1;
+    for(i = map_hash_slot(h, s->hash_bits);; i = (i + 1) & mask) {
+        idx = s->hash_table[i];
+        if (idx == MAP_HASH_FREE)
+            return NULL;
+        mr = &s->records[idx];
+        if (JS_VALUE_GET_TAG(mr->key) == JS_VALUE_GET_TAG(key) &&
+            JS_VALUE_GET_PTR(mr->key) == JS_VALUE_GET_PTR(key))
+            return mr;
+    }
+}
 
-    for(i = 0; i < new_hash_size; i++)
-        init_list_head(&new_hash_table[i]);
+/* Reallocate the tables so that at least 'count' records can be
+   added after the live ones. The holes are removed, hence the table
+   may also keep its size or shrink. */
+static int map_resize(JSContext *ctx, JSMapState *s, uint32_t count)
+{
+    JSMapIteratorData *it;
+    JSMapRecord *records, *mr;
+    struct list_head *el;
+    uint32_t *hash_table, new_size, i, j, n, mask;
+    uint64_t need;
+    int hash_bits;
+
+    /* keep one third of the records free to amortize the resizes */
+    need = (uint64_t)s->record_count + count;
+    need += need / 2;
+    if (need > MAP_MAX_RECORDS) {
+        JS_ThrowRangeError(ctx, "too many elements");
+        return -1;
+    }
+    new_size = MAP_MIN_RECORDS;
+    hash_bits = 3;
+    while (new_size < need) {
+        new_size *= 2;
+        hash_bits++;
+    }
+    hash_table = js_malloc(ctx, sizeof(hash_table[0]) << hash_bits);
+    if (!hash_table)
+        return -1;
+    if (new_size > s->record_size) {
+        records = js_realloc(ctx, s->records, sizeof(records[0]) * new_size);
+        if (!records) {
+            js_free(ctx, hash_table);
+            return -1;
+        }
+        s->records = records;
+    }
 
-    list_for_each(el, &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        if (!mr->empty) {
-            h = map_hash_key(ctx, mr->key) & (new_hash_size - 1);
-            list_add_tail(&mr->hash_link, &new_hash_table[h]);
+    /* an iterator position becomes the number of live records before it */
+    list_for_each(el, &s->iterators) {
+        it = list_entry(el, JSMapIteratorData, link);
+        n = 0;
+        for(i = 0; i < it->pos; i++) {
+            if (!JS_IsUninitialized(s->records[i].key))
+                n++;
         }
+        it->pos = n;
     }
-    s->hash_table = new_hash_table;
-    s->hash_size = new_hash_size;
-    s->record_count_threshold = new_hash_size * 2;
+    j = 0;
+    for(i = 0; i < s->record_end; i++) {
+        if (!JS_IsUninitialized(s->records[i].key))
+            s->records[j++] = s->records[i];
+    }
+    s->record_end = j;
+
+    if (new_size < s->record_size) {
+        /* keep the larger block if the allocator cannot shrink it */
+        records = js_realloc_rt(ctx->rt, s->records,
+                                sizeof(records[0]) * new_size);
+        if (records)
+            s->records = records;
+    }
+    s->record_size = new_size;
+
+    memset(hash_table, 0xff, sizeof(hash_table[0]) << hash_bits);
+    mask = (1 << hash_bits) - 1;
+    for(j = 0; j < s->record_end; j++) {
+        mr = &s->records[j];
+        for(i = map_hash_slot(mr->hash, hash_bits);
+            hash_table[i] != MAP_HASH_FREE; i = (i + 1) & mask)
+            continue;
+        hash_table[i] = j;
+    }
+    js_free(ctx, s->hash_table);
+    s->hash_table = hash_table;
+    s->hash_bits = hash_bits;
+    return 0;
 }
 
 static JSWeakRefRecord **get_first_weak_ref(JSValueConst key)
@@ -49216,38 +54567,39 @@ static JSWeakRefRecord **get_first_weak_ref(JSValueConst key)
         return NULL; // pacify compiler
 }
 
+/* Add a record with an undefined value. The key must not be present.
+   The returned pointer is valid until the next insertion. */
 static JSMapRecord *map_add_record(JSContext *ctx, JSMapState *s,
                                    JSValueConst key)
 {
-    uint32_t h;
+    uint32_t h, i, mask;
     JSMapRecord *mr;
 
-    mr = js_malloc(ctx, sizeof(*mr));
-    if (!mr)
-        return NULL;
-    mr->ref_count = 1;
-    mr->map = s;
-    mr->empty = false;
+    if (s->record_end >= s->record_size) {
+        if (map_resize(ctx, s, 1))
+            return NULL;
+    }
+    h = map_hash_key(ctx->rt, key);
+    mr = &s->records[s->record_end];
     if (s->is_weak) {
         JSWeakRefRecord *wr = js_malloc(ctx, sizeof(*wr));
-        if (!wr) {
-            js_free(ctx, mr);
+        if (!wr)
             return NULL;
-        }
         wr->kind = JS_WEAK_REF_KIND_MAP;
-        wr->u.map_record = mr;
+        wr->u.map_state = s;
         insert_weakref_record(key, wr);
         mr->key = unsafe_unconst(key);
     } else {
         mr->key = js_dup(key);
     }
-    h = map_hash_key(ctx, key) & (s->hash_size - 1);
-    list_add_tail(&mr->hash_link, &s->hash_table[h]);
-    list_add_tail(&mr->link, &s->records);
+    mr->value = JS_UNDEFINED;
+    mr->hash = h;
+    mask = (1 << s->hash_bits) - 1;
+    for(i = map_hash_slot(h, s->hash_bits);
+        s->hash_table[i] != MAP_HASH_FREE; i = (i + 1) & mask)
+        continue;
+    s->hash_table[i] = s->record_end++;
     s->record_count++;
-    if (s->record_count >= s->record_count_threshold) {
-        map_hash_resize(ctx, s);
-    }
     return mr;
 }
 
@@ -49255,15 +54607,16 @@ static JSMapRecord *map_add_record(JSContext *ctx, JSMapState *s,
    reference list. we don't use a doubly linked list to
    save space, assuming a given object has few weak
        references to it */
-static void delete_map_weak_ref(JSRuntime *rt, JSMapRecord *mr)
+static void delete_map_weak_ref(JSRuntime *rt, JSMapState *s,
+                                JSValueConst key)
 {
     JSWeakRefRecord **pwr, *wr;
 
-    pwr = get_first_weak_ref(mr->key);
+    pwr = get_first_weak_ref(key);
     for(;;) {
         wr = *pwr;
         assert(wr != NULL);
-        if (wr->kind == JS_WEAK_REF_KIND_MAP && wr->u.map_record == mr)
+        if (wr->kind == JS_WEAK_REF_KIND_MAP && wr->u.map_state == s)
             break;
         pwr = &wr->next_weak_ref;
     }
@@ -49271,37 +54624,23 @@ static void delete_map_weak_ref(JSRuntime *rt, JSMapRecord *mr)
     js_free_rt(rt, wr);
 }
 
+/* The record becomes a hole. Its hash table entry is kept so that the
+   probe sequences of the other keys are not broken. */
 static void map_delete_record(JSRuntime *rt, JSMapState *s, JSMapRecord *mr)
 {
-    if (mr->empty)
-        return;
-    list_del(&mr->hash_link);
-    if (s->is_weak) {
-        delete_map_weak_ref(rt, mr);
-    } else {
-        JS_FreeValueRT(rt, mr->key);
-    }
-    JS_FreeValueRT(rt, mr->value);
-    if (--mr->ref_count == 0) {
-        list_del(&mr->link);
-        js_free_rt(rt, mr);
-    } else {
-        /* keep a zombie record for iterators */
-        mr->empty = true;
-        mr->key = JS_UNDEFINED;
-        mr->value = JS_UNDEFINED;
-    }
-    s->record_count--;
-}
+    JSValue key, value;
 
-static void map_decref_record(JSRuntime *rt, JSMapRecord *mr)
-{
-    if (--mr->ref_count == 0) {
-        /* the record can be safely removed */
-        assert(mr->empty);
-        list_del(&mr->link);
-        js_free_rt(rt, mr);
-    }
+    key = mr->key;
+    value = mr->value;
+    mr->key = JS_UNINITIALIZED;
+    mr->value = JS_UNDEFINED;
+    s->record_count--;
+    /* freeing the values may delete other records but never moves them */
+    if (s->is_weak)
+        delete_map_weak_ref(rt, s, key);
+    else
+        JS_FreeValueRT(rt, key);
+    JS_FreeValueRT(rt, value);
 }
 
 static JSValue js_map_set(JSContext *ctx, JSValueConst this_val,
@@ -49425,14 +54764,26 @@ static JSValue js_map_clear(JSContext *ctx, JSValueConst this_val,
                             int argc, JSValueConst *argv, int magic)
 {
     JSMapState *s = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP + magic);
-    struct list_head *el, *el1;
-    JSMapRecord *mr;
+    JSMapIteratorData *it;
+    struct list_head *el;
+    uint32_t i;
 
     if (!s)
         return JS_EXCEPTION;
-    list_for_each_safe(el, el1, &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        map_delete_record(ctx->rt, s, mr);
+    for(i = 0; i < s->record_end; i++) {
+        if (!JS_IsUninitialized(s->records[i].key))
+            map_delete_record(ctx->rt, s, &s->records[i]);
+    }
+    js_free(ctx, s->records);
+    js_free(ctx, s->hash_table);
+    s->records = NULL;
+    s->hash_table = NULL;
+    s->record_end = s->record_size = 0;
+    s->hash_bits = 0;
+    /* the iterators continue with the records added later */
+    list_for_each(el, &s->iterators) {
+        it = list_entry(el, JSMapIteratorData, link);
+        it->pos = 0;
     }
     return JS_UNDEFINED;
 }
@@ -49451,7 +54802,7 @@ static JSValue js_map_forEach(JSContext *ctx, JSValueConst this_val,
     JSMapState *s = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP + magic);
     JSValueConst func, this_arg;
     JSValue ret, args[3];
-    struct list_head *el;
+    JSMapIteratorData it;
     JSMapRecord *mr;
 
     if (!s)
@@ -49463,34 +54814,33 @@ static JSValue js_map_forEach(JSContext *ctx, JSValueConst this_val,
         this_arg = JS_UNDEFINED;
     if (check_function(ctx, func))
         return JS_EXCEPTION;
-    /* Note: the list can be modified while traversing it, but the
-       current element is locked */
-    el = s->records.next;
-    while (el != &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        if (!mr->empty) {
-            mr->ref_count++;
-            /* must duplicate in case the record is deleted */
-            args[1] = js_dup(mr->key);
-            if (magic)
-                args[0] = args[1];
-            else
-                args[0] = js_dup(mr->value);
-            args[2] = unsafe_unconst(this_val);
-            ret = JS_Call(ctx, func, this_arg, 3, vc(args));
-            JS_FreeValue(ctx, args[0]);
-            if (!magic)
-                JS_FreeValue(ctx, args[1]);
-            el = el->next;
-            map_decref_record(ctx->rt, mr);
-            if (JS_IsException(ret))
-                return ret;
-            JS_FreeValue(ctx, ret);
-        } else {
-            el = el->next;
-        }
+    /* Note: the map can be modified while traversing it. The position
+       is registered as an iterator so that map_resize() updates it. */
+    it.pos = 0;
+    list_add_tail(&it.link, &s->iterators);
+    ret = JS_UNDEFINED;
+    while (it.pos < s->record_end) {
+        mr = &s->records[it.pos++];
+        if (JS_IsUninitialized(mr->key))
+            continue;
+        /* must duplicate in case the record is deleted */
+        args[1] = js_dup(mr->key);
+        if (magic)
+            args[0] = args[1];
+        else
+            args[0] = js_dup(mr->value);
+        args[2] = unsafe_unconst(this_val);
+        ret = JS_Call(ctx, func, this_arg, 3, vc(args));
+        JS_FreeValue(ctx, args[0]);
+        if (!magic)
+            JS_FreeValue(ctx, args[1]);
+        if (JS_IsException(ret))
+            break;
+        JS_FreeValue(ctx, ret);
+        ret = JS_UNDEFINED;
     }
-    return JS_UNDEFINED;
+    list_del(&it.link);
+    return ret;
 }
 
 static JSValue js_map_groupBy(JSContext *ctx, JSValueConst this_val,
@@ -49583,25 +54933,23 @@ static void js_map_finalizer(JSRuntime *rt, JSValueConst val)
 {
     JSObject *p;
     JSMapState *s;
+    JSMapIteratorData *it;
     struct list_head *el, *el1;
-    JSMapRecord *mr;
+    uint32_t i;
 
     p = JS_VALUE_GET_OBJ(val);
     s = p->u.map_state;
     if (s) {
-        /* if the object is deleted we are sure that no iterator is
-           using it */
-        list_for_each_safe(el, el1, &s->records) {
-            mr = list_entry(el, JSMapRecord, link);
-            if (!mr->empty) {
-                if (s->is_weak)
-                    delete_map_weak_ref(rt, mr);
-                else
-                    JS_FreeValueRT(rt, mr->key);
-                JS_FreeValueRT(rt, mr->value);
-            }
-            js_free_rt(rt, mr);
+        /* the remaining iterators are freed in the same GC cycle */
+        list_for_each_safe(el, el1, &s->iterators) {
+            it = list_entry(el, JSMapIteratorData, link);
+            init_list_head(&it->link);
         }
+        for(i = 0; i < s->record_end; i++) {
+            if (!JS_IsUninitialized(s->records[i].key))
+                map_delete_record(rt, s, &s->records[i]);
+        }
+        js_free_rt(rt, s->records);
         js_free_rt(rt, s->hash_table);
         js_free_rt(rt, s);
     }
@@ -49612,14 +54960,14 @@ static void js_map_mark(JSRuntime *rt, JSValueConst val,
 {
     JSObject *p = JS_VALUE_GET_OBJ(val);
     JSMapState *s;
-    struct list_head *el;
     JSMapRecord *mr;
+    uint32_t i;
 
     s = p->u.map_state;
     if (s) {
         assert(!s->is_weak);
-        list_for_each(el, &s->records) {
-            mr = list_entry(el, JSMapRecord, link);
+        for(i = 0; i < s->record_end; i++) {
+            mr = &s->records[i];
             JS_MarkValue(rt, mr->key, mark_func);
             JS_MarkValue(rt, mr->value, mark_func);
         }
@@ -49628,12 +54976,6 @@ static void js_map_mark(JSRuntime *rt, JSValueConst val,
 
 /* Map Iterator */
 
-typedef struct JSMapIteratorData {
-    JSValue obj;
-    JSIteratorKindEnum kind;
-    JSMapRecord *cur_record;
-} JSMapIteratorData;
-
 static void js_map_iterator_finalizer(JSRuntime *rt, JSValueConst val)
 {
     JSObject *p;
@@ -49643,10 +54985,10 @@ static void js_map_iterator_finalizer(JSRuntime *rt, JSValueConst val)
     it = p->u.map_iterator_data;
     if (it) {
         /* During the GC sweep phase the Map finalizer may be
-           called before the Map iterator finalizer */
-        if (JS_IsLiveObject(rt, it->obj) && it->cur_record) {
-            map_decref_record(rt, it->cur_record);
-        }
+           called before the Map iterator finalizer, it then
+           unlinks the iterators */
+        if (!JS_IsUndefined(it->obj))
+            list_del(&it->link);
         JS_FreeValueRT(rt, it->obj);
         js_free_rt(rt, it);
     }
@@ -49659,7 +55001,6 @@ static void js_map_iterator_mark(JSRuntime *rt, JSValueConst val,
     JSMapIteratorData *it;
     it = p->u.map_iterator_data;
     if (it) {
-        /* the record is already marked by the object */
         JS_MarkValue(rt, it->obj, mark_func);
     }
 }
@@ -49687,7 +55028,8 @@ static JSValue js_create_map_iterator(JSContext *ctx, JSValueConst this_val,
     }
     it->obj = js_dup(this_val);
     it->kind = kind;
-    it->cur_record = NULL;
+    it->pos = 0;
+    list_add_tail(&it->link, &s->iterators);
     JS_SetOpaqueInternal(enum_obj, it);
     return enum_obj;
  fail:
@@ -49701,7 +55043,6 @@ static JSValue js_map_iterator_next(JSContext *ctx, JSValueConst this_val,
     JSMapIteratorData *it;
     JSMapState *s;
     JSMapRecord *mr;
-    struct list_head *el;
 
     it = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP_ITERATOR + magic);
     if (!it) {
@@ -49712,17 +55053,10 @@ static JSValue js_map_iterator_next(JSContext *ctx, JSValueConst this_val,
         goto done;
     s = JS_GetOpaque(it->obj, JS_CLASS_MAP + magic);
     assert(s != NULL);
-    if (!it->cur_record) {
-        el = s->records.next;
-    } else {
-        mr = it->cur_record;
-        el = mr->link.next;
-        map_decref_record(ctx->rt, mr); /* the record can be freed here */
-    }
     for(;;) {
-        if (el == &s->records) {
+        if (it->pos >= s->record_end) {
             /* no more record  */
-            it->cur_record = NULL;
+            list_del(&it->link);
             JS_FreeValue(ctx, it->obj);
             it->obj = JS_UNDEFINED;
         done:
@@ -49730,16 +55064,10 @@ static JSValue js_map_iterator_next(JSContext *ctx, JSValueConst this_val,
             *pdone = true;
             return JS_UNDEFINED;
         }
-        mr = list_entry(el, JSMapRecord, link);
-        if (!mr->empty)
+        mr = &s->records[it->pos++];
+        if (!JS_IsUninitialized(mr->key))
             break;
-        /* get the next record */
-        el = mr->link.next;
     }
-
-    /* lock the record so that it won't be freed */
-    mr->ref_count++;
-    it->cur_record = mr;
     *pdone = false;
 
     if (it->kind == JS_ITERATOR_KIND_KEY) {
@@ -49803,13 +55131,15 @@ static JSValue js_map_read(BCReaderState *s, int magic)
 static int js_map_write(BCWriterState *s, struct JSMapState *map_state,
                         int magic)
 {
-    struct list_head *el;
     JSMapRecord *mr;
+    uint32_t i;
 
     bc_put_leb128(s, map_state ? map_state->record_count : 0);
     if (map_state) {
-        list_for_each(el, &map_state->records) {
-            mr = list_entry(el, JSMapRecord, link);
+        for(i = 0; i < map_state->record_end; i++) {
+            mr = &map_state->records[i];
+            if (JS_IsUninitialized(mr->key))
+                continue;
             if (JS_WriteObjectRec(s, mr->key))
                 return -1;
             // mr->value is always JS_UNDEFINED for sets
@@ -50118,11 +55448,11 @@ static JSValue js_set_intersection(JSContext *ctx, JSValueConst this_val,
                 JS_FreeValue(ctx, item);
             } else if (map_find_record(ctx, t, item)) {
                 JS_FreeValue(ctx, item); // no duplicates
-            } else if ((mr = map_add_record(ctx, t, item))) {
-                mr->value = JS_UNDEFINED;
             } else {
+                mr = map_add_record(ctx, t, item);
                 JS_FreeValue(ctx, item);
-                goto exception;
+                if (!mr)
+                    goto exception;
             }
         }
     } else {
@@ -50145,11 +55475,11 @@ static JSValue js_set_intersection(JSContext *ctx, JSValueConst this_val,
                 item = map_normalize_key(ctx, item);
                 if (map_find_record(ctx, t, item)) {
                     JS_FreeValue(ctx, item); // no duplicates
-                } else if ((mr = map_add_record(ctx, t, item))) {
-                    mr->value = JS_UNDEFINED;
                 } else {
+                    mr = map_add_record(ctx, t, item);
                     JS_FreeValue(ctx, item);
-                    goto exception;
+                    if (!mr)
+                        goto exception;
                 }
             } else {
                 JS_FreeValue(ctx, item);
@@ -50233,11 +55563,11 @@ static JSValue js_set_difference(JSContext *ctx, JSValueConst this_val,
                 item = map_normalize_key(ctx, item);
                 if (map_find_record(ctx, t, item)) {
                     JS_FreeValue(ctx, item); // no duplicates
-                } else if ((mr = map_add_record(ctx, t, item))) {
-                    mr->value = JS_UNDEFINED;
                 } else {
+                    mr = map_add_record(ctx, t, item);
                     JS_FreeValue(ctx, item);
-                    goto exception;
+                    if (!mr)
+                        goto exception;
                 }
             } else {
                 JS_FreeValue(ctx, item);
@@ -50258,12 +55588,29 @@ fini:
     return newset;
 }
 
+/* add the keys of the set 's' to the empty set 't' */
+static int map_set_copy(JSContext *ctx, JSMapState *t, JSMapState *s)
+{
+    uint32_t i;
+
+    if (s->record_count == 0)
+        return 0;
+    if (map_resize(ctx, t, s->record_count))
+        return -1;
+    for(i = 0; i < s->record_end; i++) {
+        if (JS_IsUninitialized(s->records[i].key))
+            continue;
+        if (!map_add_record(ctx, t, s->records[i].key))
+            return -1;
+    }
+    return 0;
+}
+
 static JSValue js_set_symmetricDifference(JSContext *ctx, JSValueConst this_val,
                                           int argc, JSValueConst *argv)
 {
     JSValue has, item, iter, keys, newset, next;
     JSValueConst setlike;
-    struct list_head *el;
     JSMapState *s, *t;
     JSMapRecord *mr;
     uint64_t size;
@@ -50285,15 +55632,8 @@ static JSValue js_set_symmetricDifference(JSContext *ctx, JSValueConst this_val,
     t = JS_GetOpaque(newset, JS_CLASS_SET);
     // can't clone this_val using js_map_constructor(),
     // test262 mandates we don't call the .add method
-    list_for_each(el, &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        if (mr->empty)
-            continue;
-        mr = map_add_record(ctx, t, js_dup(mr->key));
-        if (!mr)
-            goto exception;
-        mr->value = JS_UNDEFINED;
-    }
+    if (map_set_copy(ctx, t, s))
+        goto exception;
     iter = JS_Call(ctx, keys, setlike, 0, NULL);
     if (JS_IsException(iter))
         goto exception;
@@ -50325,11 +55665,9 @@ static JSValue js_set_symmetricDifference(JSContext *ctx, JSValueConst this_val,
             JS_FreeValue(ctx, item);
         } else {
             mr = map_add_record(ctx, t, item);
-            if (!mr) {
-                JS_FreeValue(ctx, item);
+            JS_FreeValue(ctx, item);
+            if (!mr)
                 goto exception;
-            }
-            mr->value = JS_UNDEFINED;
         }
     }
     goto fini;
@@ -50348,9 +55686,7 @@ static JSValue js_set_union(JSContext *ctx, JSValueConst this_val,
 {
     JSValue has, item, iter, keys, newset, next, rv;
     JSValueConst setlike;
-    struct list_head *el;
     JSMapState *s, *t;
-    JSMapRecord *mr;
     uint64_t size;
     int done;
 
@@ -50368,15 +55704,8 @@ static JSValue js_set_union(JSContext *ctx, JSValueConst this_val,
     if (JS_IsException(newset))
         goto exception;
     t = JS_GetOpaque(newset, JS_CLASS_SET);
-    list_for_each(el, &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        if (mr->empty)
-            continue;
-        mr = map_add_record(ctx, t, js_dup(mr->key));
-        if (!mr)
-            goto exception;
-        mr->value = JS_UNDEFINED;
-    }
+    if (map_set_copy(ctx, t, s))
+        goto exception;
     iter = JS_Call(ctx, keys, setlike, 0, NULL);
     if (JS_IsException(iter))
         goto exception;
@@ -50676,13 +56005,33 @@ void JS_SetHostPromiseRejectionTracker(JSRuntime *rt,
     rt->host_promise_rejection_tracker_opaque = opaque;
 }
 
+/* enqueue promise_reaction_job() for 'rd' and free it. Its functions
+   are moved to the job instead of being duplicated. */
+static int promise_reaction_enqueue(JSContext *ctx, JSPromiseReactionData *rd,
+                                    bool is_reject, JSValueConst value)
+{
+    JSJobEntry *e;
+
+    e = js_new_job(ctx, promise_reaction_job, 5);
+    if (!e) {
+        promise_reaction_data_free(ctx->rt, rd);
+        return -1;
+    }
+    e->argv[0] = rd->resolving_funcs[0];
+    e->argv[1] = rd->resolving_funcs[1];
+    e->argv[2] = rd->handler;
+    e->argv[3] = js_bool(is_reject);
+    e->argv[4] = js_dup(value);
+    js_free_rt(ctx->rt, rd);
+    return 0;
+}
+
 static void fulfill_or_reject_promise(JSContext *ctx, JSValueConst promise,
                                       JSValueConst value, bool is_reject)
 {
     JSPromiseData *s = JS_GetOpaque(promise, JS_CLASS_PROMISE);
     struct list_head *el, *el1;
     JSPromiseReactionData *rd;
-    JSValueConst args[5];
 
     if (!s || s->promise_state != JS_PROMISE_PENDING)
         return; /* should never happen */
@@ -50708,14 +56057,8 @@ static void fulfill_or_reject_promise(JSContext *ctx, JSValueConst promise,
 
     list_for_each_safe(el, el1, &s->promise_reactions[is_reject]) {
         rd = list_entry(el, JSPromiseReactionData, link);
-        args[0] = rd->resolving_funcs[0];
-        args[1] = rd->resolving_funcs[1];
-        args[2] = rd->handler;
-        args[3] = js_bool(is_reject);
-        args[4] = value;
-        JS_EnqueueJob(ctx, promise_reaction_job, 5, args);
         list_del(&rd->link);
-        promise_reaction_data_free(ctx->rt, rd);
+        promise_reaction_enqueue(ctx, rd, is_reject, value);
     }
 
     list_for_each_safe(el, el1, &s->promise_reactions[1 - is_reject]) {
@@ -51454,12 +56797,38 @@ static __exception int perform_promise_then(JSContext *ctx,
 {
     JSPromiseData *s = JS_GetOpaque(promise, JS_CLASS_PROMISE);
     JSPromiseReactionData *rd_array[2], *rd;
+    JSValueConst handler;
+    JSJobEntry *e;
     int i, j;
 
+    if (s->promise_state != JS_PROMISE_PENDING) {
+        /* enqueue the reaction job without allocating the reaction
+           records */
+        i = s->promise_state - JS_PROMISE_FULFILLED;
+        e = js_new_job(ctx, promise_reaction_job, 5);
+        if (!e)
+            return -1;
+        if (s->promise_state == JS_PROMISE_REJECTED && !s->is_handled) {
+            JSRuntime *rt = ctx->rt;
+            if (rt->host_promise_rejection_tracker)
+                rt->host_promise_rejection_tracker(ctx, promise, s->promise_result,
+                                                   true, rt->host_promise_rejection_tracker_opaque);
+        }
+        handler = resolve_reject[i];
+        if (!JS_IsFunction(ctx, handler))
+            handler = JS_UNDEFINED;
+        e->argv[0] = js_dup(cap_resolving_funcs[0]);
+        e->argv[1] = js_dup(cap_resolving_funcs[1]);
+        e->argv[2] = js_dup(handler);
+        e->argv[3] = js_bool(i);
+        e->argv[4] = js_dup(s->promise_result);
+        s->is_handled = true;
+        return 0;
+    }
+
     rd_array[0] = NULL;
     rd_array[1] = NULL;
     for(i = 0; i < 2; i++) {
-        JSValueConst handler;
         rd = js_mallocz(ctx, sizeof(*rd));
         if (!rd) {
             if (i == 1)
@@ -51475,28 +56844,8 @@ static __exception int perform_promise_then(JSContext *ctx,
         rd_array[i] = rd;
     }
 
-    if (s->promise_state == JS_PROMISE_PENDING) {
-        for(i = 0; i < 2; i++)
-            list_add_tail(&rd_array[i]->link, &s->promise_reactions[i]);
-    } else {
-        JSValueConst args[5];
-        if (s->promise_state == JS_PROMISE_REJECTED && !s->is_handled) {
-            JSRuntime *rt = ctx->rt;
-            if (rt->host_promise_rejection_tracker)
-                rt->host_promise_rejection_tracker(ctx, promise, s->promise_result,
-                                                   true, rt->host_promise_rejection_tracker_opaque);
-        }
-        i = s->promise_state - JS_PROMISE_FULFILLED;
-        rd = rd_array[i];
-        args[0] = rd->resolving_funcs[0];
-        args[1] = rd->resolving_funcs[1];
-        args[2] = rd->handler;
-        args[3] = js_bool(i);
-        args[4] = s->promise_result;
-        JS_EnqueueJob(ctx, promise_reaction_job, 5, args);
-        for(i = 0; i < 2; i++)
-            promise_reaction_data_free(ctx->rt, rd_array[i]);
-    }
+    for(i = 0; i < 2; i++)
+        list_add_tail(&rd_array[i]->link, &s->promise_reactions[i]);
     s->is_handled = true;
     return 0;
 }
@@ -56015,6 +61364,77 @@ static int js_TA_cmp_generic(const void *a, const void *b, void *opaque) {
     return cmp;
 }
 
+/* below this length, rqsort() is faster than the radix sort */
+#define TA_RADIX_SORT_MIN_LEN 64
+
+/* counting sort of 8 bit elements */
+static void js_TA_counting_sort8(uint8_t *tab, size_t len, bool is_signed)
+{
+    size_t count[256], i, j;
+    int c;
+
+    memset(count, 0, sizeof(count));
+    for(i = 0; i < len; i++)
+        count[tab[i]]++;
+    j = 0;
+    for(i = 0; i < 256; i++) {
+        c = is_signed ? (i + 128) & 0xff : i;
+        memset(tab + j, c, count[c]);
+        j += count[c];
+    }
+}
+
+/* return false if the array could not be sorted (no memory) */
+static bool js_TA_sort_default(JSContext *ctx, JSObject *p, size_t len)
+{
+    JSRadixKeyEnum kind;
+    void *tmp;
+
+    switch(p->class_id) {
+    case JS_CLASS_INT8_ARRAY:
+        js_TA_counting_sort8(p->u.array.u.uint8_ptr, len, true);
+        return true;
+    case JS_CLASS_UINT8C_ARRAY:
+    case JS_CLASS_UINT8_ARRAY:
+        js_TA_counting_sort8(p->u.array.u.uint8_ptr, len, false);
+        return true;
+    case JS_CLASS_INT16_ARRAY:
+    case JS_CLASS_INT32_ARRAY:
+    case JS_CLASS_BIG_INT64_ARRAY:
+        kind = JS_RADIX_KEY_SIGNED;
+        break;
+    case JS_CLASS_FLOAT16_ARRAY:
+    case JS_CLASS_FLOAT32_ARRAY:
+    case JS_CLASS_FLOAT64_ARRAY:
+        kind = JS_RADIX_KEY_FLOAT;
+        break;
+    default:
+        kind = JS_RADIX_KEY_UNSIGNED;
+        break;
+    }
+    tmp = js_malloc_rt(ctx->rt, len << typed_array_size_log2(p->class_id));
+    if (!tmp)
+        return false;
+    /* 'nan_min' is the smallest NaN without sign bit */
+    switch(typed_array_size_log2(p->class_id)) {
+    case 1:
+        js_radix_sort16(p->u.array.u.uint16_ptr, tmp, len, kind, 0x7c01);
+        break;
+    case 2:
+        js_radix_sort32(p->u.array.u.uint32_ptr, tmp, len, kind,
+                           0x7f800001);
+        break;
+    case 3:
+        js_radix_sort64(p->u.array.u.uint64_ptr, tmp, len, kind,
+                           0x7ff0000000000001);
+        break;
+    default:
+        abort();
+    }
+    js_free_rt(ctx->rt, tmp);
+    return true;
+}
+
 static JSValue js_typed_array_sort(JSContext *ctx, JSValueConst this_val,
                                    int argc, JSValueConst *argv)
 {
@@ -56151,7 +61571,10 @@ static JSValue js_typed_array_sort(JSContext *ctx, JSValueConst this_val,
         done:
             js_free(ctx, array_idx);
         } else {
-            rqsort(p->u.array.u.ptr, len, elt_size, cmpfun, &tsc);
+            if (len < TA_RADIX_SORT_MIN_LEN ||
+                !js_TA_sort_default(ctx, p, len)) {
+                rqsort(p->u.array.u.ptr, len, elt_size, cmpfun, &tsc);
+            }
             if (tsc.exception)
                 return JS_EXCEPTION;
         }
@@ -57848,25 +63271,27 @@ void JS_AddIntrinsicWeakRef(JSContext *ctx)
     JS_NewGlobalCConstructor(ctx, "FinalizationRegistry", js_finrec_constructor, 1, ctx->class_proto[JS_CLASS_FINALIZATION_REGISTRY]);
 }
 
-static void reset_weak_ref(JSRuntime *rt, JSWeakRefRecord **first_weak_ref)
+static void reset_weak_ref(JSRuntime *rt, JSValueConst target)
 {
-    JSWeakRefRecord *wr, *wr_next;
+    JSWeakRefRecord **first_weak_ref, *wr, *wr_next;
     JSWeakRefData *wrd;
     JSMapRecord *mr;
     JSMapState *s;
     JSFinRecEntry *fre;
 
+    first_weak_ref = get_first_weak_ref(target);
     /* first pass to remove the records from the WeakMap/WeakSet
-       lists */
+       tables. The values are kept in the weak reference records
+       because the tables may be freed by the second pass. */
     for(wr = *first_weak_ref; wr != NULL; wr = wr->next_weak_ref) {
         switch(wr->kind) {
         case JS_WEAK_REF_KIND_MAP:
-            mr = wr->u.map_record;
-            s = mr->map;
-            assert(s->is_weak);
-            assert(!mr->empty); /* no iterator on WeakMap/WeakSet */
-            list_del(&mr->hash_link);
-            list_del(&mr->link);
+            s = wr->u.map_state;
+            mr = map_find_weak_record(rt, s, target);
+            assert(mr != NULL);
+            wr->u.map_value = mr->value; /* overwrites map_state */
+            mr->key = JS_UNINITIALIZED;
+            mr->value = JS_UNDEFINED;
             s->record_count--;
             break;
         case JS_WEAK_REF_KIND_WEAK_REF:
@@ -57888,9 +63313,7 @@ static void reset_weak_ref(JSRuntime *rt, JSWeakRefRecord **first_weak_ref)
         wr_next = wr->next_weak_ref;
         switch(wr->kind) {
         case JS_WEAK_REF_KIND_MAP:
-            mr = wr->u.map_record;
-            JS_FreeValueRT(rt, mr->value);
-            js_free_rt(rt, mr);
+            JS_FreeValueRT(rt, wr->u.map_value);
             break;
         case JS_WEAK_REF_KIND_WEAK_REF:
             wrd = wr->u.weak_ref_data;
@@ -426,6 +426,7 @@ typedef struct JSMallocFunctions {
 #define JS_DUMP_OBJECTS       0x20000  /* dump objects in JS_FreeRuntime */
 #define JS_DUMP_ATOMS         0x40000  /* dump atoms in JS_FreeRuntime */
 #define JS_DUMP_SHAPES        0x80000  /* dump shapes in JS_FreeRuntime */
+#define JS_DUMP_OPCODE_STATS 0x100000  /* dump the most executed opcode sequences in JS_FreeRuntime */
 
 // Finalizers run in LIFO order at the very end of JS_FreeRuntime.
 // Intended for cleanup of associated resources; the runtime itself
@@ -443,12 +444,65 @@ JS_EXTERN void JS_SetDumpFlags(JSRuntime *rt, uint64_t flags);
 JS_EXTERN uint64_t JS_GetDumpFlags(JSRuntime *rt);
 JS_EXTERN size_t JS_GetGCThreshold(JSRuntime *rt);
 JS_EXTERN void JS_SetGCThreshold(JSRuntime *rt, size_t gc_threshold);
+
+/* Policy of the automatic GC. After a collection, the next threshold is
+   live_size + growth * live_size where live_size is the memory usage
+   after the collection. 'growth' adapts within [min_growth, max_growth]:
+   it increases when the time spent in the GC exceeds 'target_gc_ratio'
+   or when the collection freed almost nothing, and decreases otherwise.
+   The defaults (min_growth = max_growth = 0.5) give a fixed 1.5 factor. */
+typedef struct JSGCPolicy {
+    size_t min_threshold; /* default 256 KiB */
+    size_t max_growth_size; /* max heap growth in bytes, 0 = no limit */
+    double min_growth;
+    double max_growth;
+    /* fraction of the run time spent in the GC, 0 = not measured */
+    double target_gc_ratio;
+    /* if non zero, collect with JS_RunGCStep() calls of this budget at
+       each allocation instead of a single JS_RunGC() pause */
+    size_t step_budget;
+} JSGCPolicy;
+
+JS_EXTERN void JS_GetGCPolicy(JSRuntime *rt, JSGCPolicy *policy);
+JS_EXTERN void JS_SetGCPolicy(JSRuntime *rt, const JSGCPolicy *policy);
+
+typedef enum JSGCTriggerAction {
+    JS_GC_TRIGGER_RUN, /* collect as decided by the policy */
+    JS_GC_TRIGGER_FULL, /* run JS_RunGC() */
+    JS_GC_TRIGGER_DEFER, /* no collection until 'next_threshold' */
+} JSGCTriggerAction;
+
+typedef struct JSGCTriggerInfo {
+    size_t malloc_size;
+    size_t threshold; /* the threshold which was crossed */
+    size_t last_live_size; /* memory usage after the last collection */
+    uint64_t last_duration_ns; /* duration of the last collection */
+    /* in/out: JS_RunGCStep() budget for JS_GC_TRIGGER_RUN, 0 = JS_RunGC() */
+    size_t step_budget;
+    /* in/out: next threshold for JS_GC_TRIGGER_DEFER */
+    size_t next_threshold;
+} JSGCTriggerInfo;
+
+/* Called when the memory usage crosses the GC threshold, before the
+   collection starts. Must not run JS code. */
+typedef JSGCTriggerAction JSGCTriggerFunc(JSRuntime *rt,
+                                          JSGCTriggerInfo *info,
+                                          void *opaque);
+JS_EXTERN void JS_SetGCTriggerFunc(JSRuntime *rt, JSGCTriggerFunc *func,
+                                   void *opaque);
 /* use 0 to disable maximum stack size check */
 JS_EXTERN void JS_SetMaxStackSize(JSRuntime *rt, size_t stack_size);
 /* should be called when changing thread to update the stack top value
    used to check stack overflow. */
 JS_EXTERN void JS_UpdateStackTop(JSRuntime *rt);
 JS_EXTERN JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque);
+/* Serve the allocations of up to 256 bytes (shapes, property tables,
+   short strings...) from size-class slabs carved out of 'mf' memory. The
+   slabs are only returned to 'mf' by JS_FreeRuntime(). Not useful when
+   building with mimalloc, which already does this. */
+#define JS_RUNTIME_SLAB_ALLOC (1 << 0)
+JS_EXTERN JSRuntime *JS_NewRuntime3(const JSMallocFunctions *mf, void *opaque,
+                                    int flags);
 JS_EXTERN void JS_FreeRuntime(JSRuntime *rt);
 JS_EXTERN void *JS_GetRuntimeOpaque(JSRuntime *rt);
 JS_EXTERN void JS_SetRuntimeOpaque(JSRuntime *rt, void *opaque);
@@ -458,7 +512,16 @@ typedef void JS_MarkFunc(JSRuntime *rt, JSGCObjectHeader *gp);
 JS_EXTERN void JS_MarkValue(JSRuntime *rt, JSValueConst val,
                             JS_MarkFunc *mark_func);
 JS_EXTERN void JS_RunGC(JSRuntime *rt);
+/* Run a step of the incremental cycle collector visiting about 'budget'
+   GC objects (0 = finish the cycle). A new cycle is started if none is in
+   progress. The mutator can run between the steps. Return true when the
+   cycle is complete. */
+JS_EXTERN bool JS_RunGCStep(JSRuntime *rt, size_t budget);
 JS_EXTERN bool JS_IsLiveObject(JSRuntime *rt, JSValueConst obj);
+/* Return the number of GC objects (objects, function bytecodes,
+   shapes...) created so far, e.g. to skip a collection when nothing was
+   allocated since the previous one. */
+JS_EXTERN uint64_t JS_GetGCAllocCount(JSRuntime *rt);
 
 JS_EXTERN JSContext *JS_NewContext(JSRuntime *rt);
 JS_EXTERN void JS_FreeContext(JSContext *s);
@@ -530,6 +593,7 @@ typedef struct JSMemoryUsage {
     int64_t c_func_count, array_count;
     int64_t fast_array_count, fast_array_elements;
     int64_t binary_object_count, binary_object_size;
+    int64_t regexp_cache_count, regexp_cache_hits, regexp_cache_misses;
 } JSMemoryUsage;
 
 JS_EXTERN void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s);
@@ -962,6 +1026,15 @@ JS_EXTERN JSValue JS_ParseJSON(JSContext *ctx, const char *buf, size_t buf_len,
                                const char *filename);
 JS_EXTERN JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
                                    JSValueConst replacer, JSValueConst space0);
+/* Same as JS_JSONStringify() but the result is UTF-8 encoded and zero
+   terminated, without creating a string value. 'buf' is returned if the
+   result fits in its 'buf_size' bytes, otherwise a buffer allocated with
+   js_malloc() which must be freed with js_free(). The result length is
+   stored in '*plen'. Return NULL if exception or if the result is
+   undefined (use JS_HasException() to distinguish). */
+JS_EXTERN char *JS_JSONStringifyUTF8(JSContext *ctx, JSValueConst obj,
+                                     JSValueConst replacer, JSValueConst space0,
+                                     char *buf, size_t buf_size, size_t *plen);
 
 typedef void JSFreeArrayBufferDataFunc(JSRuntime *rt, void *opaque, void *ptr);
 JS_EXTERN JSValue JS_NewArrayBuffer(JSContext *ctx, uint8_t *buf, size_t len,
@@ -1048,6 +1121,28 @@ JS_EXTERN void JS_SetHostPromiseRejectionTracker(JSRuntime *rt, JSHostPromiseRej
 /* return != 0 if the JS code needs to be interrupted */
 typedef int JSInterruptHandler(JSRuntime *rt, void *opaque);
 JS_EXTERN void JS_SetInterruptHandler(JSRuntime *rt, JSInterruptHandler *cb, void *opaque);
+/* Sampling CPU profiler: the JS stack is sampled at the interrupt checks
+   when 'interval_us' microseconds have elapsed since the last sample (0 =
+   only when requested). Return -1 if out of memory or already started. */
+JS_EXTERN int JS_StartProfiling(JSRuntime *rt, int interval_us);
+/* take a sample at the next interrupt check. Can be called from a signal
+   handler or from another thread, e.g. a timer thread. */
+JS_EXTERN void JS_RequestProfileSample(JSRuntime *rt);
+/* stop the profiler and return the samples as a string in the Chrome
+   DevTools .cpuprofile JSON format. Return JS_UNDEFINED if it was not
+   started. */
+JS_EXTERN JSValue JS_StopProfiling(JSContext *ctx);
+/* Sampling heap profiler: the JS stack is recorded every 'interval'
+   allocations. Return -1 if 'interval' < 1, out of memory or already
+   started. */
+JS_EXTERN int JS_StartHeapSampling(JSRuntime *rt, int interval);
+/* stop the heap profiler and return the samples as a string in the
+   Chrome DevTools .heapprofile JSON format. Return JS_UNDEFINED if it was
+   not started. */
+JS_EXTERN JSValue JS_StopHeapSampling(JSContext *ctx);
+/* return the GC objects of the runtime and their references as a string
+   in the Chrome DevTools .heapsnapshot JSON format */
+JS_EXTERN JSValue JS_TakeHeapSnapshot(JSContext *ctx);
 /* if can_block is true, Atomics.wait() can be used */
 JS_EXTERN void JS_SetCanBlock(JSRuntime *rt, bool can_block);
 /* set the [IsHTMLDDA] internal slot */
@@ -1081,6 +1176,14 @@ JS_EXTERN int JS_EnqueueJob(JSContext *ctx, JSJobFunc *job_func,
 
 JS_EXTERN bool JS_IsJobPending(JSRuntime *rt);
 JS_EXTERN int JS_ExecutePendingJob(JSRuntime *rt, JSContext **pctx);
+/* Execute at most 'max' jobs (no limit if max < 0), including the jobs
+   they enqueue. Return the number of executed jobs or < 0 if a job
+   raised an exception. The context of the last job is stored in
+   '*pctx'. */
+JS_EXTERN int JS_ExecutePendingJobs(JSRuntime *rt, int max, JSContext **pctx);
+/* Free the pending jobs without executing them, e.g. before freeing
+   their context after an uncaught exception */
+JS_EXTERN void JS_DiscardPendingJobs(JSRuntime *rt);
 
 /* Structure to retrieve (de)serialized SharedArrayBuffer objects. */
 typedef struct JSSABTab {
@@ -1095,17 +1198,56 @@ typedef struct JSSABTab {
 #define JS_WRITE_OBJ_REFERENCE (1 << 3) /* allow object references to encode arbitrary object graph */
 #define JS_WRITE_OBJ_STRIP_SOURCE  (1 << 4) /* do not write source code information */
 #define JS_WRITE_OBJ_STRIP_DEBUG   (1 << 5) /* do not write debug information */
+#define JS_WRITE_OBJ_SYSTEM_ALLOC  (1 << 6) /* allocate the output with malloc() instead of the runtime allocator */
+#define JS_WRITE_OBJ_SHARED_ATOMS  (1 << 7) /* reference the atom table of the context instead of embedding one */
 JS_EXTERN uint8_t *JS_WriteObject(JSContext *ctx, size_t *psize, JSValueConst obj, int flags);
 JS_EXTERN uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
                                    int flags, JSSABTab *psab_tab);
+/* Same as JS_WriteObject2() but the contents of the ArrayBuffers listed
+   in 'transfer' are moved instead of copied: the output only holds
+   pointers to them and the ArrayBuffers are detached once 'obj' is
+   written. '*ptransfer_tab' receives the moved contents, which are
+   allocated with malloc() and belong to the caller until
+   JS_ReadObject3() adopts them. Requires JS_WRITE_OBJ_REFERENCE. Like
+   SharedArrayBuffers, the output is only meaningful in the same
+   process. */
+JS_EXTERN uint8_t *JS_WriteObject3(JSContext *ctx, size_t *psize, JSValueConst obj,
+                                   int flags, JSSABTab *psab_tab,
+                                   JSValueConst *transfer, int transfer_len,
+                                   JSSABTab *ptransfer_tab);
+/* Serialize the atom table filled by the objects written with
+   JS_WRITE_OBJ_SHARED_ATOMS. Each atom is stored and interned once for
+   all of them: the table must be loaded with JS_ReadAtomTable() before
+   any of these objects is read. */
+JS_EXTERN uint8_t *JS_WriteAtomTable(JSContext *ctx, size_t *psize);
+/* Replace the atom table of the context. Return -1 with an exception
+   in case of error. */
+JS_EXTERN int JS_ReadAtomTable(JSContext *ctx, const uint8_t *buf, size_t buf_len);
 
 #define JS_READ_OBJ_BYTECODE  (1 << 0) /* allow function/module */
 #define JS_READ_OBJ_ROM_DATA  (0)      /* avoid duplicating 'buf' data (obsolete, broken by ICs) */
 #define JS_READ_OBJ_SAB       (1 << 2) /* allow SharedArrayBuffer */
 #define JS_READ_OBJ_REFERENCE (1 << 3) /* allow object references */
+#define JS_READ_OBJ_TRANSFER  (1 << 4) /* allow transferred ArrayBuffers */
 JS_EXTERN JSValue JS_ReadObject(JSContext *ctx, const uint8_t *buf, size_t buf_len, int flags);
 JS_EXTERN JSValue JS_ReadObject2(JSContext *ctx, const uint8_t *buf, size_t buf_len,
                                  int flags, JSSABTab *psab_tab);
+/* '*ptransfer_tab' receives the transferred ArrayBuffer contents that
+   were adopted by the new object, even if an exception is returned. The
+   caller must free() the other ones. */
+JS_EXTERN JSValue JS_ReadObject3(JSContext *ctx, const uint8_t *buf, size_t buf_len,
+                                 int flags, JSSABTab *psab_tab,
+                                 JSSABTab *ptransfer_tab);
+/* Return the number of bytes stored in 'buf', 0 at the end of the input
+   or -1 in case of error. Can block until more input is available. */
+typedef int64_t JSReadObjectFunc(void *opaque, uint8_t *buf, size_t buf_size);
+/* Same as JS_ReadObject() but the input is read incrementally with
+   'read_func', so that the deserialization starts before the whole
+   input is available. Only the unread part of the input is buffered.
+   JS_READ_OBJ_SAB and JS_READ_OBJ_TRANSFER are not supported. */
+JS_EXTERN JSValue JS_ReadObjectStream(JSContext *ctx,
+                                      JSReadObjectFunc *read_func,
+                                      void *opaque, int flags);
 /* instantiate and evaluate a bytecode function. Only used when
    reading a script or module with JS_ReadObject() */
 JS_EXTERN JSValue JS_EvalFunction(JSContext *ctx, JSValue fun_obj);
@@ -6,15 +6,419 @@
 #include <windows.h>
 #endif
 
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <atomic>
+#include <cassert>
 #include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 #include "QjsBinaryCodeExecutor.h"
+#include "QjsExecutorPool.h"
+#include "qjs_bundle.h"
+#include <quickjs.h>
+#include <quickjs-libc.h>
+
+// afterExecute 回调在执行的线程中同步调用，记录本次执行看到的 runs
+static thread_local int lastRuns;
+
+static void writeFile(const char *filename, const char *data) {
+    FILE *f = fopen(filename, "wb");
+    assert(f);
+    fwrite(data, 1, strlen(data), f);
+    fclose(f);
+}
+
+static int readInt(JSContext *ctx, const char *name) {
+    JSValue global = JS_GetGlobalObject(ctx);
+    JSValue val = JS_GetPropertyStr(ctx, global, name);
+    int32_t ret = -1;
+    if (!JS_IsUndefined(val))
+        JS_ToInt32(ctx, &ret, val);
+    JS_FreeValue(ctx, val);
+    JS_FreeValue(ctx, global);
+    return ret;
+}
+
+// 运行时池：多个线程同时 execute()，运行时复用，每次执行都是新的上下文
+static int testExecutorPool() {
+    static const char entry[] = "test_pool_entry.js";
+    static const char code[] = "globalThis.runs = (globalThis.runs ?? 0) + 1;\n"
+                               "await Promise.resolve();\n"
+                               "globalThis.runs += 0;\n";
+    writeFile(entry, code);
+
+    std::atomic<int> jsErrors{0};
+    std::mutex mutex;
+    std::set<JSRuntime *> runtimes;
+    std::set<JSContext *> contexts;
+
+    QjsBinaryCodeExecutor executor;
+    executor.setEntryFile(entry);
+    executor.setExecutionMode(ExecutionMode::JS);
+    executor.onJsError([&](JSRuntime *, JSContext *, const std::string &name, const std::string &msg,
+                           const std::string &) {
+        std::cerr << name << ": " << msg << std::endl;
+        jsErrors++;
+    });
+    executor.afterExecute([&](JSRuntime *rt, JSContext *ctx) {
+        lastRuns = readInt(ctx, "runs");
+        std::lock_guard<std::mutex> lock(mutex);
+        runtimes.insert(rt);
+        contexts.insert(ctx);
+    });
+
+    {
+        QjsExecutorPool pool(executor, 2);
+        assert(pool.size() == 2);
+
+        // 线程数多于运行时，acquire() 需要等待归还
+        const int threadCount = 4, runCount = 25;
+        std::atomic<int> failures{0};
+        std::vector<std::thread> threads;
+        for (int i = 0; i < threadCount; i++) {
+            threads.emplace_back([&] {
+                for (int j = 0; j < runCount; j++) {
+                    // 上一次执行的全局对象已丢弃
+                    if (pool.execute() != 0 || lastRuns != 1)
+                        failures++;
+                }
+            });
+        }
+        for (auto &t: threads)
+            t.join();
+        assert(failures == 0);
+        assert(jsErrors == 0);
+        assert(runtimes.size() == 2);
+        assert(contexts.size() > 2);
+
+        // 同一个 Lease 多次执行时共用全局对象，归还后重置
+        {
+            QjsExecutorPool::Lease lease = pool.acquire();
+            assert(lease);
+            assert(lease.execute() == 0 && lastRuns == 1);
+            assert(lease.execute() == 0 && lastRuns == 2);
+            assert(readInt(lease.context(), "runs") == 2);
+        }
+        QjsExecutorPool::Lease lease = pool.acquire();
+        assert(lease);
+        assert(readInt(lease.context(), "runs") == -1);
+        assert(lease.execute() == 0 && lastRuns == 1);
+        assert(runtimes.size() == 2);
+    }
+
+    remove(entry);
+    printf("QjsExecutorPool OK\n");
+    return 0;
+}
+
+// afterContextCreate 给每个上下文（包括 Worker 的）设置 tag
+static void setTag(QjsBinaryCodeExecutor &executor, int tag) {
+    executor.afterContextCreate([tag](JSRuntime *, JSContext *ctx) {
+        js_init_module_os(ctx, "qjs:os");
+        JSValue global = JS_GetGlobalObject(ctx);
+        JS_SetPropertyStr(ctx, global, "tag", JS_NewInt32(ctx, tag));
+        JS_FreeValue(ctx, global);
+    });
+}
+
+// Worker 的上下文由启动它的运行时所属的执行器创建，执行器释放后不再被引用
+static int testWorkerContext() {
+    static const char entry[] = "test_worker_entry.js";
+    static const char worker[] = "test_worker_tag.js";
+    writeFile(entry, "import * as os from 'qjs:os';\n"
+                     "const w = new os.Worker('./test_worker_tag.js');\n"
+                     "w.onmessage = (e) => { globalThis.workerTag = e.data; w.onmessage = null; };\n");
+    writeFile(worker, "import * as os from 'qjs:os';\n"
+                      "os.Worker.parent.postMessage(globalThis.tag);\n");
+
+    int workerTag = -1;
+    QjsBinaryCodeExecutor poolExecutor;
+    poolExecutor.setEntryFile(entry);
+    poolExecutor.setExecutionMode(ExecutionMode::JS);
+    setTag(poolExecutor, 1);
+    poolExecutor.afterExecute([&](JSRuntime *, JSContext *ctx) {
+        workerTag = readInt(ctx, "workerTag");
+    });
+    {
+        QjsExecutorPool pool(poolExecutor, 1);
+        {
+            QjsBinaryCodeExecutor executor;
+            executor.setEntryFile(entry);
+            executor.setExecutionMode(ExecutionMode::JS);
+            setTag(executor, 2);
+            executor.afterExecute([&](JSRuntime *, JSContext *ctx) {
+                workerTag = readInt(ctx, "workerTag");
+            });
+            assert(executor.execute() == 0);
+            assert(workerTag == 2);
+        }
+        assert(pool.execute() == 0);
+        assert(workerTag == 1);
+    }
+
+    remove(entry);
+    remove(worker);
+    printf("worker context OK\n");
+    return 0;
+}
+
+// 压缩模块头中的 raw_length 不可信，分配的大小受块数据限制
+static void testBundleDecompress() {
+    uint8_t data[12];
+    uint32_t rawLength = 4, blockLen = 4 | QJS_BUNDLE_BLOCK_STORED;
+    size_t len = 0;
+    memcpy(data + 4, &blockLen, 4);
+    memcpy(data + 8, "abcd", 4);
+    memcpy(data, &rawLength, 4);
+    uint8_t *buf = qjs_bundle_decompress(data, sizeof(data), nullptr, 0, &len);
+    assert(buf && len == 4 && !memcmp(buf, "abcd", 4));
+    free(buf);
+    rawLength = UINT32_MAX;
+    memcpy(data, &rawLength, 4);
+    assert(!qjs_bundle_decompress(data, sizeof(data), nullptr, 0, &len));
+    // 4 个字节的压缩块最多解码为 4 * 255 个字节
+    rawLength = 4 * 255 + 1;
+    blockLen = 4;
+    memcpy(data, &rawLength, 4);
+    memcpy(data + 4, &blockLen, 4);
+    QJSBundleReader r;
+    assert(qjs_bundle_reader_init(&r, data, sizeof(data), nullptr, 0) == 0);
+    assert(qjs_bundle_reader_max_length(&r) == 4 * 255);
+    assert(!qjs_bundle_decompress(data, sizeof(data), nullptr, 0, &len));
+    printf("bundle decompress OK\n");
+}
+
+static const char bundleLib[] = "export const value = 40;\n";
+static const char bundleMain[] = "import { value } from './test_bundle_lib.js';\n"
+                                 "globalThis.result = value + 2;\n";
+
+// 执行入口文件，返回入口模块设置的 globalThis.result，有 JS 异常时返回 -1
+static int runBundle(QjsBinaryCodeExecutor &executor, const char *filename,
+                     ExecutionMode mode = ExecutionMode::BINARY) {
+    int result = -1;
+    bool jsError = false;
+    executor.setEntryFile(filename);
+    executor.setExecutionMode(mode);
+    executor.onJsError([&](JSRuntime *, JSContext *, const std::string &name, const std::string &msg,
+                           const std::string &) {
+        std::cerr << name << ": " << msg << std::endl;
+        jsError = true;
+    });
+    executor.afterExecute([&](JSRuntime *, JSContext *ctx) {
+        result = readInt(ctx, "result");
+    });
+    int ret = executor.execute();
+    // 回调引用了局部变量
+    executor.onJsError(nullptr);
+    executor.afterExecute(nullptr);
+    return ret != 0 || jsError ? -1 : result;
+}
+
+// 旧的扁平格式：[bc_version:4] 之后每个模块为 [load_only:1][长度:8][JS_WriteObject() 输出]
+static void writeLegacyBundle(const char *filename) {
+    static const struct {
+        const char *name;
+        const char *source;
+        bool loadOnly;
+    } modules[] = {
+        {"test_bundle_lib.js", bundleLib, true},
+        {"test_bundle_main.js", bundleMain, false},
+    };
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    FILE *f = fopen(filename, "wb");
+    assert(f);
+    uint32_t version = QJS_BUNDLE_BC_VERSION;
+    fwrite(&version, sizeof(version), 1, f);
+    for (const auto &mod: modules) {
+        JSValue obj = JS_Eval(ctx, mod.source, strlen(mod.source), mod.name,
+                              JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+        assert(!JS_IsException(obj));
+        size_t size;
+        uint8_t *buf = JS_WriteObject(ctx, &size, obj, JS_WRITE_OBJ_BYTECODE);
+        assert(buf);
+        uint8_t loadOnly = mod.loadOnly;
+        uint64_t length = size;
+        fwrite(&loadOnly, 1, 1, f);
+        fwrite(&length, sizeof(length), 1, f);
+        fwrite(buf, 1, size, f);
+        js_free(ctx, buf);
+        JS_FreeValue(ctx, obj);
+    }
+    fclose(f);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+// 旧格式的模块文件映射到内存后预加载 load_only 的模块
+static void testLegacyBundle() {
+    static const char bundle[] = "test_bundle_legacy.bin";
+    writeLegacyBundle(bundle);
+    {
+        QjsBinaryCodeExecutor executor;
+        assert(runBundle(executor, bundle) == 42);
+        assert(executor.getBytecodeVersion() == QJS_BUNDLE_BC_VERSION);
+    }
+    remove(bundle);
+    printf("legacy bundle OK\n");
+}
+
+static bool hasLog(const std::vector<std::string> &logs, const std::string &msg) {
+    for (const auto &log: logs) {
+        if (log.find(msg) != std::string::npos)
+            return true;
+    }
+    return false;
+}
+
+// 第一个上下文预加载后生成快照，之后的上下文从快照恢复，结果与逐个加载相同
+static void testSnapshot() {
+    static const char bundle[] = "test_bundle_snapshot.bin";
+    writeLegacyBundle(bundle);
+    for (bool enabled: {true, false}) {
+        std::vector<std::string> logs;
+        QjsBinaryCodeExecutor executor;
+        executor.setSnapshotEnabled(enabled);
+        executor.setDebugMode(true);
+        executor.setLogCallback([&](const std::string &log) { logs.push_back(log); });
+        assert(runBundle(executor, bundle) == 42);
+        assert(hasLog(logs, "已生成预加载快照: 1 个模块") == enabled);
+        assert(!hasLog(logs, "已从快照恢复"));
+        {
+            QjsExecutorPool pool(executor, 1);
+            for (int i = 0; i < 2; i++) {
+                QjsExecutorPool::Lease lease = pool.acquire();
+                assert(lease.execute() == 0);
+                assert(readInt(lease.context(), "result") == 42);
+            }
+        }
+        assert(hasLog(logs, "已从快照恢复 1 个预加载模块") == enabled);
+    }
+    remove(bundle);
+    printf("snapshot OK\n");
+}
+
+// JS 模式的字节码缓存：命中、源文件修改后失效，模块名不同的同一个文件不共用缓存
+static void testCodeCache() {
+    static const char dir[] = "test_code_cache";
+    static const char mainFile[] = "test_cache_main.js";
+    static const char libFile[] = "test_cache_lib.js";
+    std::vector<std::string> logs;
+    auto run = [&](const char *entry) {
+        logs.clear();
+        QjsBinaryCodeExecutor executor;
+        executor.setCodeCacheDir(dir);
+        executor.setDebugMode(true);
+        executor.setLogCallback([&](const std::string &log) { logs.push_back(log); });
+        return runBundle(executor, entry, ExecutionMode::JS);
+    };
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+    writeFile(mainFile, "import { value } from './test_cache_lib.js';\n"
+                    "globalThis.result = value;\n");
+    writeFile(libFile, "export const value = 1;\n");
+
+    assert(run(mainFile) == 1);
+    assert(hasLog(logs, std::string("已写入字节码缓存: ") + mainFile));
+    assert(hasLog(logs, std::string("已写入字节码缓存: ") + libFile));
+    assert(run(mainFile) == 1);
+    assert(hasLog(logs, std::string("从字节码缓存加载模块: ") + mainFile));
+    assert(hasLog(logs, std::string("从字节码缓存加载模块: ") + libFile));
+    assert(!hasLog(logs, "已写入字节码缓存"));
+
+    writeFile(libFile, "export const value = 22;\n");
+    assert(run(mainFile) == 22);
+    assert(hasLog(logs, std::string("从字节码缓存加载模块: ") + mainFile));
+    assert(hasLog(logs, std::string("已写入字节码缓存: ") + libFile));
+
+    // 模块以 "./test_cache_main.js" 注册，它的 import 也相对于这个名字解析
+    const std::string dotMain = std::string("./") + mainFile;
+    assert(run(dotMain.c_str()) == 22);
+    assert(hasLog(logs, "已写入字节码缓存: " + dotMain));
+    assert(run(dotMain.c_str()) == 22);
+    assert(hasLog(logs, "从字节码缓存加载模块: " + dotMain));
+    assert(run(mainFile) == 22);
+    assert(hasLog(logs, std::string("从字节码缓存加载模块: ") + mainFile));
+
+    remove(mainFile);
+    remove(libFile);
+    std::filesystem::remove_all(dir, ec);
+    printf("code cache OK\n");
+}
+
+#ifdef _WIN32
+static const char nullOutput[] = " > NUL";
+#else
+static const char nullOutput[] = " > /dev/null";
+#endif
+
+// qjsc -b 生成的各种模块文件：依赖模块由加载器在 import 时才反序列化，包括动态 import 的模块
+static void testQjscBundles(const std::string &qjsc) {
+    static const char bundle[] = "test_bundle.bin";
+    static const struct {
+        const char *flags;
+        const char *secret;
+    } formats[] = {
+        {"-b", ""},
+        {"-b -x QWEQWE", "QWEQWE"},
+        {"-b -z", ""},
+        {"-b -z -x QWEQWE", "QWEQWE"},
+        {"-b -a", ""},
+        {"-b -a -z -j 2", ""},
+    };
+    writeFile("test_bundle_lib.js", bundleLib);
+    writeFile("test_bundle_dyn.js", "export const extra = 2;\n");
+    writeFile("test_bundle_main.js", "import { value } from './test_bundle_lib.js';\n"
+                                     "const { extra } = await import('./test_bundle_dyn.js');\n"
+                                     "globalThis.result = value + extra;\n");
+    for (const auto &format: formats) {
+        std::string cmd = qjsc + " " + format.flags + " -o " + bundle +
+                          " -D test_bundle_dyn.js test_bundle_main.js" + nullOutput;
+        assert(system(cmd.c_str()) == 0);
+        QjsBinaryCodeExecutor executor;
+        executor.setXorSecret(format.secret);
+        if (runBundle(executor, bundle) != 42) {
+            fprintf(stderr, "qjsc %s: wrong result\n", format.flags);
+            assert(0);
+        }
+    }
+    remove(bundle);
+    remove("test_bundle_lib.js");
+    remove("test_bundle_dyn.js");
+    remove("test_bundle_main.js");
+    printf("qjsc bundles OK\n");
+}
+
+// 执行器测试：每个测试失败时直接 assert。qjsc 默认与测试程序在同一目录
+static int testExecutor(const std::string &qjsc) {
+    testBundleDecompress();
+    testLegacyBundle();
+    testSnapshot();
+    testQjscBundles(qjsc);
+    testCodeCache();
+    testWorkerContext();
+    return 0;
+}
 
 int main(int argc, char **argv) {
 #ifdef _WIN32
     SetConsoleOutputCP(CP_UTF8);
 #endif
 
+    if (argc > 1 && !strcmp(argv[1], "pool"))
+        return testExecutorPool();
+    if (argc > 1 && !strcmp(argv[1], "executor")) {
+        std::string qjsc = argc > 2 ? argv[2] : (std::filesystem::path(argv[0]).parent_path() / "qjsc").string();
+        return testExecutor(qjsc);
+    }
+
     printf("argc = %d\n", argc);
 
     for (int i = 1; i < 2; i++) {
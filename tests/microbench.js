@@ -1162,7 +1162,7 @@ function main(argc, argv, g)
         string_to_float,
     ];
     var tests = [];
-    var i, j, n, f, name, found;
+    var i, j, n, f, name, found, out_file;
 
     if (typeof BigInt == "function") {
         /* BigInt test */
@@ -1189,6 +1189,10 @@ function main(argc, argv, g)
             sort_bench.array_size = +argv[i++];
             continue;
         }
+        if (name == "-o") {
+            out_file = argv[i++];
+            continue;
+        }
         for (j = 0, found = false; j < test_list.length; j++) {
             f = test_list[j];
             if (f.name.startsWith(name)) {
@@ -1220,7 +1224,9 @@ function main(argc, argv, g)
     else
         log_line("total", "", total[2]);
 
-    if (tests == test_list)
+    if (out_file)
+        save_result(out_file, log_data);
+    else if (tests == test_list)
         save_result("microbench-new.txt", log_data);
 }
 
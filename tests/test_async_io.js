@@ -0,0 +1,108 @@
+/*---
+flags: [qjs:track-promise-rejections]
+---*/
+import * as std from "qjs:std";
+import * as os from "qjs:os";
+import { assert } from "./assert.js";
+
+async function test_load_file_async()
+{
+    var fname = "tmp_async_io.txt", s, u8;
+
+    std.writeFile(fname, "helloé");
+    s = await std.loadFileAsync(fname);
+    assert(s, "helloé");
+    u8 = await std.loadFileAsync(fname, { binary: true });
+    assert(u8 instanceof Uint8Array, true);
+    assert(u8.length, 7);
+    assert(u8[0], 0x68);
+    os.remove(fname);
+    assert(await std.loadFileAsync(fname), null);
+}
+
+async function test_read_write_async()
+{
+    var fds, ab, u8, i, p, n;
+
+    fds = os.pipe();
+    ab = new ArrayBuffer(16);
+    u8 = new Uint8Array(ab);
+    /* the read completes once the write was done */
+    p = os.readAsync(fds[0], ab, 4, 8);
+    for(i = 0; i < 8; i++)
+        u8[8 + i] = 0x61 + i;
+    n = await os.writeAsync(fds[1], ab, 8, 4);
+    assert(n, 4);
+    n = await p;
+    assert(n, 4);
+    assert(String.fromCharCode(...u8.subarray(4, 8)), "abcd");
+    os.close(fds[1]);
+    assert(await os.readAsync(fds[0], ab, 0, 1), 0);
+    os.close(fds[0]);
+    assert(await os.readAsync(-1, ab, 0, 1) < 0, true);
+}
+
+async function test_concurrent_async()
+{
+    var fname = "tmp_async_io2.txt", list = [], i, res;
+
+    std.writeFile(fname, "x".repeat(100000));
+    for(i = 0; i < 20; i++)
+        list.push(std.loadFileAsync(fname));
+    res = await Promise.all(list);
+    for(i = 0; i < 20; i++)
+        assert(res[i].length, 100000);
+    os.remove(fname);
+}
+
+async function test_detach_async()
+{
+    var fds, ab, dst, p, e;
+
+    fds = os.pipe();
+    ab = new ArrayBuffer(8);
+    p = os.readAsync(fds[0], ab, 0, 8);
+    /* the idle reads don't occupy the I/O threads */
+    const idle = [], reads = [];
+    for (let i = 0; i < 8; i++) {
+        const f = os.pipe();
+        idle.push(f);
+        reads.push(os.readAsync(f[0], new ArrayBuffer(1), 0, 1));
+    }
+    assert(await std.loadFileAsync("tests/assert.js") !== null, true);
+    dst = ab.transfer();
+    assert(ab.detached, true);
+    os.write(fds[1], new Uint8Array([1, 2, 3]).buffer, 0, 3);
+    e = undefined;
+    try {
+        await p;
+    } catch (_e) {
+        e = _e;
+    }
+    assert(e instanceof TypeError, true);
+    assert(new Uint8Array(dst)[0], 0);
+    /* the data is copied when writeAsync() is called */
+    ab = new ArrayBuffer(4, { maxByteLength: 4 });
+    new Uint8Array(ab).fill(7);
+    p = os.writeAsync(fds[1], ab, 0, 4);
+    ab.resize(0);
+    assert(await p, 4);
+    dst = new ArrayBuffer(4);
+    assert(await os.readAsync(fds[0], dst, 0, 4), 4);
+    assert(new Uint8Array(dst)[3], 7);
+    os.close(fds[0]);
+    os.close(fds[1]);
+    /* complete the idle reads */
+    for (const f of idle)
+        os.close(f[1]);
+    assert((await Promise.all(reads)).join(), "0,0,0,0,0,0,0,0");
+    for (const f of idle)
+        os.close(f[0]);
+}
+
+if (os.readAsync) {
+    test_load_file_async()
+        .then(test_read_write_async)
+        .then(test_concurrent_async)
+        .then(test_detach_async);
+}
@@ -269,6 +269,67 @@ function test_array()
         err = true;
     }
     assert(err && a.toString() === "1,2,3,4");
+
+    /* sort fast paths */
+    a = [10, -1, 9, -10, 2147483647, -2147483648, 0, 1];
+    assert(a.slice().sort().join(), "-1,-10,-2147483648,0,1,10,2147483647,9");
+    assert(a.slice().sort((x, y) => x - y).join(), "-2147483648,-10,-1,0,1,9,10,2147483647");
+    assert(a.slice().sort((x, y) => y - x).join(), "2147483647,10,9,1,0,-1,-10,-2147483648");
+    a = [1.5, -Infinity, 3, Infinity, -2.25, 0];
+    assert(a.sort((x, y) => x - y).join(), "-Infinity,-2.25,0,1.5,3,Infinity");
+    a = [0, -0, 1, -0];
+    a.sort((x, y) => x - y);
+    assert(Object.is(a[0], 0) && Object.is(a[1], -0) && Object.is(a[2], -0));
+    assert(["b", "a\u20ac", "a", "ab"].sort().join(), "a,ab,a\u20ac,b");
+
+    /* packed int32 and float64 elements */
+    a = [1, 2, 3];
+    a[1] = 2.5;
+    assert(a.join(), "1,2.5,3", "packed1");
+    a[2] = -0;
+    assert(Object.is(a[2], -0), true, "packed2");
+    a.push("x");
+    assert(a.join(), "1,2.5,0,x", "packed3");
+    a = [];
+    for (var i = 0; i < 5; i++)
+        a.push(i * 2);
+    a.push(NaN);
+    assert(a.length === 6 && a[4] === 8 && isNaN(a[5]), true, "packed4");
+    assert(a.includes(NaN) && !a.includes(7) && a.includes(4), true, "includes");
+    assert(a.indexOf(NaN), -1, "indexOf1");
+    assert(a.indexOf(6) === 3 && a.indexOf(6, 4) === -1 && a.indexOf("6") === -1, true, "indexOf2");
+    a = [0, 1, 0, 1];
+    assert(a.indexOf(-0) === 0 && a.lastIndexOf(0) === 2 && a.lastIndexOf(1, 2) === 1, true, "lastIndexOf");
+    assert(a.includes(-0) && !a.includes(0.5) && a.indexOf(1e20) === -1, true, "includes2");
+    a = [1, 2, 3, 4];
+    assert(a.shift() === 1 && a.pop() === 4 && a.join() === "2,3", true, "shift");
+    a = [1.5, 2.5, 3.5];
+    a.splice(1, 1);
+    a.unshift(0);
+    assert(a.join(), "0,1.5,3.5", "splice");
+    assert(a.reverse().join(), "3.5,1.5,0", "reverse");
+    a = [3, 1, 2];
+    a.length = 1;
+    a.push({});
+    assert(a.length === 2 && a[0] === 3 && typeof a[1] === "object", true, "packed5");
+    a = [1, 2, 3];
+    a.length = 0;
+    a.push("a", "b");
+    assert(a.join(), "a,b", "packed6");
+    a = [4, 5, 6];
+    delete a[2];
+    a[5] = 7;
+    assert(a.length === 6 && a[1] === 5 && !(2 in a) && a[5] === 7, true, "packed7");
+    a = [4, 5, 6];
+    Object.defineProperty(a, "1", { get() { return 10; } });
+    assert(a.join(), "4,10,6", "packed8");
+    a = [1, 2.5, 3];
+    assert([...a, ...[4]].join() === "1,2.5,3,4" && Math.max(...a) === 3, true, "spread");
+    assert(a.with(1, "b").join() === "1,b,3" && a.toReversed().join() === "3,2.5,1", true, "with");
+    assert(JSON.stringify(JSON.parse("[1,2.5,-3]")), "[1,2.5,-3]", "json");
+    a = [1.5, -2, 0.25];
+    a.copyWithin(0, 1);
+    assert(a.join(), "-2,0.25,0.25", "copyWithin");
 }
 
 function test_string()
@@ -383,6 +444,40 @@ function test_string()
            /*JS_STRING_KIND_NORMAL*/0);
     assert(qjs.getStringKind("xyzzy".repeat(512).slice(1)),
            /*JS_STRING_KIND_SLICE*/1);
+
+    var r = "xyzzy".repeat(256);
+    r = r + r;
+    assert(qjs.getStringKind(r), /*JS_STRING_KIND_ROPE*/2);
+    assert(r.charAt(r.length - 1), "y");
+    assert(qjs.getStringKind(r), /*JS_STRING_KIND_SLICE*/1);
+    r = "";
+    for (var i = 0; i < 10000; i++)
+        r += String.fromCharCode(97 + i % 26, 0x3b1 + i % 25);
+    assert(r.length, 20000);
+    assert(r === r.slice(0, 10000) + r.slice(10000), true);
+    assert(r.charCodeAt(19999), 0x3b1 + 9999 % 25);
+
+    /* 8-bit case conversion agrees with the 16-bit path */
+    for (var c = 0; c < 256; c++) {
+        var s = String.fromCharCode(c), w = s + "\u0100";
+        assert(s.toLowerCase(), w.toLowerCase().slice(0, -1), "lower " + c);
+        assert(s.toUpperCase() + "\u0100", w.toUpperCase(), "upper " + c);
+    }
+    assert("Content-Type: \xc9t\xe9".toLowerCase(), "content-type: \xe9t\xe9");
+    assert("stra\xdfe \xb5 \xff".toUpperCase(), "STRASSE \u039c \u0178");
+    assert("x-request-id".toLowerCase(), "x-request-id");
+    assert(qjs.getStringKind("xyzzy".repeat(512).slice(1).toLowerCase()),
+           /*JS_STRING_KIND_SLICE*/1);
+
+    r = "ab".repeat(1000) + "abc";
+    assert(r.indexOf("abc"), 2000);
+    assert(r.indexOf("abc", 2001), -1);
+    assert(r.includes("bab"), true);
+    assert(r.includes("abd"), false);
+    assert(r.indexOf("\u0101"), -1);
+    assert((r + "\u0101").indexOf("c\u0101"), 2002);
+    assert(r.split("ba").length, 1001);
+    assert("a\0b\0c".split("\0"), ["a", "b", "c"]);
 }
 
 function test_math()
@@ -440,6 +535,22 @@ function test_number()
     assert((-0.5).toFixed(0), "-1");
     assert((-1e-10).toFixed(0), "-0");
 
+    /* shortest round trip digits */
+    assert(String(0.1 + 0.2), "0.30000000000000004");
+    assert(String(5e-324), "5e-324");
+    assert(String(1e-323), "1e-323");
+    assert(String(2.5e-323), "2.5e-323");
+    assert(String(2**-1017), "7.120236347223045e-307");
+    assert(String(Number.MAX_VALUE), "1.7976931348623157e+308");
+    assert(String(123456789.125), "123456789.125");
+    assert(String(1e21), "1e+21");
+    assert(String(-1.5e-7), "-1.5e-7");
+    assert(parseFloat("9007199254740993"), 9007199254740992);
+    assert(parseFloat("9007199254740995"), 9007199254740996);
+    assert(parseFloat("2.2250738585072011e-308"), 2.225073858507201e-308);
+    assert(parseFloat("1.7976931348623159e308"), Infinity);
+    assert(parseFloat("0.30000000000000004"), 0.1 + 0.2);
+
     assert((1.3).toString(7), "1.2046204620462046205");
     assert((1.3).toString(35), "1.ahhhhhhhhhm");
 
@@ -627,6 +738,32 @@ function test_typed_array()
     Object.defineProperty(ArrayBuffer, Symbol.species, desc); // restore
     assert(ex instanceof TypeError);
     assert("ArrayBuffer is detached", ex.message);
+
+    // default order sort of large arrays
+    for (const T of [Int8Array, Uint16Array, Int32Array, Float32Array, Float64Array]) {
+        a = new T(200);
+        for (i = 0; i < a.length; i++)
+            a[i] = (i * 7919) % 256 - 128;
+        if (T === Float32Array || T === Float64Array) {
+            a[3] = NaN;
+            a[5] = -0;
+            a[7] = 0;
+            a[9] = -Infinity;
+        }
+        a.sort();
+        b = Array.from(a).sort((x, y) => x - y || Object.is(y, -0) - Object.is(x, -0));
+        if (T === Float32Array || T === Float64Array) {
+            assert(a[0], -Infinity);
+            assert(a[a.length - 1], NaN);
+            assert(Object.is(a[a.indexOf(0)], -0));
+        } else {
+            assert(a.join(), b.join());
+        }
+        for (i = 1; i < a.length - 1; i++)
+            assert(a[i - 1] <= a[i]);
+    }
+    a = new BigInt64Array([5n, -3n, 2n ** 62n, -(2n ** 63n), 0n]);
+    assert(a.sort().join(), "-9223372036854775808,-3,0,5,4611686018427387904");
 }
 
 function test_json()
@@ -652,6 +789,31 @@ function test_json()
   3
  ]
 ]`);
+
+    /* records sharing their layout */
+    a = JSON.parse('[{"a":1,"b":2},{"a":3,"b":4},{"b":5,"a":6},{"a":7,"a":8}]');
+    assert(Object.keys(a[1]).join(), "a,b");
+    assert(Object.keys(a[2]).join(), "b,a");
+    assert(a[2].a, 6);
+    assert(a[3].a, 8);
+    assert(Object.keys(a[3]).length, 1);
+    a[0].c = 1;
+    assert(a[1].c, undefined);
+
+    assert(Object.is(JSON.parse("-0"), -0));
+    assert(JSON.parse("-123456789"), -123456789);
+    assert(JSON.parse("9876543210"), 9876543210);
+    assert(JSON.parse('"abcdefghijklmnopqrstuvwxyz"'), "abcdefghijklmnopqrstuvwxyz");
+    assert(JSON.parse('"abcdefghij\\u00e9klmnop\\"q"'), "abcdefghij\u00e9klmnop\"q");
+
+    assert(JSON.stringify({b:1, 2:2, a:[3,,"\n"]}), '{"2":2,"b":1,"a":[3,null,"\\n"]}');
+    /* the keys are collected before toJSON() runs */
+    a = {x: {toJSON() { delete a.y; a.z = 3; return 1; }}, y: 2};
+    assert(JSON.stringify(a), '{"x":1}');
+    Object.prototype.toJSON = function(k) { return "k" + k; };
+    assert(JSON.stringify([{}]), '"k"');
+    assert(JSON.stringify({a: [{}]}), '"k"');
+    delete Object.prototype.toJSON;
 }
 
 function test_date()
@@ -844,6 +1006,24 @@ function test_regexp()
     assert(a, ["123a23", "3"]);
     a = "ab".split(/(c)*/);
     assert(a, ["a", undefined, "b"]);
+
+    /* first character scan */
+    assert("xx password=1 yy password=2".replace(/password=\S+/g, "-"),
+           "xx - yy -");
+    assert("k K \u212a".replace(/k/gi, "-"), "- - \u212a");
+    assert("k K \u212a".replace(/k/giu, "-"), "- - -");
+    assert("\u0101 ab \u0101 cb".replace(/[ac]b/g, "-"), "\u0101 - \u0101 -");
+    a = /\uDE00/u.exec("\uD83D\uDE00 \uDE00");
+    assert(a.index, 3);
+    a = /\uDE00/.exec("\uD83D\uDE00");
+    assert(a.index, 1);
+    a = /\uDE00/u;
+    a.lastIndex = 1;
+    assert(a.exec("\uD83D\uDE00"), null);
+    a = /(b)?c/g;
+    a.lastIndex = 2;
+    assert(a.exec("bcac"), ["c", undefined]);
+    assert(a.lastIndex, 4);
 }
 
 function test_symbol()
@@ -915,6 +1095,39 @@ function test_map()
     });
 
     assert(a.size, 0);
+
+    /* the iterators survive the deletions and the table compaction */
+    a = new Map();
+    for(i = 0; i < n; i++)
+        a.set(i, i);
+    var it = a.keys();
+    assert(it.next().value, 0);
+    for(i = 0; i < n - 2; i++) {
+        a.delete(i);
+        a.set(n + i, i);
+    }
+    tab = [];
+    for(v of it)
+        tab.push(v);
+    assert(tab.length, n);
+    assert(tab[0], n - 2);
+    assert(tab[2], n);
+    assert(tab[n - 1], 2 * n - 3);
+
+    it = a.values();
+    a.clear();
+    a.set(-0, 1);
+    a.set(NaN, 2);
+    assert(it.next().value, 1);
+    assert(a.get(0), 1);
+    assert(a.get(NaN), 2);
+    a.forEach(function (v, k) {
+        if (v < 5) {
+            a.delete(k);
+            a.set(k, v + 2);
+        }
+    });
+    assert([...a].join(), "0,5,NaN,6");
 }
 
 function test_weak_map()
@@ -1020,6 +1233,12 @@ function test_set()
             keys() { return [].values() },
         })
     }
+    const a = new Set([1, 2, 3])
+    a.delete(2)
+    assert([...a.union(new Set([2, 4]))].join(), "1,3,2,4")
+    assert([...a.symmetricDifference(new Set([3, 4]))].join(), "1,4")
+    assert([...a.intersection(new Set([3, 4]))].join(), "3")
+    assert([...a.difference(new Set([3, 4]))].join(), "1")
 }
 
 function test_weak_set()
@@ -266,6 +266,14 @@ function test_constructor()
     try { new G() } catch (ex_) { ex = ex_ }
     assert(ex instanceof TypeError)
     assert(ex.message, "G is not a constructor")
+
+    /* each object is created with the size of the previous one */
+    function F(n) { for (var i = 0; i < n; i++) this["p" + i] = i; }
+    for (var n of [10, 3, 20, 0, 5]) {
+        var o = new F(n);
+        assert(Object.keys(o).length, n);
+        assert(o["p" + (n - 1)], n ? n - 1 : undefined);
+    }
 }
 
 function test_prototype()
@@ -279,6 +287,64 @@ function test_prototype()
     assert(g.prototype.constructor, g, "prototype");
 }
 
+function test_inline_cache()
+{
+    var i, o, c, p, a;
+    function get(o) { return o.a; }
+    function put(o, v) { o.a = v; }
+
+    /* own properties */
+    o = { a: 1, b: 2 };
+    for(i = 0; i < 100; i++)
+        assert(get(o), 1, "ic own");
+    delete o.a;
+    assert(get(o), undefined, "ic delete");
+    o.a = 5;
+    assert(get(o), 5, "ic re-add");
+
+    /* direct prototype */
+    p = { a: 7 };
+    c = Object.create(p);
+    for(i = 0; i < 100; i++)
+        assert(get(c), 7, "ic proto");
+    p.a = 8;
+    assert(get(c), 8, "ic proto update");
+    c.a = 9;
+    assert(get(c), 9, "ic shadowing");
+    delete c.a;
+    Object.defineProperty(p, "a", { get() { return 42; } });
+    assert(get(c), 42, "ic getter");
+    Object.setPrototypeOf(c, { a: 3 });
+    assert(get(c), 3, "ic setPrototypeOf");
+
+    /* writes */
+    o = { a: 1 };
+    for(i = 0; i < 100; i++)
+        put(o, i);
+    Object.freeze(o);
+    put(o, 100);
+    assert(o.a, 99, "ic frozen");
+    o = { a: 1 };
+    for(i = 0; i < 100; i++)
+        put(o, i);
+    Object.defineProperty(o, "a", { set(v) { this.b = v; } });
+    put(o, 5);
+    assert(o.b, 5, "ic setter");
+
+    /* polymorphic site */
+    a = [{ a: 1 }, { b: 0, a: 2 }, { c: 0, a: 3 }, { d: 0, a: 4 }, { e: 0, a: 5 }];
+    for(i = 0; i < 100; i++)
+        assert(get(a[i % 5]), (i % 5) + 1, "ic polymorphic");
+
+    /* exotic receivers */
+    Array.prototype.a = 11;
+    for(i = 0; i < 100; i++)
+        assert(get([]), 11, "ic array");
+    assert(get(new Uint8Array(2)), undefined, "ic typed array");
+    delete Array.prototype.a;
+    assert(get([]), undefined, "ic array proto delete");
+}
+
 function test_arguments()
 {
     function f2() {
@@ -402,6 +468,20 @@ function test_object_literal()
 
     a = { x, get, set, async };
     assert(JSON.stringify(a), '{"x":0,"get":1,"set":2,"async":3}');
+
+    /* the literals are created with room for their properties */
+    for (var i = 0; i < 3; i++) {
+        a = { a: i, b: 2, ["c" + i]: 3, d() { return 4 }, ...{ e: 5 },
+              __proto__: { f: 6 }, g: 7 };
+        assert(Object.keys(a).join(), "a,b,c" + i + ",d,e,g");
+        assert(a.f + a.d(), 10);
+        a.h = 8;
+        delete a.b;
+        assert(Object.keys(a).join(), "a,c" + i + ",d,e,g,h");
+    }
+    a = { __proto__: null, x: 1, y: 2, z: 3 };
+    assert(Object.getPrototypeOf(a), null);
+    assert(a.z, 3);
 }
 
 function test_regexp_skip()
@@ -729,6 +809,7 @@ test_op2();
 test_delete();
 test_constructor();
 test_prototype();
+test_inline_cache();
 test_arguments();
 test_class();
 test_template();
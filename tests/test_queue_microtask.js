@@ -33,7 +33,31 @@ function test_async_order() {
   });
 }
 
+function test_await_order() {
+  const happenings = [];
+  async function f(x) {
+    happenings.push("f" + x);
+    await x;
+    happenings.push("a" + x);
+    await Promise.resolve(x);
+    happenings.push("b" + x);
+    return x;
+  }
+  Promise.resolve().then(() => happenings.push("p1"))
+    .then(() => happenings.push("p2"))
+    .then(() => happenings.push("p3"));
+  f(1).then((v) => happenings.push("r" + v));
+  Promise.reject(2).catch((e) => happenings.push("c" + e));
+  f(undefined);
+  Promise.resolve().then(() => 0).then(() => 0).then(() => 0).then(() => {
+    assertArrayEquals(happenings, ["f1", "fundefined", "p1", "a1", "c2",
+                                   "aundefined", "p2", "b1", "bundefined",
+                                   "p3", "r1"]);
+  });
+}
+
 test_types();
 test_async();
 test_arguments();
 test_async_order();
+test_await_order();
@@ -287,6 +287,83 @@ function test_timeout_order()
     function d() { assert(s, "abc"); } // not "acb"
 }
 
+function test_timeout_many()
+{
+    var s = "", th = [], i, t;
+
+    /* expired timers fire in creation order, not in timeout order */
+    os.setTimeout(function () { s += "x"; }, 20);
+    os.setTimeout(function () { s += "y"; }, 10);
+    /* cancel most of a large number of timers */
+    for(i = 0; i < 10000; i++)
+        th.push(os.setTimeout(function () { s += "z"; }, 5 + (i % 7)));
+    for(i = 0; i < 10000; i++) {
+        if (i % 1000 != 0)
+            os.clearTimeout(th[i]);
+    }
+    t = Date.now();
+    while (Date.now() - t < 30)
+        continue;
+    os.setTimeout(function () { assert(s, "xyzzzzzzzzzz"); }, 0);
+}
+
+function test_rw_handlers()
+{
+    var pipes = [], f, fd, buf = new Uint8Array(1), i, s = "";
+
+    /* many idle handlers, only the ready ones are called */
+    for(i = 0; i < 100; i++) {
+        pipes.push(os.pipe());
+        os.setReadHandler(pipes[i][0], function () { s += "x"; });
+    }
+    os.setReadHandler(pipes[99][0], function () {
+        assert(os.read(pipes[99][0], buf.buffer, 0, 1), 1);
+        s += "r";
+        os.setReadHandler(pipes[99][0], null);
+        os.setWriteHandler(pipes[50][1], function () {
+            s += "w";
+            os.setWriteHandler(pipes[50][1], null);
+            /* regular files are polled */
+            f = std.tmpfile();
+            fd = f.fileno();
+            os.setReadHandler(fd, function () {
+                os.setReadHandler(fd, null);
+                f.close();
+                s += "f";
+                assert(s, "rwf");
+                for(i = 0; i < pipes.length; i++) {
+                    os.setReadHandler(pipes[i][0], null);
+                    os.close(pipes[i][0]);
+                    os.close(pipes[i][1]);
+                }
+            });
+        });
+    });
+    assert(os.write(pipes[99][1], buf.buffer, 0, 1), 1);
+}
+
+function test_rw_handler_closed_fd()
+{
+    var fds, fd2, buf = new Uint8Array(1), s = "";
+
+    /* the file stays registered with epoll after close() while a dup
+       of the fd is open */
+    fds = os.pipe();
+    fd2 = os.dup(fds[0]);
+    os.setReadHandler(fds[0], function () { s += "x"; });
+    os.close(fds[0]);
+    os.setReadHandler(fds[0], null);
+    assert(os.write(fds[1], buf.buffer, 0, 1), 1);
+    os.setReadHandler(fd2, function () {
+        os.setReadHandler(fd2, null);
+        assert(os.read(fd2, buf.buffer, 0, 1), 1);
+        s += "r";
+        assert(s, "r");
+        os.close(fd2);
+        os.close(fds[1]);
+    });
+}
+
 function test_stdio_close()
 {
     for (const f of [std.in, std.out, std.err]) {
@@ -311,4 +388,7 @@ test_os();
 test_interval();
 test_timeout();
 test_timeout_order();
+test_timeout_many();
+!isWin && test_rw_handlers();
+!isWin && test_rw_handler_closed_fd();
 test_stdio_close();
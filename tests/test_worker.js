@@ -29,6 +29,23 @@ function test_worker()
                 let buf = ev.buf;
                 /* check that the SharedArrayBuffer was modified */
                 assert(buf[2], 10);
+                test_transfer_errors();
+                /* test ArrayBuffer transfer */
+                let ab = new ArrayBuffer(1 << 20);
+                let u8 = new Uint8Array(ab);
+                for (let i = 0; i < u8.length; i += 4096)
+                    u8[i] = i >> 12;
+                worker.postMessage({ type: "transfer", buf: u8, ab: ab }, [ab]);
+                assert(ab.byteLength, 0);
+                assert(u8.length, 0);
+            }
+            break;
+        case "transfer_done":
+            {
+                let u8 = new Uint8Array(ev.ab);
+                assert(u8.length, 1 << 20);
+                assert(u8[4096 * 3], 3);
+                assert(u8[1], 1);
                 worker.postMessage({ type: "abort" });
             }
             break;
@@ -40,4 +57,20 @@ function test_worker()
     };
 }
 
+function test_transfer_errors()
+{
+    let ab = new ArrayBuffer(8);
+    let threw;
+    for (let transfer of [[{}], [ab, ab], [new SharedArrayBuffer(8)]]) {
+        threw = false;
+        try {
+            worker.postMessage({ type: "none" }, transfer);
+        } catch (e) {
+            threw = e instanceof TypeError;
+        }
+        assert(threw, true);
+        assert(ab.byteLength, 8);
+    }
+}
+
 test_worker();
@@ -15,6 +15,14 @@ function handle_msg(e) {
         ev.buf[2] = 10;
         parent.postMessage({ type: "sab_done", buf: ev.buf });
         break;
+    case "transfer":
+        /* the typed array still views the transferred ArrayBuffer */
+        if (ev.buf.buffer === ev.ab && ev.buf[4096 * 3] === 3) {
+            ev.buf[1] = 1;
+            parent.postMessage({ type: "transfer_done", ab: ev.ab },
+                               { transfer: [ev.ab] });
+        }
+        break;
     }
 }
 
@@ -0,0 +1,42 @@
+import * as os from "qjs:os";
+import { assert, assertThrows } from "./assert.js";
+
+function test_worker_pool()
+{
+    var pool, results, handled, done, i;
+
+    assertThrows(RangeError, () => new os.WorkerPool("./test_worker_pool_module.js", 0));
+
+    pool = new os.WorkerPool("./test_worker_pool_module.js", 4);
+    assert(pool instanceof os.Worker, true);
+    assert(pool.size, 4);
+
+    results = 0;
+    handled = 0;
+    done = 0;
+    pool.onmessage = function (e) {
+        var ev = e.data;
+        switch(ev.type) {
+        case "result":
+            assert(ev.result, ev.n * ev.n);
+            if (++results == 100) {
+                /* each thread stops after taking one "quit" message */
+                for(i = 0; i < pool.size; i++)
+                    pool.postMessage({ type: "quit" });
+            }
+            break;
+        case "done":
+            /* the module was loaded once per thread, not once per task */
+            handled += ev.handled;
+            if (++done == pool.size) {
+                assert(handled, 100);
+                pool.onmessage = null;
+            }
+            break;
+        }
+    };
+    for(i = 0; i < 100; i++)
+        pool.postMessage({ type: "task", n: i });
+}
+
+test_worker_pool();
@@ -0,0 +1,19 @@
+/* Worker code for test_worker_pool.js */
+import * as os from "qjs:os";
+
+var parent = os.Worker.parent;
+var handled = 0;
+
+parent.onmessage = function (e) {
+    var ev = e.data;
+    switch(ev.type) {
+    case "task":
+        handled++;
+        parent.postMessage({ type: "result", n: ev.n, result: ev.n * ev.n });
+        break;
+    case "quit":
+        parent.postMessage({ type: "done", handled: handled });
+        parent.onmessage = null;
+        break;
+    }
+};